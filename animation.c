@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string.h>
+#include "animation.h"
+
+static void animation_decode(Animation *animation, gpointer user_data);
+static gboolean animation_tick(Animation *animation);
+
+static GThreadPool*
+animation_get_pool(void)
+{
+    static gsize initialized = 0;
+    static GThreadPool *pool = NULL;
+
+    if ( g_once_init_enter(&initialized) ) {
+        pool = g_thread_pool_new( (GFunc)animation_decode, NULL,
+                MAX(1, g_get_num_processors()/2), FALSE, NULL );
+        g_once_init_leave(&initialized, 1);
+    }
+
+    return pool;
+}
+
+/* returns size of RGBA frame in bytes */
+static gsize
+animation_frame_size(const Animation *animation)
+{
+    return (gsize)animation->width * animation->height * 4;
+}
+
+static guint32
+read_u32_be(const guchar *data)
+{
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+/*
+ * Checks data of file for animation.
+ * GIF is animated only if it contains more than one frame which is
+ * checked later.
+ */
+static gboolean
+is_animated_data(const guchar *data, gsize size, gboolean *gif)
+{
+    gsize pos;
+    gint i;
+
+    *gif = gif_is_gif(data, size);
+    if (*gif)
+        return TRUE;
+
+    /* WebP with animation flag */
+    if ( size >= 21 && memcmp(data, "RIFF", 4) == 0 &&
+         memcmp(data+8, "WEBPVP8X", 8) == 0 )
+        return (data[20] & 0x02) != 0;
+
+    /* APNG has "acTL" chunk before first "IDAT" chunk */
+    if ( size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0 ) {
+        for ( i = 0, pos = 8; i < 64 && pos + 8 <= size; ++i ) {
+            if ( memcmp(data+pos+4, "acTL", 4) == 0 )
+                return TRUE;
+            if ( memcmp(data+pos+4, "IDAT", 4) == 0 )
+                break;
+            pos += (gsize)read_u32_be(data+pos) + 12;
+        }
+    }
+
+    return FALSE;
+}
+
+static gboolean
+animation_decode_frame(Animation *animation, AnimationFrame *frame, gboolean loop)
+{
+    GdkPixbuf *pixbuf;
+    const guchar *src;
+    guchar *dst;
+    gint x, y, w, h, n_channels, rowstride;
+    GifDecoder *gif = animation->gif;
+
+    if (gif) {
+        if ( !gif_decoder_next_frame(gif, &frame->delay, NULL) ) {
+            if ( !loop || gif->frame == 0 || !gif_decoder_rewind(gif) ||
+                 !gif_decoder_next_frame(gif, &frame->delay, NULL) )
+                return FALSE;
+        }
+        memcpy( frame->pixels, gif->canvas, animation_frame_size(animation) );
+        return TRUE;
+    }
+
+    pixbuf = gdk_pixbuf_animation_iter_get_pixbuf(animation->iter);
+    if (!pixbuf)
+        return FALSE;
+
+    frame->delay = gdk_pixbuf_animation_iter_get_delay_time(animation->iter);
+    /* last frame is shown forever */
+    if (frame->delay < 0)
+        frame->delay = G_MAXINT;
+
+    w = MIN( gdk_pixbuf_get_width(pixbuf), animation->width );
+    h = MIN( gdk_pixbuf_get_height(pixbuf), animation->height );
+    n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    memset( frame->pixels, 0, animation_frame_size(animation) );
+    for (y = 0; y < h; ++y) {
+        src = gdk_pixbuf_get_pixels(pixbuf) + (gsize)y*rowstride;
+        dst = frame->pixels + (gsize)y*animation->width*4;
+        for (x = 0; x < w; ++x, src += n_channels, dst += 4) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = n_channels == 4 ? src[3] : 0xff;
+        }
+    }
+
+    g_time_val_add( &animation->iter_time, (glong)MIN(frame->delay, 3600000)*1000 );
+    gdk_pixbuf_animation_iter_advance(animation->iter, &animation->iter_time);
+
+    return TRUE;
+}
+
+/* queues animation for decoding ahead (lock must be held) */
+static void
+animation_queue_decode(Animation *animation)
+{
+    if ( animation->decoding || animation->paused || animation->stopped ||
+         animation->count == ANIMATION_FRAMES )
+        return;
+
+    animation->decoding = TRUE;
+    g_thread_pool_push( animation_get_pool(), animation_ref(animation), NULL );
+}
+
+static void
+animation_decode(Animation *animation, gpointer user_data)
+{
+    AnimationFrame *frame;
+    gboolean ok = TRUE;
+
+    g_mutex_lock(&animation->lock);
+    while ( !animation->paused && !animation->stopped &&
+            animation->count < ANIMATION_FRAMES )
+    {
+        /* free slot is not accessed by main thread */
+        frame = &animation->frames[
+            (animation->first + animation->count) % ANIMATION_FRAMES ];
+        g_mutex_unlock(&animation->lock);
+
+        ok = animation_decode_frame(animation, frame, TRUE);
+
+        g_mutex_lock(&animation->lock);
+        if (!ok) {
+            animation->stopped = TRUE;
+            break;
+        }
+        ++animation->count;
+    }
+    animation->decoding = FALSE;
+    g_mutex_unlock(&animation->lock);
+
+    animation_unref(animation);
+}
+
+static gboolean
+animation_is_visible(Animation *animation)
+{
+    ClutterActor *stage;
+    gfloat x, y, w, h;
+
+    if ( !clutter_actor_is_mapped(animation->texture) )
+        return FALSE;
+
+    stage = clutter_actor_get_stage(animation->texture);
+    if (!stage)
+        return FALSE;
+
+    clutter_actor_get_transformed_position(animation->texture, &x, &y);
+    clutter_actor_get_transformed_size(animation->texture, &w, &h);
+
+    return x < clutter_actor_get_width(stage) && x + w > 0 &&
+           y < clutter_actor_get_height(stage) && y + h > 0;
+}
+
+static void
+animation_schedule(Animation *animation, guint interval)
+{
+    animation->timeout_id = clutter_threads_add_timeout( interval,
+            (GSourceFunc)animation_tick, animation );
+}
+
+/* removes shown frame from ring (lock must be held) */
+static gint
+animation_pop_frame(Animation *animation)
+{
+    gint delay;
+
+    delay = animation->frames[animation->first].delay;
+    animation->first = (animation->first + 1) % ANIMATION_FRAMES;
+    --animation->count;
+    animation_queue_decode(animation);
+
+    return delay;
+}
+
+static gboolean
+animation_tick(Animation *animation)
+{
+    AnimationFrame *frame;
+    gboolean stopped;
+    gint delay;
+
+    animation->timeout_id = 0;
+
+    g_mutex_lock(&animation->lock);
+
+    /* pause decoding if not visible */
+    animation->paused = !animation_is_visible(animation);
+    if (animation->paused) {
+        g_mutex_unlock(&animation->lock);
+        animation_schedule(animation, ANIMATION_HIDDEN_INTERVAL);
+        return FALSE;
+    }
+
+    if (animation->count == 0) {
+        /* decoder is late */
+        animation_queue_decode(animation);
+        stopped = animation->stopped;
+        g_mutex_unlock(&animation->lock);
+        if (!stopped) {
+            if (!animation->late)
+                ++animation->late_frames;
+            animation->late = TRUE;
+            animation_schedule(animation, ANIMATION_LATE_INTERVAL);
+        }
+        return FALSE;
+    }
+    animation->late = FALSE;
+
+    /* frame is not modified until it's removed from ring */
+    frame = &animation->frames[animation->first];
+    g_mutex_unlock(&animation->lock);
+
+    clutter_texture_set_area_from_rgb_data( CLUTTER_TEXTURE(animation->texture),
+            frame->pixels, TRUE, 0, 0, animation->width, animation->height,
+            animation->width*4, 4, CLUTTER_TEXTURE_NONE, NULL );
+
+    g_mutex_lock(&animation->lock);
+    delay = animation_pop_frame(animation);
+    g_mutex_unlock(&animation->lock);
+
+    animation_schedule(animation, delay);
+
+    return FALSE;
+}
+
+static void
+animation_on_texture_destroyed(Animation *animation, GObject *texture)
+{
+    if (animation->timeout_id) {
+        g_source_remove(animation->timeout_id);
+        animation->timeout_id = 0;
+    }
+    animation->texture = NULL;
+
+    g_mutex_lock(&animation->lock);
+    animation->stopped = TRUE;
+    g_mutex_unlock(&animation->lock);
+
+    animation_unref(animation);
+}
+
+Animation *
+animation_new(GBytes *data)
+{
+    Animation *animation;
+    GInputStream *stream;
+    gboolean gif;
+    guint i;
+
+    if ( !is_animated_data( g_bytes_get_data(data, NULL), g_bytes_get_size(data), &gif ) )
+        return NULL;
+
+    animation = g_new0(Animation, 1);
+    animation->ref_count = 1;
+    g_mutex_init(&animation->lock);
+
+    if (gif) {
+        animation->gif = gif_decoder_new(data, NULL);
+        if (!animation->gif)
+            goto failed;
+        animation->width = animation->gif->width;
+        animation->height = animation->gif->height;
+    } else {
+        stream = g_memory_input_stream_new_from_bytes(data);
+        animation->pixbuf_animation = gdk_pixbuf_animation_new_from_stream(stream, NULL, NULL);
+        g_object_unref(stream);
+        if ( !animation->pixbuf_animation ||
+             gdk_pixbuf_animation_is_static_image(animation->pixbuf_animation) )
+            goto failed;
+        animation->width = gdk_pixbuf_animation_get_width(animation->pixbuf_animation);
+        animation->height = gdk_pixbuf_animation_get_height(animation->pixbuf_animation);
+        animation->iter = gdk_pixbuf_animation_get_iter(
+                animation->pixbuf_animation, &animation->iter_time );
+    }
+
+    /* dimensions of WebP and APNG are not checked by decoder */
+    if ( animation->width <= 0 || animation->height <= 0 ||
+         (gsize)animation->width*animation->height > DECODER_MAX_PIXELS )
+        goto failed;
+    for (i = 0; i < ANIMATION_FRAMES; ++i) {
+        animation->frames[i].pixels = g_try_malloc( animation_frame_size(animation) );
+        if (!animation->frames[i].pixels)
+            goto failed;
+    }
+
+    /* animation has at least two frames */
+    if ( !animation_decode_frame(animation, &animation->frames[0], FALSE) ||
+         !animation_decode_frame(animation, &animation->frames[1], FALSE) )
+        goto failed;
+    animation->count = 2;
+
+    return animation;
+
+failed:
+    animation_unref(animation);
+    return NULL;
+}
+
+Animation *
+animation_ref(Animation *animation)
+{
+    g_atomic_int_inc(&animation->ref_count);
+    return animation;
+}
+
+void
+animation_unref(Animation *animation)
+{
+    guint i;
+
+    if ( !g_atomic_int_dec_and_test(&animation->ref_count) )
+        return;
+
+    if (animation->gif)
+        gif_decoder_free(animation->gif);
+    if (animation->iter)
+        g_object_unref(animation->iter);
+    if (animation->pixbuf_animation)
+        g_object_unref(animation->pixbuf_animation);
+    for (i = 0; i < ANIMATION_FRAMES; ++i)
+        g_free(animation->frames[i].pixels);
+    g_mutex_clear(&animation->lock);
+    g_free(animation);
+}
+
+Image *
+animation_get_image(Animation *animation)
+{
+    Image *image;
+    const guchar *src;
+    gint y;
+
+    image = image_new(animation->width, animation->height, TRUE);
+    if (!image)
+        return NULL;
+
+    src = animation->frames[animation->first].pixels;
+    for (y = 0; y < animation->height; ++y) {
+        memcpy( image->pixels + (gsize)y*image->rowstride,
+                src + (gsize)y*animation->width*4, animation->width*4 );
+    }
+
+    return image;
+}
+
+void
+animation_start(Animation *animation, ClutterActor *texture)
+{
+    gint delay;
+
+    animation->texture = texture;
+    g_object_weak_ref( G_OBJECT(texture),
+            (GWeakNotify)animation_on_texture_destroyed,
+            animation_ref(animation) );
+
+    /* first frame is already shown */
+    g_mutex_lock(&animation->lock);
+    delay = animation_pop_frame(animation);
+    g_mutex_unlock(&animation->lock);
+
+    animation_schedule(animation, delay);
+}
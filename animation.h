@@ -0,0 +1,76 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <clutter/clutter.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "decoder.h"
+#include "gif.h"
+
+/* number of decoded frames kept ahead of display */
+#define ANIMATION_FRAMES 4
+/* how often hidden animation checks whether it's visible again */
+#define ANIMATION_HIDDEN_INTERVAL 250
+/* retry interval if next frame is not decoded yet */
+#define ANIMATION_LATE_INTERVAL 10
+
+typedef struct _Animation Animation;
+typedef struct _AnimationFrame AnimationFrame;
+
+struct _AnimationFrame {
+    /* RGBA pixels (width*4 bytes per row) */
+    guchar *pixels;
+    /* in milliseconds */
+    gint delay;
+};
+
+/*
+ * Animation is decoded in decoder threads only few frames ahead of
+ * display; decoding is paused if the animation is not visible.
+ */
+struct _Animation {
+    gint ref_count;
+    gint width, height;
+
+    /* frame source */
+    GifDecoder *gif;
+    GdkPixbufAnimation *pixbuf_animation;
+    GdkPixbufAnimationIter *iter;
+    GTimeVal iter_time;
+
+    /* ring of decoded frames, guarded by lock */
+    GMutex lock;
+    AnimationFrame frames[ANIMATION_FRAMES];
+    guint first;
+    guint count;
+    /* queued or running in decoder thread */
+    gboolean decoding;
+    gboolean paused;
+    gboolean stopped;
+
+    /* display (main thread) */
+    ClutterActor *texture;
+    guint timeout_id;
+    /* number of frames shown later than scheduled */
+    guint late_frames;
+    gboolean late;
+};
+
+/*
+ * Opens animated image from data of whole file (data are referenced while
+ * animation exists) and decodes first frames.
+ * Returns NULL if image is not animated or cannot be opened.
+ */
+Animation *animation_new(GBytes *data);
+Animation *animation_ref(Animation *animation);
+void animation_unref(Animation *animation);
+
+/* returns new image with first frame */
+Image *animation_get_image(Animation *animation);
+
+/*
+ * Starts showing frames in texture (in main thread).
+ * Animation is stopped when texture is destroyed.
+ */
+void animation_start(Animation *animation, ClutterActor *texture);
+
+#endif /* ANIMATION_H */
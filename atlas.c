@@ -0,0 +1,253 @@
+#include "atlas.h"
+
+typedef struct _AtlasShelf AtlasShelf;
+typedef struct _AtlasPage AtlasPage;
+
+/* row of images with same maximum height */
+struct _AtlasShelf {
+    gint y, height;
+    /* start of free space */
+    gint x;
+};
+
+struct _AtlasPage {
+    gint ref_count;
+    CoglHandle texture;
+    /* BC1 texture created with raw GL (0 if uncompressed) */
+    guint gl_texture;
+    GArray *shelves;
+    /* start of space for new shelves */
+    gint next_y;
+    /* number of images in texture */
+    guint regions;
+};
+
+struct _Atlas {
+    GPtrArray *pages;
+    /* memory of all pages */
+    gsize memory;
+};
+
+static const gchar *atlas_key = "atlas-page";
+
+static gsize
+atlas_page_memory(gboolean compressed)
+{
+    /* BC1 has 4 bits per pixel */
+    return compressed
+        ? (gsize)ATLAS_SIZE * ATLAS_SIZE / 2
+        : (gsize)ATLAS_SIZE * ATLAS_SIZE * 4;
+}
+
+static AtlasPage *
+atlas_page_new(gboolean compressed)
+{
+    AtlasPage *page;
+    CoglHandle texture;
+    guint gl_texture = 0;
+
+    if (compressed) {
+        gl_texture = texcomp_texture_new(ATLAS_SIZE, ATLAS_SIZE, &texture);
+        if (gl_texture == 0)
+            return NULL;
+    } else {
+        texture = cogl_texture_new_with_size( ATLAS_SIZE, ATLAS_SIZE,
+                COGL_TEXTURE_NO_AUTO_MIPMAP | COGL_TEXTURE_NO_SLICING | COGL_TEXTURE_NO_ATLAS,
+                COGL_PIXEL_FORMAT_RGBA_8888_PRE );
+        if (texture == COGL_INVALID_HANDLE)
+            return NULL;
+    }
+
+    page = g_slice_new(AtlasPage);
+    page->ref_count = 1;
+    page->texture = texture;
+    page->gl_texture = gl_texture;
+    page->shelves = g_array_new( FALSE, FALSE, sizeof(AtlasShelf) );
+    page->next_y = 0;
+    page->regions = 0;
+
+    return page;
+}
+
+static void
+atlas_page_unref(AtlasPage *page)
+{
+    if (--page->ref_count > 0)
+        return;
+
+    cogl_handle_unref(page->texture);
+    if (page->gl_texture != 0)
+        texcomp_texture_free(page->gl_texture);
+    g_array_free(page->shelves, TRUE);
+    g_slice_free(AtlasPage, page);
+}
+
+/* called when texture actor which shows image from page is finalized */
+static void
+atlas_page_release(AtlasPage *page)
+{
+    /* whole texture is free again */
+    if (--page->regions == 0) {
+        g_array_set_size(page->shelves, 0);
+        page->next_y = 0;
+    }
+    atlas_page_unref(page);
+}
+
+/* finds space for rectangle on shelf with least wasted height */
+static gboolean
+atlas_page_allocate(AtlasPage *page, gint width, gint height, gint *x, gint *y)
+{
+    AtlasShelf *shelf, *best = NULL;
+    guint i;
+
+    for (i = 0; i < page->shelves->len; ++i) {
+        shelf = &g_array_index(page->shelves, AtlasShelf, i);
+        if ( shelf->height >= height && shelf->x + width <= ATLAS_SIZE &&
+             (!best || shelf->height < best->height) )
+        {
+            best = shelf;
+        }
+    }
+
+    /* new shelf if existing ones would waste more than half of height */
+    if ( (!best || best->height > 2 * height) && page->next_y + height <= ATLAS_SIZE ) {
+        g_array_set_size(page->shelves, page->shelves->len + 1);
+        best = &g_array_index(page->shelves, AtlasShelf, page->shelves->len - 1);
+        best->y = page->next_y;
+        best->height = height;
+        best->x = 0;
+        page->next_y += height;
+    }
+
+    if (!best)
+        return FALSE;
+
+    *x = best->x;
+    *y = best->y;
+    best->x += width;
+
+    return TRUE;
+}
+
+static void
+atlas_page_upload(AtlasPage *page, const Image *image, gint x, gint y)
+{
+    CoglPixelFormat format = image->has_alpha
+        ? COGL_PIXEL_FORMAT_RGBA_8888 : COGL_PIXEL_FORMAT_RGB_888;
+    gint w = image->width, h = image->height, p = ATLAS_PADDING;
+
+#define ATLAS_UPLOAD(src_x, src_y, dst_x, dst_y, dst_width, dst_height) \
+    cogl_texture_set_region( page->texture, src_x, src_y, dst_x, dst_y, \
+            dst_width, dst_height, w, h, format, image->rowstride, image->pixels )
+
+    ATLAS_UPLOAD( 0, 0, x + p, y + p, w, h );
+    /* edges */
+    ATLAS_UPLOAD( 0, 0, x + p, y, w, 1 );
+    ATLAS_UPLOAD( 0, h - 1, x + p, y + p + h, w, 1 );
+    ATLAS_UPLOAD( 0, 0, x, y + p, 1, h );
+    ATLAS_UPLOAD( w - 1, 0, x + p + w, y + p, 1, h );
+
+#undef ATLAS_UPLOAD
+}
+
+Atlas *
+atlas_new(void)
+{
+    Atlas *atlas;
+
+    atlas = g_new(Atlas, 1);
+    atlas->pages = g_ptr_array_new_with_free_func( (GDestroyNotify)atlas_page_unref );
+    atlas->memory = 0;
+
+    return atlas;
+}
+
+void
+atlas_free(Atlas *atlas)
+{
+    /* pages still used by textures are freed with them */
+    g_ptr_array_free(atlas->pages, TRUE);
+    g_free(atlas);
+}
+
+gboolean
+atlas_set_texture(Atlas *atlas, ClutterTexture *texture, const Image *image,
+        const CompressedImage *compressed)
+{
+    AtlasPage *page = NULL;
+    CoglHandle region;
+    gint x, y, width, height, padding;
+    guint i;
+
+    if ( image->width > ATLAS_MAX_IMAGE || image->height > ATLAS_MAX_IMAGE )
+        return FALSE;
+
+    /* compressed image is padded to whole blocks (so it's aligned in atlas) */
+    if (compressed) {
+        width = compressed->width;
+        height = compressed->height;
+        padding = compressed->padding;
+    } else {
+        width = image->width + 2 * ATLAS_PADDING;
+        height = image->height + 2 * ATLAS_PADDING;
+        padding = ATLAS_PADDING;
+    }
+
+    for (i = 0; i < atlas->pages->len; ++i) {
+        page = g_ptr_array_index(atlas->pages, i);
+        if ( (page->gl_texture != 0) == (compressed != NULL) &&
+             atlas_page_allocate(page, width, height, &x, &y) )
+        {
+            break;
+        }
+        page = NULL;
+    }
+
+    if (!page) {
+        if ( atlas->memory + atlas_page_memory(compressed != NULL) > ATLAS_MAX_MEMORY )
+            return FALSE;
+        page = atlas_page_new(compressed != NULL);
+        if (!page)
+            return FALSE;
+        g_ptr_array_add(atlas->pages, page);
+        atlas->memory += atlas_page_memory(compressed != NULL);
+        if ( !atlas_page_allocate(page, width, height, &x, &y) )
+            return FALSE;
+    }
+
+    if (compressed)
+        texcomp_texture_upload(page->gl_texture, x, y, compressed);
+    else
+        atlas_page_upload(page, image, x, y);
+
+    region = cogl_texture_new_from_sub_texture( page->texture,
+            x + padding, y + padding, image->width, image->height );
+    clutter_texture_set_cogl_texture(texture, region);
+    cogl_handle_unref(region);
+
+    ++page->ref_count;
+    ++page->regions;
+    g_object_set_data_full( G_OBJECT(texture), atlas_key, page,
+            (GDestroyNotify)atlas_page_release );
+
+    return TRUE;
+}
+
+gboolean
+atlas_contains(ClutterTexture *texture)
+{
+    return g_object_get_data( G_OBJECT(texture), atlas_key ) != NULL;
+}
+
+guint
+atlas_get_page_count(const Atlas *atlas)
+{
+    return atlas->pages->len;
+}
+
+gsize
+atlas_get_memory(const Atlas *atlas)
+{
+    return atlas->memory;
+}
@@ -0,0 +1,47 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <clutter/clutter.h>
+#include "decoder.h"
+#include "texcomp.h"
+
+/* size of atlas texture */
+#define ATLAS_SIZE 2048
+/* maximum memory of atlas textures (8 uncompressed textures) */
+#define ATLAS_MAX_MEMORY (8 * ATLAS_SIZE * ATLAS_SIZE * 4)
+/* border around images (copy of edge pixels) so filtering doesn't mix neighbours */
+#define ATLAS_PADDING 1
+/* bigger images get separate texture */
+#define ATLAS_MAX_IMAGE 512
+
+typedef struct _Atlas Atlas;
+
+/*
+ * Packs small images (thumbnails) into few big textures.
+ *
+ * Images are sub-textures of shared GL textures, so Cogl batches
+ * rectangles of neighbouring images into single draw call. Atlas texture
+ * is reused when all its images are released (e.g. after page change).
+ * Compressed images are stored in separate BC1 textures which take
+ * eighth of memory.
+ *
+ * Atlas is used only from main thread.
+ */
+Atlas *atlas_new(void);
+void atlas_free(Atlas *atlas);
+
+/*
+ * Uploads image (compressed image if not NULL) to atlas and shows it in
+ * texture actor. Space in atlas is released when texture is finalized.
+ * Returns FALSE if image doesn't fit into atlas.
+ */
+gboolean atlas_set_texture(Atlas *atlas, ClutterTexture *texture, const Image *image,
+        const CompressedImage *compressed);
+/* returns TRUE if texture shows image from atlas */
+gboolean atlas_contains(ClutterTexture *texture);
+
+/* number of atlas textures and memory used by them (in bytes) */
+guint atlas_get_page_count(const Atlas *atlas);
+gsize atlas_get_memory(const Atlas *atlas);
+
+#endif /* ATLAS_H */
@@ -0,0 +1,157 @@
+/*
+ * Compares decoding throughput of native decoder backends and GdkPixbuf.
+ *
+ * Usage: imagepeek-bench [-n ITERATIONS] [-s SCALE] FILE...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+
+typedef struct _BenchResult BenchResult;
+
+struct _BenchResult {
+    const gchar *format;
+    guint files;
+    guint failed;
+    /* decoded megapixels (of original size) and time in seconds */
+    gdouble native_mpix, native_time;
+    gdouble pixbuf_mpix, pixbuf_time;
+};
+
+/* returns seconds spent decoding data iterations times or -1 on error */
+static gdouble
+bench_decoder(const Decoder *decoder, const guchar *data, gsize size,
+        const DecoderRequest *request, guint iterations, gdouble *mpix)
+{
+    GError *error = NULL;
+    Image *image;
+    gint64 start;
+    guint i;
+
+    *mpix = 0;
+    start = g_get_monotonic_time();
+    for (i = 0; i < iterations; ++i) {
+        image = decoder_decode_with(decoder, data, size, request, &error);
+        if (!image) {
+            g_printerr("imagepeek-bench: %s: %s\n", decoder->name, error->message);
+            g_error_free(error);
+            return -1;
+        }
+        *mpix += (gdouble)image->original_width*image->original_height / 1e6;
+        image_free(image);
+    }
+
+    return (g_get_monotonic_time() - start) / 1e6;
+}
+
+static BenchResult*
+bench_get_result(GPtrArray *results, const gchar *format)
+{
+    BenchResult *result;
+    guint i;
+
+    for (i = 0; i < results->len; ++i) {
+        result = g_ptr_array_index(results, i);
+        if ( strcmp(result->format, format) == 0 )
+            return result;
+    }
+
+    result = g_new0(BenchResult, 1);
+    result->format = format;
+    g_ptr_array_add(results, result);
+
+    return result;
+}
+
+static void
+bench_print(GPtrArray *results)
+{
+    BenchResult *result;
+    gdouble native, pixbuf;
+    guint i;
+
+    printf("%-10s %6s %6s %14s %18s %8s\n",
+            "format", "files", "failed", "native MPix/s", "gdk-pixbuf MPix/s", "speedup");
+    for (i = 0; i < results->len; ++i) {
+        result = g_ptr_array_index(results, i);
+        native = result->native_time > 0 ? result->native_mpix / result->native_time : 0;
+        pixbuf = result->pixbuf_time > 0 ? result->pixbuf_mpix / result->pixbuf_time : 0;
+        printf("%-10s %6u %6u %14.1f %18.1f", result->format,
+                result->files, result->failed, native, pixbuf);
+        if (native > 0 && pixbuf > 0)
+            printf(" %7.2fx\n", native / pixbuf);
+        else
+            printf(" %8s\n", "-");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    DecoderRequest request = { 1.0, NULL, NULL };
+    const Decoder *decoder, *fallback;
+    GPtrArray *results;
+    BenchResult *result;
+    GError *error = NULL;
+    gchar *data;
+    gsize size;
+    guint iterations = 5;
+    gdouble t, mpix;
+    gint i;
+
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if ( strcmp(argv[i], "-n") == 0 )
+            iterations = MAX( 1, atoi(argv[i+1]) );
+        else if ( strcmp(argv[i], "-s") == 0 )
+            request.scale = CLAMP( g_ascii_strtod(argv[i+1], NULL), 0.01, 1.0 );
+        else
+            break;
+    }
+
+    if (i >= argc) {
+        g_printerr("Usage: %s [-n ITERATIONS] [-s SCALE] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    fallback = decoder_get_fallback();
+    results = g_ptr_array_new_with_free_func(g_free);
+
+    for ( ; i < argc; ++i) {
+        if ( !g_file_get_contents(argv[i], &data, &size, &error) ) {
+            g_printerr("imagepeek-bench: %s\n", error->message);
+            g_clear_error(&error);
+            continue;
+        }
+
+        decoder = decoder_find( (const guchar*)data, size );
+        result = bench_get_result( results, decoder == fallback ? "other" : decoder->name );
+        ++result->files;
+
+        if (decoder != fallback) {
+            t = bench_decoder( decoder, (const guchar*)data, size, &request, iterations, &mpix );
+            if (t < 0) {
+                ++result->failed;
+                g_free(data);
+                continue;
+            }
+            result->native_time += t;
+            result->native_mpix += mpix;
+        }
+
+        t = bench_decoder( fallback, (const guchar*)data, size, &request, iterations, &mpix );
+        if (t >= 0) {
+            result->pixbuf_time += t;
+            result->pixbuf_mpix += mpix;
+        } else if (decoder == fallback) {
+            ++result->failed;
+        }
+
+        g_free(data);
+    }
+
+    bench_print(results);
+    g_ptr_array_free(results, TRUE);
+
+    return 0;
+}
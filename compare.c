@@ -0,0 +1,386 @@
+#include <math.h>
+#include <string.h>
+#include "compare.h"
+#include "exif.h"
+#include "pages.h"
+
+/* pairs processed by one task */
+#define COMPARE_CHUNK 8
+/* each thread holds two images in full resolution */
+#define COMPARE_MAX_THREADS 4
+
+typedef struct _CompareJob CompareJob;
+typedef struct _CompareChunk CompareChunk;
+
+struct _CompareChunk {
+    CompareJob *job;
+    guint start, end;
+};
+
+struct _CompareJob {
+    Comparer *comparer;
+    guint id;
+    const PathStore *store;
+
+    /* number of pairs */
+    guint count;
+    CompareStats *stats;
+    /* stats[i] is valid if done[i] is set (atomic) */
+    gint *done;
+    /* atomic */
+    gint compared;
+
+    CompareChunk *chunks;
+    guint chunk_count;
+};
+
+struct _Comparer {
+    CompareCallback *callback;
+    gpointer user_data;
+    GThreadPool *pool;
+
+    /* id of current job, other jobs are cancelled (atomic) */
+    gint current;
+    guint last_id;
+    /* current or last finished job */
+    CompareJob *job;
+
+    /* number of unfinished chunks */
+    GMutex lock;
+    GCond idle;
+    guint running;
+};
+
+Image *
+compare_decode(const gchar *path, DecoderCancelled *cancelled, gpointer user_data, GError **error)
+{
+    DecoderRequest request = {1.0, cancelled, user_data};
+    GMappedFile *file;
+    const guchar *data;
+    gsize size;
+    ExifInfo exif;
+    Image *image;
+    gchar *document;
+    gint page;
+
+    document = pages_parse(path, &page);
+    if (document) {
+        image = pages_render(document, page, &request, error);
+        g_free(document);
+        return image;
+    }
+
+    file = g_mapped_file_new(path, FALSE, error);
+    if (!file)
+        return NULL;
+    data = (const guchar*)g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+
+    exif_read(data, size, &exif);
+    image = decoder_decode(data, size, &request, error);
+    g_mapped_file_unref(file);
+
+    if (!image) {
+        if (error && !*error) {
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                    "Failed to load image '%s'", path);
+        }
+        return NULL;
+    }
+
+    return image_apply_orientation(image, exif.orientation);
+}
+
+/*
+ * Writes absolute differences of bytes, returns sum of their squares.
+ * Simple loop over bytes is vectorized by compiler.
+ */
+static guint64
+compare_row(const guchar *a, const guchar *b, gint n, guchar *delta, guint *max_delta)
+{
+    guint64 sse = 0;
+    guchar max = 0, d;
+    gint i;
+
+    for (i = 0; i < n; ++i) {
+        d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+        delta[i] = d;
+        max = MAX(max, d);
+        sse += (guint32)d * d;
+    }
+
+    *max_delta = MAX(*max_delta, max);
+    return sse;
+}
+
+/* draws row of heatmap (if dst is not NULL), returns number of differing pixels */
+static guint
+compare_heat_row(const guchar *a, const guchar *delta, gint width, gint channels, guchar *dst)
+{
+    guint different = 0;
+    gint x, c, d, v, luma;
+
+    for (x = 0; x < width; ++x) {
+        d = delta[x * channels];
+        for (c = 1; c < channels; ++c)
+            d = MAX(d, delta[x * channels + c]);
+        different += d != 0;
+        if (!dst)
+            continue;
+
+        if (d == 0) {
+            /* unchanged pixels are dimmed for context */
+            luma = (77 * a[x * channels] + 150 * a[x * channels + 1]
+                    + 29 * a[x * channels + 2]) >> 10;
+            dst[3*x] = dst[3*x + 1] = dst[3*x + 2] = luma;
+        } else {
+            v = MIN(255, d * 4);
+            dst[3*x] = 128 + v / 2;
+            dst[3*x + 1] = v;
+            dst[3*x + 2] = 0;
+        }
+    }
+
+    return different;
+}
+
+void
+compare_images(const Image *a, const Image *b, CompareStats *stats, Image **heatmap)
+{
+    Image *out = NULL;
+    guchar *delta;
+    guint64 sse = 0;
+    gint channels, y;
+    gdouble mse;
+
+    memset( stats, 0, sizeof(*stats) );
+    if (heatmap)
+        *heatmap = NULL;
+
+    if ( a->width != b->width || a->height != b->height || a->has_alpha != b->has_alpha ) {
+        stats->mismatch = TRUE;
+        stats->max_delta = 255;
+        return;
+    }
+
+    if (heatmap)
+        out = image_new(a->width, a->height, FALSE);
+
+    channels = a->has_alpha ? 4 : 3;
+    delta = g_new(guchar, MAX(1, a->width * channels));
+    for (y = 0; y < a->height; ++y) {
+        sse += compare_row( a->pixels + (gsize)y * a->rowstride,
+                b->pixels + (gsize)y * b->rowstride,
+                a->width * channels, delta, &stats->max_delta );
+        stats->different_pixels += compare_heat_row(
+                a->pixels + (gsize)y * a->rowstride, delta, a->width, channels,
+                out ? out->pixels + (gsize)y * out->rowstride : NULL );
+    }
+    g_free(delta);
+
+    mse = (gdouble)sse / MAX(1, (gint64)a->width * a->height * channels);
+    stats->psnr = mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+
+    if (heatmap)
+        *heatmap = out;
+}
+
+gboolean
+compare_stats_differ(const CompareStats *stats, guint threshold)
+{
+    return stats->mismatch || stats->max_delta > threshold;
+}
+
+gchar *
+compare_stats_to_string(const CompareStats *stats)
+{
+    if (stats->mismatch)
+        return g_strdup("size or format differs");
+    if (stats->different_pixels == 0)
+        return g_strdup("identical");
+
+    return g_strdup_printf( "PSNR %.1f dB, max delta %u, %" G_GUINT64_FORMAT " pixels",
+            stats->psnr, stats->max_delta, stats->different_pixels );
+}
+
+static gboolean
+compare_job_is_cancelled(const CompareJob *job)
+{
+    return (guint)g_atomic_int_get(&job->comparer->current) != job->id;
+}
+
+static void
+compare_pair(CompareJob *job, guint pair)
+{
+    CompareStats *stats = &job->stats[pair];
+    gchar *path;
+    Image *a, *b = NULL;
+
+    path = path_store_get(job->store, 2 * pair);
+    a = compare_decode( path, (DecoderCancelled*)compare_job_is_cancelled, job, NULL );
+    g_free(path);
+    if (a) {
+        path = path_store_get(job->store, 2 * pair + 1);
+        b = compare_decode( path, (DecoderCancelled*)compare_job_is_cancelled, job, NULL );
+        g_free(path);
+    }
+
+    /* pair interrupted by cancelling is not compared */
+    if ( (!a || !b) && compare_job_is_cancelled(job) ) {
+        if (a)
+            image_free(a);
+        return;
+    }
+
+    if (a && b) {
+        compare_images(a, b, stats, NULL);
+    } else {
+        /* pair with unreadable image always differs */
+        memset( stats, 0, sizeof(*stats) );
+        stats->mismatch = TRUE;
+        stats->max_delta = 255;
+    }
+    if (a)
+        image_free(a);
+    if (b)
+        image_free(b);
+
+    g_atomic_int_set(&job->done[pair], 1);
+    g_atomic_int_inc(&job->compared);
+}
+
+static void
+compare_run_chunk(CompareChunk *chunk, Comparer *comparer)
+{
+    CompareJob *job = chunk->job;
+    guint i;
+
+    for (i = chunk->start; i < chunk->end && !compare_job_is_cancelled(job); ++i)
+        compare_pair(job, i);
+
+    if ( !compare_job_is_cancelled(job) )
+        comparer->callback(job->id, comparer->user_data);
+
+    g_mutex_lock(&comparer->lock);
+    if (--comparer->running == 0)
+        g_cond_broadcast(&comparer->idle);
+    g_mutex_unlock(&comparer->lock);
+}
+
+static void
+compare_job_free(CompareJob *job)
+{
+    g_free(job->stats);
+    g_free(job->done);
+    g_free(job->chunks);
+    g_free(job);
+}
+
+Comparer *
+comparer_new(CompareCallback *callback, gpointer user_data)
+{
+    Comparer *comparer;
+
+    comparer = g_new0(Comparer, 1);
+    comparer->callback = callback;
+    comparer->user_data = user_data;
+    /* decoding is bound by processors, memory by full resolution pairs */
+    comparer->pool = g_thread_pool_new( (GFunc)compare_run_chunk, comparer,
+            CLAMP(g_get_num_processors() / 2, 1, COMPARE_MAX_THREADS), FALSE, NULL );
+    g_mutex_init(&comparer->lock);
+    g_cond_init(&comparer->idle);
+
+    return comparer;
+}
+
+void
+comparer_free(Comparer *comparer)
+{
+    comparer_cancel(comparer);
+    g_thread_pool_free(comparer->pool, TRUE, TRUE);
+    if (comparer->job)
+        compare_job_free(comparer->job);
+    g_mutex_clear(&comparer->lock);
+    g_cond_clear(&comparer->idle);
+    g_free(comparer);
+}
+
+guint
+comparer_start(Comparer *comparer, const PathStore *store)
+{
+    CompareJob *job;
+    CompareChunk *chunk;
+    guint i;
+
+    /* statistics of previous job are dropped */
+    comparer_cancel(comparer);
+    if (comparer->job)
+        compare_job_free(comparer->job);
+
+    job = g_new0(CompareJob, 1);
+
+    /* id 0 is reserved for cancelled state */
+    if (++comparer->last_id == 0)
+        ++comparer->last_id;
+    job->id = comparer->last_id;
+    job->comparer = comparer;
+    job->store = store;
+    job->count = path_store_get_count(store) / 2;
+    job->stats = g_new0(CompareStats, MAX(job->count, 1));
+    job->done = g_new0(gint, MAX(job->count, 1));
+    job->chunk_count = (job->count + COMPARE_CHUNK - 1) / COMPARE_CHUNK;
+    job->chunks = g_new0(CompareChunk, MAX(job->chunk_count, 1));
+    comparer->job = job;
+
+    g_atomic_int_set(&comparer->current, job->id);
+
+    g_mutex_lock(&comparer->lock);
+    comparer->running += job->chunk_count;
+    g_mutex_unlock(&comparer->lock);
+
+    /* pool takes chunks in order so that pairs are compared from start */
+    for (i = 0; i < job->chunk_count; ++i) {
+        chunk = &job->chunks[i];
+        chunk->job = job;
+        chunk->start = i * COMPARE_CHUNK;
+        chunk->end = MIN(job->count, chunk->start + COMPARE_CHUNK);
+        g_thread_pool_push(comparer->pool, chunk, NULL);
+    }
+
+    return job->id;
+}
+
+void
+comparer_cancel(Comparer *comparer)
+{
+    g_atomic_int_set(&comparer->current, 0);
+
+    g_mutex_lock(&comparer->lock);
+    while (comparer->running > 0)
+        g_cond_wait(&comparer->idle, &comparer->lock);
+    g_mutex_unlock(&comparer->lock);
+}
+
+gboolean
+comparer_get(const Comparer *comparer, guint pair, CompareStats *stats)
+{
+    const CompareJob *job = comparer->job;
+
+    if ( !job || pair >= job->count || !g_atomic_int_get(&job->done[pair]) )
+        return FALSE;
+
+    *stats = job->stats[pair];
+    return TRUE;
+}
+
+guint
+comparer_get_compared(const Comparer *comparer)
+{
+    return comparer->job ? (guint)g_atomic_int_get(&comparer->job->compared) : 0;
+}
+
+guint
+comparer_get_count(const Comparer *comparer)
+{
+    return comparer->job ? comparer->job->count : 0;
+}
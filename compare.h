@@ -0,0 +1,65 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <glib.h>
+#include "decoder.h"
+#include "pathstore.h"
+
+typedef struct _CompareStats CompareStats;
+typedef struct _Comparer Comparer;
+
+struct _CompareStats {
+    /* peak signal-to-noise ratio in dB (infinite if images are same) */
+    gdouble psnr;
+    /* largest difference of channel value (0 to 255) */
+    guint max_delta;
+    /* number of pixels with any difference */
+    guint64 different_pixels;
+    /* images have different size or pixel format */
+    gboolean mismatch;
+};
+
+/* progress of comparing pairs (called from worker thread) */
+typedef void CompareCallback(guint id, gpointer user_data);
+
+/* decodes file in full resolution with EXIF orientation applied */
+Image *compare_decode(const gchar *path, DecoderCancelled *cancelled, gpointer user_data, GError **error);
+
+/*
+ * Compares pixels of images. If heatmap is not NULL, it's set to new
+ * opaque image with differing pixels in red to yellow (by difference) over
+ * darkened first image (or NULL if images cannot be compared).
+ */
+void compare_images(const Image *a, const Image *b, CompareStats *stats, Image **heatmap);
+/* returns TRUE if some channel differs by more than threshold */
+gboolean compare_stats_differ(const CompareStats *stats, guint threshold);
+/* returns newly allocated description of difference */
+gchar *compare_stats_to_string(const CompareStats *stats);
+
+/*
+ * Compares pairs of paths (items 2i and 2i+1) in PathStore in background.
+ *
+ * Pairs are compared in order in few threads (decoding is stopped when
+ * comparing is cancelled); callback is called after each few pairs.
+ * Statistics of compared pairs are available with comparer_get() until
+ * next comparer_start().
+ */
+Comparer *comparer_new(CompareCallback *callback, gpointer user_data);
+/* cancels comparing */
+void comparer_free(Comparer *comparer);
+
+/*
+ * Starts comparing and cancels previous one. Store must not change until
+ * comparing finishes or comparer_cancel() returns. Returns id.
+ */
+guint comparer_start(Comparer *comparer, const PathStore *store);
+/* cancels comparing and waits for worker threads */
+void comparer_cancel(Comparer *comparer);
+
+/* returns FALSE if pair is not compared yet */
+gboolean comparer_get(const Comparer *comparer, guint pair, CompareStats *stats);
+/* number of compared pairs and of all pairs */
+guint comparer_get_compared(const Comparer *comparer);
+guint comparer_get_count(const Comparer *comparer);
+
+#endif /* COMPARE_H */
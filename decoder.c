@@ -0,0 +1,1021 @@
+#include <math.h>
+#include <string.h>
+#include "decoder.h"
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+#include <jpeglib.h>
+#endif
+
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+#ifdef HAVE_LIBWEBP
+#include <webp/decode.h>
+#endif
+
+#ifdef HAVE_LIBRSVG
+#include <librsvg/rsvg.h>
+#endif
+
+/* how many rows are decoded between checks for cancellation */
+#define DECODER_CANCEL_ROWS 16
+/* size of chunks passed to GdkPixbuf loader */
+#define DECODER_CHUNK_SIZE 65536
+
+GQuark
+decoder_error_quark(void)
+{
+    return g_quark_from_static_string("imagepeek-decoder-error");
+}
+
+gboolean
+decoder_is_cancelled(const DecoderRequest *request, GError **error)
+{
+    if ( !request->cancelled || !request->cancelled(request->user_data) )
+        return FALSE;
+
+    g_set_error(error, DECODER_ERROR, DECODER_ERROR_CANCELLED, "Decoding cancelled");
+    return TRUE;
+}
+
+/* returns size of image scaled down with given scale (never smaller) */
+static gint
+decoder_scaled_size(gint size, gdouble scale)
+{
+    if (scale >= 1.0)
+        return size;
+    return MAX( 1, (gint)ceil(size*scale) );
+}
+
+gdouble
+decoder_fit_scale(const DecoderRequest *request, gint width, gint height)
+{
+    gdouble scale = request->scale;
+
+    if ( request->fit_width > 0 && request->fit_height > 0 && width > 0 && height > 0 ) {
+        scale = MIN( scale, (gdouble)request->fit_width / width );
+        scale = MIN( scale, (gdouble)request->fit_height / height );
+    }
+
+    return scale;
+}
+
+#ifdef HAVE_LIBJPEG
+/*
+ * JPEG -- libjpeg(-turbo)
+ *
+ * Scaled images are decoded with reduced DCT which is much faster than
+ * decoding full image.
+ */
+typedef struct _JpegError JpegError;
+
+struct _JpegError {
+    struct jpeg_error_mgr manager;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+static void
+jpeg_on_error(j_common_ptr cinfo)
+{
+    JpegError *err = (JpegError*)cinfo->err;
+
+    cinfo->err->format_message(cinfo, err->message);
+    longjmp(err->jump, 1);
+}
+
+static void
+jpeg_on_message(j_common_ptr cinfo, int level)
+{
+    /* ignore warnings about corrupted data */
+}
+
+static gboolean
+jpeg_probe(const guchar *data, gsize size)
+{
+    return size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+}
+
+/* returns largest supported scale denominator not smaller than scale */
+static gint
+jpeg_scale_denom(gdouble scale)
+{
+    gint denom;
+
+    for (denom = 8; denom > 1; denom /= 2) {
+        if (1.0/denom >= scale)
+            break;
+    }
+
+    return denom;
+}
+
+/* reads header and sets up decompression (call only after setjmp()) */
+static gboolean
+jpeg_setup(struct jpeg_decompress_struct *cinfo,
+        const guchar *data, gsize size, gint scale_denom, GError **error)
+{
+    jpeg_mem_src( cinfo, (unsigned char*)data, size );
+    jpeg_read_header(cinfo, TRUE);
+
+    /* CMYK is left to GdkPixbuf */
+    if ( cinfo->jpeg_color_space == JCS_CMYK || cinfo->jpeg_color_space == JCS_YCCK ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Unsupported JPEG color space");
+        return FALSE;
+    }
+
+    /* grayscale is expanded to RGB after reading each row */
+    cinfo->out_color_space =
+        cinfo->jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = scale_denom;
+    jpeg_calc_output_dimensions(cinfo);
+
+    return TRUE;
+}
+
+static gboolean
+jpeg_get_info(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        DecoderInfo *info,
+        GError **error )
+{
+    struct jpeg_decompress_struct cinfo;
+    JpegError err;
+    gboolean ok;
+
+    cinfo.err = jpeg_std_error(&err.manager);
+    err.manager.error_exit = jpeg_on_error;
+    err.manager.emit_message = jpeg_on_message;
+    if ( setjmp(err.jump) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "%s", err.message);
+        jpeg_destroy_decompress(&cinfo);
+        return FALSE;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    info->scale = jpeg_scale_denom(request->scale);
+    ok = jpeg_setup(&cinfo, data, size, info->scale, error);
+    if (ok) {
+        info->width = cinfo.image_width;
+        info->height = cinfo.image_height;
+        info->out_width = cinfo.output_width;
+        info->out_height = cinfo.output_height;
+        info->has_alpha = FALSE;
+    }
+    jpeg_destroy_decompress(&cinfo);
+
+    return ok;
+}
+
+static gboolean
+jpeg_decode(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        const DecoderInfo *info,
+        guchar *pixels,
+        gint rowstride,
+        GError **error )
+{
+    struct jpeg_decompress_struct cinfo;
+    JpegError err;
+    JSAMPROW row;
+    guchar *src, *dst;
+    gint x;
+
+    cinfo.err = jpeg_std_error(&err.manager);
+    err.manager.error_exit = jpeg_on_error;
+    err.manager.emit_message = jpeg_on_message;
+    if ( setjmp(err.jump) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "%s", err.message);
+        jpeg_destroy_decompress(&cinfo);
+        return FALSE;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if ( !jpeg_setup(&cinfo, data, size, info->scale, error) ) {
+        jpeg_destroy_decompress(&cinfo);
+        return FALSE;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    if ( (gint)cinfo.output_width != info->out_width ||
+         (gint)cinfo.output_height != info->out_height )
+    {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Unexpected size of JPEG image");
+        jpeg_destroy_decompress(&cinfo);
+        return FALSE;
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        if ( cinfo.output_scanline % DECODER_CANCEL_ROWS == 0 &&
+             decoder_is_cancelled(request, error) )
+        {
+            jpeg_destroy_decompress(&cinfo);
+            return FALSE;
+        }
+
+        row = pixels + cinfo.output_scanline*rowstride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+
+        if (cinfo.output_components == 1) {
+            /* expand gray to RGB in place (from end of row) */
+            src = row + info->out_width;
+            dst = row + info->out_width*3;
+            for (x = 0; x < info->out_width; ++x) {
+                dst -= 3;
+                --src;
+                dst[0] = dst[1] = dst[2] = *src;
+            }
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return TRUE;
+}
+
+static const Decoder decoder_jpeg = {
+    "jpeg", jpeg_probe, jpeg_get_info, jpeg_decode, NULL
+};
+#endif /* HAVE_LIBJPEG */
+
+#if defined(HAVE_LIBPNG) && defined(PNG_SIMPLIFIED_READ_SUPPORTED)
+/*
+ * PNG -- libpng simplified API
+ *
+ * Image is decoded in single call so it cannot be cancelled.
+ */
+static gboolean
+png_probe(const guchar *data, gsize size)
+{
+    return size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0;
+}
+
+static gboolean
+png_begin(png_image *image, const guchar *data, gsize size, GError **error)
+{
+    memset( image, 0, sizeof(*image) );
+    image->version = PNG_IMAGE_VERSION;
+
+    if ( !png_image_begin_read_from_memory(image, data, size) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "%s", image->message);
+        png_image_free(image);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+png_get_info(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        DecoderInfo *info,
+        GError **error )
+{
+    png_image image;
+
+    if ( !png_begin(&image, data, size, error) )
+        return FALSE;
+
+    info->width = info->out_width = image.width;
+    info->height = info->out_height = image.height;
+    /* also set for images with tRNS chunk */
+    info->has_alpha = (image.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+    info->scale = 1;
+    png_image_free(&image);
+
+    return TRUE;
+}
+
+static gboolean
+png_decode(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        const DecoderInfo *info,
+        guchar *pixels,
+        gint rowstride,
+        GError **error )
+{
+    png_image image;
+
+    if ( !png_begin(&image, data, size, error) )
+        return FALSE;
+
+    image.format = info->has_alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+    if ( !png_image_finish_read(&image, NULL, pixels, rowstride, NULL) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "%s", image.message);
+        png_image_free(&image);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const Decoder decoder_png = {
+    "png", png_probe, png_get_info, png_decode, NULL
+};
+#endif /* HAVE_LIBPNG */
+
+#ifdef HAVE_LIBWEBP
+/*
+ * WebP -- libwebp
+ *
+ * Scaled images are resized while decoding.
+ */
+static gboolean
+webp_probe(const guchar *data, gsize size)
+{
+    return size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data+8, "WEBP", 4) == 0;
+}
+
+static gboolean
+webp_get_info(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        DecoderInfo *info,
+        GError **error )
+{
+    WebPBitstreamFeatures features;
+
+    if ( WebPGetFeatures(data, size, &features) != VP8_STATUS_OK ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "Corrupted WebP image");
+        return FALSE;
+    }
+
+    info->width = features.width;
+    info->height = features.height;
+    info->out_width = decoder_scaled_size(features.width, request->scale);
+    info->out_height = decoder_scaled_size(features.height, request->scale);
+    info->has_alpha = features.has_alpha;
+    info->scale = 1;
+
+    return TRUE;
+}
+
+static gboolean
+webp_decode(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        const DecoderInfo *info,
+        guchar *pixels,
+        gint rowstride,
+        GError **error )
+{
+    WebPDecoderConfig config;
+    VP8StatusCode status;
+
+    if ( !WebPInitDecoderConfig(&config) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Incompatible WebP library");
+        return FALSE;
+    }
+
+    if (info->out_width != info->width || info->out_height != info->height) {
+        config.options.use_scaling = 1;
+        config.options.scaled_width = info->out_width;
+        config.options.scaled_height = info->out_height;
+    }
+
+    config.output.colorspace = info->has_alpha ? MODE_RGBA : MODE_RGB;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = pixels;
+    config.output.u.RGBA.stride = rowstride;
+    config.output.u.RGBA.size = (size_t)rowstride*info->out_height;
+
+    status = WebPDecode(data, size, &config);
+    WebPFreeDecBuffer(&config.output);
+
+    if (status != VP8_STATUS_OK) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED, "Corrupted WebP image");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static const Decoder decoder_webp = {
+    "webp", webp_probe, webp_get_info, webp_decode, NULL
+};
+#endif /* HAVE_LIBWEBP */
+
+#ifdef HAVE_LIBRSVG
+/*
+ * SVG -- librsvg
+ *
+ * Vector images are rendered in exactly requested scale (also bigger
+ * than 1) and only requested region of scaled image is rendered. Tiles of
+ * image are rendered from the same data, so each thread keeps last parsed
+ * image (data is compared since each tile is read separately).
+ */
+typedef struct _SvgCache SvgCache;
+
+struct _SvgCache {
+    guchar *data;
+    gsize size;
+    RsvgHandle *handle;
+};
+
+static void
+svg_cache_free(SvgCache *cache)
+{
+    g_object_unref(cache->handle);
+    g_free(cache->data);
+    g_free(cache);
+}
+
+static GPrivate svg_cache = G_PRIVATE_INIT( (GDestroyNotify)svg_cache_free );
+
+static gboolean
+svg_starts_with(const gchar *p, const gchar *end, const gchar *prefix)
+{
+    gsize length = strlen(prefix);
+    return (gsize)(end - p) >= length && memcmp(p, prefix, length) == 0;
+}
+
+/* returns position after marker or NULL if it's not found */
+static const gchar *
+svg_skip_past(const gchar *p, const gchar *end, const gchar *marker)
+{
+    const gchar *found;
+
+    if (!p)
+        return NULL;
+    found = g_strstr_len(p, end - p, marker);
+    return found ? found + strlen(marker) : NULL;
+}
+
+static gboolean
+svg_probe(const guchar *data, gsize size)
+{
+    const gchar *p = (const gchar*)data;
+    const gchar *end = p + MIN(size, 4096);
+    const gchar *bracket, *close;
+
+    if ( svg_starts_with(p, end, "\xef\xbb\xbf") )
+        p += 3;
+
+    /* root element follows XML declaration, comments or doctype */
+    while (p) {
+        while ( p < end && g_ascii_isspace(*p) )
+            ++p;
+        if ( svg_starts_with(p, end, "<?") ) {
+            p = svg_skip_past(p, end, "?>");
+        } else if ( svg_starts_with(p, end, "<!--") ) {
+            p = svg_skip_past(p, end, "-->");
+        } else if ( svg_starts_with(p, end, "<!DOCTYPE") ) {
+            /* internal subset can contain '>' */
+            bracket = memchr(p, '[', end - p);
+            close = memchr(p, '>', end - p);
+            if (bracket && close && bracket < close)
+                p = svg_skip_past(bracket, end, "]");
+            p = svg_skip_past(p, end, ">");
+        } else {
+            return svg_starts_with(p, end, "<svg") && p + 4 < end &&
+                ( g_ascii_isspace(p[4]) || p[4] == '>' || p[4] == '/' || p[4] == ':' );
+        }
+    }
+
+    return FALSE;
+}
+
+/* returns new reference to parsed image (reused if data didn't change) */
+static RsvgHandle *
+svg_open(const guchar *data, gsize size, GError **error)
+{
+    SvgCache *cache;
+    RsvgHandle *handle;
+
+    cache = g_private_get(&svg_cache);
+    if ( cache && cache->size == size && memcmp(cache->data, data, size) == 0 )
+        return g_object_ref(cache->handle);
+
+    handle = rsvg_handle_new_from_data(data, size, error);
+    if (!handle)
+        return NULL;
+
+    cache = g_new(SvgCache, 1);
+    cache->data = g_malloc(size);
+    memcpy(cache->data, data, size);
+    cache->size = size;
+    cache->handle = g_object_ref(handle);
+    g_private_replace(&svg_cache, cache);
+
+    return handle;
+}
+
+static gboolean
+svg_get_size(RsvgHandle *handle, gdouble *width, gdouble *height)
+{
+#if LIBRSVG_CHECK_VERSION(2, 52, 0)
+    return rsvg_handle_get_intrinsic_size_in_pixels(handle, width, height)
+        && *width > 0 && *height > 0;
+#else
+    RsvgDimensionData size;
+
+    rsvg_handle_get_dimensions(handle, &size);
+    *width = size.width;
+    *height = size.height;
+    return size.width > 0 && size.height > 0;
+#endif
+}
+
+static Image*
+svg_load(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error )
+{
+    RsvgHandle *handle;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    Image *image;
+    const guchar *src;
+    guchar *dst;
+    guint32 pixel;
+    gdouble width, height;
+    gint scaled_width, scaled_height, x, y, w, h, stride, i, j, a;
+    gboolean ok;
+
+    handle = svg_open(data, size, error);
+    if (!handle)
+        return NULL;
+
+    if ( !svg_get_size(handle, &width, &height) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "SVG image without size");
+        g_object_unref(handle);
+        return NULL;
+    }
+
+    scaled_width = MAX( 1, (gint)ceil(width * request->scale) );
+    scaled_height = MAX( 1, (gint)ceil(height * request->scale) );
+    x = y = 0;
+    w = scaled_width;
+    h = scaled_height;
+    if (request->width > 0) {
+        x = CLAMP(request->x, 0, scaled_width - 1);
+        y = CLAMP(request->y, 0, scaled_height - 1);
+        w = MIN(request->width, scaled_width - x);
+        h = MIN(request->height, scaled_height - y);
+    }
+
+    if ( (gint64)w*h > DECODER_MAX_PIXELS ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Rendered SVG image is too big (%dx%d)", w, h);
+        g_object_unref(handle);
+        return NULL;
+    }
+    if ( decoder_is_cancelled(request, error) ) {
+        g_object_unref(handle);
+        return NULL;
+    }
+
+    image = image_new(w, h, TRUE);
+    if (!image) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory for SVG image (%dx%d)", w, h);
+        g_object_unref(handle);
+        return NULL;
+    }
+    image->scalable = TRUE;
+    /* size of whole image or region at scale 1 */
+    if (request->width > 0) {
+        image->original_width = MAX( 1, (gint)(w / request->scale + 0.5) );
+        image->original_height = MAX( 1, (gint)(h / request->scale + 0.5) );
+    } else {
+        image->original_width = MAX( 1, (gint)ceil(width) );
+        image->original_height = MAX( 1, (gint)ceil(height) );
+    }
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+    if ( cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory for SVG image (%dx%d)", w, h);
+        cairo_surface_destroy(surface);
+        image_free(image);
+        g_object_unref(handle);
+        return NULL;
+    }
+    cr = cairo_create(surface);
+    cairo_translate(cr, -x, -y);
+#if LIBRSVG_CHECK_VERSION(2, 52, 0)
+    {
+        RsvgRectangle viewport = { 0, 0, scaled_width, scaled_height };
+        ok = rsvg_handle_render_document(handle, cr, &viewport, error);
+    }
+#else
+    cairo_scale(cr, scaled_width / width, scaled_height / height);
+    ok = rsvg_handle_render_cairo(handle, cr);
+    if (!ok) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Failed to render SVG image");
+    }
+#endif
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+    g_object_unref(handle);
+
+    /* native endian premultiplied 0xAARRGGBB to RGBA */
+    src = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+    for (j = 0; ok && j < h; ++j) {
+        dst = image->pixels + (gsize)j * image->rowstride;
+        for (i = 0; i < w; ++i) {
+            pixel = ((const guint32 *)(src + (gsize)j * stride))[i];
+            a = pixel >> 24;
+            if (a == 0) {
+                dst[0] = dst[1] = dst[2] = dst[3] = 0;
+            } else {
+                dst[0] = ( ((pixel >> 16) & 0xff) * 255 + a/2 ) / a;
+                dst[1] = ( ((pixel >> 8) & 0xff) * 255 + a/2 ) / a;
+                dst[2] = ( (pixel & 0xff) * 255 + a/2 ) / a;
+                dst[3] = a;
+            }
+            dst += 4;
+        }
+    }
+    cairo_surface_destroy(surface);
+
+    if (!ok) {
+        image_free(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+static const Decoder decoder_svg = {
+    "svg", svg_probe, NULL, NULL, svg_load
+};
+#endif /* HAVE_LIBRSVG */
+
+/*
+ * Other formats -- GdkPixbuf
+ *
+ * Data are written to loader in chunks so decoding can be cancelled.
+ */
+typedef struct _PixbufSize PixbufSize;
+
+struct _PixbufSize {
+    const DecoderRequest *request;
+    gint width, height;
+};
+
+static gboolean
+pixbuf_probe(const guchar *data, gsize size)
+{
+    return TRUE;
+}
+
+static void
+pixbuf_on_size_prepared(GdkPixbufLoader *loader, gint width, gint height, PixbufSize *size)
+{
+    gdouble scale = decoder_fit_scale(size->request, width, height);
+
+    size->width = width;
+    size->height = height;
+    if (scale < 1.0) {
+        gdk_pixbuf_loader_set_size( loader,
+                decoder_scaled_size(width, scale),
+                decoder_scaled_size(height, scale) );
+    }
+}
+
+static Image*
+pixbuf_load(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error )
+{
+    GdkPixbufLoader *loader;
+    GdkPixbuf *pixbuf = NULL;
+    PixbufSize pixbuf_size = { request, 0, 0 };
+    Image *image;
+    gsize pos, n;
+    gboolean ok = TRUE;
+
+    loader = gdk_pixbuf_loader_new();
+    g_signal_connect( loader, "size-prepared",
+            G_CALLBACK(pixbuf_on_size_prepared), &pixbuf_size );
+
+    for (pos = 0; ok && pos < size; pos += n) {
+        n = MIN(size - pos, DECODER_CHUNK_SIZE);
+        ok = !decoder_is_cancelled(request, error) &&
+            gdk_pixbuf_loader_write(loader, data + pos, n, error);
+    }
+
+    if (ok) {
+        ok = gdk_pixbuf_loader_close(loader, error);
+        pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+        if (ok && pixbuf)
+            g_object_ref(pixbuf);
+        else
+            pixbuf = NULL;
+    } else {
+        gdk_pixbuf_loader_close(loader, NULL);
+    }
+    g_object_unref(loader);
+
+    if (!pixbuf)
+        return NULL;
+
+    image = image_new_from_pixbuf(pixbuf);
+    if (pixbuf_size.width > 0) {
+        image->original_width = pixbuf_size.width;
+        image->original_height = pixbuf_size.height;
+    }
+    g_object_unref(pixbuf);
+
+    return image;
+}
+
+static const Decoder decoder_pixbuf = {
+    "gdk-pixbuf", pixbuf_probe, NULL, NULL, pixbuf_load
+};
+
+static const Decoder * const decoders[] = {
+#ifdef HAVE_LIBJPEG
+    &decoder_jpeg,
+#endif
+#if defined(HAVE_LIBPNG) && defined(PNG_SIMPLIFIED_READ_SUPPORTED)
+    &decoder_png,
+#endif
+#ifdef HAVE_LIBWEBP
+    &decoder_webp,
+#endif
+#ifdef HAVE_LIBRSVG
+    &decoder_svg,
+#endif
+    NULL
+};
+
+const Decoder * const *
+decoder_get_backends(void)
+{
+    return decoders;
+}
+
+const Decoder *
+decoder_get_fallback(void)
+{
+    return &decoder_pixbuf;
+}
+
+const Decoder *
+decoder_find(const guchar *data, gsize size)
+{
+    const Decoder * const *decoder;
+
+    for (decoder = decoders; *decoder; ++decoder) {
+        if ( (*decoder)->probe(data, size) )
+            return *decoder;
+    }
+
+    return &decoder_pixbuf;
+}
+
+Image *
+decoder_decode_with(
+        const Decoder *decoder,
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error )
+{
+    DecoderRequest fit;
+    DecoderInfo info;
+    Image *image;
+
+    if ( decoder_is_cancelled(request, error) )
+        return NULL;
+
+    if (decoder->load)
+        return decoder->load(data, size, request, error);
+
+    if ( !decoder->get_info(data, size, request, &info, error) )
+        return NULL;
+
+    /* header is read again for lower scale if image doesn't fit */
+    if ( decoder_fit_scale(request, info.width, info.height) < request->scale ) {
+        fit = *request;
+        fit.scale = decoder_fit_scale(request, info.width, info.height);
+        request = &fit;
+        if ( !decoder->get_info(data, size, request, &info, error) )
+            return NULL;
+    }
+
+    if ( info.out_width <= 0 || info.out_height <= 0 ||
+         (gsize)info.out_width*info.out_height > DECODER_MAX_PIXELS )
+    {
+        g_set_error( error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Unsupported image size %dx%d", info.out_width, info.out_height );
+        return NULL;
+    }
+
+    image = image_new(info.out_width, info.out_height, info.has_alpha);
+    if (!image) {
+        g_set_error( error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory to decode image %dx%d", info.out_width, info.out_height );
+        return NULL;
+    }
+    image->original_width = info.width;
+    image->original_height = info.height;
+
+    if ( !decoder->decode(data, size, request, &info, image->pixels, image->rowstride, error) ) {
+        image_free(image);
+        return NULL;
+    }
+
+    return image;
+}
+
+Image *
+decoder_decode(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error )
+{
+    const Decoder *decoder;
+    GError *native_error = NULL;
+    Image *image;
+
+    decoder = decoder_find(data, size);
+    if (decoder == &decoder_pixbuf)
+        return decoder_decode_with(decoder, data, size, request, error);
+
+    image = decoder_decode_with(decoder, data, size, request, &native_error);
+    if (image)
+        return image;
+
+    if ( g_error_matches(native_error, DECODER_ERROR, DECODER_ERROR_CANCELLED) ) {
+        g_propagate_error(error, native_error);
+        return NULL;
+    }
+
+    /* GdkPixbuf may handle what native backend doesn't support */
+    g_error_free(native_error);
+    return decoder_decode_with(&decoder_pixbuf, data, size, request, error);
+}
+
+Image *
+image_new(gint width, gint height, gboolean has_alpha)
+{
+    Image *image;
+    guchar *pixels;
+    gint rowstride;
+
+    /* rows are aligned to 4 bytes */
+    rowstride = ( width*(has_alpha ? 4 : 3) + 3 ) & ~3;
+    pixels = g_try_malloc( (gsize)rowstride*height );
+    if (!pixels)
+        return NULL;
+
+    image = g_slice_new0(Image);
+    image->pixels = pixels;
+    image->width = image->original_width = width;
+    image->height = image->original_height = height;
+    image->rowstride = rowstride;
+    image->has_alpha = has_alpha;
+
+    return image;
+}
+
+Image *
+image_new_from_pixbuf(GdkPixbuf *pixbuf)
+{
+    Image *image;
+
+    /* pixels are shared with pixbuf */
+    image = g_slice_new0(Image);
+    image->pixbuf = g_object_ref(pixbuf);
+    image->pixels = gdk_pixbuf_get_pixels(pixbuf);
+    image->width = image->original_width = gdk_pixbuf_get_width(pixbuf);
+    image->height = image->original_height = gdk_pixbuf_get_height(pixbuf);
+    image->rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    image->has_alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+
+    return image;
+}
+
+void
+image_free(Image *image)
+{
+    if (image->pixbuf)
+        g_object_unref(image->pixbuf);
+    else
+        g_free(image->pixels);
+    g_slice_free(Image, image);
+}
+
+Image *
+image_apply_orientation(Image *image, gint orientation)
+{
+    Image *out;
+    const guchar *src;
+    gint x, y, dx, dy, w, h, bpp;
+    gboolean transpose;
+
+    if (orientation <= 1 || orientation > 8)
+        return image;
+
+    w = image->width;
+    h = image->height;
+    bpp = image->has_alpha ? 4 : 3;
+    transpose = orientation >= 5;
+
+    /* keep image as it is if there is not enough memory */
+    out = transpose
+        ? image_new(h, w, image->has_alpha)
+        : image_new(w, h, image->has_alpha);
+    if (!out)
+        return image;
+
+    out->scalable = image->scalable;
+    if (transpose) {
+        out->original_width = image->original_height;
+        out->original_height = image->original_width;
+    } else {
+        out->original_width = image->original_width;
+        out->original_height = image->original_height;
+    }
+
+    for (y = 0; y < h; ++y) {
+        src = image->pixels + y*image->rowstride;
+        for (x = 0; x < w; ++x, src += bpp) {
+            switch (orientation) {
+            case 2: dx = w - 1 - x; dy = y; break;
+            case 3: dx = w - 1 - x; dy = h - 1 - y; break;
+            case 4: dx = x; dy = h - 1 - y; break;
+            case 5: dx = y; dy = x; break;
+            case 6: dx = h - 1 - y; dy = x; break;
+            case 7: dx = h - 1 - y; dy = w - 1 - x; break;
+            default: dx = y; dy = w - 1 - x; break;
+            }
+            memcpy( out->pixels + dy*out->rowstride + dx*bpp, src, bpp );
+        }
+    }
+
+    image_free(image);
+    return out;
+}
+
+Image *
+image_new_scaled(const Image *image, gdouble scale)
+{
+    GdkPixbuf *pixbuf, *scaled;
+    Image *out;
+    gint width, height;
+
+    width = MAX( 1, (gint)(image->original_width * scale + 0.5) );
+    height = MAX( 1, (gint)(image->original_height * scale + 0.5) );
+    if (width >= image->width || height >= image->height)
+        return NULL;
+
+    pixbuf = gdk_pixbuf_new_from_data( image->pixels, GDK_COLORSPACE_RGB,
+            image->has_alpha, 8, image->width, image->height, image->rowstride,
+            NULL, NULL );
+    scaled = gdk_pixbuf_scale_simple(pixbuf, width, height, GDK_INTERP_BILINEAR);
+    g_object_unref(pixbuf);
+    if (!scaled)
+        return NULL;
+
+    out = image_new_from_pixbuf(scaled);
+    g_object_unref(scaled);
+    out->original_width = image->original_width;
+    out->original_height = image->original_height;
+    out->scalable = image->scalable;
+
+    return out;
+}
+
+Image *
+image_scale_down(Image *image, gdouble scale)
+{
+    Image *out;
+
+    /* keep image as it is if there is not enough memory */
+    out = image_new_scaled(image, scale);
+    if (!out)
+        return image;
+
+    image_free(image);
+    return out;
+}
@@ -0,0 +1,144 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* largest accepted image (in pixels) */
+#define DECODER_MAX_PIXELS (1 << 28)
+
+typedef struct _Image Image;
+typedef struct _Decoder Decoder;
+typedef struct _DecoderInfo DecoderInfo;
+typedef struct _DecoderRequest DecoderRequest;
+
+typedef gboolean DecoderCancelled(gpointer user_data);
+
+/* decoded image with 8-bit RGB or RGBA pixels */
+struct _Image {
+    guchar *pixels;
+    gint width, height;
+    gint rowstride;
+    gboolean has_alpha;
+    /* size of image before scaled decoding */
+    gint original_width, original_height;
+    /* owner of pixels if image was decoded by GdkPixbuf */
+    GdkPixbuf *pixbuf;
+    /* vector image which can be rendered again in any scale */
+    gboolean scalable;
+};
+
+struct _DecoderRequest {
+    /* smallest acceptable scale (decoders may return bigger image) */
+    gdouble scale;
+    /* checked while decoding, decoding is stopped if it returns TRUE
+     * (DECODER_ERROR_CANCELLED) */
+    DecoderCancelled *cancelled;
+    gpointer user_data;
+    /* region of scaled image to decode (whole image if width is 0),
+     * supported only by vector backends */
+    gint x, y, width, height;
+    /* scale is lowered so that image fits into this size (if set) */
+    gint fit_width, fit_height;
+};
+
+struct _DecoderInfo {
+    /* original size */
+    gint width, height;
+    /* size of decoded image */
+    gint out_width, out_height;
+    gboolean has_alpha;
+    /* backend specific scaling (e.g. JPEG scale denominator) */
+    gint scale;
+};
+
+/*
+ * Decoder backend.
+ *
+ * Decoders read image from memory and write pixels into buffer
+ * provided by caller (out_width*out_height pixels from get_info()).
+ */
+struct _Decoder {
+    const gchar *name;
+    /* returns TRUE if data looks like format supported by backend */
+    gboolean (*probe)(const guchar *data, gsize size);
+    gboolean (*get_info)(
+            const guchar *data,
+            gsize size,
+            const DecoderRequest *request,
+            DecoderInfo *info,
+            GError **error );
+    gboolean (*decode)(
+            const guchar *data,
+            gsize size,
+            const DecoderRequest *request,
+            const DecoderInfo *info,
+            guchar *pixels,
+            gint rowstride,
+            GError **error );
+    /* used instead of get_info() and decode() by backends which
+     * cannot decode into caller's buffer */
+    Image *(*load)(
+            const guchar *data,
+            gsize size,
+            const DecoderRequest *request,
+            GError **error );
+};
+
+#define DECODER_ERROR decoder_error_quark()
+GQuark decoder_error_quark(void);
+
+enum {
+    DECODER_ERROR_FAILED,
+    DECODER_ERROR_UNSUPPORTED,
+    DECODER_ERROR_CANCELLED,
+    DECODER_ERROR_NO_MEMORY
+};
+
+/* NULL terminated list of native backends */
+const Decoder * const *decoder_get_backends(void);
+/* GdkPixbuf backend used for formats without native backend */
+const Decoder *decoder_get_fallback(void);
+
+/* returns native backend for data or fallback */
+const Decoder *decoder_find(const guchar *data, gsize size);
+
+/* returns TRUE (and sets DECODER_ERROR_CANCELLED) if request is cancelled */
+gboolean decoder_is_cancelled(const DecoderRequest *request, GError **error);
+/* returns requested scale lowered so that image fits into requested size */
+gdouble decoder_fit_scale(const DecoderRequest *request, gint width, gint height);
+
+/* decodes data with given backend */
+Image *decoder_decode_with(
+        const Decoder *decoder,
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error );
+
+/* decodes data with native backend (falls back to GdkPixbuf on failure) */
+Image *decoder_decode(
+        const guchar *data,
+        gsize size,
+        const DecoderRequest *request,
+        GError **error );
+
+Image *image_new(gint width, gint height, gboolean has_alpha);
+Image *image_new_from_pixbuf(GdkPixbuf *pixbuf);
+void image_free(Image *image);
+
+/*
+ * Returns image rotated and flipped according to EXIF orientation
+ * (1 to 8); original image is freed.
+ */
+Image *image_apply_orientation(Image *image, gint orientation);
+
+/*
+ * Returns image scaled down to given scale of original size; original
+ * image is freed. Image is returned as it is if it's not bigger.
+ */
+Image *image_scale_down(Image *image, gdouble scale);
+/* returns new image scaled down like image_scale_down() or NULL if it's not bigger */
+Image *image_new_scaled(const Image *image, gdouble scale);
+
+#endif /* DECODER_H */
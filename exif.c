@@ -0,0 +1,347 @@
+#include <string.h>
+#include "exif.h"
+
+/* limits for corrupted or malicious files */
+#define EXIF_MAX_IFDS 16
+#define EXIF_MAX_DEPTH 4
+#define EXIF_MAX_SUB_IFDS 8
+
+#define TAG_COMPRESSION 0x0103
+#define TAG_STRIP_OFFSETS 0x0111
+#define TAG_ORIENTATION 0x0112
+#define TAG_DATE_TIME 0x0132
+#define TAG_STRIP_BYTE_COUNTS 0x0117
+#define TAG_SUB_IFDS 0x014a
+#define TAG_JPEG_OFFSET 0x0201
+#define TAG_JPEG_LENGTH 0x0202
+#define TAG_EXIF_IFD 0x8769
+#define TAG_DATE_TIME_ORIGINAL 0x9003
+
+#define TYPE_ASCII 2
+#define TYPE_SHORT 3
+
+/* "YYYY:MM:DD hh:mm:ss" */
+#define DATE_TIME_LENGTH 19
+
+typedef struct _Tiff Tiff;
+
+/* TIFF structure (offsets are relative to TIFF header) */
+struct _Tiff {
+    const guchar *data;
+    gsize size;
+    /* offset of TIFF header in file */
+    gsize base;
+    /* size of file */
+    gsize file_size;
+    gboolean big_endian;
+    guint ifds;
+};
+
+static guint
+read_u16_be(const guchar *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static guint
+tiff_u16(const Tiff *tiff, gsize offset)
+{
+    const guchar *p = tiff->data + offset;
+    return tiff->big_endian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static guint32
+tiff_u32(const Tiff *tiff, gsize offset)
+{
+    const guchar *p = tiff->data + offset;
+    return tiff->big_endian
+        ? ((guint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+        : p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+/* value of SHORT or LONG entry */
+static guint32
+tiff_entry_value(const Tiff *tiff, gsize entry)
+{
+    return tiff_u16(tiff, entry + 2) == TYPE_SHORT
+        ? tiff_u16(tiff, entry + 8) : tiff_u32(tiff, entry + 8);
+}
+
+/* reads date and time as number YYYYMMDDhhmmss (0 if invalid) */
+static gint64
+tiff_entry_datetime(const Tiff *tiff, gsize entry)
+{
+    const guchar *p;
+    guint32 offset;
+    gint64 datetime = 0;
+    gint i;
+
+    offset = tiff_u32(tiff, entry + 8);
+    if ( tiff_u16(tiff, entry + 2) != TYPE_ASCII ||
+         tiff_u32(tiff, entry + 4) < DATE_TIME_LENGTH ||
+         (gsize)offset + DATE_TIME_LENGTH > tiff->size )
+        return 0;
+
+    p = tiff->data + offset;
+    for (i = 0; i < DATE_TIME_LENGTH; ++i) {
+        /* separators */
+        if (i == 4 || i == 7 || i == 10 || i == 13 || i == 16)
+            continue;
+        if ( !g_ascii_isdigit(p[i]) )
+            return 0;
+        datetime = datetime * 10 + (p[i] - '0');
+    }
+
+    return datetime;
+}
+
+static gboolean
+tiff_init(Tiff *tiff, const guchar *data, gsize size, gsize base, gsize file_size)
+{
+    if (size < 8)
+        return FALSE;
+
+    if ( memcmp(data, "II*\0", 4) == 0 )
+        tiff->big_endian = FALSE;
+    else if ( memcmp(data, "MM\0*", 4) == 0 )
+        tiff->big_endian = TRUE;
+    else
+        return FALSE;
+
+    tiff->data = data;
+    tiff->size = size;
+    tiff->base = base;
+    tiff->file_size = file_size;
+    tiff->ifds = 0;
+
+    return TRUE;
+}
+
+gboolean
+exif_jpeg_get_size(const guchar *data, gsize size, gint *width, gint *height)
+{
+    gsize pos = 2;
+    guint marker;
+
+    if ( size < 4 || data[0] != 0xff || data[1] != 0xd8 )
+        return FALSE;
+
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xff)
+            return FALSE;
+        marker = data[pos + 1];
+        if (marker == 0xff) {
+            /* fill byte */
+            ++pos;
+            continue;
+        }
+
+        if (marker == 0xc0 || marker == 0xc1 || marker == 0xc2) {
+            if (pos + 9 > size)
+                return FALSE;
+            *height = read_u16_be(data + pos + 5);
+            *width = read_u16_be(data + pos + 7);
+            return *width > 0 && *height > 0;
+        }
+
+        /* other SOF markers (lossless, arithmetic) are not supported */
+        if ( (marker >= 0xc3 && marker <= 0xcf &&
+              marker != 0xc4 && marker != 0xc8 && marker != 0xcc) ||
+             marker == 0xda )
+            return FALSE;
+
+        pos += 2 + read_u16_be(data + pos + 2);
+    }
+
+    return FALSE;
+}
+
+/* keeps largest decodable JPEG preview */
+static void
+exif_add_preview(const Tiff *tiff, guint32 offset, guint32 length, ExifInfo *info)
+{
+    const guchar *data;
+    gsize start;
+    gint width, height;
+
+    start = tiff->base + offset;
+    if (length == 0)
+        return;
+    /* preview can be read later */
+    if ( start >= tiff->file_size || length > tiff->file_size - start ) {
+        if (length > info->missing_size) {
+            info->missing_offset = start;
+            info->missing_size = length;
+        }
+        return;
+    }
+
+    data = tiff->data - tiff->base + start;
+    if ( !exif_jpeg_get_size(data, length, &width, &height) )
+        return;
+
+    if ( (gint64)width*height > (gint64)info->preview_width*info->preview_height ) {
+        info->preview_offset = start;
+        info->preview_size = length;
+        info->preview_width = width;
+        info->preview_height = height;
+    }
+}
+
+static void tiff_read_ifd(Tiff *tiff, guint32 offset, gint depth, gboolean first, ExifInfo *info);
+
+static void
+tiff_read_sub_ifds(Tiff *tiff, gsize entry, gint depth, ExifInfo *info)
+{
+    guint32 count, offset, i;
+
+    count = MIN( tiff_u32(tiff, entry + 4), EXIF_MAX_SUB_IFDS );
+    if (count == 1) {
+        tiff_read_ifd( tiff, tiff_u32(tiff, entry + 8), depth + 1, FALSE, info );
+        return;
+    }
+
+    offset = tiff_u32(tiff, entry + 8);
+    for (i = 0; i < count && (gsize)offset + 4*(i + 1) <= tiff->size; ++i)
+        tiff_read_ifd( tiff, tiff_u32(tiff, offset + 4*i), depth + 1, FALSE, info );
+}
+
+static void
+tiff_read_ifd(Tiff *tiff, guint32 offset, gint depth, gboolean first, ExifInfo *info)
+{
+    guint32 strip_offset = 0, strip_length = 0, jpeg_offset = 0, jpeg_length = 0;
+    guint n, i, tag, compression = 0;
+    gint64 datetime = 0;
+    gsize entry;
+
+    if ( depth > EXIF_MAX_DEPTH || ++tiff->ifds > EXIF_MAX_IFDS ||
+         offset < 8 || (gsize)offset + 2 > tiff->size )
+        return;
+
+    n = tiff_u16(tiff, offset);
+    n = MIN( n, (tiff->size - offset - 2) / 12 );
+
+    for (i = 0; i < n; ++i) {
+        entry = offset + 2 + i*12;
+        tag = tiff_u16(tiff, entry);
+        switch (tag) {
+        case TAG_ORIENTATION:
+            if (first && depth == 0)
+                info->orientation = tiff_u16(tiff, entry + 8);
+            break;
+        case TAG_COMPRESSION:
+            compression = tiff_u16(tiff, entry + 8);
+            break;
+        case TAG_STRIP_OFFSETS:
+            if ( tiff_u32(tiff, entry + 4) == 1 )
+                strip_offset = tiff_entry_value(tiff, entry);
+            break;
+        case TAG_STRIP_BYTE_COUNTS:
+            if ( tiff_u32(tiff, entry + 4) == 1 )
+                strip_length = tiff_entry_value(tiff, entry);
+            break;
+        case TAG_JPEG_OFFSET:
+            jpeg_offset = tiff_u32(tiff, entry + 8);
+            break;
+        case TAG_JPEG_LENGTH:
+            jpeg_length = tiff_u32(tiff, entry + 8);
+            break;
+        case TAG_SUB_IFDS:
+            tiff_read_sub_ifds(tiff, entry, depth, info);
+            break;
+        case TAG_DATE_TIME:
+            /* modification time is used only if capture time is missing */
+            if (first && depth == 0 && info->datetime == 0)
+                info->datetime = tiff_entry_datetime(tiff, entry);
+            break;
+        case TAG_EXIF_IFD:
+            if (first && depth == 0)
+                tiff_read_ifd( tiff, tiff_u32(tiff, entry + 8), depth + 1, TRUE, info );
+            break;
+        case TAG_DATE_TIME_ORIGINAL:
+            if (first && depth == 1)
+                datetime = tiff_entry_datetime(tiff, entry);
+            if (datetime)
+                info->datetime = datetime;
+            break;
+        }
+    }
+
+    if (jpeg_offset)
+        exif_add_preview(tiff, jpeg_offset, jpeg_length, info);
+    /* old-style (6) and new-style (7) JPEG compression stored in single strip */
+    if ( strip_offset && (compression == 6 || compression == 7) )
+        exif_add_preview(tiff, strip_offset, strip_length, info);
+
+    /* next IFD (e.g. IFD1 with EXIF thumbnail) */
+    entry = offset + 2 + n*12;
+    if (depth == 0 && entry + 4 <= tiff->size)
+        tiff_read_ifd( tiff, tiff_u32(tiff, entry), depth, FALSE, info );
+}
+
+/* reads APP1 EXIF segment and size of JPEG image */
+static gboolean
+exif_read_jpeg(const guchar *data, gsize size, ExifInfo *info)
+{
+    Tiff tiff;
+    gsize pos = 2, length;
+    guint marker;
+    gboolean exif = FALSE;
+
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xff)
+            break;
+        marker = data[pos + 1];
+        if (marker == 0xff) {
+            ++pos;
+            continue;
+        }
+        if (marker == 0xda)
+            break;
+
+        length = read_u16_be(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size)
+            break;
+
+        if ( !exif && marker == 0xe1 && length >= 16 &&
+             memcmp(data + pos + 4, "Exif\0\0", 6) == 0 &&
+             tiff_init(&tiff, data + pos + 10, length - 8, pos + 10, size) )
+        {
+            exif = TRUE;
+            tiff_read_ifd( &tiff, tiff_u32(&tiff, 4), 0, TRUE, info );
+        }
+
+        if (marker >= 0xc0 && marker <= 0xcf &&
+            marker != 0xc4 && marker != 0xc8 && marker != 0xcc)
+        {
+            exif_jpeg_get_size(data, size, &info->width, &info->height);
+            break;
+        }
+
+        pos += 2 + length;
+    }
+
+    return TRUE;
+}
+
+gboolean
+exif_read(const guchar *data, gsize size, ExifInfo *info)
+{
+    Tiff tiff;
+
+    memset( info, 0, sizeof(*info) );
+    info->orientation = 1;
+
+    if ( size >= 4 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff ) {
+        exif_read_jpeg(data, size, info);
+    } else if ( tiff_init(&tiff, data, size, 0, size) ) {
+        tiff_read_ifd( &tiff, tiff_u32(&tiff, 4), 0, TRUE, info );
+    } else {
+        return FALSE;
+    }
+
+    if (info->orientation < 1 || info->orientation > 8)
+        info->orientation = 1;
+
+    return TRUE;
+}
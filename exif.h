@@ -0,0 +1,32 @@
+#ifndef EXIF_H
+#define EXIF_H
+
+#include <glib.h>
+
+typedef struct _ExifInfo ExifInfo;
+
+struct _ExifInfo {
+    /* EXIF orientation (1 to 8, 1 is normal) */
+    gint orientation;
+    /* size of main image (known only for JPEG) */
+    gint width, height;
+    /* largest embedded JPEG preview (EXIF thumbnail or RAW preview) */
+    gsize preview_offset, preview_size;
+    gint preview_width, preview_height;
+    /* largest preview which is beyond data (if only start of file is read) */
+    gsize missing_offset, missing_size;
+    /* capture time as number YYYYMMDDhhmmss (0 if unknown) */
+    gint64 datetime;
+};
+
+/*
+ * Reads EXIF data of JPEG or TIFF based (e.g. CR2, NEF, ARW, DNG) image
+ * in memory. Only headers and image file directories are accessed.
+ * Returns FALSE if data are not JPEG nor TIFF.
+ */
+gboolean exif_read(const guchar *data, gsize size, ExifInfo *info);
+
+/* reads size of baseline or progressive JPEG image */
+gboolean exif_jpeg_get_size(const guchar *data, gsize size, gint *width, gint *height);
+
+#endif /* EXIF_H */
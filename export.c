@@ -0,0 +1,374 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <pango/pangocairo.h>
+#include "export.h"
+#include "decoder.h"
+#include "exif.h"
+#include "pages.h"
+
+/* offset of label shadow (shadow is not blurred) */
+#define EXPORT_SHADOW_OFFSET 2
+
+typedef struct _ExportJob ExportJob;
+
+struct _ExportJob {
+    const PathStore *items;
+    const ExportOptions *options;
+    guint pages;
+    gint cell_width, cell_height;
+
+    /* counters (atomic) */
+    gint images;
+    gint failed_images;
+    gint failed_sheets;
+};
+
+/* scale of image with EXIF orientation to fit into cell */
+static gdouble
+export_fit(gint width, gint height, gint orientation, const ExportJob *job)
+{
+    gint tmp;
+
+    if (width <= 0 || height <= 0)
+        return 1.0;
+
+    /* orientations 5 to 8 swap width and height */
+    if (orientation >= 5) {
+        tmp = width;
+        width = height;
+        height = tmp;
+    }
+
+    return MIN( 1.0, MIN( (gdouble)job->cell_width / width,
+                          (gdouble)job->cell_height / height ) );
+}
+
+/* decodes image (or its embedded preview) for cell */
+static Image *
+export_decode(const ExportJob *job, const gchar *path, GError **error)
+{
+    DecoderRequest request = {1.0, NULL, NULL};
+    const Decoder *decoder;
+    DecoderInfo info;
+    GMappedFile *file;
+    const guchar *data;
+    gsize size;
+    ExifInfo exif;
+    Image *image = NULL;
+    gchar *document;
+    gint page;
+
+    /* page of document is rendered to fit cell */
+    document = pages_parse(path, &page);
+    if (document) {
+        request.fit_width = job->cell_width;
+        request.fit_height = job->cell_height;
+        image = pages_render(document, page, &request, error);
+        g_free(document);
+        if (!image)
+            return NULL;
+        return image_scale_down( image,
+                export_fit(image->original_width, image->original_height, 1, job) );
+    }
+
+    file = g_mapped_file_new(path, FALSE, error);
+    if (!file)
+        return NULL;
+    data = (const guchar*)g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+
+    exif_read(data, size, &exif);
+
+    /* preview is enough if it's not smaller than cell (RAW images have only preview) */
+    if ( exif.preview_size > 0 && ( exif.width == 0 || exif.preview_width >=
+         exif.width * export_fit(exif.width, exif.height, exif.orientation, job) ) )
+    {
+        request.scale = export_fit( exif.preview_width, exif.preview_height,
+                exif.orientation, job );
+        image = decoder_decode( data + exif.preview_offset, exif.preview_size,
+                &request, NULL );
+    }
+
+    if (!image) {
+        request.scale = 1.0;
+        decoder = decoder_find(data, size);
+        if ( decoder->get_info && decoder->get_info(data, size, &request, &info, NULL) )
+            request.scale = export_fit(info.width, info.height, exif.orientation, job);
+        image = decoder_decode(data, size, &request, error);
+    }
+
+    g_mapped_file_unref(file);
+
+    if (!image) {
+        if (!*error) {
+            g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                    "Failed to load image '%s'", path);
+        }
+        return NULL;
+    }
+
+    /* decoders can return bigger image than requested */
+    image = image_apply_orientation(image, exif.orientation);
+    return image_scale_down( image,
+            export_fit(image->original_width, image->original_height, 1, job) );
+}
+
+static void
+export_set_color(cairo_t *cr, const ClutterColor *color)
+{
+    cairo_set_source_rgba( cr, color->red / 255.0, color->green / 255.0,
+            color->blue / 255.0, color->alpha / 255.0 );
+}
+
+/* returns image in premultiplied ARGB surface */
+static cairo_surface_t *
+export_image_surface(const Image *image)
+{
+    cairo_surface_t *surface;
+    const guchar *src;
+    guint32 *dst;
+    guchar *data;
+    gint x, y, stride, channels, a;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, image->width, image->height);
+    if ( cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ) {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_surface_flush(surface);
+    data = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+    channels = image->has_alpha ? 4 : 3;
+    for (y = 0; y < image->height; ++y) {
+        src = image->pixels + y * image->rowstride;
+        dst = (guint32*)(data + y * stride);
+        for (x = 0; x < image->width; ++x, src += channels) {
+            a = image->has_alpha ? src[3] : 0xff;
+            dst[x] = ((guint32)a << 24) |
+                ((guint32)(src[0] * a / 0xff) << 16) |
+                ((guint32)(src[1] * a / 0xff) << 8) |
+                (guint32)(src[2] * a / 0xff);
+        }
+    }
+    cairo_surface_mark_dirty(surface);
+
+    return surface;
+}
+
+static void
+export_draw_image(cairo_t *cr, const Image *image, gint x, gint y)
+{
+    cairo_surface_t *surface;
+
+    surface = export_image_surface(image);
+    if (!surface)
+        return;
+    cairo_set_source_surface(cr, surface, x, y);
+    cairo_paint(cr);
+    cairo_surface_destroy(surface);
+}
+
+static void
+export_draw_label(cairo_t *cr, PangoLayout *layout, const gchar *text,
+        gint x, gint y, const ClutterColor *color, const ClutterColor *shadow_color)
+{
+    pango_layout_set_text(layout, text, -1);
+
+    export_set_color(cr, shadow_color);
+    cairo_move_to(cr, x + EXPORT_SHADOW_OFFSET, y + EXPORT_SHADOW_OFFSET);
+    pango_cairo_show_layout(cr, layout);
+
+    export_set_color(cr, color);
+    cairo_move_to(cr, x, y);
+    pango_cairo_show_layout(cr, layout);
+}
+
+/* saves sheet as PNG or JPEG (GdkPixbuf needs unpremultiplied RGB) */
+static gboolean
+export_save(cairo_surface_t *surface, const gchar *filename, const gchar *format, GError **error)
+{
+    GdkPixbuf *pixbuf;
+    const guchar *data;
+    const guint32 *src;
+    guchar *dst;
+    gint x, y, width, height, stride, rowstride, a;
+    gboolean ok;
+
+    if ( strcmp(format, "png") == 0 ) {
+        if ( cairo_surface_write_to_png(surface, filename) == CAIRO_STATUS_SUCCESS )
+            return TRUE;
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                "Failed to save '%s'", filename);
+        return FALSE;
+    }
+
+    width = cairo_image_surface_get_width(surface);
+    height = cairo_image_surface_get_height(surface);
+    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+    if (!pixbuf) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOMEM,
+                "Not enough memory for '%s'", filename);
+        return FALSE;
+    }
+
+    cairo_surface_flush(surface);
+    data = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+    rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    for (y = 0; y < height; ++y) {
+        src = (const guint32*)(data + y * stride);
+        dst = gdk_pixbuf_get_pixels(pixbuf) + y * rowstride;
+        for (x = 0; x < width; ++x, dst += 3) {
+            a = src[x] >> 24;
+            if (a == 0) {
+                dst[0] = dst[1] = dst[2] = 0;
+                continue;
+            }
+            dst[0] = ((src[x] >> 16) & 0xff) * 0xff / a;
+            dst[1] = ((src[x] >> 8) & 0xff) * 0xff / a;
+            dst[2] = (src[x] & 0xff) * 0xff / a;
+        }
+    }
+
+    ok = gdk_pixbuf_save(pixbuf, filename, "jpeg", error, "quality", "90", NULL);
+    g_object_unref(pixbuf);
+
+    return ok;
+}
+
+/* renders and saves one sheet (called from thread pool) */
+static void
+export_page(gpointer data, ExportJob *job)
+{
+    const ExportOptions *options = job->options;
+    guint page = GPOINTER_TO_UINT(data) - 1;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    PangoLayout *layout;
+    PangoFontDescription *font;
+    GError *error = NULL;
+    Image *image;
+    gchar *path, *name, *filename;
+    guint first, count, i;
+    gint x, y;
+    gboolean ok;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, options->width, options->height);
+    cr = cairo_create(surface);
+    export_set_color(cr, &options->background_color);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+    /* labels are ellipsized in the middle to width of cell */
+    layout = pango_cairo_create_layout(cr);
+    font = pango_font_description_from_string(options->font);
+    pango_layout_set_font_description(layout, font);
+    pango_font_description_free(font);
+    pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_MIDDLE);
+    pango_layout_set_width(layout, job->cell_width * PANGO_SCALE);
+
+    first = page * options->rows * options->columns;
+    count = MIN( options->rows * options->columns,
+            path_store_get_count(job->items) - first );
+    for (i = 0; i < count; ++i) {
+        x = (i % options->columns) * (job->cell_width + options->spacing);
+        y = (i / options->columns) * (job->cell_height + options->spacing);
+        path = path_store_get(job->items, first + i);
+
+        image = export_decode(job, path, &error);
+        ok = image != NULL;
+        if (image) {
+            export_draw_image( cr, image,
+                    x + (job->cell_width - image->width) / 2,
+                    y + (job->cell_height - image->height) / 2 );
+            image_free(image);
+            g_atomic_int_inc(&job->images);
+        } else {
+            g_printerr("imagepeek: %s\n", error->message);
+            g_clear_error(&error);
+            g_atomic_int_inc(&job->failed_images);
+        }
+
+        cairo_save(cr);
+        cairo_rectangle(cr, x, y, job->cell_width, job->cell_height);
+        cairo_clip(cr);
+        export_draw_label( cr, layout, path, x, y,
+                ok ? &options->text_color : &options->error_color,
+                &options->text_shadow_color );
+        cairo_restore(cr);
+
+        g_free(path);
+    }
+
+    g_object_unref(layout);
+    cairo_destroy(cr);
+
+    name = g_strdup_printf( "sheet-%05u.%s", page + 1,
+            strcmp(options->format, "png") == 0 ? "png" : "jpg" );
+    filename = g_build_filename(options->directory, name, NULL);
+    if ( !export_save(surface, filename, options->format, &error) ) {
+        g_printerr("imagepeek: Cannot save sheet! (%s)\n", error->message);
+        g_error_free(error);
+        g_atomic_int_inc(&job->failed_sheets);
+    }
+    g_free(filename);
+    g_free(name);
+    cairo_surface_destroy(surface);
+}
+
+gboolean
+export_sheets(const PathStore *items, const ExportOptions *options)
+{
+    ExportJob job;
+    GThreadPool *pool;
+    guint items_on_page, page;
+    gint64 start;
+    gdouble seconds;
+
+    if ( strcmp(options->format, "png") != 0 && strcmp(options->format, "jpeg") != 0 ) {
+        g_printerr("imagepeek: Unknown sheet format '%s' (use png or jpeg)!\n", options->format);
+        return FALSE;
+    }
+
+    job.items = items;
+    job.options = options;
+    job.cell_width = ( options->width - ((gint)options->columns - 1) * options->spacing )
+        / (gint)options->columns;
+    job.cell_height = ( options->height - ((gint)options->rows - 1) * options->spacing )
+        / (gint)options->rows;
+    if (job.cell_width <= 0 || job.cell_height <= 0) {
+        g_printerr("imagepeek: Sheet is too small for %ux%u grid!\n",
+                options->columns, options->rows);
+        return FALSE;
+    }
+    items_on_page = options->rows * options->columns;
+    job.pages = (path_store_get_count(items) + items_on_page - 1) / items_on_page;
+    job.images = 0;
+    job.failed_images = 0;
+    job.failed_sheets = 0;
+
+    if ( g_mkdir_with_parents(options->directory, 0755) != 0 ) {
+        g_printerr("imagepeek: Cannot create directory '%s'!\n", options->directory);
+        return FALSE;
+    }
+
+    start = g_get_monotonic_time();
+
+    /* each thread renders whole sheet */
+    pool = g_thread_pool_new( (GFunc)export_page, &job,
+            MAX(1, options->threads), TRUE, NULL );
+    for (page = 0; page < job.pages; ++page)
+        g_thread_pool_push( pool, GUINT_TO_POINTER(page + 1), NULL );
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    seconds = MAX( 1e-6, (g_get_monotonic_time() - start) / 1e6 );
+    g_printerr("imagepeek: Exported %u sheets with %d images in %.1f s "
+            "(%.1f sheets/s, %.1f images/s, %d failed images).\n",
+            job.pages - job.failed_sheets, job.images, seconds,
+            job.pages / seconds, (job.images + job.failed_images) / seconds,
+            job.failed_images);
+
+    return job.failed_sheets == 0;
+}
@@ -0,0 +1,41 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <clutter/clutter.h>
+#include "pathstore.h"
+
+typedef struct _ExportOptions ExportOptions;
+
+struct _ExportOptions {
+    /* output directory (sheet-00001.jpg, ...) */
+    const gchar *directory;
+    /* "png" or "jpeg" */
+    const gchar *format;
+    /* size of sheet in pixels */
+    gint width, height;
+    /* grid of each sheet */
+    guint rows, columns;
+    gint spacing;
+    /* labels */
+    const gchar *font;
+    ClutterColor background_color;
+    ClutterColor text_color;
+    ClutterColor text_shadow_color;
+    ClutterColor error_color;
+    /* number of sheets rendered in parallel */
+    guint threads;
+};
+
+/*
+ * Renders pages of items (rows x columns grid) into image files without
+ * window or GL.
+ *
+ * Images are decoded only in resolution needed for their cell (embedded
+ * previews are used if they're big enough) and drawn centered in cells
+ * with labels on top as in grid mode. Sheets are rendered in parallel.
+ *
+ * Prints throughput when done. Returns FALSE if any sheet was not saved.
+ */
+gboolean export_sheets(const PathStore *items, const ExportOptions *options);
+
+#endif /* EXPORT_H */
@@ -0,0 +1,297 @@
+#include <string.h>
+#include "filter.h"
+
+/* paths matched by one task */
+#define FILTER_CHUNK 32768
+/* check for cancellation after this many paths (power of two) */
+#define FILTER_CHECK 4096
+
+typedef enum _FilterType FilterType;
+typedef struct _FilterSearch FilterSearch;
+typedef struct _FilterChunk FilterChunk;
+
+enum _FilterType {
+    FilterSubstring,
+    FilterSubstringNoCase,
+    FilterGlob,
+    FilterRegex
+};
+
+struct _FilterChunk {
+    FilterSearch *search;
+    guint start, end;
+    GArray *indices;
+};
+
+struct _FilterSearch {
+    Filter *filter;
+    guint id;
+    const PathStore *store;
+
+    FilterType type;
+    gchar *text;
+    GPatternSpec *pattern;
+    GRegex *regex;
+
+    FilterChunk *chunks;
+    guint chunk_count;
+    /* unfinished chunks (atomic) */
+    gint remaining;
+};
+
+struct _Filter {
+    FilterCallback *callback;
+    gpointer user_data;
+    GThreadPool *pool;
+
+    /* id of current search, other searches are cancelled (atomic) */
+    gint current;
+    guint last_id;
+
+    /* number of unfinished searches */
+    GMutex lock;
+    GCond idle;
+    guint running;
+};
+
+static gboolean
+filter_search_is_cancelled(const FilterSearch *search)
+{
+    return (guint)g_atomic_int_get(&search->filter->current) != search->id;
+}
+
+static gboolean
+filter_search_match(const FilterSearch *search, GString *path)
+{
+    gsize i;
+
+    switch (search->type) {
+    case FilterSubstringNoCase:
+        for (i = 0; i < path->len; ++i)
+            path->str[i] = g_ascii_tolower(path->str[i]);
+        /* fall through */
+    case FilterSubstring:
+        return strstr(path->str, search->text) != NULL;
+    case FilterGlob:
+        return g_pattern_match(search->pattern, path->len, path->str, NULL);
+    case FilterRegex:
+        return g_regex_match(search->regex, path->str, 0, NULL);
+    }
+
+    return FALSE;
+}
+
+static void
+filter_search_free(FilterSearch *search)
+{
+    guint i;
+
+    for (i = 0; i < search->chunk_count; ++i) {
+        if (search->chunks[i].indices)
+            g_array_free(search->chunks[i].indices, TRUE);
+    }
+    g_free(search->chunks);
+    g_free(search->text);
+    if (search->pattern)
+        g_pattern_spec_free(search->pattern);
+    if (search->regex)
+        g_regex_unref(search->regex);
+    g_free(search);
+}
+
+/* joins chunk results in order */
+static void
+filter_search_finish(FilterSearch *search)
+{
+    Filter *filter = search->filter;
+    FilterResult *result;
+    GArray *indices;
+    guint i, count = 0;
+
+    if ( !filter_search_is_cancelled(search) ) {
+        for (i = 0; i < search->chunk_count; ++i)
+            count += search->chunks[i].indices->len;
+
+        result = g_new(FilterResult, 1);
+        result->id = search->id;
+        result->count = 0;
+        result->indices = g_new(guint32, MAX(count, 1));
+        result->user_data = filter->user_data;
+        for (i = 0; i < search->chunk_count; ++i) {
+            indices = search->chunks[i].indices;
+            memcpy( result->indices + result->count, indices->data,
+                    indices->len * sizeof(guint32) );
+            result->count += indices->len;
+        }
+
+        filter->callback(result, filter->user_data);
+    }
+
+    filter_search_free(search);
+
+    g_mutex_lock(&filter->lock);
+    if (--filter->running == 0)
+        g_cond_broadcast(&filter->idle);
+    g_mutex_unlock(&filter->lock);
+}
+
+static void
+filter_run_chunk(FilterChunk *chunk, Filter *filter)
+{
+    FilterSearch *search = chunk->search;
+    GString *path;
+    guint32 i;
+
+    chunk->indices = g_array_new( FALSE, FALSE, sizeof(guint32) );
+    path = g_string_sized_new(256);
+
+    for (i = chunk->start; i < chunk->end; ++i) {
+        if ( (i & (FILTER_CHECK - 1)) == 0 && filter_search_is_cancelled(search) )
+            break;
+        g_string_truncate(path, 0);
+        path_store_append(search->store, i, path);
+        if ( filter_search_match(search, path) )
+            g_array_append_val(chunk->indices, i);
+    }
+
+    g_string_free(path, TRUE);
+
+    if ( g_atomic_int_dec_and_test(&search->remaining) )
+        filter_search_finish(search);
+}
+
+static gboolean
+filter_search_parse(FilterSearch *search, const gchar *query, GError **error)
+{
+    const gchar *p;
+
+    if ( g_str_has_prefix(query, "re:") ) {
+        search->type = FilterRegex;
+        search->regex = g_regex_new(query + 3, G_REGEX_OPTIMIZE, 0, error);
+        return search->regex != NULL;
+    }
+
+    if ( strpbrk(query, "*?[") ) {
+        search->type = FilterGlob;
+        search->pattern = g_pattern_spec_new(query);
+        return TRUE;
+    }
+
+    /* smart case */
+    search->type = FilterSubstringNoCase;
+    for (p = query; *p; ++p) {
+        if ( g_ascii_isupper(*p) ) {
+            search->type = FilterSubstring;
+            break;
+        }
+    }
+    search->text = g_strdup(query);
+    return TRUE;
+}
+
+Filter *
+filter_new(FilterCallback *callback, gpointer user_data)
+{
+    Filter *filter;
+
+    filter = g_new0(Filter, 1);
+    filter->callback = callback;
+    filter->user_data = user_data;
+    filter->pool = g_thread_pool_new( (GFunc)filter_run_chunk, filter,
+            g_get_num_processors(), FALSE, NULL );
+    g_mutex_init(&filter->lock);
+    g_cond_init(&filter->idle);
+
+    return filter;
+}
+
+void
+filter_free(Filter *filter)
+{
+    filter_cancel(filter);
+    g_thread_pool_free(filter->pool, TRUE, TRUE);
+    g_mutex_clear(&filter->lock);
+    g_cond_clear(&filter->idle);
+    g_free(filter);
+}
+
+guint
+filter_start(Filter *filter, const PathStore *store, const gchar *query, GError **error)
+{
+    FilterSearch *search;
+    FilterChunk *chunks, *chunk;
+    guint id, i, count, chunk_count;
+
+    search = g_new0(FilterSearch, 1);
+    if ( !filter_search_parse(search, query, error) ) {
+        filter_search_free(search);
+        return 0;
+    }
+
+    /* id 0 is reserved for cancelled state */
+    if (++filter->last_id == 0)
+        ++filter->last_id;
+    search->id = filter->last_id;
+    search->filter = filter;
+    search->store = store;
+
+    count = path_store_get_count(store);
+    search->chunk_count = MAX( 1, (count + FILTER_CHUNK - 1) / FILTER_CHUNK );
+    search->chunks = g_new0(FilterChunk, search->chunk_count);
+    search->remaining = search->chunk_count;
+    for (i = 0; i < search->chunk_count; ++i) {
+        chunk = &search->chunks[i];
+        chunk->search = search;
+        chunk->start = i * FILTER_CHUNK;
+        chunk->end = MIN(count, chunk->start + FILTER_CHUNK);
+    }
+
+    g_atomic_int_set(&filter->current, search->id);
+
+    g_mutex_lock(&filter->lock);
+    ++filter->running;
+    g_mutex_unlock(&filter->lock);
+
+    /* search is freed when its last chunk is finished */
+    id = search->id;
+    chunks = search->chunks;
+    chunk_count = search->chunk_count;
+    for (i = 0; i < chunk_count; ++i)
+        g_thread_pool_push(filter->pool, &chunks[i], NULL);
+
+    return id;
+}
+
+void
+filter_cancel(Filter *filter)
+{
+    g_atomic_int_set(&filter->current, 0);
+
+    g_mutex_lock(&filter->lock);
+    while (filter->running > 0)
+        g_cond_wait(&filter->idle, &filter->lock);
+    g_mutex_unlock(&filter->lock);
+}
+
+guint
+filter_result_find(const FilterResult *result, guint32 index)
+{
+    guint low = 0, high = result->count, middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (result->indices[middle] < index)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+void
+filter_result_free(FilterResult *result)
+{
+    g_free(result->indices);
+    g_free(result);
+}
@@ -0,0 +1,48 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <glib.h>
+#include "pathstore.h"
+
+typedef struct _Filter Filter;
+typedef struct _FilterResult FilterResult;
+
+struct _FilterResult {
+    /* id returned by filter_start() */
+    guint id;
+    /* indices of matching paths in ascending order */
+    guint32 *indices;
+    guint count;
+    gpointer user_data;
+};
+
+typedef void FilterCallback(FilterResult *result, gpointer user_data);
+
+/*
+ * Matches paths in PathStore against query in multiple threads.
+ *
+ * Query is a regular expression if prefixed with "re:", a glob pattern
+ * (matched against whole path) if it contains '*', '?' or '[', otherwise
+ * a substring (case insensitive if query has no upper case letters).
+ *
+ * Callback is called from worker thread with result owned by caller
+ * (unless search is cancelled).
+ */
+Filter *filter_new(FilterCallback *callback, gpointer user_data);
+/* cancels search */
+void filter_free(Filter *filter);
+
+/*
+ * Starts new search and cancels the previous one. Store must not change
+ * until callback is called or filter_cancel() returns.
+ * Returns search id or 0 on error (invalid query).
+ */
+guint filter_start(Filter *filter, const PathStore *store, const gchar *query, GError **error);
+/* cancels search and waits for worker threads */
+void filter_cancel(Filter *filter);
+
+/* returns position of first index not less than index */
+guint filter_result_find(const FilterResult *result, guint32 index);
+void filter_result_free(FilterResult *result);
+
+#endif /* FILTER_H */
@@ -0,0 +1,389 @@
+#include <string.h>
+#include "gif.h"
+
+#define GIF_ERROR g_quark_from_static_string("imagepeek-gif-error")
+#define GIF_MAX_CODES 4096
+/* largest accepted canvas (in pixels) */
+#define GIF_MAX_PIXELS (1 << 28)
+
+static guint
+gif_u16(const guchar *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static gboolean
+gif_read(GifDecoder *gif, guchar *buffer, gsize size)
+{
+    return fread(buffer, 1, size, gif->file) == size;
+}
+
+static gboolean
+gif_read_sub_blocks(GifDecoder *gif, GByteArray *data)
+{
+    guchar block[255];
+    gint size;
+    gsize n;
+
+    g_byte_array_set_size(data, 0);
+    while ( (size = getc(gif->file)) > 0 ) {
+        n = fread(block, 1, size, gif->file);
+        g_byte_array_append(data, block, n);
+        if ( n != (gsize)size )
+            return FALSE;
+    }
+
+    return size == 0;
+}
+
+static gint
+gif_interlaced_row(gint row, gint height)
+{
+    gint n;
+
+    n = (height + 7) / 8;
+    if (row < n)
+        return row * 8;
+    row -= n;
+
+    n = (height + 3) / 8;
+    if (row < n)
+        return row * 8 + 4;
+    row -= n;
+
+    n = (height + 1) / 4;
+    if (row < n)
+        return row * 4 + 2;
+    row -= n;
+
+    return row * 2 + 1;
+}
+
+/*
+ * Decodes LZW compressed data to color indices.
+ * Returns number of decoded indices or -1 on error.
+ */
+static gssize
+gif_decode_lzw(const guchar *data, gsize size, gint min_code_size,
+        guchar *out, gsize out_size)
+{
+    guint16 prefix[GIF_MAX_CODES];
+    guchar suffix[GIF_MAX_CODES];
+    guchar stack[GIF_MAX_CODES + 1];
+    gint clear, end, code_size, next, old, code, in, first, sp;
+    guint32 bits = 0;
+    gint bit_count = 0;
+    gsize pos = 0, n = 0;
+
+    if (min_code_size < 2 || min_code_size > 11)
+        return -1;
+
+    clear = 1 << min_code_size;
+    end = clear + 1;
+    code_size = min_code_size + 1;
+    next = clear + 2;
+    old = -1;
+    first = 0;
+
+    for (code = 0; code < clear; ++code) {
+        prefix[code] = 0;
+        suffix[code] = code;
+    }
+
+    while (n < out_size) {
+        while (bit_count < code_size) {
+            /* truncated data -- keep what was decoded */
+            if (pos == size)
+                return n;
+            bits |= (guint32)data[pos++] << bit_count;
+            bit_count += 8;
+        }
+        code = bits & ((1 << code_size) - 1);
+        bits >>= code_size;
+        bit_count -= code_size;
+
+        if (code == clear) {
+            code_size = min_code_size + 1;
+            next = clear + 2;
+            old = -1;
+            continue;
+        }
+        if (code == end)
+            break;
+
+        if (old == -1) {
+            if (code > clear)
+                return -1;
+            out[n++] = first = code;
+            old = code;
+            continue;
+        }
+
+        in = code;
+        sp = 0;
+        if (code >= next) {
+            if (code > next)
+                return -1;
+            stack[sp++] = first;
+            code = old;
+        }
+        while (code >= clear) {
+            stack[sp++] = suffix[code];
+            code = prefix[code];
+        }
+        first = code;
+        stack[sp++] = first;
+
+        while (sp > 0 && n < out_size)
+            out[n++] = stack[--sp];
+
+        if (next < GIF_MAX_CODES) {
+            prefix[next] = old;
+            suffix[next] = first;
+            ++next;
+            if ( next == (1 << code_size) && code_size < 12 )
+                ++code_size;
+        }
+        old = in;
+    }
+
+    return n;
+}
+
+static void
+gif_dispose(GifDecoder *gif)
+{
+    gint x, y, x2, y2;
+
+    if (gif->dispose == 2) {
+        /* restore to background (transparent) */
+        x = MIN(gif->dispose_x, gif->width);
+        y = MIN(gif->dispose_y, gif->height);
+        x2 = MIN(gif->dispose_x + gif->dispose_width, gif->width);
+        y2 = MIN(gif->dispose_y + gif->dispose_height, gif->height);
+        for ( ; y < y2; ++y )
+            memset( gif->canvas + (y*gif->width + x)*4, 0, (x2 - x)*4 );
+    } else if (gif->dispose == 3 && gif->previous) {
+        /* restore to previous */
+        memcpy( gif->canvas, gif->previous, gif->width*gif->height*4 );
+    }
+
+    gif->dispose = 0;
+}
+
+static gboolean
+gif_read_image(GifDecoder *gif, gint dispose, gint transparent, GError **error)
+{
+    guchar desc[9], local_palette[256*3];
+    const guchar *palette, *src;
+    guchar *dst;
+    guint palette_size;
+    gint fx, fy, fw, fh, min_code_size, row, x, y, c, index;
+    gboolean interlaced;
+    gssize n;
+    gsize i;
+
+    if ( !gif_read(gif, desc, sizeof(desc)) )
+        goto corrupted;
+
+    fx = gif_u16(desc);
+    fy = gif_u16(desc+2);
+    fw = gif_u16(desc+4);
+    fh = gif_u16(desc+6);
+    interlaced = desc[8] & 0x40;
+
+    if (desc[8] & 0x80) {
+        palette_size = 2 << (desc[8] & 7);
+        if ( !gif_read(gif, local_palette, palette_size*3) )
+            goto corrupted;
+        palette = local_palette;
+    } else {
+        palette_size = gif->global_palette_size;
+        palette = gif->global_palette;
+    }
+
+    min_code_size = getc(gif->file);
+    if (min_code_size == EOF)
+        goto corrupted;
+    /* truncated image is decoded partially */
+    gif_read_sub_blocks(gif, gif->data);
+
+    if ( (gsize)fw*fh > gif->indices_size ) {
+        gif->indices_size = (gsize)fw*fh;
+        gif->indices = g_realloc(gif->indices, gif->indices_size);
+    }
+
+    n = gif_decode_lzw( gif->data->data, gif->data->len, min_code_size,
+            gif->indices, (gsize)fw*fh );
+    if (n < 0)
+        goto corrupted;
+
+    if (dispose == 3) {
+        if (!gif->previous)
+            gif->previous = g_malloc( gif->width*gif->height*4 );
+        memcpy( gif->previous, gif->canvas, gif->width*gif->height*4 );
+    }
+
+    for (i = 0, row = 0; row < fh; ++row) {
+        y = fy + (interlaced ? gif_interlaced_row(row, fh) : row);
+        src = gif->indices + row*fw;
+        for (c = 0; c < fw; ++c, ++i) {
+            if ( (gssize)i >= n )
+                break;
+            x = fx + c;
+            index = src[c];
+            if ( x >= gif->width || y >= gif->height ||
+                 index == transparent || (guint)index >= palette_size )
+                continue;
+            dst = gif->canvas + (y*gif->width + x)*4;
+            dst[0] = palette[index*3];
+            dst[1] = palette[index*3 + 1];
+            dst[2] = palette[index*3 + 2];
+            dst[3] = 0xff;
+        }
+    }
+
+    gif->dispose = dispose;
+    gif->dispose_x = fx;
+    gif->dispose_y = fy;
+    gif->dispose_width = fw;
+    gif->dispose_height = fh;
+    ++gif->frame;
+
+    return TRUE;
+
+corrupted:
+    g_set_error(error, GIF_ERROR, 0, "Corrupted GIF image");
+    return FALSE;
+}
+
+gboolean
+gif_is_gif(const guchar *data, gsize size)
+{
+    return size >= 6 &&
+        ( memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0 );
+}
+
+GifDecoder *
+gif_decoder_new(GBytes *data, GError **error)
+{
+    GifDecoder *gif;
+    guchar header[13];
+    gsize size;
+    FILE *f;
+
+    /* data are read as stream (empty stream cannot be opened) */
+    size = g_bytes_get_size(data);
+    f = size > 0 ? fmemopen( (gpointer)g_bytes_get_data(data, NULL), size, "rb" ) : NULL;
+    if (!f) {
+        g_set_error(error, GIF_ERROR, 0, "Data are not a GIF image");
+        return NULL;
+    }
+
+    gif = g_new0(GifDecoder, 1);
+    gif->bytes = g_bytes_ref(data);
+    gif->file = f;
+
+    if ( !gif_read(gif, header, sizeof(header)) || !gif_is_gif(header, sizeof(header)) ) {
+        g_set_error(error, GIF_ERROR, 0, "Data are not a GIF image");
+        gif_decoder_free(gif);
+        return NULL;
+    }
+
+    gif->width = gif_u16(header+6);
+    gif->height = gif_u16(header+8);
+    if ( gif->width == 0 || gif->height == 0 ||
+         (gsize)gif->width*gif->height > GIF_MAX_PIXELS )
+    {
+        g_set_error( error, GIF_ERROR, 0, "Unsupported size of GIF image %dx%d",
+                gif->width, gif->height );
+        gif_decoder_free(gif);
+        return NULL;
+    }
+
+    if (header[10] & 0x80) {
+        gif->global_palette_size = 2 << (header[10] & 7);
+        if ( !gif_read(gif, gif->global_palette, gif->global_palette_size*3) ) {
+            g_set_error(error, GIF_ERROR, 0, "Corrupted GIF image");
+            gif_decoder_free(gif);
+            return NULL;
+        }
+    }
+    gif->background = header[11];
+
+    gif->first_block = ftell(f);
+    gif->canvas = g_malloc0( gif->width*gif->height*4 );
+    gif->data = g_byte_array_new();
+
+    return gif;
+}
+
+void
+gif_decoder_free(GifDecoder *gif)
+{
+    if (gif->file)
+        fclose(gif->file);
+    if (gif->bytes)
+        g_bytes_unref(gif->bytes);
+    if (gif->data)
+        g_byte_array_free(gif->data, TRUE);
+    g_free(gif->canvas);
+    g_free(gif->previous);
+    g_free(gif->indices);
+    g_free(gif);
+}
+
+gboolean
+gif_decoder_next_frame(GifDecoder *gif, gint *delay, GError **error)
+{
+    gint block, label, dispose = 0, transparent = -1, delay_cs = 0;
+    const guchar *gce;
+
+    gif_dispose(gif);
+
+    for (;;) {
+        block = getc(gif->file);
+        if (block == 0x21) {
+            /* extension */
+            label = getc(gif->file);
+            if ( label == EOF || !gif_read_sub_blocks(gif, gif->data) )
+                break;
+            if (label == 0xf9 && gif->data->len >= 4) {
+                /* graphic control extension */
+                gce = gif->data->data;
+                dispose = (gce[0] >> 2) & 7;
+                delay_cs = gif_u16(gce+1);
+                if (gce[0] & 1)
+                    transparent = gce[3];
+            }
+        } else if (block == 0x2c) {
+            /* image */
+            if ( !gif_read_image(gif, dispose, transparent, error) )
+                return FALSE;
+            /* same as browsers -- too short delays are slowed down */
+            *delay = delay_cs <= 1 ? 100 : delay_cs*10;
+            return TRUE;
+        } else if (block == 0x3b || (block == EOF && gif->frame > 0)) {
+            /* trailer (missing trailer is tolerated) */
+            return FALSE;
+        } else {
+            break;
+        }
+    }
+
+    g_set_error(error, GIF_ERROR, 0, "Corrupted GIF image");
+    return FALSE;
+}
+
+gboolean
+gif_decoder_rewind(GifDecoder *gif)
+{
+    if ( fseek(gif->file, gif->first_block, SEEK_SET) != 0 )
+        return FALSE;
+
+    memset( gif->canvas, 0, gif->width*gif->height*4 );
+    gif->dispose = 0;
+    gif->frame = 0;
+
+    return TRUE;
+}
@@ -0,0 +1,60 @@
+#ifndef GIF_H
+#define GIF_H
+
+#include <stdio.h>
+#include <glib.h>
+
+typedef struct _GifDecoder GifDecoder;
+
+/*
+ * Streaming GIF decoder.
+ *
+ * Only the current frame is kept in memory (RGBA canvas with size of
+ * the logical screen); frames are read from data of file one by one.
+ */
+struct _GifDecoder {
+    GBytes *bytes;
+    FILE *file;
+    gint width, height;
+
+    guchar global_palette[256*3];
+    guint global_palette_size;
+    gint background;
+
+    /* file offset of first block after header */
+    long first_block;
+    /* number of decoded frames since last rewind */
+    guint frame;
+
+    /* RGBA canvas and its copy for "restore to previous" disposal */
+    guchar *canvas;
+    guchar *previous;
+
+    /* disposal of last frame */
+    gint dispose;
+    gint dispose_x, dispose_y, dispose_width, dispose_height;
+
+    /* LZW data and decoded color indices of current frame */
+    GByteArray *data;
+    guchar *indices;
+    gsize indices_size;
+};
+
+/* reads GIF from data of file (data are referenced until decoder is freed) */
+GifDecoder *gif_decoder_new(GBytes *data, GError **error);
+void gif_decoder_free(GifDecoder *gif);
+
+/* returns TRUE if file starts with GIF signature */
+gboolean gif_is_gif(const guchar *data, gsize size);
+
+/*
+ * Decodes next frame into canvas.
+ * Returns FALSE on end of file or error (error is set only on error).
+ * Frame delay in milliseconds is stored in delay.
+ */
+gboolean gif_decoder_next_frame(GifDecoder *gif, gint *delay, GError **error);
+
+/* seeks to first frame */
+gboolean gif_decoder_rewind(GifDecoder *gif);
+
+#endif /* GIF_H */
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hud.h"
+
+/* recorded frames for percentiles */
+#define HUD_FRAMES 240
+/* frames in graph */
+#define HUD_GRAPH_FRAMES 60
+/* text update interval (ms) */
+#define HUD_UPDATE_INTERVAL 250
+/* frame time of full graph bar (us) */
+#define HUD_GRAPH_SCALE 33000
+
+#define HUD_FONT "monospace 12px"
+
+struct _Hud {
+    ClutterActor *stage;
+    ClutterActor *group;
+    ClutterActor *text;
+    HudCallback *callback;
+    gpointer user_data;
+
+    /* paint durations in microseconds (ring buffer) */
+    gint64 frames[HUD_FRAMES];
+    guint frame_count;
+    guint frame_next;
+    gint64 paint_start;
+
+    gulong paint_handler, paint_after_handler;
+    guint update_id;
+};
+
+/* graph bars (UTF-8) */
+static const gchar * const hud_bars[] = {
+    "\xe2\x96\x81", "\xe2\x96\x82", "\xe2\x96\x83", "\xe2\x96\x84",
+    "\xe2\x96\x85", "\xe2\x96\x86", "\xe2\x96\x87", "\xe2\x96\x88"
+};
+
+static void
+hud_on_paint(ClutterActor *stage, Hud *hud)
+{
+    hud->paint_start = g_get_monotonic_time();
+}
+
+static void
+hud_on_paint_after(ClutterActor *stage, Hud *hud)
+{
+    hud->frames[hud->frame_next] = g_get_monotonic_time() - hud->paint_start;
+    hud->frame_next = (hud->frame_next + 1) % HUD_FRAMES;
+    if (hud->frame_count < HUD_FRAMES)
+        ++hud->frame_count;
+}
+
+static gint
+hud_compare_frames(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+hud_append_frames(Hud *hud, GString *text)
+{
+    gint64 sorted[HUD_FRAMES], frame;
+    guint i, n, bar;
+
+    if (hud->frame_count == 0) {
+        g_string_append(text, "Frame: -\n");
+        return;
+    }
+
+    memcpy( sorted, hud->frames, sizeof(sorted) );
+    qsort( sorted, hud->frame_count, sizeof(gint64), hud_compare_frames );
+    g_string_append_printf( text, "Frame: p50 %.1f ms  p99 %.1f ms  max %.1f ms\n",
+            sorted[hud->frame_count / 2] / 1000.0,
+            sorted[(hud->frame_count * 99) / 100] / 1000.0,
+            sorted[hud->frame_count - 1] / 1000.0 );
+
+    /* last frames (oldest first) */
+    n = MIN(hud->frame_count, HUD_GRAPH_FRAMES);
+    for (i = 0; i < n; ++i) {
+        frame = hud->frames[(hud->frame_next + HUD_FRAMES - n + i) % HUD_FRAMES];
+        bar = MIN( frame * G_N_ELEMENTS(hud_bars) / HUD_GRAPH_SCALE,
+                G_N_ELEMENTS(hud_bars) - 1 );
+        g_string_append(text, hud_bars[bar]);
+    }
+    g_string_append_c(text, '\n');
+}
+
+static gboolean
+hud_update(Hud *hud)
+{
+    GString *text;
+
+    text = g_string_new("");
+    hud_append_frames(hud, text);
+    hud->callback(text, hud->user_data);
+
+    /* no trailing new line */
+    if (text->len > 0 && text->str[text->len - 1] == '\n')
+        g_string_truncate(text, text->len - 1);
+    clutter_text_set_text( CLUTTER_TEXT(hud->text), text->str );
+    clutter_actor_raise_top(hud->group);
+
+    g_string_free(text, TRUE);
+    return TRUE;
+}
+
+Hud *
+hud_new(ClutterActor *stage, HudCallback *callback, gpointer user_data)
+{
+    Hud *hud;
+    ClutterActor *background;
+    const ClutterColor background_color = {0x00, 0x00, 0x00, 0xc0};
+    const ClutterColor text_color = {0xff, 0xff, 0xff, 0xff};
+
+    hud = g_new0(Hud, 1);
+    hud->stage = stage;
+    hud->callback = callback;
+    hud->user_data = user_data;
+
+    hud->text = clutter_text_new_full(HUD_FONT, "", &text_color);
+    clutter_actor_set_position(hud->text, 8.0, 8.0);
+
+    /* background for readability over images */
+    background = clutter_rectangle_new_with_color(&background_color);
+    clutter_actor_add_constraint( background,
+            clutter_bind_constraint_new(hud->text, CLUTTER_BIND_WIDTH, 16.0) );
+    clutter_actor_add_constraint( background,
+            clutter_bind_constraint_new(hud->text, CLUTTER_BIND_HEIGHT, 16.0) );
+
+    hud->group = clutter_group_new();
+    clutter_container_add_actor( CLUTTER_CONTAINER(hud->group), background );
+    clutter_container_add_actor( CLUTTER_CONTAINER(hud->group), hud->text );
+    clutter_container_add_actor( CLUTTER_CONTAINER(stage), hud->group );
+    clutter_actor_hide(hud->group);
+
+    return hud;
+}
+
+void
+hud_free(Hud *hud)
+{
+    hud_set_visible(hud, FALSE);
+    clutter_actor_destroy(hud->group);
+    g_free(hud);
+}
+
+void
+hud_set_visible(Hud *hud, gboolean visible)
+{
+    if ( visible == hud_get_visible(hud) )
+        return;
+
+    if (visible) {
+        hud->frame_count = 0;
+        hud->frame_next = 0;
+        hud->paint_handler = g_signal_connect( hud->stage, "paint",
+                G_CALLBACK(hud_on_paint), hud );
+        hud->paint_after_handler = g_signal_connect_after( hud->stage, "paint",
+                G_CALLBACK(hud_on_paint_after), hud );
+        hud->update_id = clutter_threads_add_timeout( HUD_UPDATE_INTERVAL,
+                (GSourceFunc)hud_update, hud );
+        hud_update(hud);
+        clutter_actor_show(hud->group);
+    } else {
+        g_signal_handler_disconnect(hud->stage, hud->paint_handler);
+        g_signal_handler_disconnect(hud->stage, hud->paint_after_handler);
+        g_source_remove(hud->update_id);
+        hud->update_id = 0;
+        clutter_actor_hide(hud->group);
+    }
+}
+
+gboolean
+hud_get_visible(const Hud *hud)
+{
+    return hud->update_id != 0;
+}
@@ -0,0 +1,24 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <clutter/clutter.h>
+
+typedef struct _Hud Hud;
+
+/* appends application statistics to HUD text */
+typedef void HudCallback(GString *text, gpointer user_data);
+
+/*
+ * Performance overlay on stage.
+ *
+ * Shows graph and percentiles of frame times (stage paint duration) and
+ * text from callback. Frames are recorded and text is updated (at most
+ * few times per second) only while HUD is visible.
+ */
+Hud *hud_new(ClutterActor *stage, HudCallback *callback, gpointer user_data);
+void hud_free(Hud *hud);
+
+void hud_set_visible(Hud *hud, gboolean visible);
+gboolean hud_get_visible(const Hud *hud);
+
+#endif /* HUD_H */
@@ -0,0 +1,416 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "io.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* threads for blocking I/O (mostly waiting) */
+#define IO_THREADS 16
+#define IO_PREFETCH_THREADS 4
+/* maximum number of requests submitted at once */
+#define IO_BATCH 64
+
+typedef struct _IoPrefetch IoPrefetch;
+
+struct _Io {
+    IoCallback *callback;
+    gpointer user_data;
+
+    /* fallback if io_uring is not available */
+    GThreadPool *pool;
+    GThreadPool *prefetch_pool;
+
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+    GThread *thread;
+    /* requests for I/O thread (io itself stops the thread) */
+    GAsyncQueue *queue;
+#endif
+};
+
+struct _IoPrefetch {
+    gchar *filename;
+    gsize length;
+};
+
+static void
+io_set_error(IoRequest *request, gint err, const gchar *action)
+{
+    g_set_error( &request->error, G_FILE_ERROR, g_file_error_from_errno(err),
+            "Failed to %s file '%s': %s", action, request->filename, g_strerror(err) );
+}
+
+static gboolean
+io_is_cancelled(IoRequest *request)
+{
+    return request->cancelled && request->cancelled(request->user_data);
+}
+
+/* allocates buffer for data (after file is opened) */
+static gboolean
+io_prepare(IoRequest *request, gint fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        io_set_error(request, errno, "read");
+        return FALSE;
+    }
+
+    request->file_size = st.st_size;
+    request->size = request->file_size > request->offset
+        ? request->file_size - request->offset : 0;
+    if (request->length > 0)
+        request->size = MIN(request->length, request->size);
+    if (request->stat_only)
+        request->size = 0;
+    request->data = g_try_malloc(request->size + 1);
+    if (!request->data) {
+        io_set_error(request, ENOMEM, "read");
+        return FALSE;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, request->offset, request->size, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return TRUE;
+}
+
+static void
+io_finish(Io *io, IoRequest *request)
+{
+    if (request->error) {
+        g_free(request->data);
+        request->data = NULL;
+        request->size = 0;
+    }
+    io->callback(request, io->user_data);
+}
+
+static void
+io_read_file(IoRequest *request, Io *io)
+{
+    gsize offset = 0;
+    gssize n;
+    gint fd;
+
+    if ( io_is_cancelled(request) ) {
+        io_finish(io, request);
+        return;
+    }
+
+    fd = open(request->filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        io_set_error(request, errno, "open");
+        io_finish(io, request);
+        return;
+    }
+
+    if ( io_prepare(request, fd) ) {
+        while (offset < request->size) {
+            n = pread( fd, request->data + offset, request->size - offset,
+                    request->offset + offset );
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1) {
+                io_set_error(request, errno, "read");
+                break;
+            }
+            if (n == 0) {
+                /* file is shorter than expected */
+                request->size = offset;
+                break;
+            }
+            offset += n;
+        }
+    }
+
+    close(fd);
+    io_finish(io, request);
+}
+
+static void
+io_prefetch_file(IoPrefetch *prefetch, Io *io)
+{
+    gint fd;
+
+    fd = open(prefetch->filename, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(fd, 0, prefetch->length, POSIX_FADV_WILLNEED);
+#endif
+        close(fd);
+    }
+
+    g_free(prefetch->filename);
+    g_slice_free(IoPrefetch, prefetch);
+}
+
+#ifdef HAVE_LIBURING
+typedef struct _IoFile IoFile;
+
+struct _IoFile {
+    IoRequest *request;
+    gint fd;
+    gsize offset;
+    /* open or read is submitted and not completed */
+    gboolean pending;
+};
+
+static void
+io_uring_queue_read(Io *io, IoFile *file)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&io->ring);
+    io_uring_prep_read( sqe, file->fd, file->request->data + file->offset,
+            file->request->size - file->offset, file->request->offset + file->offset );
+    io_uring_sqe_set_data(sqe, file);
+}
+
+/* waits for completion, returns error code if ring failed */
+static gint
+io_uring_wait(Io *io, struct io_uring_cqe **cqe)
+{
+    gint ret;
+
+    do {
+        ret = io_uring_wait_cqe(&io->ring, cqe);
+    } while (ret == -EINTR);
+
+    return ret;
+}
+
+/* sets error for files with requests which will not be completed */
+static void
+io_uring_fail_pending(IoFile *files, guint count, gint err, const gchar *action)
+{
+    guint i;
+
+    for (i = 0; i < count; ++i) {
+        if (files[i].pending && !files[i].request->error)
+            io_set_error(files[i].request, err, action);
+        files[i].pending = FALSE;
+    }
+}
+
+/*
+ * Opens all files in batch with one submission, then reads them with
+ * another one (short reads are resubmitted).
+ */
+static void
+io_uring_process(Io *io, IoRequest **requests, guint count)
+{
+    IoFile files[IO_BATCH];
+    IoFile *file;
+    IoRequest *request;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    guint i, n = 0, pending;
+    gint ret;
+
+    for (i = 0; i < count; ++i) {
+        if ( io_is_cancelled(requests[i]) ) {
+            io_finish(io, requests[i]);
+            continue;
+        }
+        file = &files[n++];
+        file->request = requests[i];
+        file->fd = -1;
+        file->offset = 0;
+        file->pending = TRUE;
+
+        sqe = io_uring_get_sqe(&io->ring);
+        io_uring_prep_openat( sqe, AT_FDCWD, file->request->filename,
+                O_RDONLY | O_CLOEXEC, 0 );
+        io_uring_sqe_set_data(sqe, file);
+    }
+
+    /* whole batch is cancelled */
+    if (n == 0)
+        return;
+
+    io_uring_submit_and_wait(&io->ring, n);
+    for (i = 0; i < n; ++i) {
+        ret = io_uring_wait(io, &cqe);
+        if (ret != 0) {
+            io_uring_fail_pending(files, n, -ret, "open");
+            break;
+        }
+        file = io_uring_cqe_get_data(cqe);
+        if (cqe->res < 0)
+            io_set_error(file->request, -cqe->res, "open");
+        else
+            file->fd = cqe->res;
+        file->pending = FALSE;
+        io_uring_cqe_seen(&io->ring, cqe);
+    }
+
+    pending = 0;
+    for (i = 0; i < n; ++i) {
+        file = &files[i];
+        if ( file->fd != -1 && io_prepare(file->request, file->fd) &&
+             file->request->size > 0 )
+        {
+            io_uring_queue_read(io, file);
+            file->pending = TRUE;
+            ++pending;
+        }
+    }
+
+    while (pending > 0) {
+        io_uring_submit_and_wait(&io->ring, 1);
+        ret = io_uring_wait(io, &cqe);
+        if (ret != 0) {
+            io_uring_fail_pending(files, n, -ret, "read");
+            break;
+        }
+        file = io_uring_cqe_get_data(cqe);
+        request = file->request;
+
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+            io_uring_queue_read(io, file);
+        } else if (cqe->res < 0) {
+            io_set_error(request, -cqe->res, "read");
+            file->pending = FALSE;
+            --pending;
+        } else if (cqe->res == 0) {
+            /* file is shorter than expected */
+            request->size = file->offset;
+            file->pending = FALSE;
+            --pending;
+        } else {
+            file->offset += cqe->res;
+            if (file->offset < request->size) {
+                io_uring_queue_read(io, file);
+            } else {
+                file->pending = FALSE;
+                --pending;
+            }
+        }
+        io_uring_cqe_seen(&io->ring, cqe);
+    }
+
+    /* every request is finished (with error if ring failed) */
+    for (i = 0; i < n; ++i) {
+        if (files[i].fd != -1)
+            close(files[i].fd);
+        io_finish(io, files[i].request);
+    }
+}
+
+static gpointer
+io_uring_thread(Io *io)
+{
+    IoRequest *requests[IO_BATCH];
+    gpointer data;
+    guint count;
+    gboolean stop = FALSE;
+
+    while (!stop) {
+        /* wait for first request and take all pending */
+        data = g_async_queue_pop(io->queue);
+        count = 0;
+        while (data) {
+            if (data == io) {
+                stop = TRUE;
+                break;
+            }
+            requests[count++] = data;
+            if (count == IO_BATCH)
+                break;
+            data = g_async_queue_try_pop(io->queue);
+        }
+
+        if (count > 0)
+            io_uring_process(io, requests, count);
+    }
+
+    /* requests queued after stopping are finished without reading */
+    while ( (data = g_async_queue_try_pop(io->queue)) )
+        io_finish(io, data);
+
+    return NULL;
+}
+#endif /* HAVE_LIBURING */
+
+Io *
+io_new(IoCallback *callback, gpointer user_data)
+{
+    Io *io;
+
+    io = g_new0(Io, 1);
+    io->callback = callback;
+    io->user_data = user_data;
+    io->prefetch_pool = g_thread_pool_new( (GFunc)io_prefetch_file, io,
+            IO_PREFETCH_THREADS, FALSE, NULL );
+
+#ifdef HAVE_LIBURING
+    /* thread pool is used if io_uring is not supported by kernel */
+    if ( io_uring_queue_init(IO_BATCH, &io->ring, 0) == 0 ) {
+        io->queue = g_async_queue_new();
+        io->thread = g_thread_new( "imagepeek-io", (GThreadFunc)io_uring_thread, io );
+        return io;
+    }
+#endif
+
+    io->pool = g_thread_pool_new( (GFunc)io_read_file, io, IO_THREADS, FALSE, NULL );
+    return io;
+}
+
+void
+io_free(Io *io)
+{
+#ifdef HAVE_LIBURING
+    if (io->thread) {
+        g_async_queue_push(io->queue, io);
+        g_thread_join(io->thread);
+        g_async_queue_unref(io->queue);
+        io_uring_queue_exit(&io->ring);
+    }
+#endif
+    if (io->pool)
+        g_thread_pool_free(io->pool, FALSE, TRUE);
+    g_thread_pool_free(io->prefetch_pool, TRUE, TRUE);
+    g_free(io);
+}
+
+void
+io_read(Io *io, IoRequest **requests, guint count)
+{
+    guint i;
+
+#ifdef HAVE_LIBURING
+    if (io->thread) {
+        /* lock queue so that I/O thread gets whole batch at once */
+        g_async_queue_lock(io->queue);
+        for (i = 0; i < count; ++i)
+            g_async_queue_push_unlocked(io->queue, requests[i]);
+        g_async_queue_unlock(io->queue);
+        return;
+    }
+#endif
+
+    for (i = 0; i < count; ++i)
+        g_thread_pool_push(io->pool, requests[i], NULL);
+}
+
+void
+io_prefetch(Io *io, const gchar * const *filenames, guint count, gsize length)
+{
+    IoPrefetch *prefetch;
+    guint i;
+
+    for (i = 0; i < count; ++i) {
+        prefetch = g_slice_new(IoPrefetch);
+        prefetch->filename = g_strdup(filenames[i]);
+        prefetch->length = length;
+        g_thread_pool_push(io->prefetch_pool, prefetch, NULL);
+    }
+}
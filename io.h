@@ -0,0 +1,53 @@
+#ifndef IO_H
+#define IO_H
+
+#include <glib.h>
+
+typedef struct _Io Io;
+typedef struct _IoRequest IoRequest;
+
+typedef void IoCallback(IoRequest *request, gpointer user_data);
+typedef gboolean IoCancelled(gpointer user_data);
+
+struct _IoRequest {
+    const gchar *filename;
+    /* offset of first byte to read */
+    gsize offset;
+    /* number of bytes to read from offset (0 to read rest of file) */
+    gsize length;
+    /* file is only opened to get its size (nothing is read) */
+    gboolean stat_only;
+
+    /* request is dropped (without reading) if this returns TRUE */
+    IoCancelled *cancelled;
+    gpointer user_data;
+
+    /* read data (owned by caller after callback) */
+    guchar *data;
+    gsize size;
+    gsize file_size;
+    GError *error;
+};
+
+/*
+ * I/O stage which reads files in batches.
+ *
+ * Files are read with io_uring (if available) or in a thread pool, so
+ * latency of opening and reading files is paid once per batch instead of
+ * once per file. Callback is called from I/O thread for each finished
+ * request (also on error or if cancelled).
+ */
+Io *io_new(IoCallback *callback, gpointer user_data);
+/* waits for pending requests */
+void io_free(Io *io);
+
+/* queues requests in one batch */
+void io_read(Io *io, IoRequest **requests, guint count);
+
+/*
+ * Hints kernel to read start of files (length bytes, 0 for whole files)
+ * into page cache in background.
+ */
+void io_prefetch(Io *io, const gchar * const *filenames, guint count, gsize length);
+
+#endif /* IO_H */
@@ -0,0 +1,351 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "keycache.h"
+
+/* keys kept in cache file at most */
+#define KEY_CACHE_MAX_ENTRIES 200000
+/* smaller cache file is never rewritten only to remove stale keys */
+#define KEY_CACHE_MIN_LINES 4096
+
+typedef struct _KeyCacheEntry KeyCacheEntry;
+
+struct _KeyCacheEntry {
+    CachedKey key;
+    /* order of adding (newest is highest) */
+    guint64 serial;
+    /* set for snapshot of entry when cache file is rewritten */
+    gchar *path;
+    gboolean keep;
+};
+
+struct _KeyCache {
+    gchar *filename;
+    gchar *header;
+
+    /* file is loaded by first lookup */
+    GOnce load_once;
+    GRWLock lock;
+    /* path -> KeyCacheEntry */
+    GHashTable *entries;
+    guint64 last_serial;
+
+    /* keys added since last flush */
+    GMutex pending_lock;
+    GPtrArray *pending_paths;
+    GArray *pending_keys;
+
+    /* single thread appending to and rewriting file */
+    GThreadPool *writer;
+    /* lines in file and after it was last rewritten (used by writer) */
+    guint lines;
+    guint base_lines;
+    /* file is missing or has other format */
+    gboolean rewrite;
+};
+
+static void
+key_cache_format_line(GString *data, const gchar *path, const CachedKey *key)
+{
+    gint i;
+
+    g_string_append_printf( data, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT,
+            key->mtime, key->size );
+    for (i = 0; i < KEY_CACHE_VALUES; ++i)
+        g_string_append_printf(data, " %" G_GINT64_FORMAT, key->values[i]);
+    g_string_append_printf(data, " %s\n", path);
+}
+
+static void
+key_cache_insert(KeyCache *cache, gchar *path, const CachedKey *key)
+{
+    KeyCacheEntry *entry;
+
+    entry = g_new0(KeyCacheEntry, 1);
+    entry->key = *key;
+    entry->serial = ++cache->last_serial;
+    g_hash_table_replace(cache->entries, path, entry);
+}
+
+/* loads cache file into hash table */
+static gpointer
+key_cache_load(KeyCache *cache)
+{
+    GMappedFile *mapped;
+    CachedKey key;
+    const gchar *p, *end, *line_end;
+    gchar *next;
+    gsize header_size = strlen(cache->header);
+    gint i;
+
+    cache->rewrite = TRUE;
+
+    mapped = g_mapped_file_new(cache->filename, FALSE, NULL);
+    if (!mapped)
+        return NULL;
+
+    p = g_mapped_file_get_contents(mapped);
+    end = p + g_mapped_file_get_length(mapped);
+    if ( !p || end - p < (gssize)header_size || strncmp(p, cache->header, header_size) != 0 ) {
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+    cache->rewrite = FALSE;
+
+    /* line: mtime size values... path (later lines replace earlier) */
+    g_rw_lock_writer_lock(&cache->lock);
+    for ( p += header_size; p < end; p = line_end + 1 ) {
+        line_end = memchr(p, '\n', end - p);
+        if (!line_end)
+            break;
+        ++cache->lines;
+        key.mtime = g_ascii_strtoll(p, &next, 10);
+        key.size = g_ascii_strtoll(next, &next, 10);
+        for (i = 0; i < KEY_CACHE_VALUES; ++i)
+            key.values[i] = g_ascii_strtoll(next, &next, 10);
+        if (next >= line_end || *next != ' ')
+            continue;
+        ++next;
+        key_cache_insert( cache, g_strndup(next, line_end - next), &key );
+    }
+    g_rw_lock_writer_unlock(&cache->lock);
+
+    cache->base_lines = cache->lines;
+    g_mapped_file_unref(mapped);
+    return NULL;
+}
+
+static void
+key_cache_ensure_loaded(KeyCache *cache)
+{
+    g_once( &cache->load_once, (GThreadFunc)key_cache_load, cache );
+}
+
+static void
+key_cache_make_dir(const KeyCache *cache)
+{
+    gchar *dir;
+
+    dir = g_path_get_dirname(cache->filename);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+}
+
+static void
+key_cache_append(KeyCache *cache, GPtrArray *paths, GArray *keys)
+{
+    GString *data;
+    FILE *f;
+    guint i;
+
+    data = g_string_new(NULL);
+    for (i = 0; i < paths->len; ++i) {
+        key_cache_format_line( data, g_ptr_array_index(paths, i),
+                &g_array_index(keys, CachedKey, i) );
+    }
+
+    key_cache_make_dir(cache);
+    f = fopen(cache->filename, "a");
+    if ( !f || fwrite(data->str, 1, data->len, f) != data->len ) {
+        g_printerr( "imagepeek: Cannot save cache '%s'! (%s)\n",
+                cache->filename, g_strerror(errno) );
+    } else {
+        cache->lines += paths->len;
+    }
+    if (f)
+        fclose(f);
+    g_string_free(data, TRUE);
+}
+
+static gint
+key_cache_compare_serial(gconstpointer a, gconstpointer b)
+{
+    const KeyCacheEntry *x = *(KeyCacheEntry * const *)a;
+    const KeyCacheEntry *y = *(KeyCacheEntry * const *)b;
+
+    return (x->serial > y->serial) - (x->serial < y->serial);
+}
+
+/*
+ * Rewrites cache file with keys of existing unchanged files (newest
+ * KEY_CACHE_MAX_ENTRIES) and removes other keys from memory.
+ */
+static void
+key_cache_rewrite(KeyCache *cache)
+{
+    GHashTableIter iter;
+    GPtrArray *snapshot;
+    KeyCacheEntry *entry, *copy;
+    const KeyCacheEntry *current;
+    GString *data;
+    struct stat st;
+    const gchar *path;
+    guint i, kept = 0;
+    GError *error = NULL;
+
+    /* files are checked without blocking lookups */
+    snapshot = g_ptr_array_new();
+    g_rw_lock_reader_lock(&cache->lock);
+    g_hash_table_iter_init(&iter, cache->entries);
+    while ( g_hash_table_iter_next(&iter, (gpointer *)&path, (gpointer *)&entry) ) {
+        copy = g_new(KeyCacheEntry, 1);
+        *copy = *entry;
+        copy->path = g_strdup(path);
+        g_ptr_array_add(snapshot, copy);
+    }
+    g_rw_lock_reader_unlock(&cache->lock);
+
+    g_ptr_array_sort(snapshot, key_cache_compare_serial);
+    for (i = snapshot->len; i > 0 && kept < KEY_CACHE_MAX_ENTRIES; --i) {
+        copy = g_ptr_array_index(snapshot, i - 1);
+        copy->keep = stat(copy->path, &st) == 0 &&
+            st.st_mtime == copy->key.mtime && st.st_size == copy->key.size;
+        if (copy->keep)
+            ++kept;
+    }
+
+    data = g_string_new(cache->header);
+    for (i = 0; i < snapshot->len; ++i) {
+        copy = g_ptr_array_index(snapshot, i);
+        if (copy->keep)
+            key_cache_format_line(data, copy->path, &copy->key);
+    }
+
+    key_cache_make_dir(cache);
+    if ( g_file_set_contents(cache->filename, data->str, data->len, &error) ) {
+        cache->lines = cache->base_lines = kept;
+        cache->rewrite = FALSE;
+    } else {
+        g_printerr( "imagepeek: Cannot save cache '%s'! (%s)\n",
+                cache->filename, error->message );
+        g_error_free(error);
+    }
+    g_string_free(data, TRUE);
+
+    /* keys added meanwhile are kept */
+    g_rw_lock_writer_lock(&cache->lock);
+    for (i = 0; i < snapshot->len; ++i) {
+        copy = g_ptr_array_index(snapshot, i);
+        current = g_hash_table_lookup(cache->entries, copy->path);
+        if (!copy->keep && current && current->serial == copy->serial)
+            g_hash_table_remove(cache->entries, copy->path);
+        g_free(copy->path);
+        g_free(copy);
+    }
+    g_rw_lock_writer_unlock(&cache->lock);
+
+    g_ptr_array_free(snapshot, TRUE);
+}
+
+static void
+key_cache_write(gpointer data, KeyCache *cache)
+{
+    GPtrArray *paths;
+    GArray *keys;
+
+    key_cache_ensure_loaded(cache);
+
+    g_mutex_lock(&cache->pending_lock);
+    paths = cache->pending_paths;
+    keys = cache->pending_keys;
+    cache->pending_paths = g_ptr_array_new_with_free_func(g_free);
+    cache->pending_keys = g_array_new( FALSE, FALSE, sizeof(CachedKey) );
+    g_mutex_unlock(&cache->pending_lock);
+
+    /* pending keys are already in memory and are saved with others */
+    if (paths->len > 0) {
+        if ( cache->rewrite || cache->lines + paths->len > KEY_CACHE_MAX_ENTRIES ||
+             cache->lines + paths->len > MAX(KEY_CACHE_MIN_LINES, 2 * cache->base_lines) )
+        {
+            key_cache_rewrite(cache);
+        } else {
+            key_cache_append(cache, paths, keys);
+        }
+    }
+
+    g_ptr_array_free(paths, TRUE);
+    g_array_free(keys, TRUE);
+}
+
+KeyCache *
+key_cache_new(const gchar *name, const gchar *header)
+{
+    KeyCache *cache;
+
+    cache = g_new0(KeyCache, 1);
+    cache->filename = g_build_filename( g_get_user_cache_dir(), "imagepeek", name, NULL );
+    cache->header = g_strdup(header);
+    cache->load_once = (GOnce)G_ONCE_INIT;
+    g_rw_lock_init(&cache->lock);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_mutex_init(&cache->pending_lock);
+    cache->pending_paths = g_ptr_array_new_with_free_func(g_free);
+    cache->pending_keys = g_array_new( FALSE, FALSE, sizeof(CachedKey) );
+    cache->writer = g_thread_pool_new( (GFunc)key_cache_write, cache, 1, FALSE, NULL );
+
+    return cache;
+}
+
+void
+key_cache_free(KeyCache *cache)
+{
+    g_thread_pool_free(cache->writer, FALSE, TRUE);
+    g_hash_table_destroy(cache->entries);
+    g_rw_lock_clear(&cache->lock);
+    g_ptr_array_free(cache->pending_paths, TRUE);
+    g_array_free(cache->pending_keys, TRUE);
+    g_mutex_clear(&cache->pending_lock);
+    g_free(cache->filename);
+    g_free(cache->header);
+    g_free(cache);
+}
+
+gboolean
+key_cache_lookup(KeyCache *cache, const gchar *path, const struct stat *st, CachedKey *key)
+{
+    const KeyCacheEntry *entry;
+    gboolean found;
+
+    key_cache_ensure_loaded(cache);
+
+    g_rw_lock_reader_lock(&cache->lock);
+    entry = g_hash_table_lookup(cache->entries, path);
+    found = entry && entry->key.mtime == st->st_mtime && entry->key.size == st->st_size;
+    if (found)
+        *key = entry->key;
+    g_rw_lock_reader_unlock(&cache->lock);
+
+    return found;
+}
+
+void
+key_cache_add(KeyCache *cache, const gchar *path, const CachedKey *key)
+{
+    /* cache file has one path per line */
+    if ( strchr(path, '\n') )
+        return;
+
+    key_cache_ensure_loaded(cache);
+
+    g_rw_lock_writer_lock(&cache->lock);
+    key_cache_insert( cache, g_strdup(path), key );
+    g_rw_lock_writer_unlock(&cache->lock);
+
+    g_mutex_lock(&cache->pending_lock);
+    g_ptr_array_add( cache->pending_paths, g_strdup(path) );
+    g_array_append_val(cache->pending_keys, *key);
+    g_mutex_unlock(&cache->pending_lock);
+}
+
+void
+key_cache_flush(KeyCache *cache)
+{
+    gboolean pending;
+
+    g_mutex_lock(&cache->pending_lock);
+    pending = cache->pending_paths->len > 0;
+    g_mutex_unlock(&cache->pending_lock);
+
+    if (pending)
+        g_thread_pool_push(cache->writer, cache, NULL);
+}
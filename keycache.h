@@ -0,0 +1,41 @@
+#ifndef KEYCACHE_H
+#define KEYCACHE_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/* values stored for each file */
+#define KEY_CACHE_VALUES 2
+
+typedef struct _KeyCache KeyCache;
+typedef struct _CachedKey CachedKey;
+
+/* keys of file (valid while mtime and size are same) */
+struct _CachedKey {
+    gint64 mtime;
+    gint64 size;
+    gint64 values[KEY_CACHE_VALUES];
+};
+
+/*
+ * Persistent cache of values read from files (~/.cache/imagepeek/<name>).
+ *
+ * Cache file is loaded on first lookup. New keys are appended to the file
+ * in separate thread; the file is rewritten only after it has grown to
+ * twice its size, without files which no longer exist or changed and with
+ * at most KEY_CACHE_MAX_ENTRIES most recently added keys.
+ *
+ * Functions can be called from any thread.
+ */
+KeyCache *key_cache_new(const gchar *name, const gchar *header);
+/* waits for pending writes */
+void key_cache_free(KeyCache *cache);
+
+/* returns TRUE and sets key if cache contains valid key for file */
+gboolean key_cache_lookup(KeyCache *cache, const gchar *path, const struct stat *st, CachedKey *key);
+/* adds key of file (saved with next key_cache_flush()) */
+void key_cache_add(KeyCache *cache, const gchar *path, const CachedKey *key);
+/* saves added keys in background */
+void key_cache_flush(KeyCache *cache);
+
+#endif /* KEYCACHE_H */
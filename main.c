@@ -1,3 +1,7 @@
+#include <glib-unix.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "main.h"
@@ -23,6 +27,9 @@
     "gl_FragColor = col;" \
     "}"
 
+/* glGetString() argument */
+#define GL_RENDERER 0x1F01
+
 #define PROPERTY(name, type) \
     static type \
     get_##name(const Application *app) \
@@ -41,6 +48,11 @@ PROPERTY(error_color, typeColor)
 PROPERTY(zoom_increment, typeDouble)
 PROPERTY(zoom_animation, typeInteger)
 PROPERTY(scroll_animation, typeInteger)
+PROPERTY(atlas, typeBoolean)
+PROPERTY(compress_textures, typeBoolean)
+PROPERTY(slideshow, typeBoolean)
+PROPERTY(similar_threshold, typeInteger)
+PROPERTY(compare_threshold, typeInteger)
 
 #define OPTION(key, type, fn, val) \
     {key, Option##type, {.set##type = set_##fn}, {.get##type = get_##fn}, {.value##type = val}},
@@ -64,18 +76,52 @@ static const Option options[] = {
     OPTION("item_spacing",      Integer,    item_spacing,      4)
     OPTION("zoom_increment",    Double,     zoom_increment,    0.125)
     OPTION("zoom_quality",      Integer,    zoom_quality,      1)
+    OPTION("prefetch_pages",    Integer,    prefetch_pages,    1)
+    OPTION("sort",              String,     sort,              "none")
+    OPTION("atlas",             Boolean,    atlas,             TRUE)
+    OPTION("texture_budget",    Integer,    texture_budget,    1024)
+    OPTION("pixel_cache",       Integer,    pixel_cache,       0)
+    OPTION("pixel_cache_compress", Boolean, pixel_cache_compress, FALSE)
+    OPTION("compress_textures", Boolean,    compress_textures, FALSE)
+    OPTION("slideshow",         Boolean,    slideshow,         FALSE)
+    OPTION("slideshow_interval", Integer,   slideshow_interval, 5000)
+    OPTION("slideshow_shuffle", Boolean,    slideshow_shuffle, FALSE)
+    OPTION("slideshow_ready",   Integer,    slideshow_ready,   2)
+    OPTION("watchdog",          Integer,    watchdog,          500)
+    OPTION("metrics_file",      String,     metrics_file,      "")
+    OPTION("metrics_interval",  Integer,    metrics_interval,  15)
+    OPTION("similar_threshold", Integer,    similar_threshold, 10)
+    OPTION("compare_threshold", Integer,    compare_threshold, 2)
     {NULL}
 };
 
 /* TODO: remove globals */
 static const gfloat scroll_amount = 100.0;
 static const gfloat scroll_skip_factor = 0.9;
+/* start of file read for thumbnails (EXIF thumbnail is in first 64 KiB) */
+static const gsize thumbnail_head_size = 256*1024;
+/* extensions of files which can contain embedded JPEG preview */
+static const gchar * const preview_extensions[] = {
+    "jpg", "jpeg", "jpe", "cr2", "nef", "nrw", "arw", "srf", "sr2", "dng",
+    "orf", "rw2", "pef", "srw", "raf", "3fr", "erf", "kdc", "mrw", NULL
+};
+/* largest side of whole rendered vector item, bigger zoom renders tiles */
+static const gint vector_max_size = 4096;
+static const gint vector_tile_size = 512;
+/* rendered tiles kept for each vector item */
+static const guint vector_max_tiles = 64;
+/* textures are not downgraded below this size */
+static const gint min_texture_size = 64;
+/* pages of items read ahead at most */
+static const gint max_prefetch_pages = 16;
 
 
 static typeInteger
 get_count(const Application *app)
 {
-    return app->argc;
+    if (app->visible)
+        return app->visible->count;
+    return app->items ? path_store_get_count(app->items) : 0;
 }
 
 static typeInteger
@@ -132,6 +178,151 @@ set_item_font(Application *app, typeString font_name)
     app->options.item_font = g_strdup(font_name);
 }
 
+static typeString
+get_sort(const Application *app)
+{
+    return app->options.sort;
+}
+
+static void
+set_sort(Application *app, typeString sort)
+{
+    gboolean descending = sort && sort[0] == '-';
+
+    app->options.sort_order = sort_order_from_string(descending ? sort + 1 : sort);
+    app->options.sort_descending = descending && app->options.sort_order != SortNone;
+
+    g_free(app->options.sort);
+    app->options.sort = g_strconcat( app->options.sort_descending ? "-" : "",
+            sort_order_to_string(app->options.sort_order), NULL );
+}
+
+static typeInteger
+get_prefetch_pages(const Application *app)
+{
+    return app->options.prefetch_pages;
+}
+
+static void
+set_prefetch_pages(Application *app, typeInteger pages)
+{
+    app->options.prefetch_pages = CLAMP(pages, 0, max_prefetch_pages);
+}
+
+static typeInteger
+get_texture_budget(const Application *app)
+{
+    return app->options.texture_budget;
+}
+
+static void
+set_texture_budget(Application *app, typeInteger budget)
+{
+    app->options.texture_budget = MAX(0, budget);
+    residency_set_budget( app->residency,
+            (gsize)app->options.texture_budget * 1024 * 1024 );
+}
+
+static typeInteger
+get_pixel_cache(const Application *app)
+{
+    return pixel_cache_get_limit(app->pixel_cache);
+}
+
+static void
+set_pixel_cache(Application *app, typeInteger limit)
+{
+    pixel_cache_set_limit( app->pixel_cache, MAX(0, limit) );
+}
+
+static typeBoolean
+get_pixel_cache_compress(const Application *app)
+{
+    return pixel_cache_get_compress(app->pixel_cache);
+}
+
+static void
+set_pixel_cache_compress(Application *app, typeBoolean compress)
+{
+    pixel_cache_set_compress(app->pixel_cache, compress);
+}
+
+static typeInteger
+get_slideshow_interval(const Application *app)
+{
+    return slideshow_get_interval(app->slideshow);
+}
+
+static void
+set_slideshow_interval(Application *app, typeInteger interval)
+{
+    slideshow_set_interval( app->slideshow, MAX(0, interval) );
+}
+
+static typeBoolean
+get_slideshow_shuffle(const Application *app)
+{
+    return slideshow_get_shuffle(app->slideshow);
+}
+
+static void
+set_slideshow_shuffle(Application *app, typeBoolean shuffle)
+{
+    slideshow_set_shuffle(app->slideshow, shuffle);
+    restart_slideshow(app);
+}
+
+static typeInteger
+get_slideshow_ready(const Application *app)
+{
+    return slideshow_get_ready_count(app->slideshow);
+}
+
+static void
+set_slideshow_ready(Application *app, typeInteger count)
+{
+    slideshow_set_ready_count( app->slideshow, MAX(0, count) );
+}
+
+static typeInteger
+get_watchdog(const Application *app)
+{
+    return watchdog_get_threshold(app->watchdog);
+}
+
+static void
+set_watchdog(Application *app, typeInteger threshold)
+{
+    watchdog_set_threshold( app->watchdog, MAX(0, threshold) );
+}
+
+static typeString
+get_metrics_file(const Application *app)
+{
+    return app->options.metrics_file;
+}
+
+static void
+set_metrics_file(Application *app, typeString filename)
+{
+    g_free(app->options.metrics_file);
+    app->options.metrics_file = g_strdup(filename);
+    restart_metrics(app);
+}
+
+static typeInteger
+get_metrics_interval(const Application *app)
+{
+    return app->options.metrics_interval;
+}
+
+static void
+set_metrics_interval(Application *app, typeInteger interval)
+{
+    app->options.metrics_interval = MAX(0, interval);
+    restart_metrics(app);
+}
+
 static typeInteger
 get_item_spacing(const Application *app)
 {
@@ -146,30 +337,94 @@ set_item_spacing(Application *app, typeInteger spacing)
     clutter_table_layout_set_row_spacing( CLUTTER_TABLE_LAYOUT(app->layout), s );
 }
 
-static typeStringList
-get_items(const Application *app, gsize *size)
+static gchar *
+get_items(const Application *app)
+{
+    GString *list, *item;
+    guint i, count;
+
+    list = g_string_new("");
+    item = g_string_new("");
+    count = get_count(app);
+    for (i = 0; i < count; ++i) {
+        g_string_truncate(item, 0);
+        path_store_append(app->items, i, item);
+        list_append_escaped(list, item->str);
+    }
+    g_string_free(item, TRUE);
+
+    return g_string_free(list, FALSE);
+}
+
+/* returns index of visible item in item store */
+static guint
+get_item_index(const Application *app, guint index)
 {
-    if (size)
-        *size = get_count(app);
-    return app->argv;
+    return app->visible ? app->visible->indices[index] : index;
 }
 
-static typeString
+/* returns newly allocated path of item or NULL if index is out of range */
+static gchar *
 get_item(const Application *app, guint index)
 {
     if ( index < get_count(app) )
-        return get_items(app, NULL)[index];
+        return path_store_get( app->items, get_item_index(app, index) );
     return NULL;
 }
 
+/* replaces list of items (store is owned by app) */
 static void
-set_items(Application *app, typeStringList items, gsize count)
+set_item_store(Application *app, PathStore *items)
 {
-    /* TODO: delete previous list of items if necessary */
-    app->argc = count;
-    app->argv = items;
+    /* filter and sort refer to previous items */
+    if (app->filter)
+        filter_cancel(app->filter);
+    app->search_id = 0;
+    if (app->sorter)
+        sorter_cancel(app->sorter);
+    app->sort_id = 0;
+    if (app->hasher)
+        hasher_cancel(app->hasher);
+    app->hash_id = 0;
+    if (app->comparer)
+        comparer_cancel(app->comparer);
+    if (app->visible) {
+        filter_result_free(app->visible);
+        app->visible = NULL;
+    }
+
+    if (app->items)
+        path_store_free(app->items);
+    app->items = items;
     set_rows( app, get_rows(app) );
     set_columns( app, get_columns(app) );
+    restart_slideshow(app);
+    index_items(app);
+    if (app->compare) {
+        compare_items(app);
+        start_compare(app);
+    }
+
+    if (app->debug) {
+        g_printerr("imagepeek: Item list: %u items in %.1f KiB.\n",
+                get_count(app), path_store_get_memory(items) / 1024.0);
+    }
+}
+
+static void
+set_items(Application *app, typeStringList items, gsize count)
+{
+    PathStore *store;
+    gsize i;
+
+    /* multi-page documents are expanded to pages when first shown */
+    store = path_store_new();
+    for (i = 0; i < count; ++i)
+        path_store_add(store, items[i]);
+    set_item_store(app, store);
+
+    /* items restored from session are already sorted */
+    app->sort_on_startup = TRUE;
 }
 
 static gdouble
@@ -407,7 +662,8 @@ scrollable_on_drag_end(ClutterDragAction *action,
     scrollable_set_scroll(actor, x-vector[0]*16, y-vector[1]*16, 500);
 }
 
-static void
+/* returns drag action which scrolls actor */
+static ClutterAction *
 init_scrollable(ClutterActor *actor, guint *scroll_animation)
 {
     ClutterAction* drag;
@@ -435,6 +691,8 @@ init_scrollable(ClutterActor *actor, guint *scroll_animation)
             G_CALLBACK(scrollable_on_drag_end),
             vector );
     clutter_actor_add_action(actor, drag);
+
+    return drag;
 }
 
 static typeBoolean
@@ -508,6 +766,7 @@ static void
 on_zoom_completed(ClutterAnimation *anim, Application *app)
 {
     update(app);
+    refine_items(app);
 }
 
 
@@ -550,819 +809,4033 @@ set_zoom_quality(Application *app, typeInteger quality)
         app->options.zoom_quality = CLUTTER_TEXTURE_QUALITY_HIGH;
 }
 
-static gboolean
-load_image(Application *app, const char *filename, gint x, gint y)
+static ClutterActor*
+new_item(Application *app, const char *filename, gboolean *ok)
 {
-    ClutterActor *item, *view, *label, *text, *text_shadow_color;
-    ClutterTableLayout *layout;
-    gfloat xx, yy, w;
-    GError *error = NULL;
-
-    layout = CLUTTER_TABLE_LAYOUT( clutter_table_layout_new() );
-    item = clutter_box_new( CLUTTER_LAYOUT_MANAGER(layout) );
-
-    /* image */
-    /* FIXME: SIGBUS when image is larger than 4094
-     * -- workaround is to disable slicing */
-    view = g_object_new(CLUTTER_TYPE_TEXTURE, "disable-slicing", TRUE, NULL);
-    /*view = clutter_texture_new();*/
-    clutter_texture_set_filter_quality( CLUTTER_TEXTURE(view), app->options.zoom_quality );
-    clutter_texture_set_load_async( CLUTTER_TEXTURE(view), FALSE );
-    clutter_texture_set_from_file( CLUTTER_TEXTURE(view), filename, &error );
-    if (error) {
-        g_printerr("imagepeek: %s\n", error->message);
-        g_error_free(error);
-        error = NULL;
-        g_object_unref(view);
-        view = NULL;
-    } else {
-        clutter_container_add_actor( CLUTTER_CONTAINER(item), view );
-        clutter_table_layout_set_fill( layout, view, FALSE, FALSE );
-        clutter_table_layout_set_expand( layout, view, FALSE, FALSE );
+    ClutterActor *item;
+    LoadJob *job;
+    gfloat width, height;
+
+    item = clutter_box_new( clutter_table_layout_new() );
+    g_object_set_data_full( G_OBJECT(item), "filename", g_strdup(filename), g_free );
+
+    /*
+     * decode in main thread only in resolution needed to fit window
+     * (refined in finish_startup())
+     */
+    job = load_job_new(app, filename, item);
+    clutter_actor_get_size(app->stage, &width, &height);
+    job->fit_width = width;
+    job->fit_height = height;
+    if (job->check_cache) {
+        job->check_cache = FALSE;
+        job->cached = pixel_cache_contains(app->pixel_cache, filename);
     }
+    watchdog_enter(app->watchdog, WatchdogDecode, filename);
+    load_job_process(job);
+    watchdog_leave(app->watchdog);
+    show_loaded(app, job);
+    load_job_free(job);
+
+    *ok = g_object_get_data( G_OBJECT(item), "image" ) != NULL;
+    return item;
+}
 
-    if ( get_rows(app) > 1 || get_columns(app) > 1 || !view ) {
-        /* text shadow */
-        text_shadow_color = clutter_text_new_full(app->options.item_font, filename, &app->options.text_shadow_color);
-        clutter_text_set_ellipsize( CLUTTER_TEXT(text_shadow_color), PANGO_ELLIPSIZE_MIDDLE );
-        clutter_actor_set_anchor_point(text_shadow_color, -2.0, -2.0);
+static ClutterActor*
+add_item_label(Application *app, ClutterActor *item, const char *filename, gboolean ok)
+{
+    ClutterActor *label, *text, *text_shadow_color;
+
+    /* text shadow */
+    text_shadow_color = clutter_text_new_full(app->options.item_font, filename, &app->options.text_shadow_color);
+    clutter_text_set_ellipsize( CLUTTER_TEXT(text_shadow_color), PANGO_ELLIPSIZE_MIDDLE );
+    clutter_actor_set_anchor_point(text_shadow_color, -2.0, -2.0);
+    /* blur is rendered offscreen for each label */
+    if (!app->software_rendering)
         clutter_actor_add_effect( text_shadow_color, clutter_blur_effect_new() );
 
-        /* text */
-        text = clutter_text_new_full(app->options.item_font, filename, &app->options.text_color);
-        clutter_text_set_ellipsize( CLUTTER_TEXT(text), PANGO_ELLIPSIZE_MIDDLE );
-        clutter_text_set_selectable( CLUTTER_TEXT(text) , TRUE );
+    /* text */
+    text = clutter_text_new_full(app->options.item_font, filename, &app->options.text_color);
+    clutter_text_set_ellipsize( CLUTTER_TEXT(text), PANGO_ELLIPSIZE_MIDDLE );
+    clutter_text_set_selectable( CLUTTER_TEXT(text) , TRUE );
 
-        /* label */
-        label = clutter_group_new();
-        clutter_container_add_actor( CLUTTER_CONTAINER(label), text_shadow_color );
-        clutter_container_add_actor( CLUTTER_CONTAINER(label), text );
+    /* label */
+    label = clutter_group_new();
+    clutter_container_add_actor( CLUTTER_CONTAINER(label), text_shadow_color );
+    clutter_container_add_actor( CLUTTER_CONTAINER(label), text );
 
-        clutter_actor_set_width(label, 0.0);
-        clutter_actor_add_constraint( text, clutter_bind_constraint_new(item, CLUTTER_BIND_WIDTH, 0.0) );
-        clutter_actor_add_constraint( text_shadow_color, clutter_bind_constraint_new(text, CLUTTER_BIND_WIDTH, 4.0) );
+    clutter_actor_set_width(label, 0.0);
+    clutter_actor_add_constraint( text, clutter_bind_constraint_new(item, CLUTTER_BIND_WIDTH, 0.0) );
+    clutter_actor_add_constraint( text_shadow_color, clutter_bind_constraint_new(text, CLUTTER_BIND_WIDTH, 4.0) );
 
-        if (!view)
-            clutter_text_set_color( CLUTTER_TEXT(text), &app->options.error_color );
+    if (!ok)
+        clutter_text_set_color( CLUTTER_TEXT(text), &app->options.error_color );
 
-        clutter_container_add_actor( CLUTTER_CONTAINER(item), label );
-    }
+    clutter_container_add_actor( CLUTTER_CONTAINER(item), label );
+    g_object_set_data( G_OBJECT(item), "label", text );
+
+    return text;
+}
 
-    layout = CLUTTER_TABLE_LAYOUT(app->layout);
+static void
+pack_item(Application *app, ClutterActor *item, gint x, gint y)
+{
+    gfloat xx, yy, w;
 
     /* save scroll */
     scrollable_get_scroll(app->viewport, &xx, &yy);
     w = clutter_actor_get_width(app->viewport);
 
     /* add item and label */
-    clutter_table_layout_pack(layout, item, x, y);
+    watchdog_enter( app->watchdog, WatchdogLayout,
+            g_object_get_data(G_OBJECT(item), "filename") );
+    clutter_table_layout_pack( CLUTTER_TABLE_LAYOUT(app->layout), item, x, y );
+    watchdog_leave(app->watchdog);
 
     /* restore scroll */
     w = (clutter_actor_get_width(app->viewport)-w)/2;
     scrollable_set_scroll(app->viewport, xx+w, yy, 0);
-
-    return view != NULL;
 }
 
-static void
-clean_container(ClutterActor *actor)
+static gboolean
+load_job_is_stale(const LoadJob *job)
 {
-    GList *children, *it;
-
-    children = clutter_container_get_children( CLUTTER_CONTAINER(actor) );
-    for( it = children; it; it = it->next )
-        clutter_container_remove_actor( CLUTTER_CONTAINER(actor), CLUTTER_ACTOR(it->data) );
-    g_list_free(children);
+    /* prepared slideshow items are kept when page changes */
+    if (job->slideshow)
+        return job->generation != g_atomic_int_get(&job->app->slideshow_generation);
+    return job->generation != g_atomic_int_get(&job->app->generation);
 }
 
-static void
-crop_container(ClutterActor *actor, guint n)
+static LoadJob*
+load_job_new(Application *app, const char *filename, ClutterActor *item)
 {
-    GList *children, *it;
-
-    children = clutter_container_get_children( CLUTTER_CONTAINER(actor) );
-    it = g_list_nth(children, n);
-    for( ; it; it = it->next )
-        clutter_container_remove_actor( CLUTTER_CONTAINER(actor), CLUTTER_ACTOR(it->data) );
-    g_list_free(children);
+    LoadJob *job;
+    gboolean scalable;
+
+    job = g_slice_new0(LoadJob);
+    job->app = app;
+    job->generation = g_atomic_int_get(&app->generation);
+    job->queue_time = g_get_monotonic_time();
+    job->filename = g_strdup(filename);
+    job->item = g_object_ref(item);
+    job->compare_filename = g_strdup( g_object_get_data(G_OBJECT(item), "compare-filename") );
+    job->document = pages_parse(filename, &job->page);
+    /* image is decoded only in resolution needed for current zoom */
+    scalable = g_object_get_data( G_OBJECT(item), "scalable" ) != NULL;
+    job->scale = scalable ? get_vector_scale(app, item) : MIN( 1.0, get_zoom(app->viewport) );
+    /* compared images are always decoded in full resolution */
+    job->thumbnail = !job->compare_filename && (get_rows(app) > 1 || get_columns(app) > 1);
+    /* stat() would block main thread on slow file systems */
+    job->check_cache = !job->thumbnail && !job->compare_filename && !job->document &&
+        !scalable && pixel_cache_get_limit(app->pixel_cache) > 0;
+    job->compress = job->thumbnail && can_use_atlas(app) &&
+        get_compress_textures(app) && app->texture_compression;
+
+    /*
+     * In grid mode only start of file is read in hope it contains preview.
+     * Decoded pixels of cached image are mapped from pixel cache instead
+     * (file is read after lookup fails), files of compared pair are
+     * mapped while decoding and documents are opened while rendering page.
+     */
+    job->read.filename = job->document ? job->document : job->filename;
+    job->read.stat_only = job->check_cache || job->compare_filename || job->document;
+    if (!job->read.stat_only)
+        job->read.length = job->thumbnail && may_have_preview(filename) ? thumbnail_head_size : 0;
+    job->read.cancelled = (IoCancelled*)load_job_is_stale;
+    job->read.user_data = job;
+
+    return job;
 }
 
 static void
-clean_items(Application *app)
+load_job_free(LoadJob *job)
 {
-    /* clean container and reset scroll offset */
-    clean_container(app->viewport);
-    scrollable_set_scroll( app->viewport, 0, 0, 0 );
-    app->count = 0;
+    g_free(job->filename);
+    g_free(job->compare_filename);
+    g_free(job->document);
+    g_free(job->tile);
+    g_object_unref(job->item);
+    if (job->animation)
+        animation_unref(job->animation);
+    if (job->unsaved && job->unsaved != job->image)
+        image_free(job->unsaved);
+    if (job->image)
+        image_free(job->image);
+    if (job->compressed)
+        compressed_image_free(job->compressed);
+    if (job->error)
+        g_error_free(job->error);
+    g_free(job->read.data);
+    if (job->read.error)
+        g_error_free(job->read.error);
+    g_slice_free(LoadJob, job);
 }
 
-static gboolean
-load_images(Application *app)
+/* decodes JPEG preview embedded in image file */
+static Image*
+load_job_decode_preview(LoadJob *job, const guchar *data, const ExifInfo *exif)
 {
-    guint i, x, y, count;
+    DecoderRequest request = { job->scale,
+        (DecoderCancelled*)load_job_is_stale, job };
+    Image *image;
+
+    /* scale is relative to original image */
+    if (exif->width > 0) {
+        request.scale = MIN( 1.0, job->scale * exif->width / exif->preview_width );
+        request.fit_width = (gint64)job->fit_width * exif->preview_width / exif->width;
+        request.fit_height = (gint64)job->fit_height * exif->preview_width / exif->width;
+    }
 
-    count = app->count;
-    i = get_current_offset(app) + count;
-    x = count % get_columns(app);
-    y = clutter_table_layout_get_row_count( CLUTTER_TABLE_LAYOUT(app->layout) )-1;
+    image = decoder_decode( data + exif->preview_offset, exif->preview_size,
+            &request, NULL );
 
-    if (app->restart) {
-        app->restart = FALSE;
-        clean_items(app);
+    /* preview takes same space as original */
+    if (image && exif->width > 0) {
+        image->original_width = exif->width;
+        image->original_height =
+            (gint64)exif->width * exif->preview_height / exif->preview_width;
     }
 
-    if( i >= get_count(app) ) {
-        app->loading = FALSE;
-        return FALSE;
+    return image;
+}
+
+/*
+ * Decodes image from data; if data contain only start of the file, only
+ * embedded preview is decoded.
+ *
+ * Preview embedded in camera images is decoded instead of the image if
+ * it's enough for current zoom, for thumbnails or if the image is RAW.
+ */
+static Image*
+load_job_decode_data(LoadJob *job, const guchar *data, gsize size, gboolean partial, GError **error)
+{
+    DecoderRequest request = { job->scale,
+        (DecoderCancelled*)load_job_is_stale, job };
+    ExifInfo exif;
+    Image *image = NULL;
+    gboolean enough;
+
+    request.fit_width = job->fit_width;
+    request.fit_height = job->fit_height;
+
+    /* tile is region of vector image */
+    if (job->tile) {
+        request.x = job->tile_x;
+        request.y = job->tile_y;
+        request.width = request.height = vector_tile_size;
     }
 
-    if (x == 0) {
-        ++y;
-        if (y >= get_rows(app) ) {
-            app->loading = FALSE;
-            return FALSE;
+    exif_read(data, size, &exif);
+
+    if (exif.preview_size > 0) {
+        enough = exif.width == 0 || exif.preview_width >= exif.width*job->scale;
+        if (enough || job->thumbnail) {
+            image = load_job_decode_preview(job, data, &exif);
+            job->preview = image && !enough;
         }
     }
 
-    ++app->count;
-    load_image( app, get_item(app, i), x, y );
-    return TRUE;
+    if (!image && !partial)
+        image = decoder_decode(data, size, &request, error);
+
+    if (image)
+        image = image_apply_orientation(image, exif.orientation);
+
+    return image;
 }
 
-static void
-load_more(Application *app)
+/*
+ * Decodes image with native decoder if available; outdated job is
+ * cancelled in the middle of decoding.
+ *
+ * Uses data read by I/O stage; file is mapped if the data are missing
+ * or not sufficient. Animation is opened from the same data.
+ */
+static Image*
+load_job_decode(LoadJob *job, GError **error)
 {
-    guint r1, c1, r2, c2;
-    GString *title;
-    gchar* title2;
-    typeInteger count, current;
-
-    if (app->loading) {
-        app->restart = TRUE;
-        return;
+    GMappedFile *file;
+    GBytes *data;
+    Image *image;
+    gboolean partial;
+
+    if (job->cached) {
+        image = pixel_cache_load(job->app->pixel_cache, job->filename);
+        if (image) {
+            metrics_add(job->app->metrics, MetricsPixelCacheHits, 1);
+            return image;
+        }
+        /* removed from cache in the meantime */
+        job->cached = FALSE;
+    }
+    if ( !job->thumbnail && pixel_cache_get_limit(job->app->pixel_cache) > 0 )
+        metrics_add(job->app->metrics, MetricsPixelCacheMisses, 1);
+
+    /* file is mapped if preview read alone cannot be decoded */
+    if (job->read.data && job->read.offset > 0) {
+        image = load_job_decode_read_preview(job);
+        if (image)
+            return image;
+        g_free(job->read.data);
+        job->read.data = NULL;
     }
-    app->restart = FALSE;
-
-    r1 = clutter_table_layout_get_row_count( CLUTTER_TABLE_LAYOUT(app->layout) );
-    c1 = clutter_table_layout_get_column_count( CLUTTER_TABLE_LAYOUT(app->layout) );
-    r2 = get_rows(app);
-    c2 = get_columns(app);
 
-    if ( (r1 > r2 && c1 == c2) || (c1 > c2 && r1 == r2 && r2 == 1) ) {
-        /* remove last items */
-        app->count = r2*c2;
-        crop_container(app->viewport, r2*c2);
-    } else if (r1 != r2 || c1 != c2) {
-        if ( r1 == 0 || (r1 > 1 && c1 != c2) || (r1 != r2 && c1 != c2) ) {
-            /* reaload all items */
-            clean_items(app);
+    partial = job->read.data && job->read.size < job->read.file_size;
+    if (partial && job->read.size > 0) {
+        image = load_job_decode_data( job, job->read.data, job->read.size,
+                TRUE, error );
+        if (image)
+            return image;
+    }
 
-            /* set window title */
-            count = get_count(app);
-            current = get_current_offset(app);
-            title = g_string_new("");
-            g_string_printf(title, "[%d/%d] %s - imagepeek",
-                    (int)current+1, (int)count, get_item(app, current) );
-            title2 = g_string_free(title, FALSE);
-            clutter_stage_set_title( CLUTTER_STAGE(app->stage), title2 );
-            g_free(title2);
-        }
+    if (job->read.data && !partial) {
+        data = g_bytes_new_take(job->read.data, job->read.size);
+        job->read.data = NULL;
+    } else {
+        /* only needed parts of mapped file are read from disk */
+        file = g_mapped_file_new(job->filename, FALSE, error);
+        if (!file)
+            return NULL;
+        data = g_mapped_file_get_bytes(file);
+        g_mapped_file_unref(file);
+    }
 
-        app->loading = TRUE;
-        if ( load_images(app) )
-            g_idle_add( (GSourceFunc)load_images, app );
+    job->animation = animation_new(data);
+    if (job->animation) {
+        image = animation_get_image(job->animation);
+    } else {
+        image = load_job_decode_data( job, g_bytes_get_data(data, NULL),
+                g_bytes_get_size(data), FALSE, error );
     }
-}
+    g_bytes_unref(data);
 
-static void
-reload(Application *app)
-{
-    clean_items(app);
-    load_more(app);
+    return image;
 }
 
-static void
-load_next(Application *app)
+/*
+ * Decodes image and its pair in full resolution and returns heatmap of
+ * their difference (or the image if pair has different size).
+ */
+static Image*
+load_job_compare(LoadJob *job, GError **error)
 {
-    typeInteger offset, items_on_page, count;
+    Image *a, *b, *heatmap;
+
+    a = compare_decode( job->filename,
+            (DecoderCancelled*)load_job_is_stale, job, error );
+    if (!a)
+        return NULL;
+    b = compare_decode( job->compare_filename,
+            (DecoderCancelled*)load_job_is_stale, job, error );
+    if (!b) {
+        image_free(a);
+        return NULL;
+    }
 
-    offset = get_current_offset(app);
-    items_on_page = get_rows(app) * get_columns(app);
-    count = get_count(app);
+    compare_images(a, b, &job->compare_stats, &heatmap);
+    image_free(b);
+    if (!heatmap)
+        return a;
 
-    offset += items_on_page;
-    if ( offset < count ) {
-        if ( offset >= count )
-            offset = count - items_on_page;
-        set_current_offset(app, offset);
-        reload(app);
-    }
+    image_free(a);
+    return heatmap;
 }
 
-static void
-load_prev(Application *app)
+/*
+ * Returns TRUE if file can contain embedded preview, i.e. reading only
+ * start of the file can be enough for thumbnail (other files are read
+ * whole at once).
+ */
+static gboolean
+may_have_preview(const gchar *filename)
 {
-    typeInteger offset, items_on_page;
+    const gchar *ext;
+    gint i;
 
-    offset = get_current_offset(app);
-    items_on_page = get_rows(app) * get_columns(app);
+    ext = strrchr(filename, '.');
+    if (!ext || strchr(ext, G_DIR_SEPARATOR))
+        return FALSE;
 
-    if ( offset >= items_on_page ) {
-        offset -= get_rows(app) * get_columns(app);
-    } else if ( offset > 0 ) {
-        offset = 0;
-    } else {
-        return;
+    for (i = 0; preview_extensions[i]; ++i) {
+        if ( g_ascii_strcasecmp(ext + 1, preview_extensions[i]) == 0 )
+            return TRUE;
     }
 
-    set_current_offset(app, offset);
-    reload(app);
+    return FALSE;
 }
 
+/*
+ * Returns TRUE if start of file is enough for decoding thumbnail, i.e.
+ * it contains embedded preview. EXIF is kept for preview which is beyond
+ * the start of file.
+ */
 static gboolean
-on_key_press(ClutterActor *stage,
-        ClutterEvent *event,
-        gpointer      user_data)
+load_job_head_is_enough(LoadJob *job)
 {
-    Application *app;
-    guint keyval;
-    gdouble s, s2;
-    gfloat x;
+    if ( !exif_read(job->read.data, job->read.size, &job->exif) )
+        return FALSE;
 
-    app = (Application *)user_data;
-    ClutterModifierType state = clutter_event_get_state(event);
-    keyval = clutter_event_get_key_symbol (event);
+    return job->exif.preview_size > 0;
+}
 
-    switch (keyval)
-    {
-        /* zoom in/out */
-        case CLUTTER_KEY_KP_Add:
-            s = get_zoom(app->viewport);
+/* decodes embedded preview which was read alone */
+static Image*
+load_job_decode_read_preview(LoadJob *job)
+{
+    ExifInfo exif = job->exif;
+    Image *image;
+
+    exif.preview_offset = 0;
+    exif.preview_size = job->read.size;
+    if ( !exif_jpeg_get_size(job->read.data, job->read.size,
+                &exif.preview_width, &exif.preview_height) )
+        return NULL;
+
+    image = load_job_decode_preview(job, job->read.data, &exif);
+    if (!image)
+        return NULL;
+    job->preview = exif.width > 0 && exif.preview_width < exif.width*job->scale;
+
+    return image_apply_orientation(image, exif.orientation);
+}
+
+/* renders page of document (stopped if job becomes stale) */
+static Image*
+load_job_render_page(LoadJob *job, GError **error)
+{
+    DecoderRequest request = { job->scale,
+        (DecoderCancelled*)load_job_is_stale, job };
+
+    request.fit_width = job->fit_width;
+    request.fit_height = job->fit_height;
+
+    return pages_render(job->document, job->page, &request, error);
+}
+
+static void
+load_job_process(LoadJob *job)
+{
+    gint64 start = g_get_monotonic_time();
+    Image *scaled;
+
+    /* placeholder is replaced with pages before any of them is rendered */
+    if (job->expand) {
+        job->pages = pages_count(job->document);
+        if (job->pages > 1)
+            return;
+        job->pages = 0;
+    }
+
+    if (job->compare_filename) {
+        job->image = load_job_compare(job, &job->error);
+    } else if (job->document) {
+        job->image = load_job_render_page(job, &job->error);
+    } else {
+        job->image = load_job_decode(job, &job->error);
+    }
+
+    /*
+     * Keep full resolution pixels of images which are slow to decode;
+     * they are saved after the image is shown.
+     */
+    if ( job->image && !job->animation && !job->cached && !job->thumbnail &&
+         !job->compare_filename && !job->document && !job->image->scalable &&
+         !job->preview && job->image->width == job->image->original_width &&
+         pixel_cache_get_limit(job->app->pixel_cache) > 0 &&
+         g_get_monotonic_time() - start >= PIXEL_CACHE_MIN_DECODE_TIME )
+    {
+        job->unsaved = job->image;
+    }
+
+    /*
+     * Decoders can return bigger image than requested. Without GPU it's
+     * cheaper to scale image once than to filter it in each frame.
+     * Heatmap of compared pair is always computed in full resolution.
+     */
+    if ( (job->downgrade || job->app->software_rendering || job->compare_filename) &&
+         job->image && !job->animation && !job->tile )
+    {
+        if (job->unsaved) {
+            scaled = image_new_scaled(job->image, job->scale);
+            if (scaled)
+                job->image = scaled;
+        } else {
+            job->image = image_scale_down(job->image, job->scale);
+        }
+    }
+
+    /* thumbnails are encoded in parallel in decoding threads */
+    if ( job->compress && job->image && !job->animation && !job->image->has_alpha &&
+         job->image->width <= ATLAS_MAX_IMAGE && job->image->height <= ATLAS_MAX_IMAGE )
+    {
+        job->compressed = texcomp_encode(job->image, ATLAS_PADDING);
+    }
+
+    g_free(job->read.data);
+    job->read.data = NULL;
+
+    job->decode_time = g_get_monotonic_time() - start;
+    metrics_observe(job->app->metrics, MetricsDecodeTime, job->decode_time);
+}
+
+/* called from I/O thread */
+static void
+on_file_read(IoRequest *read, Application *app)
+{
+    LoadJob *job = read->user_data;
+
+    if (read->data)
+        metrics_add(app->metrics, MetricsBytesRead, read->size);
+
+    /* decoded pixels are mapped from pixel cache if available */
+    if (job->check_cache) {
+        job->check_cache = FALSE;
+        job->cached = !load_job_is_stale(job) &&
+            pixel_cache_contains(app->pixel_cache, job->filename);
+    }
+
+    /*
+     * read whole file if its start is not enough (nothing is read before
+     * pixel cache lookup) or only embedded preview found beyond it
+     */
+    if ( read->data && read->offset == 0 && (read->length > 0 || read->stat_only) &&
+         read->size < read->file_size && !job->cached && !job->compare_filename &&
+         !job->document && !load_job_is_stale(job) &&
+         (read->stat_only || !load_job_head_is_enough(job)) )
+    {
+        g_free(read->data);
+        read->data = NULL;
+        if (!read->stat_only && job->exif.missing_size > 0) {
+            read->offset = job->exif.missing_offset;
+            read->length = job->exif.missing_size;
+        } else {
+            read->length = 0;
+        }
+        read->stat_only = FALSE;
+        io_read(app->io, &read, 1);
+        return;
+    }
+
+    g_atomic_int_add(&app->reads_pending, -1);
+    g_atomic_int_inc(&app->decodes_pending);
+    g_thread_pool_push(app->load_pool, job, NULL);
+}
+
+/* reads files of jobs in one batch and decodes them */
+static void
+load_jobs(Application *app, GPtrArray *jobs)
+{
+    IoRequest **reads;
+    guint i;
+
+    reads = g_new(IoRequest*, jobs->len);
+    for (i = 0; i < jobs->len; ++i)
+        reads[i] = &((LoadJob*)g_ptr_array_index(jobs, i))->read;
+    g_atomic_int_add(&app->reads_pending, jobs->len);
+    io_read(app->io, reads, jobs->len);
+    g_free(reads);
+}
+
+/* hints kernel to read items on next pages */
+static void
+prefetch_items(Application *app)
+{
+    gchar **filenames;
+    guint start, count, items_on_page, i;
+
+    items_on_page = get_rows(app) * get_columns(app);
+    start = get_current_offset(app) + items_on_page;
+    if ( start >= (guint)get_count(app) )
+        return;
+    count = MIN( get_prefetch_pages(app) * items_on_page, get_count(app) - start );
+
+    filenames = g_new(gchar*, count + 1);
+    for (i = 0; i < count; ++i)
+        filenames[i] = get_item(app, start + i);
+    filenames[count] = NULL;
+    io_prefetch( app->io, (const gchar * const *)filenames, count,
+            items_on_page > 1 ? thumbnail_head_size : 0 );
+    g_strfreev(filenames);
+}
+
+static void
+load_job_run(LoadJob *job, Application *app)
+{
+    /* skip decoding if page changed before job started */
+    if ( !load_job_is_stale(job) )
+        load_job_process(job);
+    g_atomic_int_add(&app->decodes_pending, -1);
+
+    g_async_queue_push(app->loaded, job);
+    if ( g_atomic_int_compare_and_exchange(&app->loaded_pending, FALSE, TRUE) )
+        clutter_threads_add_idle( (GSourceFunc)dispatch_loaded, app );
+}
+
+static gboolean
+can_use_atlas(const Application *app)
+{
+    /* mipmaps would mix neighbouring images */
+    return get_atlas(app) && app->options.zoom_quality != CLUTTER_TEXTURE_QUALITY_HIGH;
+}
+
+static ClutterActor*
+set_item_image(Application *app, ClutterActor *item, Image *image,
+        const CompressedImage *compressed, gboolean thumbnail, GError **error)
+{
+    ClutterActor *view, *old_view;
+    ClutterTableLayout *layout;
+    gfloat xx, yy, w;
+    gboolean use_atlas;
+
+    /* FIXME: SIGBUS when image is larger than 4094
+     * -- workaround is to disable slicing */
+    view = g_object_new(CLUTTER_TYPE_TEXTURE, "disable-slicing", TRUE, NULL);
+    /* image is already scaled for current zoom, filtering is slow without GPU */
+    clutter_texture_set_filter_quality( CLUTTER_TEXTURE(view),
+            app->software_rendering ? CLUTTER_TEXTURE_QUALITY_LOW : app->options.zoom_quality );
+
+    /* thumbnails share few textures */
+    use_atlas = thumbnail && can_use_atlas(app);
+    if ( !(use_atlas && atlas_set_texture(app->atlas, CLUTTER_TEXTURE(view), image, compressed)) &&
+         !clutter_texture_set_from_rgb_data( CLUTTER_TEXTURE(view),
+                image->pixels,
+                image->has_alpha,
+                image->width,
+                image->height,
+                image->rowstride,
+                image->has_alpha ? 4 : 3,
+                CLUTTER_TEXTURE_NONE,
+                error ) )
+    {
+        g_object_unref(view);
+        return NULL;
+    }
+    /* scaled down image takes same space as original */
+    clutter_actor_set_size(view, image->original_width, image->original_height);
+    if ( !atlas_contains(CLUTTER_TEXTURE(view)) )
+        residency_add( app->residency, view, get_texture_size(view) );
+
+    /* save scroll */
+    scrollable_get_scroll(app->viewport, &xx, &yy);
+    w = clutter_actor_get_width(app->viewport);
+
+    layout = CLUTTER_TABLE_LAYOUT( clutter_box_get_layout_manager(CLUTTER_BOX(item)) );
+    clutter_container_add_actor( CLUTTER_CONTAINER(item), view );
+    clutter_table_layout_set_fill( layout, view, FALSE, FALSE );
+    clutter_table_layout_set_expand( layout, view, FALSE, FALSE );
+    /* keep label above image */
+    clutter_actor_lower_bottom(view);
+
+    /* replace image decoded for lower zoom */
+    old_view = g_object_get_data( G_OBJECT(item), "image" );
+    if (old_view)
+        clutter_actor_destroy(old_view);
+    g_object_set_data( G_OBJECT(item), "image", view );
+
+    /* restore scroll */
+    w = (clutter_actor_get_width(app->viewport)-w)/2;
+    if (app->scroll_to_end)
+        scrollable_get_max(app->viewport, NULL, &yy);
+    scrollable_set_scroll(app->viewport, xx+w, yy, 0);
+
+    return view;
+}
+
+/* returns TRUE if GL renderer emulates GPU (needs current GL context) */
+static gboolean
+is_software_renderer(void)
+{
+    typedef const guchar *GetString(guint name);
+    GetString *get_string;
+    const gchar *renderer;
+
+    get_string = (GetString*)cogl_get_proc_address("glGetString");
+    if (!get_string)
+        return FALSE;
+
+    renderer = (const gchar*)get_string(GL_RENDERER);
+    return renderer && ( strstr(renderer, "llvmpipe") ||
+                         strstr(renderer, "softpipe") ||
+                         strstr(renderer, "swrast") ||
+                         strstr(renderer, "Software Rasterizer") );
+}
+
+static gsize
+get_texture_size(ClutterActor *view)
+{
+    gint width, height;
+
+    clutter_texture_get_base_size( CLUTTER_TEXTURE(view), &width, &height );
+    return (gsize)width * height * 4;
+}
+
+/* visible textures and textures near center of window are kept longest */
+static gdouble
+get_texture_priority(ClutterActor *view, Application *app)
+{
+    gfloat x, y, w, h, stage_w, stage_h, dx, dy;
+    gboolean visible;
+
+    clutter_actor_get_transformed_position(view, &x, &y);
+    clutter_actor_get_transformed_size(view, &w, &h);
+    clutter_actor_get_size(app->stage, &stage_w, &stage_h);
+
+    visible = x < stage_w && y < stage_h && x + w > 0 && y + h > 0;
+
+    /* distance from center in window sizes */
+    dx = ABS(x + w/2 - stage_w/2) / MAX(1.0, stage_w);
+    dy = ABS(y + h/2 - stage_h/2) / MAX(1.0, stage_h);
+
+    return (visible ? 1.0 : 0.0) + 1.0 / (1.0 + dx + dy);
+}
+
+/* decodes image again in half resolution to free texture memory */
+static gboolean
+downgrade_texture(ClutterActor *view, Application *app)
+{
+    ClutterActor *item;
+    GPtrArray *jobs;
+    LoadJob *job;
+    const gchar *filename;
+    gdouble *scale;
+    gint width, height;
+
+    /* only images (not animations) which are not too small */
+    item = clutter_actor_get_parent(view);
+    if (!item)
+        return FALSE;
+    /* items prepared for slideshow must stay ready */
+    if ( clutter_actor_get_parent(item) != app->viewport )
+        return FALSE;
+    scale = g_object_get_data( G_OBJECT(item), "scale" );
+    filename = g_object_get_data( G_OBJECT(item), "filename" );
+    clutter_texture_get_base_size( CLUTTER_TEXTURE(view), &width, &height );
+    if ( !scale || !filename || MIN(width, height) < 2 * min_texture_size )
+        return FALSE;
+
+    *scale /= 2;
+    g_object_set_data( G_OBJECT(item), "downgraded", GINT_TO_POINTER(TRUE) );
+
+    job = load_job_new(app, filename, item);
+    job->scale = *scale;
+    job->downgrade = TRUE;
+
+    jobs = g_ptr_array_new();
+    g_ptr_array_add(jobs, job);
+    load_jobs(app, jobs);
+    g_ptr_array_free(jobs, TRUE);
+
+    return TRUE;
+}
+
+/* decodes again images which were decoded for lower zoom */
+static void
+refine_items(Application *app)
+{
+    GList *children, *it;
+    GPtrArray *jobs;
+    ClutterActor *item, *view;
+    const gchar *filename;
+    gdouble *scale, zoom;
+    gboolean thumbnails, preview;
+
+    jobs = g_ptr_array_new();
+    zoom = MIN( 1.0, get_zoom(app->viewport) );
+    thumbnails = get_rows(app) > 1 || get_columns(app) > 1;
+    children = clutter_container_get_children( CLUTTER_CONTAINER(app->viewport) );
+    for( it = children; it; it = it->next ) {
+        item = CLUTTER_ACTOR(it->data);
+        scale = g_object_get_data( G_OBJECT(item), "scale" );
+        filename = g_object_get_data( G_OBJECT(item), "filename" );
+        /* small embedded preview is replaced outside grid mode */
+        preview = !thumbnails && g_object_get_data( G_OBJECT(item), "preview" );
+        /* don't undo downgrade until there is enough texture memory */
+        view = g_object_get_data( G_OBJECT(item), "image" );
+        if ( scale && view && g_object_get_data(G_OBJECT(item), "downgraded") &&
+             !residency_fits(app->residency,
+                 get_texture_size(view) * (zoom / *scale) * (zoom / *scale)) )
+        {
+            continue;
+        }
+        if ( scale && filename && g_object_get_data(G_OBJECT(item), "scalable") ) {
+            refine_vector_item(app, item, jobs);
+            continue;
+        }
+        if ( scale && filename && (*scale < zoom || preview) ) {
+            /* don't request same image again */
+            *scale = MAX(*scale, zoom);
+            g_object_set_data( G_OBJECT(item), "preview", NULL );
+            g_ptr_array_add( jobs, load_job_new(app, filename, item) );
+        }
+    }
+    g_list_free(children);
+
+    load_jobs(app, jobs);
+    g_ptr_array_free(jobs, TRUE);
+}
+
+/* returns zoom rounded up to power of 2 (at least 1) */
+static gdouble
+get_vector_step(const Application *app)
+{
+    gdouble zoom = get_zoom(app->viewport);
+
+    if (zoom <= 1.0)
+        return 1.0;
+    /* tolerance for zoom computed in steps of zoom_increment */
+    return pow( 2.0, ceil(log2(zoom) - 1e-6) );
+}
+
+/*
+ * Returns scale for rendering whole vector item. Zoom is rounded up to
+ * zoom step so that item is not rendered again for each zoom level; size
+ * of rendered item is limited by vector_max_size.
+ */
+static gdouble
+get_vector_scale(const Application *app, ClutterActor *item)
+{
+    ClutterActor *view;
+    gfloat width, height;
+    gdouble zoom, scale;
+
+    zoom = get_zoom(app->viewport);
+    scale = zoom <= 1.0 ? zoom : get_vector_step(app);
+
+    view = g_object_get_data( G_OBJECT(item), "image" );
+    if (view) {
+        clutter_actor_get_size(view, &width, &height);
+        scale = MIN( scale, vector_max_size / MAX(1.0, MAX(width, height)) );
+    }
+
+    return scale;
+}
+
+/* renders vector item again for current zoom (old image is shown until then) */
+static void
+refine_vector_item(Application *app, ClutterActor *item, GPtrArray *jobs)
+{
+    const gchar *filename;
+    gdouble *scale, target;
+
+    scale = g_object_get_data( G_OBJECT(item), "scale" );
+    filename = g_object_get_data( G_OBJECT(item), "filename" );
+
+    target = get_vector_scale(app, item);
+    if (*scale < target) {
+        /* don't request same image again */
+        *scale = target;
+        g_ptr_array_add( jobs, load_job_new(app, filename, item) );
+    }
+
+    add_vector_tiles(app, item, jobs);
+}
+
+/*
+ * Renders visible part of vector item in tiles if zoom step is bigger than
+ * scale of whole rendered item. Tiles are kept for each zoom step until
+ * they are covered by tiles of other step or there are too many of them.
+ */
+static void
+add_vector_tiles(Application *app, ClutterActor *item, GPtrArray *jobs)
+{
+    GHashTable *tiles;
+    GHashTableIter iter;
+    VectorTile *tile;
+    ClutterActor *view;
+    LoadJob *job;
+    const gchar *filename;
+    gfloat x, y, w, h, stage_w, stage_h, width, height;
+    gdouble step, size, *scale;
+    gint x1, y1, x2, y2, tx, ty, generation;
+    gboolean visible, over;
+    gchar *key;
+
+    view = g_object_get_data( G_OBJECT(item), "image" );
+    scale = g_object_get_data( G_OBJECT(item), "scale" );
+    filename = g_object_get_data( G_OBJECT(item), "filename" );
+    step = get_vector_step(app);
+
+    /* whole rendered item is sharp enough */
+    if ( !view || step <= *scale ) {
+        g_object_set_data( G_OBJECT(item), "tiles", NULL );
+        return;
+    }
+
+    /* visible part of item in tiles */
+    clutter_actor_get_transformed_position(view, &x, &y);
+    clutter_actor_get_transformed_size(view, &w, &h);
+    clutter_actor_get_size(view, &width, &height);
+    clutter_actor_get_size(app->stage, &stage_w, &stage_h);
+    if (w <= 0 || h <= 0)
+        return;
+    size = vector_tile_size / step;
+    x1 = floor( MAX(0, -x) * width / w / size );
+    y1 = floor( MAX(0, -y) * height / h / size );
+    x2 = ceil( MIN(width, (stage_w - x) * width / w) / size );
+    y2 = ceil( MIN(height, (stage_h - y) * height / h) / size );
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    tiles = g_object_get_data( G_OBJECT(item), "tiles" );
+    if (!tiles) {
+        tiles = g_hash_table_new_full( g_str_hash, g_str_equal,
+                g_free, (GDestroyNotify)vector_tile_free );
+        g_object_set_data_full( G_OBJECT(item), "tiles", tiles,
+                (GDestroyNotify)g_hash_table_unref );
+    }
+
+    /*
+     * Pending tiles of other steps or dropped jobs are not needed. Tiles
+     * outside window are removed if there would be too many.
+     */
+    generation = g_atomic_int_get(&app->generation);
+    over = g_hash_table_size(tiles) + (guint)((x2 - x1) * (y2 - y1)) > vector_max_tiles;
+    g_hash_table_iter_init(&iter, tiles);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer*)&tile) ) {
+        visible = tile->step == step &&
+            tile->x >= x1 && tile->x < x2 && tile->y >= y1 && tile->y < y2;
+        if ( !tile->view && (tile->step != step || tile->generation != generation) )
+            g_hash_table_iter_remove(&iter);
+        else if (over && !visible)
+            g_hash_table_iter_remove(&iter);
+    }
+
+    for (ty = y1; ty < y2; ++ty) {
+        for (tx = x1; tx < x2; ++tx) {
+            key = g_strdup_printf("%g:%d:%d", step, tx, ty);
+            if ( g_hash_table_contains(tiles, key) ) {
+                g_free(key);
+                continue;
+            }
+
+            tile = g_slice_new0(VectorTile);
+            tile->step = step;
+            tile->x = tx;
+            tile->y = ty;
+            tile->generation = generation;
+            g_hash_table_insert(tiles, key, tile);
+
+            job = load_job_new(app, filename, item);
+            job->tile = g_strdup(key);
+            job->scale = step;
+            job->tile_x = tx * vector_tile_size;
+            job->tile_y = ty * vector_tile_size;
+            g_ptr_array_add(jobs, job);
+        }
+    }
+}
+
+/* returns TRUE if tile is covered by shown tiles of given step */
+static gboolean
+vector_tile_is_covered(GHashTable *tiles, const VectorTile *tile, gdouble step, gfloat width, gfloat height)
+{
+    const VectorTile *cover;
+    gdouble size, cover_size;
+    gint x1, y1, x2, y2, x, y;
+    gchar key[64];
+
+    /* tile region in tiles of given step */
+    size = vector_tile_size / tile->step;
+    cover_size = vector_tile_size / step;
+    x1 = floor(tile->x * size / cover_size);
+    y1 = floor(tile->y * size / cover_size);
+    x2 = ceil( MIN(width, (tile->x + 1) * size) / cover_size );
+    y2 = ceil( MIN(height, (tile->y + 1) * size) / cover_size );
+
+    for (y = y1; y < y2; ++y) {
+        for (x = x1; x < x2; ++x) {
+            g_snprintf(key, sizeof(key), "%g:%d:%d", step, x, y);
+            cover = g_hash_table_lookup(tiles, key);
+            if (!cover || !cover->view)
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* shows rendered tile above whole vector item */
+static void
+show_vector_tile(Application *app, LoadJob *job)
+{
+    GHashTable *tiles;
+    GHashTableIter iter;
+    VectorTile *tile, *other;
+    ClutterActor *image, *view = NULL;
+    ClutterTableLayout *layout;
+    GError *error = job->error;
+    gfloat width, height, x, y, w, h;
+
+    job->error = NULL;
+    tiles = g_object_get_data( G_OBJECT(job->item), "tiles" );
+    tile = tiles ? g_hash_table_lookup(tiles, job->tile) : NULL;
+    image = g_object_get_data( G_OBJECT(job->item), "image" );
+
+    /* zoom changed since tile was requested */
+    if (!tile || tile->view || !image) {
+        g_clear_error(&error);
+        return;
+    }
+
+    if (job->image) {
+        view = g_object_new(CLUTTER_TYPE_TEXTURE, "disable-slicing", TRUE, NULL);
+        clutter_texture_set_filter_quality( CLUTTER_TEXTURE(view),
+                app->software_rendering ? CLUTTER_TEXTURE_QUALITY_LOW : app->options.zoom_quality );
+        if ( !clutter_texture_set_from_rgb_data( CLUTTER_TEXTURE(view),
+                    job->image->pixels,
+                    job->image->has_alpha,
+                    job->image->width,
+                    job->image->height,
+                    job->image->rowstride,
+                    job->image->has_alpha ? 4 : 3,
+                    CLUTTER_TEXTURE_NONE,
+                    error ? NULL : &error ) )
+        {
+            g_object_unref(view);
+            view = NULL;
+        }
+    }
+    if (!view) {
+        if (!error) {
+            g_set_error(&error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                    "Failed to render tile of '%s'", job->filename);
+        }
+        g_printerr("imagepeek: %s\n", error->message);
+        g_error_free(error);
+        /* tile is requested again after next zoom */
+        g_hash_table_remove(tiles, job->tile);
+        return;
+    }
+    g_clear_error(&error);
+
+    /* tile covers its region of item (image and tile are centered in item) */
+    clutter_actor_get_size(image, &width, &height);
+    x = tile->x * vector_tile_size / tile->step;
+    y = tile->y * vector_tile_size / tile->step;
+    w = job->image->width / tile->step;
+    h = job->image->height / tile->step;
+    clutter_actor_set_size(view, w, h);
+    clutter_actor_set_anchor_point( view, -(x + (w - width) / 2), -(y + (h - height) / 2) );
+
+    layout = CLUTTER_TABLE_LAYOUT( clutter_box_get_layout_manager(CLUTTER_BOX(job->item)) );
+    clutter_container_add_actor( CLUTTER_CONTAINER(job->item), view );
+    clutter_table_layout_set_fill( layout, view, FALSE, FALSE );
+    clutter_table_layout_set_expand( layout, view, FALSE, FALSE );
+    /* above whole image, below label */
+    clutter_actor_raise(view, image);
+    tile->view = g_object_ref(view);
+
+    /* tiles of other steps are removed when they are covered */
+    g_hash_table_iter_init(&iter, tiles);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer*)&other) ) {
+        if ( other->step != tile->step && other->view &&
+             vector_tile_is_covered(tiles, other, tile->step, width, height) )
+        {
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+}
+
+static void
+vector_tile_free(VectorTile *tile)
+{
+    if (tile->view) {
+        clutter_actor_destroy(tile->view);
+        g_object_unref(tile->view);
+    }
+    g_slice_free(VectorTile, tile);
+}
+
+static void
+show_loaded(Application *app, LoadJob *job)
+{
+    ClutterActor *text, *view;
+    GError *error = job->error;
+    gdouble *scale;
+    gboolean refined;
+    gint64 start;
+
+    if (job->tile) {
+        show_vector_tile(app, job);
+        return;
+    }
+
+    /* item already shows image decoded for lower zoom */
+    scale = g_object_get_data( G_OBJECT(job->item), "scale" );
+    refined = scale != NULL;
+    if (refined && job->scale < *scale)
+        return;
+
+    job->error = NULL;
+    if (job->image) {
+        watchdog_enter(app->watchdog, WatchdogUpload, job->filename);
+        start = g_get_monotonic_time();
+        view = set_item_image( app, job->item, job->image, job->compressed,
+                job->thumbnail && !job->animation, &error );
+        metrics_observe( app->metrics, MetricsUploadTime,
+                g_get_monotonic_time() - start );
+        watchdog_leave(app->watchdog);
+        if (view && job->animation) {
+            animation_start(job->animation, view);
+        } else if (view) {
+            /* small preview is good enough for thumbnails at this zoom */
+            scale = g_new(gdouble, 1);
+            *scale = job->preview || job->image->scalable ? job->scale
+                : (gdouble)job->image->width / job->image->original_width;
+            g_object_set_data_full( G_OBJECT(job->item), "scale", scale, g_free );
+            /* vector image is rendered again for higher zoom */
+            if (job->image->scalable)
+                g_object_set_data( G_OBJECT(job->item), "scalable", GINT_TO_POINTER(TRUE) );
+            g_object_set_data( G_OBJECT(job->item), "preview",
+                    GINT_TO_POINTER(job->preview) );
+        }
+        if (view) {
+            if (app->trace_player) {
+                trace_player_add_latency( app->trace_player,
+                        g_get_monotonic_time() - job->queue_time );
+            }
+            g_object_set_data( G_OBJECT(job->item), "decode_time",
+                    GINT_TO_POINTER( (gint)MIN(job->decode_time, G_MAXINT) ) );
+            if (job->preview)
+                ++app->preview_count;
+            else
+                ++app->decode_count;
+            metrics_add(app->metrics, MetricsItemsLoaded, 1);
+            if (job->preview)
+                metrics_add(app->metrics, MetricsPreviews, 1);
+            if (job->compare_filename)
+                show_compare_stats(app, job);
+        }
+    } else if ( g_error_matches(error, DECODER_ERROR, DECODER_ERROR_CANCELLED) ) {
+        g_clear_error(&error);
+    } else if (!error)
+        g_set_error(&error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                "Failed to load image '%s'", job->filename);
+
+    if (error) {
+        g_printerr("imagepeek: %s\n", error->message);
+        g_error_free(error);
+        metrics_add(app->metrics, MetricsLoadErrors, 1);
+
+        /* image decoded for lower zoom is kept */
+        text = g_object_get_data( G_OBJECT(job->item), "label" );
+        if (!refined && text)
+            clutter_text_set_color( CLUTTER_TEXT(text), &app->options.error_color );
+        else if (!refined)
+            add_item_label(app, job->item, job->filename, FALSE);
+    }
+}
+
+static gboolean
+dispatch_loaded(Application *app)
+{
+    LoadJob *job;
+    DocumentPages document;
+
+    g_atomic_int_set(&app->loaded_pending, FALSE);
+
+    /* drop outdated jobs and jobs for removed items */
+    while ( (job = g_async_queue_try_pop(app->loaded)) ) {
+        /*
+         * pages of loaded placeholders are added at once when other jobs
+         * are dispatched (placeholder index is checked later since page
+         * could have changed); indices of running slideshow must stay
+         * valid (placeholder is expanded when it's shown after slideshow
+         * stops)
+         */
+        if (job->pages > 1) {
+            if ( app->compare || slideshow_is_running(app->slideshow) ) {
+                load_job_free(job);
+                continue;
+            }
+            document.index = job->index;
+            document.path = job->filename;
+            document.pages = job->pages;
+            job->filename = NULL;
+            g_array_append_val(app->documents, document);
+            if (!app->expand_id) {
+                app->expand_id = clutter_threads_add_idle_full( G_PRIORITY_LOW,
+                        (GSourceFunc)expand_documents, app, NULL );
+            }
+        } else if ( !load_job_is_stale(job) && (job->slideshow ||
+             clutter_actor_get_parent(job->item) == app->viewport) )
+        {
+            show_loaded(app, job);
+            /* item prepared for slideshow can be shown in its slot */
+            if (job->slideshow) {
+                slideshow_set_ready( app->slideshow, GPOINTER_TO_UINT(
+                        g_object_get_data(G_OBJECT(job->item), "slideshow-index") ) );
+            }
+        }
+        /* slow image is saved in background after it's shown */
+        if (job->unsaved) {
+            if (job->image == job->unsaved)
+                job->image = NULL;
+            pixel_cache_save(app->pixel_cache, job->filename, job->unsaved);
+            job->unsaved = NULL;
+        }
+        load_job_free(job);
+    }
+
+    return FALSE;
+}
+
+/* drops placeholders waiting for expansion */
+static void
+free_documents(Application *app)
+{
+    guint i;
+
+    for (i = 0; i < app->documents->len; ++i)
+        g_free( g_array_index(app->documents, DocumentPages, i).path );
+    g_array_set_size(app->documents, 0);
+}
+
+static gint
+compare_document_pages(gconstpointer a, gconstpointer b)
+{
+    const DocumentPages *x = a, *y = b;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/* returns index of item after documents are expanded (sorted by index) */
+static guint
+get_expanded_index(GArray *documents, guint index)
+{
+    const DocumentPages *document;
+    guint i, expanded = index;
+
+    for (i = 0; i < documents->len; ++i) {
+        document = &g_array_index(documents, DocumentPages, i);
+        if (document->index >= index)
+            break;
+        expanded += document->pages - 1;
+    }
+
+    return expanded;
+}
+
+/*
+ * Replaces loaded placeholders of documents with their pages (current item
+ * stays on screen). Items are reloaded and background jobs restarted once
+ * for all documents loaded in the meantime.
+ */
+static gboolean
+expand_documents(Application *app)
+{
+    GArray *documents = app->documents;
+    DocumentPages *document;
+    GPtrArray *pages;
+    guint *indices, *counts;
+    gchar *path;
+    guint current, offset, count, i, j;
+    gchar *query = NULL;
+    gboolean resort = FALSE, reindex = FALSE;
+
+    app->expand_id = 0;
+    if ( app->compare || slideshow_is_running(app->slideshow) ) {
+        free_documents(app);
+        return FALSE;
+    }
+
+    /* drop documents which are no longer at their index or duplicate */
+    g_array_sort(documents, compare_document_pages);
+    count = path_store_get_count(app->items);
+    for (i = 0, j = 0; i < documents->len; ++i) {
+        document = &g_array_index(documents, DocumentPages, i);
+        path = document->index < count ? path_store_get(app->items, document->index) : NULL;
+        if ( path && strcmp(path, document->path) == 0 &&
+             (j == 0 || g_array_index(documents, DocumentPages, j - 1).index != document->index) )
+        {
+            g_array_index(documents, DocumentPages, j++) = *document;
+        } else {
+            g_free(document->path);
+        }
+        g_free(path);
+    }
+    g_array_set_size(documents, j);
+    if (documents->len == 0)
+        return FALSE;
+
+    /* background jobs read items (they are started again) */
+    if (app->filter_query)
+        query = g_strdup(app->filter_query);
+    filter_cancel(app->filter);
+    app->search_id = 0;
+    if (app->sort_id != 0) {
+        sorter_cancel(app->sorter);
+        app->sort_id = 0;
+        resort = TRUE;
+    }
+    if (app->hash_id != 0 || app->hashes) {
+        hasher_cancel(app->hasher);
+        app->hash_id = 0;
+        reindex = TRUE;
+    }
+
+    current = get_item_index( app, get_current_offset(app) );
+
+    /* all documents are replaced in one pass over item list */
+    indices = g_new(guint, documents->len);
+    counts = g_new(guint, documents->len);
+    pages = g_ptr_array_new_with_free_func(g_free);
+    for (i = 0; i < documents->len; ++i) {
+        document = &g_array_index(documents, DocumentPages, i);
+        indices[i] = document->index;
+        counts[i] = document->pages;
+        for (j = 0; j < (guint)document->pages; ++j)
+            g_ptr_array_add( pages, pages_get_item(document->path, j + 1) );
+    }
+    path_store_replace_many( app->items, indices, counts, documents->len,
+            (const gchar * const *)pages->pdata );
+    g_ptr_array_free(pages, TRUE);
+    g_free(indices);
+    g_free(counts);
+
+    /* first page of document takes place of placeholder */
+    if (app->visible) {
+        for (i = 0; i < app->visible->count; ++i) {
+            app->visible->indices[i] =
+                get_expanded_index(documents, app->visible->indices[i]);
+        }
+        offset = filter_result_find( app->visible, get_expanded_index(documents, current) );
+    } else {
+        offset = get_expanded_index(documents, current);
+    }
+
+    free_documents(app);
+
+    set_current_offset(app, offset);
+    reload(app);
+
+    if (reindex)
+        index_items(app);
+    if (resort)
+        sort_items(app);
+    if (query) {
+        filter_items(app, query);
+        g_free(query);
+    }
+
+    return FALSE;
+}
+
+static LoadJob*
+load_image(Application *app, const char *filename, const char *compare_filename, gint x, gint y)
+{
+    ClutterActor *item;
+
+    /* empty item is shown until image is decoded */
+    item = clutter_box_new( clutter_table_layout_new() );
+    if ( get_rows(app) > 1 || get_columns(app) > 1 || compare_filename )
+        add_item_label(app, item, filename, TRUE);
+    g_object_set_data_full( G_OBJECT(item), "filename", g_strdup(filename), g_free );
+    if (compare_filename) {
+        g_object_set_data_full( G_OBJECT(item), "compare-filename",
+                g_strdup(compare_filename), g_free );
+    }
+    pack_item(app, item, x, y);
+
+    return load_job_new(app, filename, item);
+}
+
+static void
+clean_container(ClutterActor *actor)
+{
+    GList *children, *it;
+
+    children = clutter_container_get_children( CLUTTER_CONTAINER(actor) );
+    for( it = children; it; it = it->next )
+        clutter_container_remove_actor( CLUTTER_CONTAINER(actor), CLUTTER_ACTOR(it->data) );
+    g_list_free(children);
+}
+
+static void
+crop_container(ClutterActor *actor, guint n)
+{
+    GList *children, *it;
+
+    children = clutter_container_get_children( CLUTTER_CONTAINER(actor) );
+    it = g_list_nth(children, n);
+    for( ; it; it = it->next )
+        clutter_container_remove_actor( CLUTTER_CONTAINER(actor), CLUTTER_ACTOR(it->data) );
+    g_list_free(children);
+}
+
+static void
+clean_items(Application *app)
+{
+    /* clean container, cancel loading and reset scroll offset */
+    g_atomic_int_inc(&app->generation);
+    clean_container(app->viewport);
+    scrollable_set_scroll( app->viewport, 0, 0, 0 );
+    app->count = 0;
+}
+
+static void
+load_images(Application *app)
+{
+    GPtrArray *jobs;
+    LoadJob *job;
+    gchar *filename, *compare_filename;
+    guint i, x, columns, rows;
+    gint y;
+
+    jobs = g_ptr_array_new();
+
+    columns = get_columns(app);
+    rows = get_rows(app);
+    y = clutter_table_layout_get_row_count( CLUTTER_TABLE_LAYOUT(app->layout) )-1;
+
+    for (;;) {
+        i = get_current_offset(app) + app->count;
+        x = app->count % columns;
+
+        if( i >= get_count(app) )
+            break;
+
+        if (x == 0) {
+            ++y;
+            if (y >= (gint)rows)
+                break;
+        }
+
+        ++app->count;
+        filename = get_item(app, i);
+        /* item is followed by its pair in compare mode */
+        compare_filename = app->compare
+            ? path_store_get( app->items, get_item_index(app, i) + 1 ) : NULL;
+        job = load_image(app, filename, compare_filename, x, y);
+        /*
+         * shown document is expanded to pages (compared pairs are kept and
+         * slideshow shows first page)
+         */
+        job->expand = !app->compare && job->document &&
+            strcmp(job->document, filename) == 0 &&
+            !slideshow_is_running(app->slideshow);
+        job->index = get_item_index(app, i);
+        g_ptr_array_add(jobs, job);
+        g_free(filename);
+        g_free(compare_filename);
+    }
+
+    /* whole page is read in one batch */
+    load_jobs(app, jobs);
+    g_ptr_array_free(jobs, TRUE);
+
+    prefetch_items(app);
+}
+
+static void
+update_title(Application *app)
+{
+    GString *title;
+    gchar* title2;
+    gchar *filename;
+    typeInteger count, current;
+
+    /* set window title */
+    count = get_count(app);
+    current = get_current_offset(app);
+    filename = get_item(app, current);
+    title = g_string_new("");
+    g_string_printf(title, "[%d/%d] %s - imagepeek",
+            (int)current+1, (int)count, filename );
+    if (app->visible && app->filter_query)
+        g_string_append_printf(title, " [filter: %s]", app->filter_query);
+    if (app->options.sort_order != SortNone)
+        g_string_append_printf(title, " [sort: %s]", app->options.sort);
+    g_free(filename);
+    title2 = g_string_free(title, FALSE);
+    clutter_stage_set_title( CLUTTER_STAGE(app->stage), title2 );
+    g_free(title2);
+}
+
+static void
+load_more(Application *app)
+{
+    guint r1, c1, r2, c2;
+
+    r1 = clutter_table_layout_get_row_count( CLUTTER_TABLE_LAYOUT(app->layout) );
+    c1 = clutter_table_layout_get_column_count( CLUTTER_TABLE_LAYOUT(app->layout) );
+    r2 = get_rows(app);
+    c2 = get_columns(app);
+
+    if ( (r1 > r2 && c1 == c2) || (c1 > c2 && r1 == r2 && r2 == 1) ) {
+        /* remove last items */
+        app->count = r2*c2;
+        crop_container(app->viewport, r2*c2);
+        /* replace thumbnails if grid mode ended */
+        refine_items(app);
+    } else if (r1 != r2 || c1 != c2) {
+        if ( r1 == 0 || (r1 > 1 && c1 != c2) || (r1 != r2 && c1 != c2) ) {
+            /* reaload all items */
+            clean_items(app);
+            update_title(app);
+        }
+
+        load_images(app);
+    }
+}
+
+static gboolean
+reload_now(Application *app)
+{
+    app->reload_id = 0;
+    clean_items(app);
+    load_more(app);
+
+    return FALSE;
+}
+
+static void
+reload(Application *app)
+{
+    /* cancel pending loads immediately but load new page only once per
+     * frame so that fast repeated navigation loads only the last page */
+    g_atomic_int_inc(&app->generation);
+    app->scroll_to_end = FALSE;
+    if (!app->reload_id) {
+        app->reload_id = clutter_threads_add_idle_full( CLUTTER_PRIORITY_REDRAW - 1,
+                (GSourceFunc)reload_now, app, NULL );
+    }
+}
+
+static void
+load_next(Application *app)
+{
+    typeInteger offset, items_on_page, count;
+
+    offset = get_current_offset(app);
+    items_on_page = get_rows(app) * get_columns(app);
+    count = get_count(app);
+
+    offset += items_on_page;
+    if ( offset < count ) {
+        if ( offset >= count )
+            offset = count - items_on_page;
+        set_current_offset(app, offset);
+        reload(app);
+    }
+}
+
+static void
+load_prev(Application *app)
+{
+    typeInteger offset, items_on_page;
+
+    offset = get_current_offset(app);
+    items_on_page = get_rows(app) * get_columns(app);
+
+    if ( offset >= items_on_page ) {
+        offset -= get_rows(app) * get_columns(app);
+    } else if ( offset > 0 ) {
+        offset = 0;
+    } else {
+        return;
+    }
+
+    set_current_offset(app, offset);
+    reload(app);
+}
+
+static void
+set_sort_order(Application *app, SortOrder order, gboolean descending)
+{
+    gchar *sort;
+
+    sort = g_strconcat( descending ? "-" : "", sort_order_to_string(order), NULL );
+    set_sort(app, sort);
+    g_free(sort);
+
+    sort_items(app);
+}
+
+/* sorts items in background (current item stays on screen) */
+static void
+sort_items(Application *app)
+{
+    if (app->options.sort_order == SortNone || !app->items)
+        return;
+
+    /* previous sort is cancelled */
+    app->sort_id = sorter_start( app->sorter, app->items,
+            app->options.sort_order, app->options.sort_descending );
+}
+
+static void
+on_sort_done(SortResult *result, Application *app)
+{
+    clutter_threads_add_idle( (GSourceFunc)show_sort_result, result );
+}
+
+static gint
+compare_indices(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    guint32 x = *(const guint32 *)a, y = *(const guint32 *)b;
+    return (x > y) - (x < y);
+}
+
+static gboolean
+show_sort_result(SortResult *result)
+{
+    Application *app = result->user_data;
+    guint32 *position;
+    guint current, offset, i;
+    gchar *query = NULL;
+    gboolean reindex = FALSE;
+
+    /* drop results of replaced sorts */
+    if (result->id != app->sort_id) {
+        sort_result_free(result);
+        return FALSE;
+    }
+    app->sort_id = 0;
+
+    /* pending search reads items (filter is started again) */
+    if (app->search_id != 0 && app->search_mode == PromptFilter)
+        query = g_strdup(app->filter_query);
+    filter_cancel(app->filter);
+    app->search_id = 0;
+
+    /* pending hashing reads items too */
+    if (app->hash_id != 0) {
+        hasher_cancel(app->hasher);
+        app->hash_id = 0;
+        reindex = TRUE;
+    }
+    if (app->comparer)
+        comparer_cancel(app->comparer);
+
+    current = get_item_index( app, get_current_offset(app) );
+
+    /* new position of each item */
+    position = g_new(guint32, MAX(result->count, 1));
+    for (i = 0; i < result->count; ++i)
+        position[result->order[i]] = i;
+    path_store_reorder(app->items, result->order);
+    if (app->hashes)
+        hash_result_reorder(app->hashes, result->order);
+
+    if (app->visible) {
+        for (i = 0; i < app->visible->count; ++i)
+            app->visible->indices[i] = position[app->visible->indices[i]];
+        g_qsort_with_data( app->visible->indices, app->visible->count,
+                sizeof(guint32), compare_indices, NULL );
+        offset = filter_result_find(app->visible, position[current]);
+    } else {
+        offset = position[current];
+    }
+
+    g_free(position);
+    sort_result_free(result);
+
+    set_current_offset(app, offset);
+    reload(app);
+    restart_slideshow(app);
+
+    /* runs of similar items change with order */
+    if (reindex)
+        index_items(app);
+    else if (app->collapse && app->hashes)
+        collapse_items(app);
+
+    /* pairs of adjacent items change with order */
+    if (app->compare) {
+        compare_items(app);
+        start_compare(app);
+    }
+
+    if (query) {
+        filter_items(app, query);
+        g_free(query);
+    }
+
+    return FALSE;
+}
+
+/* shows only visible items (all if NULL), current item stays if possible */
+static void
+set_visible(Application *app, FilterResult *visible)
+{
+    guint current;
+
+    current = get_item_index( app, get_current_offset(app) );
+    if (app->visible)
+        filter_result_free(app->visible);
+    app->visible = visible;
+
+    set_current_offset( app, visible ? filter_result_find(visible, current) : current );
+    reload(app);
+    restart_slideshow(app);
+}
+
+static void
+filter_items(Application *app, const gchar *query)
+{
+    GError *error = NULL;
+
+    g_free(app->filter_query);
+    app->filter_query = NULL;
+
+    if (query[0] == '\0') {
+        filter_cancel(app->filter);
+        app->search_id = 0;
+        /* collapsed list and compared pairs are kept */
+        if (app->visible && !app->collapse && !app->compare)
+            set_visible(app, NULL);
+        prompt_update(app, NULL);
+        return;
+    }
+
+    /* previous search is cancelled */
+    app->search_mode = PromptFilter;
+    app->search_id = filter_start(app->filter, app->items, query, &error);
+    if (error) {
+        prompt_update(app, error->message);
+        g_error_free(error);
+        return;
+    }
+    app->filter_query = g_strdup(query);
+}
+
+/* jumps to item number or to next item matching query */
+static void
+jump_to(Application *app, const gchar *query)
+{
+    GError *error = NULL;
+    gchar *end;
+    guint64 n;
+
+    n = g_ascii_strtoull(query, &end, 10);
+    if (end != query && *end == '\0') {
+        if ( n < 1 || n > (guint64)get_count(app) ) {
+            prompt_update(app, "out of range");
+            return;
+        }
+        prompt_hide(app);
+        set_current_offset(app, n - 1);
+        reload(app);
+        return;
+    }
+
+    app->search_mode = PromptJump;
+    app->search_id = filter_start(app->filter, app->items, query, &error);
+    if (error) {
+        prompt_update(app, error->message);
+        g_error_free(error);
+        return;
+    }
+    prompt_update(app, "searching");
+}
+
+static void
+jump_to_result(Application *app, const FilterResult *result)
+{
+    guint32 index;
+    guint i, n, offset;
+
+    /* first match after current item (wraps around) */
+    i = filter_result_find( result, get_item_index(app, get_current_offset(app)) + 1 );
+    for (n = 0; n < result->count; ++n) {
+        index = result->indices[(i + n) % result->count];
+        if (!app->visible) {
+            offset = index;
+            break;
+        }
+        /* match must pass filter */
+        offset = filter_result_find(app->visible, index);
+        if ( offset < app->visible->count && app->visible->indices[offset] == index )
+            break;
+    }
+
+    if (n == result->count) {
+        prompt_update(app, "no match");
+        return;
+    }
+
+    prompt_hide(app);
+    if ( offset != (guint)get_current_offset(app) ) {
+        set_current_offset(app, offset);
+        reload(app);
+    }
+}
+
+static void
+on_search_done(FilterResult *result, Application *app)
+{
+    clutter_threads_add_idle( (GSourceFunc)show_search_result, result );
+}
+
+static gboolean
+show_search_result(FilterResult *result)
+{
+    Application *app = result->user_data;
+    gchar *status;
+
+    /* drop results of replaced searches */
+    if (result->id != app->search_id) {
+        filter_result_free(result);
+        return FALSE;
+    }
+    app->search_id = 0;
+
+    if (app->search_mode == PromptJump) {
+        jump_to_result(app, result);
+        filter_result_free(result);
+    } else if (result->count == 0) {
+        /* keep previous items */
+        prompt_update(app, "no match");
+        filter_result_free(result);
+    } else {
+        status = g_strdup_printf( "%u of %u", result->count,
+                path_store_get_count(app->items) );
+        prompt_update(app, status);
+        g_free(status);
+        /* filtered list replaces collapsed list and compared pairs */
+        app->collapse = FALSE;
+        if (app->compare && app->comparer)
+            comparer_cancel(app->comparer);
+        app->compare = FALSE;
+        app->jump_difference_pending = FALSE;
+        set_visible(app, result);
+    }
+
+    return FALSE;
+}
+
+static void
+prompt_show(Application *app, PromptMode mode, const gchar *text)
+{
+    if (!app->prompt) {
+        app->prompt = clutter_text_new_full(app->options.item_font, "", &app->options.text_color);
+        clutter_container_add_actor( CLUTTER_CONTAINER(app->stage), app->prompt );
+        clutter_actor_add_constraint( app->prompt,
+                clutter_align_constraint_new(app->stage, CLUTTER_ALIGN_Y_AXIS, 1.0) );
+    }
+
+    app->prompt_mode = mode;
+    g_string_assign(app->query, text ? text : "");
+    prompt_update(app, NULL);
+    clutter_actor_show(app->prompt);
+    clutter_actor_raise_top(app->prompt);
+}
+
+static void
+prompt_hide(Application *app)
+{
+    app->prompt_mode = PromptNone;
+    clutter_actor_hide(app->prompt);
+}
+
+static void
+prompt_update(Application *app, const gchar *status)
+{
+    gchar *text;
+
+    if (app->prompt_mode == PromptNone)
+        return;
+
+    text = g_strdup_printf( "%s: %s_%s%s",
+            app->prompt_mode == PromptFilter ? "Filter" : "Go to",
+            app->query->str, status ? "    " : "", status ? status : "" );
+    clutter_text_set_text( CLUTTER_TEXT(app->prompt), text );
+    g_free(text);
+}
+
+static gboolean
+prompt_on_key_press(Application *app, ClutterEvent *event)
+{
+    gunichar c;
+
+    switch ( clutter_event_get_key_symbol(event) )
+    {
+        case CLUTTER_KEY_Escape:
+            /* cancel (and remove filter) */
+            if (app->prompt_mode == PromptFilter)
+                filter_items(app, "");
+            app->search_id = 0;
+            prompt_hide(app);
+            break;
+
+        case CLUTTER_KEY_KP_Enter:
+        case CLUTTER_KEY_Return:
+            if (app->prompt_mode == PromptJump)
+                jump_to(app, app->query->str);
+            else
+                prompt_hide(app);
+            break;
+
+        case CLUTTER_KEY_BackSpace:
+            if (app->query->len == 0)
+                break;
+            g_string_truncate( app->query,
+                    g_utf8_prev_char(app->query->str + app->query->len) - app->query->str );
+            if (app->prompt_mode == PromptFilter)
+                filter_items(app, app->query->str);
+            else
+                prompt_update(app, NULL);
+            break;
+
+        default:
+            c = clutter_event_get_key_unicode(event);
+            if ( !g_unichar_isprint(c) )
+                break;
+            g_string_append_unichar(app->query, c);
+            if (app->prompt_mode == PromptFilter)
+                filter_items(app, app->query->str);
+            else
+                prompt_update(app, NULL);
+    }
+
+    return TRUE;
+}
+
+static gboolean
+on_key_press(ClutterActor *stage,
+        ClutterEvent *event,
+        gpointer      user_data)
+{
+    Application *app;
+    guint keyval;
+    gdouble s, s2;
+
+    app = (Application *)user_data;
+    ClutterModifierType state = clutter_event_get_state(event);
+    keyval = clutter_event_get_key_symbol (event);
+
+    /* text input */
+    if (app->prompt_mode != PromptNone)
+        return prompt_on_key_press(app, event);
+
+    switch (keyval)
+    {
+        /* zoom in/out */
+        case CLUTTER_KEY_KP_Add:
+            s = get_zoom(app->viewport);
             if (s <= app->options.zoom_increment)
                 s *= 1.0 + app->options.zoom_increment;
             else
-                s += app->options.zoom_increment;
-            set_zoom_simple(app, s);
+                s += app->options.zoom_increment;
+            set_zoom_simple(app, s);
+            break;
+        case CLUTTER_KEY_KP_Subtract:
+            s = get_zoom(app->viewport);
+            if (s <= app->options.zoom_increment)
+                s /= 1.0 + app->options.zoom_increment;
+            else
+                s -= app->options.zoom_increment;
+            set_zoom_simple(app, s);
+            break;
+        case CLUTTER_KEY_KP_9:
+        case CLUTTER_KEY_KP_8:
+        case CLUTTER_KEY_KP_7:
+        case CLUTTER_KEY_KP_6:
+        case CLUTTER_KEY_KP_5:
+        case CLUTTER_KEY_KP_4:
+        case CLUTTER_KEY_KP_3:
+        case CLUTTER_KEY_KP_2:
+        case CLUTTER_KEY_KP_1:
+        case CLUTTER_KEY_9:
+        case CLUTTER_KEY_8:
+        case CLUTTER_KEY_7:
+        case CLUTTER_KEY_6:
+        case CLUTTER_KEY_5:
+        case CLUTTER_KEY_4:
+        case CLUTTER_KEY_3:
+        case CLUTTER_KEY_2:
+        case CLUTTER_KEY_1:
+            if (keyval > CLUTTER_KEY_KP_0 && keyval <= CLUTTER_KEY_KP_9 )
+                s = (gdouble)(keyval - CLUTTER_KEY_KP_0);
+            else
+                s = (gdouble)(keyval - CLUTTER_KEY_0);
+            if (state & CLUTTER_CONTROL_MASK)
+                s = 1.0/s;
+            set_zoom_simple(app, s);
+            break;
+
+        /* zoom to fit vertically/horizontally */
+        case CLUTTER_KEY_w:
+            s = clutter_actor_get_width(stage)/clutter_actor_get_width(app->viewport);
+            set_zoom_simple(app, s);
+            break;
+        case CLUTTER_KEY_h:
+            s = clutter_actor_get_height(stage)/clutter_actor_get_height(app->viewport);
+            set_zoom_simple(app, s);
+            break;
+
+        /* zoom to fit */
+        case CLUTTER_KEY_0:
+        case CLUTTER_KEY_KP_0:
+        case CLUTTER_KEY_KP_Divide:
+            s = clutter_actor_get_width(stage)/clutter_actor_get_width(app->viewport);
+            s2 = clutter_actor_get_height(stage)/clutter_actor_get_height(app->viewport);
+            if ( s > s2 ) s = s2;
+            set_zoom_simple(app, s);
+            break;
+
+        /* zoom reset */
+        case CLUTTER_KEY_KP_Multiply:
+            set_zoom_simple(app, 1.0);
+            break;
+
+        /* sharpen filter strength */
+        case CLUTTER_KEY_a:
+            set_sharpen( app, get_sharpen(app) + 0.05 );
+            break;
+        case CLUTTER_KEY_z:
+            set_sharpen( app, get_sharpen(app) - 0.05 );
+            break;
+
+        /* fullscreen */
+        case CLUTTER_KEY_f:
+        case CLUTTER_KEY_F:
+            set_fullscreen( app, !get_fullscreen(app) );
+            break;
+
+        /* next page */
+        case CLUTTER_KEY_n:
+        case CLUTTER_KEY_KP_Enter:
+        case CLUTTER_KEY_Return:
+            load_next(app);
+            break;
+        case CLUTTER_KEY_Right:
+            if ( (gint)clutter_actor_get_width(stage) >= (gint)(clutter_actor_get_width(app->viewport)*get_zoom(app->viewport)) )
+                load_next(app);
+            break;
+        case CLUTTER_KEY_Down:
+            if ( (gint)clutter_actor_get_height(stage) >= (gint)(clutter_actor_get_height(app->viewport)*get_zoom(app->viewport)) )
+                load_next(app);
+            break;
+
+        /* prev page */
+        case CLUTTER_KEY_p:
+        case CLUTTER_KEY_N:
+        case CLUTTER_KEY_b:
+        case CLUTTER_KEY_BackSpace:
+            load_prev(app);
+            break;
+        case CLUTTER_KEY_Left:
+            if ( (gint)clutter_actor_get_width(stage) >= (gint)(clutter_actor_get_width(app->viewport)*get_zoom(app->viewport)) )
+                load_prev(app);
+            break;
+        case CLUTTER_KEY_Up:
+            if ( (gint)clutter_actor_get_height(stage) >= (gint)(clutter_actor_get_height(app->viewport)*get_zoom(app->viewport)) )
+                load_prev(app);
+            break;
+
+        case CLUTTER_KEY_space:
+            if ( state & CLUTTER_SHIFT_MASK ) {
+        case CLUTTER_KEY_k:
+                if (get_current_offset(app) == 0) break;
+                load_prev(app);
+                /* scroll to bottom as images are loaded */
+                app->scroll_to_end = TRUE;
+            } else {
+        case CLUTTER_KEY_j:
+                load_next(app);
+            }
+            break;
+
+        case CLUTTER_KEY_Home:
+            if ( state & CLUTTER_SHIFT_MASK ) {
+                if ( get_current_offset(app) != 0 ) {
+                    set_current_offset(app, 0);
+                    reload(app);
+                }
+            }
+            break;
+        case CLUTTER_KEY_End:
+            if ( state & CLUTTER_SHIFT_MASK ) {
+                typeInteger offset = get_count(app) -
+                    get_rows(app) * get_columns(app);
+                if ( offset > get_current_offset(app) ) {
+                    set_current_offset(app, offset);
+                    reload(app);
+                }
+            }
+            break;
+
+        /* shift items on page */
+        case CLUTTER_KEY_S:
+        case CLUTTER_KEY_s:
+            set_current_offset( app, get_current_offset(app) +
+                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
+            reload(app);
+            break;
+
+        /* add rows/columns */
+        case CLUTTER_KEY_r:
+        case CLUTTER_KEY_R:
+            set_rows( app, get_rows(app) +
+                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
+            load_more(app);
+            break;
+        case CLUTTER_KEY_c:
+        case CLUTTER_KEY_C:
+            set_columns( app, get_columns(app) +
+                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
+            load_more(app);
+            break;
+
+        /* sort order (SHIFT to reverse) */
+        case CLUTTER_KEY_o:
+        case CLUTTER_KEY_O:
+            if (state & CLUTTER_SHIFT_MASK) {
+                set_sort_order( app, MAX(SortName, app->options.sort_order),
+                        !app->options.sort_descending );
+            } else {
+                set_sort_order( app,
+                        app->options.sort_order % (SortOrderCount - 1) + 1,
+                        app->options.sort_descending );
+            }
+            break;
+
+        /* slideshow (SHIFT to toggle shuffle) */
+        case CLUTTER_KEY_t:
+        case CLUTTER_KEY_T:
+            if (state & CLUTTER_SHIFT_MASK) {
+                set_slideshow_shuffle( app, !get_slideshow_shuffle(app) );
+            } else {
+                set_slideshow( app, !get_slideshow(app) );
+                update_slideshow(app);
+            }
+            break;
+
+        /* next different item (SHIFT to collapse similar items) */
+        case CLUTTER_KEY_d:
+        case CLUTTER_KEY_D:
+            if (state & CLUTTER_SHIFT_MASK)
+                set_collapse(app, !app->collapse);
+            else
+                jump_to_different(app);
+            break;
+
+        /* compare pairs of items and go to next differing pair */
+        case CLUTTER_KEY_v:
+        case CLUTTER_KEY_V:
+            set_compare(app, !app->compare);
+            break;
+        case CLUTTER_KEY_x:
+        case CLUTTER_KEY_X:
+            jump_to_next_difference(app);
+            break;
+
+        /* performance overlay */
+        case CLUTTER_KEY_i:
+            hud_set_visible( app->hud, !hud_get_visible(app->hud) );
+            break;
+
+        /* filter items and jump to item */
+        case CLUTTER_KEY_l:
+            prompt_show(app, PromptFilter, app->filter_query);
+            break;
+        case CLUTTER_KEY_g:
+            prompt_show(app, PromptJump, NULL);
+            break;
+
+        /* reload */
+        case CLUTTER_KEY_F5:
+            reload(app);
+            break;
+
+        /* exit */
+        case CLUTTER_KEY_q:
+        case CLUTTER_KEY_Escape:
+            /* running instance is only hidden (CTRL to exit) */
+            if ( app->server && !(state & CLUTTER_CONTROL_MASK) ) {
+                hide_app(app);
+                break;
+            }
+            clutter_main_quit();
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+on_allocation_changed(ClutterActor *actor,
+        ClutterActorBox *box,
+        ClutterAllocationFlags flags,
+        Application *app)
+{
+    update(app);
+}
+
+static ClutterColor
+color_from_string(const gchar *color_string)
+{
+    const ClutterColor bad_color = {0xff,0,0xff,0xff};
+    ClutterColor color;
+    guint color_value = 0;
+
+    if ( sscanf(color_string, "#%x", &color_value) == 1 && color_value <= 0xffffffff ) {
+        if ( strlen(color_string) == 9 ) {
+            color.alpha = 0xff & color_value;
+            color_value >>= 8;
+        } else {
+            color.alpha = 0xff;
+        }
+
+        color.blue  = 0xff & color_value;
+        color_value >>= 8;
+        color.green = 0xff & color_value;
+        color_value >>= 8;
+        color.red   = 0xff & color_value;
+
+        return color;
+    }
+
+    return bad_color;
+}
+
+static const
+gchar *color_to_string(ClutterColor color, gchar *color_string)
+{
+    sprintf(color_string, "#%02x%02x%02x%02x",
+            (guint)color.red, (guint)color.green,
+            (guint)color.blue, (guint)color.alpha);
+
+    return color_string;
+}
+
+static void
+config_integer( Application *app,
+                GKeyFile *keyfile,
+                const gchar *key,
+                setterInteger set,
+                typeInteger default_value,
+                GError **error )
+{
+    typeInteger value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_integer(keyfile, "general", key, error);
+        if (!*error) {
+            (*set)(app, value);
+            return;
+        }
+    }
+
+    (*set)(app, default_value);
+}
+
+static void
+config_double( Application *app,
+               GKeyFile *keyfile,
+               const gchar *key,
+               setterDouble set,
+               typeDouble default_value,
+               GError **error )
+{
+    typeDouble value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_double(keyfile, "general", key, error);
+        if (!*error) {
+            (*set)(app, value);
+            return;
+        }
+    }
+
+    (*set)(app, default_value);
+}
+
+static void
+config_boolean( Application *app,
+                GKeyFile *keyfile,
+                const gchar *key,
+                setterBoolean set,
+                typeBoolean default_value,
+                GError **error )
+{
+    typeBoolean value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_boolean(keyfile, "general", key, error);
+        if (!*error) {
+            (*set)(app, value);
+            return;
+        }
+    }
+
+    (*set)(app, default_value);
+}
+
+static void
+config_string( Application *app,
+               GKeyFile *keyfile,
+               const gchar *key,
+               setterString set,
+               typeString default_value,
+               GError **error )
+{
+    gchar *value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_string(keyfile, "general", key, error);
+        if (!*error) {
+            (*set)(app, value);
+            g_free(value);
+            return;
+        }
+    }
+
+    (*set)(app, default_value);
+}
+
+static void
+config_string_list( Application *app,
+                    GKeyFile *keyfile,
+                    const gchar *key,
+                    setterStringList set,
+                    typeStringList default_value,
+                    GError **error )
+{
+    typeStringList value;
+    gsize size;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_string_list(keyfile, "general", key, &size, error);
+        if (!*error) {
+            (*set)(app, value, size);
+            g_strfreev(value);
+            return;
+        }
+    }
+
+    if (default_value) {
+        /* size from null teerminated list */
+        for (size = 0; default_value[size]; ++size);
+        (*set)(app, default_value, size);
+    }
+}
+
+static void
+config_color( Application *app,
+              GKeyFile *keyfile,
+              const gchar *key,
+              setterColor set,
+              typeColor default_value,
+              GError **error )
+{
+    gchar *value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_string(keyfile, "general", key, error);
+        if (!*error) {
+            (*set)(app, color_from_string(value));
+            g_free(value);
+            return;
+        }
+    }
+
+    (*set)(app, default_value);
+}
+
+static void
+config_value( Application *app,
+              GKeyFile *keyfile,
+              const Option *option,
+              GError **error )
+{
+    const gchar *key = option->key;
+
+    switch(option->type) {
+        case OptionInteger:
+            config_integer( app, keyfile, key,
+                    option->setter.setInteger,
+                    option->value.valueInteger,
+                    error );
+            break;
+        case OptionDouble:
+            config_double( app, keyfile, key,
+                    option->setter.setDouble,
+                    option->value.valueDouble,
+                    error );
             break;
-        case CLUTTER_KEY_KP_Subtract:
-            s = get_zoom(app->viewport);
-            if (s <= app->options.zoom_increment)
-                s /= 1.0 + app->options.zoom_increment;
-            else
-                s -= app->options.zoom_increment;
-            set_zoom_simple(app, s);
+        case OptionBoolean:
+            config_boolean( app, keyfile, key,
+                    option->setter.setBoolean,
+                    option->value.valueBoolean,
+                    error );
             break;
-        case CLUTTER_KEY_KP_9:
-        case CLUTTER_KEY_KP_8:
-        case CLUTTER_KEY_KP_7:
-        case CLUTTER_KEY_KP_6:
-        case CLUTTER_KEY_KP_5:
-        case CLUTTER_KEY_KP_4:
-        case CLUTTER_KEY_KP_3:
-        case CLUTTER_KEY_KP_2:
-        case CLUTTER_KEY_KP_1:
-        case CLUTTER_KEY_9:
-        case CLUTTER_KEY_8:
-        case CLUTTER_KEY_7:
-        case CLUTTER_KEY_6:
-        case CLUTTER_KEY_5:
-        case CLUTTER_KEY_4:
-        case CLUTTER_KEY_3:
-        case CLUTTER_KEY_2:
-        case CLUTTER_KEY_1:
-            if (keyval > CLUTTER_KEY_KP_0 && keyval <= CLUTTER_KEY_KP_9 )
-                s = (gdouble)(keyval - CLUTTER_KEY_KP_0);
-            else
-                s = (gdouble)(keyval - CLUTTER_KEY_0);
-            if (state & CLUTTER_CONTROL_MASK)
-                s = 1.0/s;
-            set_zoom_simple(app, s);
+        case OptionString:
+            config_string( app, keyfile, key,
+                    option->setter.setString,
+                    option->value.valueString,
+                    error );
+            break;
+        case OptionStringList:
+            config_string_list( app, keyfile, key,
+                    option->setter.setStringList,
+                    option->value.valueStringList,
+                    error );
+            break;
+        case OptionColor:
+            config_color( app, keyfile, key,
+                    option->setter.setColor,
+                    option->value.valueColor,
+                    error );
             break;
+    }
+}
+
+static GKeyFile*
+key_file_new(const gchar *filename)
+{
+    GError *error = NULL;
+    GKeyFile *keyfile = NULL;
+
+    keyfile = g_key_file_new();
+    if (filename) {
+        g_key_file_load_from_file(keyfile, filename,
+                G_KEY_FILE_KEEP_COMMENTS, &error);
+        if (error) {
+            g_error_free(error);
+            error = NULL;
+            g_key_file_free(keyfile);
+            keyfile = NULL;
+        }
+    }
+
+    return keyfile;
+}
+
+static void
+key_file_free(GKeyFile *keyfile)
+{
+    if (keyfile)
+        g_key_file_free(keyfile);
+}
+
+static gboolean
+key_file_save(GKeyFile *keyfile, const gchar *filename)
+{
+    gboolean ret = FALSE;
+    FILE *f;
+    gchar *data;
+    gsize size;
+
+    if (keyfile && filename) {
+        f = fopen(filename, "w");
+        if (f) {
+            data = g_key_file_to_data(keyfile, &size, NULL);
+            if ( fwrite(data, size, 1, f) == 1 )
+                ret = TRUE;
+            g_free(data);
+            fclose(f);
+        }
+    }
+
+    return ret;
+}
+
+static gboolean
+key_file_is_key(const gchar *line, const gchar *end, const gchar *key, const gchar **value)
+{
+    gsize len = strlen(key);
+
+    if ( (gsize)(end - line) <= len || strncmp(line, key, len) != 0 )
+        return FALSE;
+
+    for ( line += len; line < end && (*line == ' ' || *line == '\t'); ++line );
+    if ( line == end || *line != '=' )
+        return FALSE;
+    for ( ++line; line < end && (*line == ' ' || *line == '\t'); ++line );
+
+    *value = line;
+    return TRUE;
+}
+
+/*
+ * Loads key file except the (possibly huge) string list with given key
+ * which is left unparsed in mapped file.
+ */
+static GKeyFile*
+key_file_new_lazy( const gchar *filename,
+                   const gchar *key,
+                   GMappedFile **mapped,
+                   const gchar **list,
+                   gsize *list_size )
+{
+    GError *error = NULL;
+    GKeyFile *keyfile;
+    GString *data;
+    const gchar *p, *end, *eol, *value;
+    gboolean general = FALSE;
+
+    *mapped = NULL;
+    *list = NULL;
+    *list_size = 0;
+
+    if (!filename)
+        return NULL;
+
+    *mapped = g_mapped_file_new(filename, FALSE, &error);
+    if (error) {
+        g_error_free(error);
+        *mapped = NULL;
+        return NULL;
+    }
+
+    p = g_mapped_file_get_contents(*mapped);
+    end = p + g_mapped_file_get_length(*mapped);
+    data = g_string_new("");
+    for ( ; p < end; p = eol < end ? eol + 1 : end ) {
+        eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+
+        if (*p == '[') {
+            general = eol - p >= 9 && strncmp(p, "[general]", 9) == 0;
+        } else if ( general && key_file_is_key(p, eol, key, &value) ) {
+            *list = value;
+            /* trailing whitespace is ignored */
+            for ( p = eol; p > value && g_ascii_isspace(p[-1]); --p );
+            *list_size = p - value;
+            continue;
+        }
+
+        g_string_append_len(data, p, eol - p);
+        g_string_append_c(data, '\n');
+    }
+
+    keyfile = g_key_file_new();
+    g_key_file_load_from_data(keyfile, data->str, data->len,
+            G_KEY_FILE_KEEP_COMMENTS, &error);
+    g_string_free(data, TRUE);
+    if (error) {
+        g_error_free(error);
+        g_key_file_free(keyfile);
+        g_mapped_file_unref(*mapped);
+        *mapped = NULL;
+        *list = NULL;
+        *list_size = 0;
+        return NULL;
+    }
+
+    return keyfile;
+}
+
+/* returns end of list item starting at p (unescaped separator or end) */
+static const gchar*
+list_item_end(const gchar *p, const gchar *end)
+{
+    for ( ; p < end; ++p ) {
+        if (*p == '\\') {
+            if (++p == end)
+                break;
+        } else if (*p == ';') {
+            return p;
+        }
+    }
+    return end;
+}
+
+static gchar*
+list_item_unescape(const gchar *p, const gchar *end)
+{
+    GString *item = g_string_sized_new(end - p);
+
+    for ( ; p < end; ++p ) {
+        if (*p == '\\' && p + 1 < end) {
+            switch (*++p) {
+                case 's':
+                    g_string_append_c(item, ' ');
+                    break;
+                case 'n':
+                    g_string_append_c(item, '\n');
+                    break;
+                case 't':
+                    g_string_append_c(item, '\t');
+                    break;
+                case 'r':
+                    g_string_append_c(item, '\r');
+                    break;
+                default:
+                    g_string_append_c(item, *p);
+            }
+        } else {
+            g_string_append_c(item, *p);
+        }
+    }
+
+    return g_string_free(item, FALSE);
+}
+
+static gchar*
+list_get_item(const gchar *list, gsize size, guint index)
+{
+    const gchar *p, *end, *item_end;
+
+    end = list + size;
+    for ( p = list; p < end; p = item_end + 1 ) {
+        item_end = list_item_end(p, end);
+        if (index == 0)
+            return list_item_unescape(p, item_end);
+        --index;
+    }
+
+    return NULL;
+}
+
+static PathStore*
+list_parse(const gchar *list, gsize size)
+{
+    PathStore *items;
+    const gchar *p, *end, *item_end;
+    gchar *item;
+
+    items = path_store_new();
+    end = list + size;
+    for ( p = list; p < end; p = item_end + 1 ) {
+        item_end = list_item_end(p, end);
+        if ( memchr(p, '\\', item_end - p) ) {
+            item = list_item_unescape(p, item_end);
+            path_store_add(items, item);
+            g_free(item);
+        } else {
+            /* most paths need no unescaping */
+            path_store_add_len(items, p, item_end - p);
+        }
+    }
+
+    return items;
+}
+
+/* inverse of list_item_unescape() (appends item with separator) */
+static void
+list_append_escaped(GString *list, const gchar *item)
+{
+    const gchar *p;
+
+    for (p = item; *p; ++p) {
+        switch (*p) {
+            case ' ':
+                /* only leading space needs escaping */
+                if (p == item)
+                    g_string_append(list, "\\s");
+                else
+                    g_string_append_c(list, ' ');
+                break;
+            case '\n':
+                g_string_append(list, "\\n");
+                break;
+            case '\t':
+                g_string_append(list, "\\t");
+                break;
+            case '\r':
+                g_string_append(list, "\\r");
+                break;
+            case '\\':
+            case ';':
+                g_string_append_c(list, '\\');
+                g_string_append_c(list, *p);
+                break;
+            default:
+                g_string_append_c(list, *p);
+        }
+    }
+    g_string_append_c(list, ';');
+}
+
+static gboolean
+restore_session(Application *app, const char *filename)
+{
+    GKeyFile *keyfile;
+    GError *error = NULL;
+    const Option *option = options;
+
+    /* item list is parsed later in restore_session_items() */
+    keyfile = key_file_new_lazy(filename, "items", &app->session_mapped,
+            &app->session_items, &app->session_items_size);
+
+    while(option->key) {
+        if (option->type != OptionStringList)
+            config_value(app, keyfile, option, &error);
+        if (error) {
+            g_printerr("imagepeek: Error while parsing session file! (%s)\n", error->message);
+            g_error_free(error);
+            error = NULL;
+        }
+        ++option;
+    }
+
+    if (keyfile) {
+        key_file_free(keyfile);
+        return TRUE;
+    } else {
+        return FALSE;
+    }
+}
+
+static void
+free_session_items(Application *app)
+{
+    if (app->session_mapped) {
+        g_mapped_file_unref(app->session_mapped);
+        app->session_mapped = NULL;
+    }
+    app->session_items = NULL;
+    app->session_items_size = 0;
+}
+
+static void
+restore_session_items(Application *app)
+{
+    if (app->session_items)
+        set_item_store( app, list_parse(app->session_items, app->session_items_size) );
+    free_session_items(app);
+}
+
+static gboolean
+save_session(const Application *app, const char *filename)
+{
+    GKeyFile *keyfile;
+    gboolean ret = TRUE;
+    const Option *option = options;
+    OptionType type;
+    const gchar *key;
+
+    keyfile = key_file_new(filename);
+    if (!keyfile) {
+        keyfile = key_file_new(NULL);
+        if (!keyfile)
+            return FALSE;
+    }
+
+    while(option->key) {
+        type = option->type;
+        key = option->key;
+        if (type == OptionInteger) {
+            getterInteger *get = option->getter.getInteger;
+            if (get)
+                g_key_file_set_integer( keyfile, "general", key, (*get)(app) );
+        } else if (type == OptionDouble) {
+            getterDouble *get = option->getter.getDouble;
+            if (get)
+                g_key_file_set_double( keyfile, "general", key, (*get)(app) );
+        } else if (type == OptionBoolean) {
+            getterBoolean *get = option->getter.getBoolean;
+            if (get)
+                g_key_file_set_boolean( keyfile, "general", key, (*get)(app) );
+        } else if (type == OptionString) {
+            getterString *get = option->getter.getString;
+            if (get)
+                g_key_file_set_string( keyfile, "general", key, (*get)(app) );
+        } else if (type == OptionStringList) {
+            getterStringList *get = option->getter.getStringList;
+            gchar *list;
+            if (get) {
+                /* list is escaped by getter (items are not copied to array) */
+                list = (*get)(app);
+                g_key_file_set_value(keyfile, "general", key, list);
+                g_free(list);
+            }
+        } else if (type == OptionColor) {
+            gchar color[9];
+            getterColor *get = option->getter.getColor;
+            if (get)
+                g_key_file_set_string( keyfile, "general",
+                    key, color_to_string((*get)(app), &color[0]) );
+        }
+        ++option;
+    }
 
-        /* zoom to fit vertically/horizontally */
-        case CLUTTER_KEY_w:
-            s = clutter_actor_get_width(stage)/clutter_actor_get_width(app->viewport);
-            set_zoom_simple(app, s);
-            break;
-        case CLUTTER_KEY_h:
-            s = clutter_actor_get_height(stage)/clutter_actor_get_height(app->viewport);
-            set_zoom_simple(app, s);
-            break;
+    ret = key_file_save(keyfile, filename);
+    key_file_free(keyfile);
 
-        /* zoom to fit */
-        case CLUTTER_KEY_0:
-        case CLUTTER_KEY_KP_0:
-        case CLUTTER_KEY_KP_Divide:
-            s = clutter_actor_get_width(stage)/clutter_actor_get_width(app->viewport);
-            s2 = clutter_actor_get_height(stage)/clutter_actor_get_height(app->viewport);
-            if ( s > s2 ) s = s2;
-            set_zoom_simple(app, s);
+    return ret;
+}
+
+
+/* saves session to session file (if any), returns FALSE on error */
+static gboolean
+save_app_session(Application *app)
+{
+    FilterResult *visible = app->visible;
+    guint offset = app->current_offset;
+    gboolean ok;
+
+    if (!app->session_file || app->session_file[0] == '\0')
+        return TRUE;
+
+    /* session stores current item in unfiltered list */
+    if (visible) {
+        app->current_offset = get_item_index( app, get_current_offset(app) );
+        app->visible = NULL;
+    }
+
+    watchdog_enter(app->watchdog, WatchdogSaveSession, app->session_file);
+    ok = save_session(app, app->session_file);
+    watchdog_leave(app->watchdog);
+    if (ok)
+        g_printerr("imagepeek: Session file \"%s\" saved.\n", app->session_file);
+    else
+        g_printerr("imagepeek: Cannot save session file '%s'!\n", app->session_file);
+
+    app->visible = visible;
+    app->current_offset = offset;
+
+    return ok;
+}
+
+/* returns socket path if single instance mode is enabled (IMAGEPEEK_SERVER) */
+static gchar *
+get_server_path(void)
+{
+    const gchar *path = g_getenv("IMAGEPEEK_SERVER");
+
+    if (!path)
+        return NULL;
+    if (path[0] == '\0')
+        return g_build_filename( g_get_user_runtime_dir(), "imagepeek.socket", NULL );
+    return g_strdup(path);
+}
+
+static gchar *
+absolute_path(const gchar *cwd, const gchar *path)
+{
+    if ( g_path_is_absolute(path) )
+        return g_strdup(path);
+    return g_build_filename(cwd, path, NULL);
+}
+
+/* sends items and session to running instance, returns FALSE if there is none */
+static gboolean
+send_to_server(const gchar *path, int argc, char **argv)
+{
+    GKeyFile *keyfile;
+    const gchar *session;
+    gchar **items, *cwd, *value, *data;
+    gsize size;
+    gboolean ok;
+    int i;
+
+    keyfile = g_key_file_new();
+    cwd = g_get_current_dir();
+
+    session = g_getenv("IMAGEPEEK_SESSION");
+    if (session && session[0] != '\0') {
+        value = absolute_path(cwd, session);
+        g_key_file_set_string(keyfile, "general", "session", value);
+        g_free(value);
+    }
+
+    if (argc > 1) {
+        items = g_new(gchar*, argc);
+        for (i = 1; i < argc; ++i)
+            items[i-1] = absolute_path(cwd, argv[i]);
+        items[argc-1] = NULL;
+        g_key_file_set_string_list( keyfile, "general", "items",
+                (const gchar * const *)items, argc-1 );
+        g_strfreev(items);
+    }
+
+    data = g_key_file_to_data(keyfile, &size, NULL);
+    ok = server_send(path, data, size);
+
+    g_free(data);
+    g_free(cwd);
+    g_key_file_free(keyfile);
+
+    return ok;
+}
+
+/* shows items and session from other instance */
+static void
+on_server_message(const gchar *message, gsize size, Application *app)
+{
+    GKeyFile *keyfile;
+    GError *error = NULL;
+    gchar *session, **items;
+    gsize count;
+
+    keyfile = g_key_file_new();
+    if ( !g_key_file_load_from_data(keyfile, message, size, G_KEY_FILE_NONE, &error) ) {
+        g_printerr("imagepeek: Invalid message from other instance! (%s)\n", error->message);
+        g_error_free(error);
+        g_key_file_free(keyfile);
+        return;
+    }
+
+    if (app->prompt_mode != PromptNone)
+        prompt_hide(app);
+
+    /*
+     * switch session (previous one is saved); like a new instance,
+     * invocation without session gets default options and is not saved
+     */
+    session = g_key_file_get_string(keyfile, "general", "session", NULL);
+    save_app_session(app);
+    g_free(app->session_file);
+    app->session_file = session;
+    restore_session(app, session);
+    restore_session_items(app);
+
+    items = g_key_file_get_string_list(keyfile, "general", "items", &count, NULL);
+    if (items) {
+        set_items(app, items, count);
+        g_strfreev(items);
+        set_current_offset(app, 0);
+        sort_items(app);
+    }
+
+    g_key_file_free(keyfile);
+
+    clutter_stage_set_color( CLUTTER_STAGE(app->stage), &app->options.background_color );
+    clutter_actor_show(app->stage);
+    reload(app);
+}
+
+/* running instance stays hidden until other instance sends items */
+static void
+hide_app(Application *app)
+{
+    save_app_session(app);
+    clean_items(app);
+    clutter_actor_hide(app->stage);
+}
+
+/* returns TRUE if command line requests export of sheets */
+static gboolean
+is_export(int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc && strcmp(argv[i], "--") != 0; ++i) {
+        if ( g_str_has_prefix(argv[i], "--export-sheets") )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static const Option *
+option_find(const gchar *key)
+{
+    const Option *option;
+
+    for (option = options; option->key; ++option) {
+        if ( strcmp(option->key, key) == 0 )
+            return option;
+    }
+
+    return NULL;
+}
+
+/*
+ * Options are read from session file without application (export runs
+ * without window), missing values are defaults from option table.
+ */
+static typeInteger
+session_get_integer(GKeyFile *keyfile, const gchar *key)
+{
+    GError *error = NULL;
+    typeInteger value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_integer(keyfile, "general", key, &error);
+        if (!error)
+            return value;
+        g_error_free(error);
+    }
+
+    return option_find(key)->value.valueInteger;
+}
+
+static gchar *
+session_get_string(GKeyFile *keyfile, const gchar *key)
+{
+    gchar *value;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_string(keyfile, "general", key, NULL);
+        if (value)
+            return value;
+    }
+
+    return g_strdup( option_find(key)->value.valueString );
+}
+
+static typeColor
+session_get_color(GKeyFile *keyfile, const gchar *key)
+{
+    gchar *value;
+    typeColor color;
+
+    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
+        value = g_key_file_get_string(keyfile, "general", key, NULL);
+        if (value) {
+            color = color_from_string(value);
+            g_free(value);
+            return color;
+        }
+    }
+
+    return option_find(key)->value.valueColor;
+}
+
+/*
+ * Renders pages of items from command line (or session) into image
+ * files. Grid, font and colors are taken from session.
+ */
+static gboolean
+export_main(int argc, char **argv)
+{
+    gchar *directory = NULL, *size = NULL, *format = NULL, *font;
+    gint threads = 0, width = 1920, height = 1080, i;
+    const GOptionEntry entries[] = {
+        { "export-sheets", 0, 0, G_OPTION_ARG_FILENAME, &directory,
+            "Render pages into image files in DIR", "DIR" },
+        { "sheet-size", 0, 0, G_OPTION_ARG_STRING, &size,
+            "Size of sheets (default 1920x1080)", "WIDTHxHEIGHT" },
+        { "sheet-format", 0, 0, G_OPTION_ARG_STRING, &format,
+            "Format of sheets, png or jpeg (default)", "FORMAT" },
+        { "jobs", 'j', 0, G_OPTION_ARG_INT, &threads,
+            "Number of sheets rendered in parallel (default is number of processors)", "N" },
+        { NULL }
+    };
+    GOptionContext *context;
+    GError *error = NULL;
+    GKeyFile *keyfile;
+    GMappedFile *mapped;
+    const gchar *list;
+    gsize list_size;
+    PathStore *items;
+    ExportOptions export_options;
+    gboolean ok;
+
+    context = g_option_context_new("[images...] - export contact sheets");
+    g_option_context_add_main_entries(context, entries, NULL);
+    ok = g_option_context_parse(context, &argc, &argv, &error);
+    g_option_context_free(context);
+    if (!ok) {
+        g_printerr("imagepeek: %s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    if ( size && sscanf(size, "%dx%d", &width, &height) != 2 ) {
+        g_printerr("imagepeek: Bad sheet size '%s'!\n", size);
+        return FALSE;
+    }
+
+    /* items from arguments or session */
+    keyfile = key_file_new_lazy( g_getenv("IMAGEPEEK_SESSION"), "items",
+            &mapped, &list, &list_size );
+    if (argc > 1) {
+        items = path_store_new();
+        for (i = 1; i < argc; ++i)
+            path_store_add(items, argv[i]);
+    } else if (list) {
+        items = list_parse(list, list_size);
+    } else {
+        items = NULL;
+    }
+    if (mapped)
+        g_mapped_file_unref(mapped);
+
+    if ( !items || path_store_get_count(items) == 0 ) {
+        g_printerr("imagepeek: No images to export!\n");
+        if (keyfile)
+            key_file_free(keyfile);
+        if (items)
+            path_store_free(items);
+        return FALSE;
+    }
+
+    font = session_get_string(keyfile, "item_font");
+    export_options.directory = directory;
+    export_options.format = format ? format : "jpeg";
+    export_options.width = width;
+    export_options.height = height;
+    export_options.rows = MAX( 1, session_get_integer(keyfile, "rows") );
+    export_options.columns = MAX( 1, session_get_integer(keyfile, "columns") );
+    export_options.spacing = MAX( 0, session_get_integer(keyfile, "item_spacing") );
+    export_options.font = font;
+    export_options.background_color = session_get_color(keyfile, "background_color");
+    export_options.text_color = session_get_color(keyfile, "text_color");
+    export_options.text_shadow_color = session_get_color(keyfile, "text_shadow_color");
+    export_options.error_color = session_get_color(keyfile, "error_color");
+    export_options.threads = threads > 0 ? threads : g_get_num_processors();
+    if (keyfile)
+        key_file_free(keyfile);
+
+    ok = export_sheets(items, &export_options);
+
+    path_store_free(items);
+    g_free(font);
+    g_free(directory);
+    g_free(size);
+    g_free(format);
+
+    return ok;
+}
+
+/* appends stall counters of watchdog */
+static void
+append_stalls(GString *text, const Application *app)
+{
+    guint stalls, i;
+
+    stalls = watchdog_get_stalls(app->watchdog, WatchdogStageCount);
+    g_string_append_printf( text, "Stalls: %u (%.1f s, longest %.0f ms)", stalls,
+            watchdog_get_stall_time(app->watchdog) / 1000000.0,
+            watchdog_get_longest_stall(app->watchdog) / 1000.0 );
+    for (i = 0; i < WatchdogStageCount && stalls > 0; ++i) {
+        stalls = watchdog_get_stalls(app->watchdog, i);
+        if (stalls > 0)
+            g_string_append_printf( text, "  %s %u", watchdog_stage_name(i), stalls );
+    }
+    g_string_append_c(text, '\n');
+}
+
+static void
+print_stalls(const Application *app)
+{
+    GString *text;
+
+    text = g_string_new("imagepeek: ");
+    append_stalls(text, app);
+    g_printerr("%s", text->str);
+    g_string_free(text, TRUE);
+}
+
+/* statistics of loading and current page */
+static void
+on_hud_update(GString *text, Application *app)
+{
+    GList *children, *it;
+    ClutterActor *item, *view;
+    const gchar *filename;
+    gint width, height;
+    guint shown = 0, total;
+    gsize texture_memory = 0;
+    gsize hits, lookups;
+    gint decode_time;
+
+    g_string_append_printf( text, "Queue: read %d  decode %d  upload %d\n",
+            g_atomic_int_get(&app->reads_pending),
+            g_atomic_int_get(&app->decodes_pending),
+            g_async_queue_length(app->loaded) );
+
+    total = app->preview_count + app->decode_count;
+    g_string_append_printf( text, "EXIF previews: %u of %u images (%.0f %%)\n",
+            app->preview_count, total,
+            total ? 100.0 * app->preview_count / total : 0.0 );
+
+    if ( pixel_cache_get_limit(app->pixel_cache) > 0 ) {
+        hits = metrics_get(app->metrics, MetricsPixelCacheHits);
+        lookups = hits + metrics_get(app->metrics, MetricsPixelCacheMisses);
+        g_string_append_printf( text, "Pixel cache: %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT
+                " lookups hit (%.0f %%)\n", hits, lookups,
+                lookups ? 100.0 * hits / lookups : 0.0 );
+    }
+
+    children = clutter_container_get_children( CLUTTER_CONTAINER(app->viewport) );
+    for (it = children; it; it = it->next) {
+        view = g_object_get_data( G_OBJECT(it->data), "image" );
+        if ( view && !atlas_contains(CLUTTER_TEXTURE(view)) ) {
+            clutter_texture_get_base_size( CLUTTER_TEXTURE(view), &width, &height );
+            texture_memory += (gsize)width * height * 4;
+        }
+    }
+    g_string_append_printf( text, "Textures: %.1f MiB, atlas: %u textures, %.1f MiB\n",
+            texture_memory / (1024.0 * 1024.0),
+            atlas_get_page_count(app->atlas),
+            atlas_get_memory(app->atlas) / (1024.0 * 1024.0) );
+    g_string_append_printf( text, "Texture budget: %.1f of %.1f MiB%s\n",
+            residency_get_used(app->residency) / (1024.0 * 1024.0),
+            residency_get_budget(app->residency) / (1024.0 * 1024.0),
+            residency_get_pressure(app->residency) ? " (memory pressure)" : "" );
+    append_stalls(text, app);
+    if (app->hash_id != 0) {
+        g_string_append(text, "Similarity index: indexing\n");
+    } else if (app->hashes) {
+        g_string_append_printf( text, "Similarity index: %u items%s\n",
+                app->hashes->count, app->collapse ? " (similar items collapsed)" : "" );
+    }
+    if (app->compare) {
+        g_string_append_printf( text, "Compare: %u of %u pairs compared\n",
+                comparer_get_compared(app->comparer),
+                comparer_get_count(app->comparer) );
+    }
+    if ( slideshow_is_running(app->slideshow) ) {
+        g_string_append_printf( text, "Slideshow: %u shown, %u missed deadlines (%.1f s late)\n",
+                slideshow_get_shown(app->slideshow),
+                slideshow_get_missed(app->slideshow),
+                slideshow_get_late_time(app->slideshow) / 1000000.0 );
+    }
+
+    /* decode time of items on page */
+    for (it = children; it && shown < 16; it = it->next, ++shown) {
+        item = it->data;
+        filename = g_object_get_data( G_OBJECT(item), "filename" );
+        decode_time = GPOINTER_TO_INT( g_object_get_data(G_OBJECT(item), "decode_time") );
+        if (decode_time > 0)
+            g_string_append_printf(text, "%8.1f ms  ", decode_time / 1000.0);
+        else
+            g_string_append(text, "       -     ");
+        g_string_append(text, filename ? filename : "");
+        g_string_append_c(text, '\n');
+    }
+    if (it)
+        g_string_append_printf( text, "(%u more items)\n", g_list_length(it) );
+
+    g_list_free(children);
+}
+
+/* computes perceptual hashes of items in background (if index is enabled) */
+static void
+index_items(Application *app)
+{
+    if (!app->hasher || !app->items || !app->index_enabled)
+        return;
+
+    if (app->hashes) {
+        hash_result_free(app->hashes);
+        app->hashes = NULL;
+    }
+    app->hash_start = g_get_monotonic_time();
+    /* previous hashing is cancelled */
+    app->hash_id = hasher_start(app->hasher, app->items);
+}
+
+/* starts indexing on first use */
+static void
+enable_index(Application *app)
+{
+    if (app->index_enabled)
+        return;
+    app->index_enabled = TRUE;
+    index_items(app);
+}
+
+static void
+on_hash_done(HashResult *result, Application *app)
+{
+    clutter_threads_add_idle( (GSourceFunc)show_hash_result, result );
+}
+
+static gboolean
+show_hash_result(HashResult *result)
+{
+    Application *app = result->user_data;
+    gdouble time;
+
+    /* drop results for replaced items */
+    if (result->id != app->hash_id) {
+        hash_result_free(result);
+        return FALSE;
+    }
+    app->hash_id = 0;
+    app->hashes = result;
+
+    if (app->debug) {
+        time = (g_get_monotonic_time() - app->hash_start) / 1000000.0;
+        g_printerr("imagepeek: Hashed %u items (%u decoded) in %.1f s (%.0f images/s).\n",
+                result->count, result->computed, time, result->computed / MAX(time, 0.001));
+    }
+
+    if (app->collapse)
+        collapse_items(app);
+    if (app->jump_different_pending) {
+        app->jump_different_pending = FALSE;
+        jump_to_different(app);
+    }
+
+    return FALSE;
+}
+
+/* returns TRUE if items (indices in item list) don't look alike */
+static gboolean
+items_differ(const Application *app, guint a, guint b)
+{
+    const HashResult *hashes = app->hashes;
+
+    /* items which cannot be decoded are never similar */
+    if (!hashes->known[a] || !hashes->known[b])
+        return TRUE;
+
+    return phash_distance(hashes->hashes[a], hashes->hashes[b])
+        > (guint)get_similar_threshold(app);
+}
+
+/* moves to next item which differs from current one */
+static void
+jump_to_different(Application *app)
+{
+    guint count, offset, current;
+
+    if (!app->hashes) {
+        app->jump_different_pending = TRUE;
+        g_printerr("imagepeek: Indexing items, jumping when done.\n");
+        enable_index(app);
+        return;
+    }
+
+    /* compared to current item so that slow drift is noticed */
+    count = get_count(app);
+    offset = get_current_offset(app);
+    current = get_item_index(app, offset);
+    for (++offset; offset < count; ++offset) {
+        if ( items_differ(app, current, get_item_index(app, offset)) )
             break;
+    }
+
+    if (offset < count) {
+        set_current_offset(app, offset);
+        reload(app);
+    }
+}
+
+/* shows only first item of each run of similar items */
+static void
+collapse_items(Application *app)
+{
+    FilterResult *visible;
+    guint count, first = 0, i;
+
+    count = path_store_get_count(app->items);
+    visible = g_new0(FilterResult, 1);
+    visible->indices = g_new(guint32, MAX(count, 1));
+    visible->user_data = app;
+    for (i = 0; i < count; ++i) {
+        if ( i == 0 || items_differ(app, first, i) ) {
+            first = i;
+            visible->indices[visible->count++] = i;
+        }
+    }
+
+    set_visible(app, visible);
+}
+
+static void
+set_collapse(Application *app, gboolean collapse)
+{
+    /* collapsed list replaces filter */
+    filter_cancel(app->filter);
+    app->search_id = 0;
+    g_free(app->filter_query);
+    app->filter_query = NULL;
+    app->compare = FALSE;
+    app->jump_difference_pending = FALSE;
+
+    app->collapse = collapse;
+    if (!collapse) {
+        if (app->visible)
+            set_visible(app, NULL);
+    } else if (app->hashes) {
+        collapse_items(app);
+    } else {
+        g_printerr("imagepeek: Indexing items, similar items are collapsed when done.\n");
+        enable_index(app);
+    }
+}
+
+/* replaces label of compared item with difference to its pair */
+static void
+show_compare_stats(Application *app, LoadJob *job)
+{
+    ClutterActor *text;
+    gchar *a, *b, *stats, *label;
+
+    /* label is recreated (text and its shadow) */
+    text = g_object_get_data( G_OBJECT(job->item), "label" );
+    if (text) {
+        clutter_container_remove_actor( CLUTTER_CONTAINER(job->item),
+                clutter_actor_get_parent(text) );
+    }
+
+    a = g_path_get_basename(job->filename);
+    b = g_path_get_basename(job->compare_filename);
+    stats = compare_stats_to_string(&job->compare_stats);
+    label = g_strdup_printf("%s / %s: %s", a, b, stats);
+    add_item_label( app, job->item, label,
+            !compare_stats_differ(&job->compare_stats, get_compare_threshold(app)) );
+
+    g_free(a);
+    g_free(b);
+    g_free(stats);
+    g_free(label);
+}
+
+/* compares all pairs in background (for jumping to next difference) */
+static void
+start_compare(Application *app)
+{
+    if (!app->items)
+        return;
+
+    if (!app->comparer)
+        app->comparer = comparer_new( (CompareCallback*)on_compare_progress, app );
+    /* previous comparing is cancelled */
+    comparer_start(app->comparer, app->items);
+}
+
+static void
+on_compare_progress(guint id, Application *app)
+{
+    clutter_threads_add_idle( (GSourceFunc)show_compare_progress, app );
+}
+
+static gboolean
+show_compare_progress(Application *app)
+{
+    if (app->compare && app->jump_difference_pending)
+        jump_to_next_difference(app);
 
-        /* zoom reset */
-        case CLUTTER_KEY_KP_Multiply:
-            set_zoom_simple(app, 1.0);
-            break;
+    return FALSE;
+}
 
-        /* sharpen filter strength */
-        case CLUTTER_KEY_a:
-            set_sharpen( app, get_sharpen(app) + 0.05 );
-            break;
-        case CLUTTER_KEY_z:
-            set_sharpen( app, get_sharpen(app) - 0.05 );
-            break;
+/* moves to next pair which differs more than compare_threshold */
+static void
+jump_to_next_difference(Application *app)
+{
+    CompareStats stats;
+    guint count, offset;
 
-        /* fullscreen */
-        case CLUTTER_KEY_f:
-        case CLUTTER_KEY_F:
-            set_fullscreen( app, !get_fullscreen(app) );
-            break;
+    if (!app->compare) {
+        g_printerr("imagepeek: Compare mode is off.\n");
+        return;
+    }
 
-        /* next page */
-        case CLUTTER_KEY_n:
-        case CLUTTER_KEY_KP_Enter:
-        case CLUTTER_KEY_Return:
-            load_next(app);
-            break;
-        case CLUTTER_KEY_Right:
-            if ( (gint)clutter_actor_get_width(stage) >= (gint)(clutter_actor_get_width(app->viewport)*get_zoom(app->viewport)) )
-                load_next(app);
-            break;
-        case CLUTTER_KEY_Down:
-            if ( (gint)clutter_actor_get_height(stage) >= (gint)(clutter_actor_get_height(app->viewport)*get_zoom(app->viewport)) )
-                load_next(app);
+    count = get_count(app);
+    for (offset = get_current_offset(app) + 1; offset < count; ++offset) {
+        /* visible items are first items of pairs */
+        if ( !comparer_get(app->comparer, get_item_index(app, offset) / 2, &stats) ) {
+            if (!app->jump_difference_pending)
+                g_printerr("imagepeek: Comparing items, jumping when done.\n");
+            app->jump_difference_pending = TRUE;
+            return;
+        }
+        if ( compare_stats_differ(&stats, get_compare_threshold(app)) )
             break;
+    }
+    app->jump_difference_pending = FALSE;
 
-        /* prev page */
-        case CLUTTER_KEY_p:
-        case CLUTTER_KEY_N:
-        case CLUTTER_KEY_b:
-        case CLUTTER_KEY_BackSpace:
-            load_prev(app);
-            break;
-        case CLUTTER_KEY_Left:
-            if ( (gint)clutter_actor_get_width(stage) >= (gint)(clutter_actor_get_width(app->viewport)*get_zoom(app->viewport)) )
-                load_prev(app);
-            break;
-        case CLUTTER_KEY_Up:
-            if ( (gint)clutter_actor_get_height(stage) >= (gint)(clutter_actor_get_height(app->viewport)*get_zoom(app->viewport)) )
-                load_prev(app);
-            break;
+    if (offset < count) {
+        set_current_offset(app, offset);
+        reload(app);
+    }
+}
 
-        case CLUTTER_KEY_space:
-            if ( state & CLUTTER_SHIFT_MASK ) {
-        case CLUTTER_KEY_k:
-                if (get_current_offset(app) == 0) break;
-                load_prev(app);
-                scrollable_get_scroll( app->viewport, &x, NULL );
-                scrollable_set_scroll( app->viewport,
-                        x,
-                        clutter_actor_get_height(app->viewport),
-                        0 );
-            } else {
-        case CLUTTER_KEY_j:
-                load_next(app);
-            }
-            break;
+/* shows only first item of each pair */
+static void
+compare_items(Application *app)
+{
+    FilterResult *visible;
+    guint count, i;
 
-        case CLUTTER_KEY_Home:
-            if ( state & CLUTTER_SHIFT_MASK ) {
-                if ( get_current_offset(app) != 0 ) {
-                    set_current_offset(app, 0);
-                    reload(app);
-                }
-            }
-            break;
-        case CLUTTER_KEY_End:
-            if ( state & CLUTTER_SHIFT_MASK ) {
-                typeInteger offset = get_count(app) -
-                    get_rows(app) * get_columns(app);
-                if ( offset > get_current_offset(app) ) {
-                    set_current_offset(app, offset);
-                    reload(app);
-                }
-            }
-            break;
+    count = path_store_get_count(app->items) / 2;
+    visible = g_new0(FilterResult, 1);
+    visible->indices = g_new(guint32, MAX(count, 1));
+    visible->user_data = app;
+    for (i = 0; i < count; ++i)
+        visible->indices[visible->count++] = 2 * i;
 
-        /* shift items on page */
-        case CLUTTER_KEY_S:
-        case CLUTTER_KEY_s:
-            set_current_offset( app, get_current_offset(app) +
-                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
-            reload(app);
-            break;
+    set_visible(app, visible);
+}
 
-        /* add rows/columns */
-        case CLUTTER_KEY_r:
-        case CLUTTER_KEY_R:
-            set_rows( app, get_rows(app) +
-                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
-            load_more(app);
-            break;
-        case CLUTTER_KEY_c:
-        case CLUTTER_KEY_C:
-            set_columns( app, get_columns(app) +
-                    ((state & CLUTTER_SHIFT_MASK) ? -1 : 1) );
-            load_more(app);
-            break;
+static void
+set_compare(Application *app, gboolean compare)
+{
+    /* pairs replace filter and collapsed list */
+    filter_cancel(app->filter);
+    app->search_id = 0;
+    g_free(app->filter_query);
+    app->filter_query = NULL;
+    app->collapse = FALSE;
+    app->jump_difference_pending = FALSE;
+
+    if ( compare && (!app->items || path_store_get_count(app->items) < 2) ) {
+        g_printerr("imagepeek: Comparing needs at least two items!\n");
+        compare = FALSE;
+    }
 
-        /* reload */
-        case CLUTTER_KEY_F5:
-            reload(app);
-            break;
+    app->compare = compare;
+    if (compare) {
+        compare_items(app);
+        start_compare(app);
+    } else {
+        if (app->comparer)
+            comparer_cancel(app->comparer);
+        if (app->visible)
+            set_visible(app, NULL);
+    }
+}
 
-        /* exit */
-        case CLUTTER_KEY_q:
-        case CLUTTER_KEY_Escape:
-            clutter_main_quit();
-            break;
+/*
+ * Interleaves items before and after argument "--versus" so that each
+ * item is followed by item to compare it with. Returns FALSE if the
+ * argument is missing.
+ */
+static gboolean
+parse_versus(int *argc, char ***argv)
+{
+    char **args = *argv, **pairs;
+    int i, split = 0, count;
 
-        default:
-            return FALSE;
+    for (i = 1; i < *argc && split == 0; ++i) {
+        if ( strcmp(args[i], "--versus") == 0 )
+            split = i;
+    }
+    if (split == 0)
+        return FALSE;
+
+    count = MIN(split - 1, *argc - split - 1);
+    if (split - 1 != *argc - split - 1) {
+        g_printerr("imagepeek: Lists to compare differ in length, comparing first %d pairs.\n",
+                count);
+    }
+
+    pairs = g_new(char*, 2 * count + 2);
+    pairs[0] = args[0];
+    for (i = 0; i < count; ++i) {
+        pairs[2*i + 1] = args[1 + i];
+        pairs[2*i + 2] = args[split + 1 + i];
     }
+    pairs[2*count + 1] = NULL;
+
+    *argc = 2*count + 1;
+    *argv = pairs;
 
     return TRUE;
 }
 
+/* metrics are written periodically if file is set */
 static void
-on_allocation_changed(ClutterActor *actor,
-        ClutterActorBox *box,
-        ClutterAllocationFlags flags,
-        Application *app)
+restart_metrics(Application *app)
 {
-    update(app);
+    if (app->metrics_id != 0) {
+        g_source_remove(app->metrics_id);
+        app->metrics_id = 0;
+    }
+
+    if ( app->options.metrics_file && app->options.metrics_file[0] != '\0' &&
+         app->options.metrics_interval > 0 )
+    {
+        app->metrics_id = clutter_threads_add_timeout( app->options.metrics_interval * 1000,
+                (GSourceFunc)write_metrics, app );
+    }
 }
 
-static ClutterColor
-color_from_string(const gchar *color_string)
+/* samples values which are not counted as they change */
+static void
+update_metrics(Application *app)
 {
-    const ClutterColor bad_color = {0xff,0,0xff,0xff};
-    ClutterColor color;
-    guint color_value = 0;
-
-    if ( sscanf(color_string, "#%x", &color_value) == 1 && color_value <= 0xffffffff ) {
-        if ( strlen(color_string) == 9 ) {
-            color.alpha = 0xff & color_value;
-            color_value >>= 8;
-        } else {
-            color.alpha = 0xff;
-        }
+    metrics_set( app->metrics, MetricsItems, get_count(app) );
+    metrics_set( app->metrics, MetricsTextureMemory, residency_get_used(app->residency) );
+    metrics_set( app->metrics, MetricsAtlasMemory, atlas_get_memory(app->atlas) );
+    metrics_set( app->metrics, MetricsStalls,
+            watchdog_get_stalls(app->watchdog, WatchdogStageCount) );
+    metrics_set( app->metrics, MetricsStallTime, watchdog_get_stall_time(app->watchdog) );
+}
 
-        color.blue  = 0xff & color_value;
-        color_value >>= 8;
-        color.green = 0xff & color_value;
-        color_value >>= 8;
-        color.red   = 0xff & color_value;
+static gboolean
+write_metrics(Application *app)
+{
+    GError *error = NULL;
 
-        return color;
+    update_metrics(app);
+    if ( !metrics_write(app->metrics, app->options.metrics_file, &error) ) {
+        g_printerr("imagepeek: Cannot write metrics! (%s)\n", error->message);
+        g_error_free(error);
     }
 
-    return bad_color;
+    return TRUE;
 }
 
-static const
-gchar *color_to_string(ClutterColor color, gchar *color_string)
+/* SIGUSR1 writes metrics into file (or standard output if it's not set) */
+static gboolean
+on_metrics_signal(Application *app)
 {
-    sprintf(color_string, "#%02x%02x%02x%02x",
-            (guint)color.red, (guint)color.green,
-            (guint)color.blue, (guint)color.alpha);
+    gchar *text;
 
-    return color_string;
+    if (app->options.metrics_file && app->options.metrics_file[0] != '\0') {
+        write_metrics(app);
+    } else {
+        update_metrics(app);
+        text = metrics_to_text(app->metrics);
+        fputs(text, stdout);
+        fflush(stdout);
+        g_free(text);
+    }
+
+    return TRUE;
 }
 
 static void
-config_integer( Application *app,
-                GKeyFile *keyfile,
-                const gchar *key,
-                setterInteger set,
-                typeInteger default_value,
-                GError **error )
+on_stage_paint(ClutterActor *stage, Application *app)
 {
-    typeInteger value;
+    app->paint_start = g_get_monotonic_time();
+}
 
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_integer(keyfile, "general", key, error);
-        if (!*error) {
-            (*set)(app, value);
-            return;
-        }
-    }
+static void
+on_stage_painted(ClutterActor *stage, Application *app)
+{
+    gint64 time = g_get_monotonic_time() - app->paint_start;
 
-    (*set)(app, default_value);
+    metrics_observe(app->metrics, MetricsFrameTime, time);
+    /* frame missed refresh of 60 Hz display */
+    if (time > 1000000 / 60)
+        metrics_add(app->metrics, MetricsFrameDrops, 1);
 }
 
+/*
+ * Records input events into file IMAGEPEEK_TRACE_RECORD or replays events
+ * from file IMAGEPEEK_TRACE_REPLAY (as fast as possible if
+ * IMAGEPEEK_TRACE_FAST is set) and exits with statistics.
+ */
 static void
-config_double( Application *app,
-               GKeyFile *keyfile,
-               const gchar *key,
-               setterDouble set,
-               typeDouble default_value,
-               GError **error )
+start_trace(Application *app)
 {
-    typeDouble value;
+    const gchar *record = g_getenv("IMAGEPEEK_TRACE_RECORD");
+    const gchar *replay = g_getenv("IMAGEPEEK_TRACE_REPLAY");
+    GError *error = NULL;
 
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_double(keyfile, "general", key, error);
-        if (!*error) {
-            (*set)(app, value);
+    if (replay) {
+        app->trace_player = trace_player_new( replay, app->stage,
+                (TracePlay*)replay_event, (TraceDone*)on_replay_done, app, &error );
+        if (!app->trace_player) {
+            g_printerr("imagepeek: Cannot replay trace! (%s)\n", error->message);
+            g_error_free(error);
+            return;
+        }
+        restore_trace_state(app);
+        trace_player_set_fast( app->trace_player, g_getenv("IMAGEPEEK_TRACE_FAST") != NULL );
+        trace_player_start(app->trace_player);
+    } else if (record) {
+        app->trace_recorder = trace_recorder_new(record, &error);
+        if (!app->trace_recorder) {
+            g_printerr("imagepeek: Cannot record trace! (%s)\n", error->message);
+            g_error_free(error);
             return;
         }
+        save_trace_state(app);
+        /* events are recorded before they reach handlers */
+        g_signal_connect( app->stage, "captured-event",
+                G_CALLBACK(record_event), app );
+        g_signal_connect( app->drag_action, "drag-motion",
+                G_CALLBACK(record_drag), app );
+        g_signal_connect( app->drag_action, "drag-end",
+                G_CALLBACK(record_drag_end), app );
     }
+}
 
-    (*set)(app, default_value);
+static void
+save_trace_state(Application *app)
+{
+    TraceRecorder *recorder = app->trace_recorder;
+    gchar value[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar *item;
+
+    g_snprintf( value, sizeof(value), "%d", get_count(app) );
+    trace_recorder_add_state(recorder, "count", value);
+    item = get_item( app, get_current_offset(app) );
+    trace_recorder_add_state(recorder, "item", item);
+    g_free(item);
+    g_snprintf( value, sizeof(value), "%d", get_current_offset(app) );
+    trace_recorder_add_state(recorder, "current", value);
+    g_snprintf( value, sizeof(value), "%d", get_rows(app) );
+    trace_recorder_add_state(recorder, "rows", value);
+    g_snprintf( value, sizeof(value), "%d", get_columns(app) );
+    trace_recorder_add_state(recorder, "columns", value);
+    g_ascii_dtostr( value, sizeof(value), get_zoom_simple(app) );
+    trace_recorder_add_state(recorder, "zoom", value);
+    g_snprintf( value, sizeof(value), "%.0fx%.0f",
+            clutter_actor_get_width(app->stage), clutter_actor_get_height(app->stage) );
+    trace_recorder_add_state(recorder, "size", value);
+    trace_recorder_add_state(recorder, "sort", get_sort(app));
+    trace_recorder_add_state(recorder, "filter", app->visible ? app->filter_query : "");
 }
 
+/* restores state from start of recording */
 static void
-config_boolean( Application *app,
-                GKeyFile *keyfile,
-                const gchar *key,
-                setterBoolean set,
-                typeBoolean default_value,
-                GError **error )
+restore_trace_state(Application *app)
 {
-    typeBoolean value;
+    TracePlayer *player = app->trace_player;
+    const gchar *value;
+    gint width, height;
+
+    value = trace_player_get_state(player, "count");
+    if ( value && atoi(value) != get_count(app) ) {
+        g_printerr("imagepeek: Trace was recorded with %s items, replaying with %d items.\n",
+                value, get_count(app));
+    }
 
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_boolean(keyfile, "general", key, error);
-        if (!*error) {
-            (*set)(app, value);
-            return;
-        }
+    value = trace_player_get_state(player, "size");
+    if ( value && sscanf(value, "%dx%d", &width, &height) == 2 )
+        clutter_actor_set_size(app->stage, width, height);
+    value = trace_player_get_state(player, "sort");
+    if ( value && g_strcmp0(value, get_sort(app)) != 0 ) {
+        set_sort(app, value);
+        sort_items(app);
+    }
+    value = trace_player_get_state(player, "filter");
+    if (value && *value)
+        filter_items(app, value);
+    value = trace_player_get_state(player, "rows");
+    if (value)
+        set_rows( app, atoi(value) );
+    value = trace_player_get_state(player, "columns");
+    if (value)
+        set_columns( app, atoi(value) );
+    value = trace_player_get_state(player, "current");
+    if (value)
+        set_current_offset( app, atoi(value) );
+    value = trace_player_get_state(player, "zoom");
+    if (value) {
+        set_zoom( app->viewport, g_ascii_strtod(value, NULL), 0,
+                G_CALLBACK(on_zoom_completed), app );
     }
 
-    (*set)(app, default_value);
+    reload(app);
 }
 
-static void
-config_string( Application *app,
-               GKeyFile *keyfile,
-               const gchar *key,
-               setterString set,
-               typeString default_value,
-               GError **error )
+static gboolean
+record_event(ClutterActor *stage, ClutterEvent *event, Application *app)
 {
-    gchar *value;
+    TraceEvent trace_event = {0};
 
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_string(keyfile, "general", key, error);
-        if (!*error) {
-            (*set)(app, value);
-            g_free(value);
-            return;
-        }
+    switch ( clutter_event_type(event) ) {
+        case CLUTTER_KEY_PRESS:
+            trace_event.type = TraceKey;
+            trace_event.keyval = clutter_event_get_key_symbol(event);
+            trace_event.unicode = clutter_event_get_key_unicode(event);
+            break;
+        case CLUTTER_SCROLL:
+            trace_event.type = TraceScroll;
+            trace_event.direction = clutter_event_get_scroll_direction(event);
+            break;
+        default:
+            return FALSE;
     }
+    trace_event.state = clutter_event_get_state(event);
+    trace_recorder_add(app->trace_recorder, &trace_event);
 
-    (*set)(app, default_value);
+    return FALSE;
 }
 
 static void
-config_string_list( Application *app,
-                    GKeyFile *keyfile,
-                    const gchar *key,
-                    setterStringList set,
-                    typeStringList default_value,
-                    GError **error )
+record_drag(ClutterDragAction *action, ClutterActor *actor,
+        gfloat delta_x, gfloat delta_y, Application *app)
 {
-    typeStringList value;
-    gsize size;
-
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_string_list(keyfile, "general", key, &size, error);
-        if (!*error) {
-            (*set)(app, value, size);
-            return;
-        }
-    }
+    TraceEvent trace_event = {0};
 
-    if (default_value) {
-        /* size from null teerminated list */
-        for (size = 0; default_value[size]; ++size);
-        (*set)(app, default_value, size);
-    }
+    trace_event.type = TraceDrag;
+    trace_event.x = delta_x;
+    trace_event.y = delta_y;
+    trace_recorder_add(app->trace_recorder, &trace_event);
 }
 
 static void
-config_color( Application *app,
-              GKeyFile *keyfile,
-              const gchar *key,
-              setterColor set,
-              typeColor default_value,
-              GError **error )
+record_drag_end(ClutterDragAction *action, ClutterActor *actor,
+        gfloat event_x, gfloat event_y, ClutterModifierType modifiers, Application *app)
 {
-    gchar *value;
+    TraceEvent trace_event = {0};
 
-    if ( keyfile && g_key_file_has_key(keyfile, "general", key, NULL) ) {
-        value = g_key_file_get_string(keyfile, "general", key, error);
-        if (!*error) {
-            (*set)(app, color_from_string(value));
-            g_free(value);
-            return;
-        }
-    }
-
-    (*set)(app, default_value);
+    trace_event.type = TraceDragEnd;
+    trace_event.x = event_x;
+    trace_event.y = event_y;
+    trace_event.state = modifiers;
+    trace_recorder_add(app->trace_recorder, &trace_event);
 }
 
+/* emits signals as if event was delivered by Clutter */
 static void
-config_value( Application *app,
-              GKeyFile *keyfile,
-              const Option *option,
-              GError **error )
+replay_event(const TraceEvent *trace_event, Application *app)
 {
-    const gchar *key = option->key;
-
-    switch(option->type) {
-        case OptionInteger:
-            config_integer( app, keyfile, key,
-                    option->setter.setInteger,
-                    option->value.valueInteger,
-                    error );
-            break;
-        case OptionDouble:
-            config_double( app, keyfile, key,
-                    option->setter.setDouble,
-                    option->value.valueDouble,
-                    error );
-            break;
-        case OptionBoolean:
-            config_boolean( app, keyfile, key,
-                    option->setter.setBoolean,
-                    option->value.valueBoolean,
-                    error );
+    ClutterEvent *event;
+    gboolean handled = FALSE;
+
+    switch (trace_event->type) {
+        case TraceKey:
+            event = clutter_event_new(CLUTTER_KEY_PRESS);
+            clutter_event_set_stage( event, CLUTTER_STAGE(app->stage) );
+            clutter_event_set_key_symbol(event, trace_event->keyval);
+            clutter_event_set_key_unicode(event, trace_event->unicode);
+            clutter_event_set_state(event, trace_event->state);
+            /* viewport has key focus, unhandled keys propagate to stage */
+            g_signal_emit_by_name(app->viewport, "key-press-event", event, &handled);
+            if (!handled)
+                g_signal_emit_by_name(app->stage, "key-press-event", event, &handled);
+            clutter_event_free(event);
             break;
-        case OptionString:
-            config_string( app, keyfile, key,
-                    option->setter.setString,
-                    option->value.valueString,
-                    error );
+        case TraceScroll:
+            event = clutter_event_new(CLUTTER_SCROLL);
+            clutter_event_set_stage( event, CLUTTER_STAGE(app->stage) );
+            clutter_event_set_scroll_direction(event, trace_event->direction);
+            clutter_event_set_state(event, trace_event->state);
+            g_signal_emit_by_name(app->viewport, "scroll-event", event, &handled);
+            clutter_event_free(event);
             break;
-        case OptionStringList:
-            config_string_list( app, keyfile, key,
-                    option->setter.setStringList,
-                    option->value.valueStringList,
-                    error );
+        case TraceDrag:
+            g_signal_emit_by_name( app->drag_action, "drag-motion", app->viewport,
+                    trace_event->x, trace_event->y );
             break;
-        case OptionColor:
-            config_color( app, keyfile, key,
-                    option->setter.setColor,
-                    option->value.valueColor,
-                    error );
+        case TraceDragEnd:
+            g_signal_emit_by_name( app->drag_action, "drag-end", app->viewport,
+                    trace_event->x, trace_event->y, trace_event->state );
             break;
     }
 }
 
-static GKeyFile*
-key_file_new(const gchar *filename)
+static void
+on_replay_done(Application *app)
 {
-    GError *error = NULL;
-    GKeyFile *keyfile = NULL;
+    clutter_threads_add_timeout( 100, (GSourceFunc)finish_replay, app );
+}
 
-    keyfile = g_key_file_new();
-    if (filename) {
-        g_key_file_load_from_file(keyfile, filename,
-                G_KEY_FILE_KEEP_COMMENTS, &error);
-        if (error) {
-            g_error_free(error);
-            error = NULL;
-            g_key_file_free(keyfile);
-            keyfile = NULL;
-        }
+/* exits when images requested by last events are shown */
+static gboolean
+finish_replay(Application *app)
+{
+    if ( g_atomic_int_get(&app->reads_pending) > 0 ||
+         g_atomic_int_get(&app->decodes_pending) > 0 ||
+         g_async_queue_length(app->loaded) > 0 || app->reload_id != 0 )
+    {
+        return TRUE;
     }
 
-    return keyfile;
+    trace_player_print_stats(app->trace_player);
+    clutter_main_quit();
+
+    return FALSE;
 }
 
+/* starts or stops slideshow according to option, prepared items are dropped */
 static void
-key_file_free(GKeyFile *keyfile)
+update_slideshow(Application *app)
 {
-    if (keyfile)
-        g_key_file_free(keyfile);
-}
+    g_atomic_int_inc(&app->slideshow_generation);
+    g_hash_table_remove_all(app->slideshow_items);
+    slideshow_stop(app->slideshow);
 
-static gboolean
-key_file_save(GKeyFile *keyfile, const gchar *filename)
-{
-    gboolean ret = FALSE;
-    FILE *f;
-    gchar *data;
-    gsize size;
+    if ( !get_slideshow(app) )
+        return;
 
-    if (keyfile && filename) {
-        f = fopen(filename, "w");
-        if (f) {
-            data = g_key_file_to_data(keyfile, &size, NULL);
-            if ( fwrite(data, size, 1, f) == 1 )
-                ret = TRUE;
-            g_free(data);
-            fclose(f);
-        }
+    /* one item at a time */
+    if ( get_rows(app) > 1 || get_columns(app) > 1 ) {
+        set_rows(app, 1);
+        set_columns(app, 1);
+        load_more(app);
     }
 
-    return ret;
+    if ( !slideshow_start(app->slideshow, get_count(app), get_current_offset(app)) ) {
+        g_printerr("imagepeek: Slideshow needs at least two items!\n");
+        set_slideshow(app, FALSE);
+    }
 }
 
-static gboolean
-restore_session(Application *app, const char *filename)
+/* indices of prepared items are not valid after item list changes */
+static void
+restart_slideshow(Application *app)
 {
-    GKeyFile *keyfile;
-    GError *error = NULL;
-    const Option *option = options;
+    if ( slideshow_is_running(app->slideshow) )
+        update_slideshow(app);
+}
 
-    keyfile = key_file_new(filename);
+/* decodes item and uploads its texture while it's outside of viewport */
+static void
+on_slideshow_prepare(guint index, Application *app)
+{
+    ClutterActor *item;
+    GPtrArray *jobs;
+    LoadJob *job;
+    gchar *filename;
+
+    filename = get_item(app, index);
+    item = clutter_box_new( clutter_table_layout_new() );
+    g_object_ref_sink(item);
+    g_object_set_data_full( G_OBJECT(item), "filename", filename, g_free );
+    g_object_set_data( G_OBJECT(item), "slideshow-index", GUINT_TO_POINTER(index) );
+    g_hash_table_insert( app->slideshow_items, GUINT_TO_POINTER(index), item );
+
+    job = load_job_new(app, filename, item);
+    job->slideshow = TRUE;
+    job->generation = g_atomic_int_get(&app->slideshow_generation);
+
+    jobs = g_ptr_array_new();
+    g_ptr_array_add(jobs, job);
+    load_jobs(app, jobs);
+    g_ptr_array_free(jobs, TRUE);
+}
 
-    while(option->key) {
-        config_value(app, keyfile, option, &error);
-        if (error) {
-            g_printerr("imagepeek: Error while parsing session file! (%s)\n", error->message);
-            g_error_free(error);
-            error = NULL;
-        }
-        ++option;
-    }
+/* replaces page with prepared item */
+static void
+on_slideshow_show(guint index, Application *app)
+{
+    ClutterActor *item;
 
-    if (keyfile) {
-        key_file_free(keyfile);
-        return TRUE;
-    } else {
-        return FALSE;
-    }
+    item = g_hash_table_lookup( app->slideshow_items, GUINT_TO_POINTER(index) );
+    if (!item)
+        return;
+
+    g_object_ref(item);
+    g_hash_table_remove( app->slideshow_items, GUINT_TO_POINTER(index) );
+    clean_items(app);
+    set_current_offset(app, index);
+    pack_item(app, item, 0, 0);
+    g_object_unref(item);
+    app->count = 1;
+    update_title(app);
+
+    /* zoom could change since item was prepared */
+    refine_items(app);
 }
 
 static gboolean
-save_session(const Application *app, const char *filename)
+finish_startup(Application *app)
 {
-    GKeyFile *keyfile;
-    gboolean ret = TRUE;
-    const Option *option = options;
-    OptionType type;
-    const gchar *key;
+    gchar *filename;
 
-    keyfile = key_file_new(filename);
-    if (!keyfile) {
-        keyfile = key_file_new(NULL);
-        if (!keyfile)
-            return FALSE;
-    }
+    restore_session_items(app);
 
-    while(option->key) {
-        type = option->type;
-        key = option->key;
-        if (type == OptionInteger) {
-            getterInteger *get = option->getter.getInteger;
-            if (get)
-                g_key_file_set_integer( keyfile, "general", key, (*get)(app) );
-        } else if (type == OptionDouble) {
-            getterDouble *get = option->getter.getDouble;
-            if (get)
-                g_key_file_set_double( keyfile, "general", key, (*get)(app) );
-        } else if (type == OptionBoolean) {
-            getterBoolean *get = option->getter.getBoolean;
-            if (get)
-                g_key_file_set_boolean( keyfile, "general", key, (*get)(app) );
-        } else if (type == OptionString) {
-            getterString *get = option->getter.getString;
-            if (get)
-                g_key_file_set_string( keyfile, "general", key, (*get)(app) );
-        } else if (type == OptionStringList) {
-            getterStringList *get = option->getter.getStringList;
-            typeStringList list;
-            gsize size;
-            if (get) {
-                list = (*get)(app, &size);
-                g_key_file_set_string_list(keyfile, "general", key,
-                        (const gchar **)list, size);
-            }
-        } else if (type == OptionColor) {
-            gchar color[9];
-            getterColor *get = option->getter.getColor;
-            if (get)
-                g_key_file_set_string( keyfile, "general",
-                    key, color_to_string((*get)(app), &color[0]) );
-        }
-        ++option;
+    /* set correct rows, columns and offset value */
+    set_rows( app, get_rows(app) );
+    set_columns( app, get_columns(app) );
+
+    update_title(app);
+
+    if (app->sort_on_startup)
+        sort_items(app);
+
+    /* add label to first item if needed */
+    if ( app->first_item_ok && (get_rows(app) > 1 || get_columns(app) > 1) ) {
+        filename = get_item( app, get_current_offset(app) );
+        add_item_label(app, app->first_item, filename, TRUE);
+        g_free(filename);
     }
+    app->first_item = NULL;
 
-    ret = key_file_save(keyfile, filename);
-    key_file_free(keyfile);
+    /* interaction */
+    app->drag_action = init_scrollable(app->viewport, &app->options.scroll_animation);
+    g_signal_connect( app->stage,
+            "key-press-event",
+            G_CALLBACK(on_key_press),
+            app );
 
-    return ret;
+    /* load rest of the items on page */
+    app->count = 1;
+    load_images(app);
+    /* first item was decoded to fit window */
+    refine_items(app);
+
+    /* slideshow saved in session */
+    update_slideshow(app);
+
+    /* perceptual hashes of all items (computed on first D or SHIFT+D) */
+    app->hasher = hasher_new( (HashCallback*)on_hash_done, app );
+
+    /* pairs from command line */
+    if (app->compare_on_startup)
+        set_compare(app, TRUE);
+
+    start_trace(app);
+
+    return FALSE;
 }
 
+static void
+on_first_paint(ClutterActor *stage, Application *app)
+{
+    g_signal_handler_disconnect(stage, app->first_paint_handler);
+    app->first_paint_handler = 0;
+
+    if (app->debug) {
+        g_printerr("imagepeek: First image shown in %.1f ms.\n",
+                (g_get_monotonic_time() - app->start_time) / 1000.0);
+    }
+
+    /* rest of startup is done after the first frame is on screen */
+    g_idle_add( (GSourceFunc)finish_startup, app );
+}
 
 static gboolean
 init_app(Application *app, int argc, char **argv)
 {
     ClutterActor *box;
     ClutterLayoutManager *layout;
+    gchar *first;
 
     app->count = 0;
-    app->loading = FALSE;
-    app->restart = FALSE;
-    app->argc = 0;
-    app->argv = NULL;
+    app->items = NULL;
+    app->visible = NULL;
+    app->filter_query = NULL;
+    app->search_id = 0;
+    app->search_mode = PromptNone;
+    app->prompt = NULL;
+    app->prompt_mode = PromptNone;
+    app->query = g_string_new("");
+    app->server = NULL;
+    app->reads_pending = 0;
+    app->decodes_pending = 0;
+    app->preview_count = 0;
+    app->decode_count = 0;
+    app->options.sort = NULL;
+    app->options.sort_order = SortNone;
+    app->options.sort_descending = FALSE;
+    app->sort_id = 0;
+    app->sort_on_startup = FALSE;
+    app->hasher = NULL;
+    app->index_enabled = FALSE;
+    app->hash_id = 0;
+    app->hashes = NULL;
+    app->collapse = FALSE;
+    app->jump_different_pending = FALSE;
+    app->compare = FALSE;
+    app->comparer = NULL;
+    app->jump_difference_pending = FALSE;
+    app->compare_on_startup = FALSE;
     app->options.item_font = NULL;
+    app->options.metrics_file = NULL;
+    app->options.metrics_interval = 0;
+    app->session_mapped = NULL;
+    app->session_items = NULL;
+    app->session_items_size = 0;
+    app->first_item = NULL;
+    app->first_item_ok = FALSE;
+    app->first_paint_handler = 0;
+    app->debug = g_getenv("IMAGEPEEK_DEBUG") != NULL;
+
+    app->generation = 0;
+    app->reload_id = 0;
+    app->documents = g_array_new( FALSE, FALSE, sizeof(DocumentPages) );
+    app->expand_id = 0;
+    app->scroll_to_end = FALSE;
+    app->loaded = g_async_queue_new();
+    app->loaded_pending = FALSE;
+    app->load_pool = g_thread_pool_new( (GFunc)load_job_run, app,
+            g_get_num_processors(), FALSE, NULL );
+    app->io = io_new( (IoCallback*)on_file_read, app );
+    app->filter = filter_new( (FilterCallback*)on_search_done, app );
+    app->sorter = sorter_new( (SortCallback*)on_sort_done, app );
 
     app->stage = clutter_stage_get_default();
+    app->hud = hud_new( app->stage, (HudCallback*)on_hud_update, app );
+    app->atlas = atlas_new();
+    app->pixel_cache = pixel_cache_new();
+    app->watchdog = watchdog_new();
+    app->metrics = metrics_new();
+    app->metrics_id = 0;
+    app->metrics_signal_id = g_unix_signal_add( SIGUSR1,
+            (GSourceFunc)on_metrics_signal, app );
+    app->residency = residency_new( (ResidencyPriority*)get_texture_priority,
+            (ResidencyDowngrade*)downgrade_texture, app );
+    app->slideshow = slideshow_new( (SlideshowPrepare*)on_slideshow_prepare,
+            (SlideshowShow*)on_slideshow_show, app );
+    app->slideshow_items = g_hash_table_new_full( g_direct_hash, g_direct_equal,
+            NULL, g_object_unref );
+    app->slideshow_generation = 0;
+    app->drag_action = NULL;
+    app->trace_recorder = NULL;
+    app->trace_player = NULL;
 
     /*layout = clutter_box_layout_new();*/
     layout = clutter_bin_layout_new(CLUTTER_BIN_ALIGNMENT_FIXED, CLUTTER_BIN_ALIGNMENT_FIXED);
@@ -1387,34 +4860,59 @@ init_app(Application *app, int argc, char **argv)
     clutter_actor_show_all(app->stage);
     clutter_stage_set_user_resizable( CLUTTER_STAGE(app->stage), TRUE );
 
-    /* load session */
-    app->session_file = g_getenv("IMAGEPEEK_SESSION");
+    /* GL context is available after stage is realized */
+    app->software_rendering = is_software_renderer();
+    app->texture_compression = texcomp_is_supported();
+    if (app->debug && app->software_rendering)
+        g_printerr("imagepeek: Software GL renderer, effects are reduced.\n");
+
+    /* load session (item list is parsed after first image is shown) */
+    app->session_file = g_strdup( g_getenv("IMAGEPEEK_SESSION") );
     restore_session(app, app->session_file);
 
-    /* images from arguments or session */
+    /* background color */
+    clutter_stage_set_color( CLUTTER_STAGE(app->stage), &app->options.background_color );
+
+    /* first image from arguments or session */
     if ( argc > 1 ) {
+        free_session_items(app);
         set_items( app, argv+1, argc-1 );
         set_current_offset(app, 0);
+        first = get_item(app, 0);
+    } else if (app->session_items) {
+        first = list_get_item( app->session_items, app->session_items_size,
+                app->current_offset );
+        if (!first) {
+            /* current item is out of range */
+            restore_session_items(app);
+            first = get_item( app, get_current_offset(app) );
+        }
+    } else {
+        first = NULL;
     }
-    if ( get_count(app) < 1 )
+    if (!first)
         return FALSE;
 
-    /* set correct rows, columns and offset value */
-    set_rows( app, get_rows(app) );
-    set_columns( app, get_columns(app) );
+    /* load first item, other items are loaded in finish_startup() */
+    app->first_item = new_item(app, first, &app->first_item_ok);
+    if (!app->first_item_ok)
+        add_item_label(app, app->first_item, first, FALSE);
+    pack_item(app, app->first_item, 0, 0);
+    g_free(first);
 
-    /* background color */
-    clutter_stage_set_color( CLUTTER_STAGE(app->stage), &app->options.background_color );
+    app->first_paint_handler = g_signal_connect_after( app->stage,
+            "paint",
+            G_CALLBACK(on_first_paint),
+            app );
 
-    /* interaction */
-    init_scrollable(app->viewport, &app->options.scroll_animation);
     g_signal_connect( app->stage,
-            "key-press-event",
-            G_CALLBACK(on_key_press),
+            "paint",
+            G_CALLBACK(on_stage_paint),
+            app );
+    g_signal_connect_after( app->stage,
+            "paint",
+            G_CALLBACK(on_stage_painted),
             app );
-
-    /* load items */
-    load_more(app);
 
     return TRUE;
 }
@@ -1422,8 +4920,30 @@ init_app(Application *app, int argc, char **argv)
 int main(int argc, char **argv)
 {
     Application app;
+    gchar *server_path;
+    GError *gerror = NULL;
+    gboolean compare;
+    char **versus_argv = NULL;
     int error = 0;
 
+    app.start_time = g_get_monotonic_time();
+
+    /* export doesn't open window */
+    if ( is_export(argc, argv) )
+        return export_main(argc, argv) ? 0 : 1;
+
+    /* lists to compare are opened in new instance */
+    compare = parse_versus(&argc, &argv);
+    if (compare)
+        versus_argv = argv;
+
+    /* hand over to running instance before any initialization */
+    server_path = compare ? NULL : get_server_path();
+    if ( server_path && send_to_server(server_path, argc, argv) ) {
+        g_free(server_path);
+        return 0;
+    }
+
     /* initialization */
     if ( clutter_init(&argc, &argv) != CLUTTER_INIT_SUCCESS )
         return 1;
@@ -1431,19 +4951,75 @@ int main(int argc, char **argv)
         g_printerr("imagepeek: No images loaded!\n");
         return 1;
     }
+    /* pairs are kept in order of arguments */
+    if (compare) {
+        app.sort_on_startup = FALSE;
+        app.compare_on_startup = TRUE;
+    }
+
+    /* become the running instance */
+    if (server_path) {
+        app.server = server_new( server_path, (ServerCallback*)on_server_message,
+                &app, &gerror );
+        if (!app.server) {
+            g_printerr("imagepeek: Cannot start server! (%s)\n", gerror->message);
+            g_error_free(gerror);
+        }
+        g_free(server_path);
+    }
 
     /* main loop */
     clutter_main();
 
-    /* save session */
-    if (app.session_file && app.session_file[0] != '\0') {
-        if ( save_session(&app, app.session_file) ) {
-            g_printerr("imagepeek: Session file \"%s\" saved.\n", app.session_file);
-        } else {
-            g_printerr("imagepeek: Cannot save session file '%s'!\n", app.session_file);
-            ++error;
-        }
+    /* cleanup isn't done in main loop */
+    if (app.debug)
+        print_stalls(&app);
+    if (app.metrics_id != 0) {
+        g_source_remove(app.metrics_id);
+        write_metrics(&app);
+    }
+    g_source_remove(app.metrics_signal_id);
+    watchdog_free(app.watchdog);
+
+    /* cancel and wait for running jobs */
+    g_atomic_int_inc(&app.generation);
+    io_free(app.io);
+    g_thread_pool_free(app.load_pool, TRUE, TRUE);
+    free_documents(&app);
+    g_array_free(app.documents, TRUE);
+    sorter_free(app.sorter);
+    filter_free(app.filter);
+    if (app.hasher)
+        hasher_free(app.hasher);
+    if (app.hashes)
+        hash_result_free(app.hashes);
+    if (app.comparer)
+        comparer_free(app.comparer);
+    hud_free(app.hud);
+    slideshow_free(app.slideshow);
+    g_hash_table_destroy(app.slideshow_items);
+    /* item textures keep used atlas textures alive */
+    atlas_free(app.atlas);
+    residency_free(app.residency);
+    pixel_cache_free(app.pixel_cache);
+    metrics_free(app.metrics);
+
+    if (app.server)
+        server_free(app.server);
+
+    if (app.trace_recorder)
+        trace_recorder_free(app.trace_recorder);
+    /* replay doesn't change session so that it can be repeated */
+    if (app.trace_player) {
+        trace_player_free(app.trace_player);
+    } else if ( !save_app_session(&app) ) {
+        ++error;
     }
+    if (app.visible)
+        filter_result_free(app.visible);
+    if (app.items)
+        path_store_free(app.items);
+    g_free(versus_argv);
 
     g_printerr("imagepeek: Exiting.\n");
     return error;
@@ -1,9 +1,33 @@
 #include <clutter/clutter.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "animation.h"
+#include "atlas.h"
+#include "exif.h"
+#include "export.h"
+#include "filter.h"
+#include "hud.h"
+#include "io.h"
+#include "pathstore.h"
+#include "pixcache.h"
+#include "residency.h"
+#include "server.h"
+#include "slideshow.h"
+#include "sort.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "metrics.h"
+#include "phash.h"
+#include "compare.h"
+#include "pages.h"
 
 typedef enum _OptionType OptionType;
+typedef enum _PromptMode PromptMode;
 typedef struct _Option Option;
 typedef struct _Options Options;
 typedef struct _Application Application;
+typedef struct _LoadJob LoadJob;
+typedef struct _VectorTile VectorTile;
+typedef struct _DocumentPages DocumentPages;
 
 typedef gint typeInteger;
 typedef gdouble typeDouble;
@@ -23,9 +47,16 @@ typedef typeInteger getterInteger(const Application*);
 typedef typeDouble getterDouble(const Application*);
 typedef typeBoolean getterBoolean(const Application*);
 typedef typeString getterString(const Application*);
-typedef typeStringList getterStringList(const Application*, gsize*);
+/* returns list escaped as key file value (newly allocated) */
+typedef gchar *getterStringList(const Application*);
 typedef typeColor getterColor(const Application*);
 
+enum _PromptMode {
+    PromptNone,
+    PromptFilter,
+    PromptJump
+};
+
 struct _Options {
     gdouble zoom_increment;
     gfloat sharpen_strength;
@@ -39,6 +70,28 @@ struct _Options {
     guint rows, columns;
     gboolean fullscreen;
     ClutterTextureQuality zoom_quality;
+    /* number of next pages to prefetch */
+    guint prefetch_pages;
+    /* sort order name ("-" prefix for descending) */
+    gchar *sort;
+    SortOrder sort_order;
+    gboolean sort_descending;
+    /* pack thumbnails into atlas textures */
+    gboolean atlas;
+    /* texture memory budget in MiB (0 for unlimited) */
+    guint texture_budget;
+    /* store thumbnails in compressed textures */
+    gboolean compress_textures;
+    /* run slideshow */
+    gboolean slideshow;
+    /* metrics are written periodically into this file (empty to disable) */
+    gchar *metrics_file;
+    /* in seconds */
+    guint metrics_interval;
+    /* items with perceptual hashes differing in fewer bits are similar */
+    guint similar_threshold;
+    /* pairs with larger difference of some channel differ */
+    guint compare_threshold;
 };
 
 struct _Application {
@@ -47,19 +100,200 @@ struct _Application {
     ClutterActor *viewport;
     Options options;
 
-    /* number of items */
-    guint argc;
     /* list of items */
-    gchar **argv;
+    PathStore *items;
+    /* indices of items matching filter (NULL to show all items) */
+    FilterResult *visible;
+    gchar *filter_query;
+    /* parallel search for filter and jump-to */
+    Filter *filter;
+    /* id of pending search (0 if none) */
+    guint search_id;
+    PromptMode search_mode;
+    /* sorting in background */
+    Sorter *sorter;
+    /* perceptual hashes of items (NULL while indexing) */
+    Hasher *hasher;
+    /* index is built on first use and then kept up to date */
+    gboolean index_enabled;
+    guint hash_id;
+    HashResult *hashes;
+    gint64 hash_start;
+    /* runs of similar items are collapsed to their first item */
+    gboolean collapse;
+    /* jump to different item waits for index */
+    gboolean jump_different_pending;
+    /* pages show difference of item pairs (items 2i and 2i+1) */
+    gboolean compare;
+    Comparer *comparer;
+    /* jump to differing pair waits for comparing */
+    gboolean jump_difference_pending;
+    /* compare pairs from command line after startup */
+    gboolean compare_on_startup;
+    /* id of pending sort (0 if none) */
+    guint sort_id;
+    /* sort items from command line after startup */
+    gboolean sort_on_startup;
+    /* text input for filter and jump-to */
+    ClutterActor *prompt;
+    PromptMode prompt_mode;
+    GString *query;
     /* index of first item on the page */
     guint current_offset;
     /* number of loaded items */
     guint count;
 
-    gboolean loading;
-    gboolean restart;
+    /* file reading (before decoding) */
+    Io *io;
+    /* decoding threads */
+    GThreadPool *load_pool;
+    /* decoded items (LoadJob) waiting to be shown */
+    GAsyncQueue *loaded;
+    gint loaded_pending;
+    /* load generation, incremented when page changes (atomic) */
+    gint generation;
+    /* pending reload */
+    guint reload_id;
+    /* loaded placeholders of documents (DocumentPages) expanded at once */
+    GArray *documents;
+    guint expand_id;
+    /* scroll to bottom of page when images are loaded */
+    gboolean scroll_to_end;
+
+    gchar *session_file;
+    /* unparsed item list from session file */
+    GMappedFile *session_mapped;
+    const gchar *session_items;
+    gsize session_items_size;
+
+    /* textures of thumbnails in grid */
+    Atlas *atlas;
+    /* texture memory budget */
+    Residency *residency;
+    /* decoded images on disk */
+    PixelCache *pixel_cache;
+    /* detects stalls of main loop */
+    Watchdog *watchdog;
+    /* runtime counters and histograms */
+    Metrics *metrics;
+    guint metrics_id;
+    guint metrics_signal_id;
+    gint64 paint_start;
+    /* GL is emulated on CPU (e.g. llvmpipe) */
+    gboolean software_rendering;
+    /* GL supports compressed textures */
+    gboolean texture_compression;
+
+    /* first item is loaded before rest of the application */
+    ClutterActor *first_item;
+    gboolean first_item_ok;
+    gulong first_paint_handler;
+
+    /* performance overlay */
+    Hud *hud;
+    /* files waiting for reading and for decoding (atomic) */
+    gint reads_pending;
+    gint decodes_pending;
+    /* shown images which were decoded from EXIF preview and fully */
+    guint preview_count;
+    guint decode_count;
+
+    /* slideshow with items prepared ahead */
+    Slideshow *slideshow;
+    /* prepared items (index -> ClutterActor) */
+    GHashTable *slideshow_items;
+    /* incremented when prepared items are dropped (atomic) */
+    gint slideshow_generation;
+
+    /* drag scrolling of viewport */
+    ClutterAction *drag_action;
+    /* input events are recorded or replayed (IMAGEPEEK_TRACE_RECORD/REPLAY) */
+    TraceRecorder *trace_recorder;
+    TracePlayer *trace_player;
+
+    /* control socket of single running instance (IMAGEPEEK_SERVER) */
+    Server *server;
+
+    /* print debugging information (IMAGEPEEK_DEBUG) */
+    gboolean debug;
+    /* startup time (monotonic time in microseconds) */
+    gint64 start_time;
+};
+
+struct _LoadJob {
+    Application *app;
+    /* job is dropped if page changed since it was queued */
+    gint generation;
+    gchar *filename;
+    /* file data read in I/O stage */
+    IoRequest read;
+    /* item to show image in (accessed only in main thread) */
+    ClutterActor *item;
+    /* smallest scale of decoded image (image is displayed at this zoom) */
+    gdouble scale;
+    /* image is decoded in lower scale to fit into this size (if set) */
+    gint fit_width, fit_height;
+    /* embedded preview can be used even if it's smaller than needed */
+    gboolean thumbnail;
+    /* EXIF read from start of file (if embedded preview is read alone) */
+    ExifInfo exif;
+    /* pixel cache is checked in I/O stage (only start of file is read) */
+    gboolean check_cache;
+    /* decoded image is in pixel cache (file is not read) */
+    gboolean cached;
+    /* full resolution image saved to pixel cache after dispatch */
+    Image *unsaved;
+    /* encode image for compressed texture */
+    gboolean compress;
+    Image *image;
+    /* image is preview smaller than needed */
+    gboolean preview;
+    /* set if image is animated */
+    Animation *animation;
+    /* encoded image (if compress is set and image is opaque) */
+    CompressedImage *compressed;
+    /* image is decoded in lower resolution to free texture memory */
+    gboolean downgrade;
+    /* item is prepared for slideshow (it's not in viewport yet) */
+    gboolean slideshow;
+    /* time spent decoding (microseconds) */
+    gint64 decode_time;
+    /* time when job was created (monotonic, microseconds) */
+    gint64 queue_time;
+    /* image is compared with this one (heatmap of difference is shown) */
+    gchar *compare_filename;
+    CompareStats compare_stats;
+    /* document and page number (from 1) if item is page of document */
+    gchar *document;
+    gint page;
+    /* item at index in item list is placeholder of document (its pages
+     * are counted first) */
+    gboolean expand;
+    guint index;
+    /* pages of placeholder replacing it in item list (nothing is rendered) */
+    gint pages;
+    /* key of tile if only region of vector item is rendered */
+    gchar *tile;
+    gint tile_x, tile_y;
+    GError *error;
+};
+
+/* part of vector item rendered for zoom beyond size of whole item texture */
+struct _VectorTile {
+    /* zoom step and position in tiles */
+    gdouble step;
+    gint x, y;
+    /* NULL while tile is rendered in job of given generation */
+    ClutterActor *view;
+    gint generation;
+};
 
-    const gchar *session_file;
+/* placeholder of multi-page document to replace with its pages */
+struct _DocumentPages {
+    /* index in item list */
+    guint index;
+    gchar *path;
+    gint pages;
 };
 
 enum _OptionType {
@@ -103,6 +337,7 @@ struct _Option {
 typedef void (*zoom_callback)(ClutterAnimation *, gpointer);
 
 static gboolean init_app(Application *app, int argc, char **argv);
+static gboolean finish_startup(Application *app);
 
 /* Application setters */
 static setterDouble     set_sharpen;
@@ -115,6 +350,17 @@ static setterInteger    set_columns;
 static setterDouble     set_zoom_simple;
 static setterInteger    set_zoom_quality;
 static setterInteger    set_item_spacing;
+static setterString     set_sort;
+static setterInteger    set_prefetch_pages;
+static setterInteger    set_texture_budget;
+static setterInteger    set_pixel_cache;
+static setterBoolean    set_pixel_cache_compress;
+static setterInteger    set_slideshow_interval;
+static setterBoolean    set_slideshow_shuffle;
+static setterInteger    set_slideshow_ready;
+static setterInteger    set_watchdog;
+static setterString     set_metrics_file;
+static setterInteger    set_metrics_interval;
 
 /* Application getters */
 static getterDouble     get_sharpen;
@@ -128,21 +374,166 @@ static getterInteger    get_count;
 static getterDouble     get_zoom_simple;
 static getterInteger    get_zoom_quality;
 static getterInteger    get_item_spacing;
-static typeString       get_item(const Application *app, guint index);
+static getterString     get_sort;
+static getterInteger    get_prefetch_pages;
+static getterInteger    get_texture_budget;
+static getterInteger    get_pixel_cache;
+static getterBoolean    get_pixel_cache_compress;
+static getterInteger    get_slideshow_interval;
+static getterBoolean    get_slideshow_shuffle;
+static getterInteger    get_slideshow_ready;
+static getterInteger    get_watchdog;
+static getterString     get_metrics_file;
+static getterInteger    get_metrics_interval;
+static gchar           *get_item(const Application *app, guint index);
+static guint            get_item_index(const Application *app, guint index);
+static void set_item_store(Application *app, PathStore *items);
 
 /* session */
 static gboolean save_session(const Application *app, const char *filename);
 static gboolean restore_session(Application *app, const char *filename);
+static void restore_session_items(Application *app);
+static void free_session_items(Application *app);
+static gboolean save_app_session(Application *app);
+
+/* single instance */
+static gchar *get_server_path(void);
+static gchar *absolute_path(const gchar *cwd, const gchar *path);
+static gboolean send_to_server(const gchar *path, int argc, char **argv);
+static void on_server_message(const gchar *message, gsize size, Application *app);
+static void hide_app(Application *app);
+
+/* headless export */
+static gboolean is_export(int argc, char **argv);
+static gboolean export_main(int argc, char **argv);
+static const Option *option_find(const gchar *key);
+static typeInteger session_get_integer(GKeyFile *keyfile, const gchar *key);
+static gchar *session_get_string(GKeyFile *keyfile, const gchar *key);
+static typeColor session_get_color(GKeyFile *keyfile, const gchar *key);
+
+/* performance overlay */
+static void on_hud_update(GString *text, Application *app);
+static void append_stalls(GString *text, const Application *app);
+static void print_stalls(const Application *app);
+
+/* similar items */
+static void index_items(Application *app);
+static void enable_index(Application *app);
+static void on_hash_done(HashResult *result, Application *app);
+static gboolean show_hash_result(HashResult *result);
+static gboolean items_differ(const Application *app, guint a, guint b);
+static void jump_to_different(Application *app);
+static void collapse_items(Application *app);
+static void set_collapse(Application *app, gboolean collapse);
+
+/* vector items */
+static gdouble get_vector_step(const Application *app);
+static gdouble get_vector_scale(const Application *app, ClutterActor *item);
+static void refine_vector_item(Application *app, ClutterActor *item, GPtrArray *jobs);
+static void add_vector_tiles(Application *app, ClutterActor *item, GPtrArray *jobs);
+static gboolean vector_tile_is_covered(GHashTable *tiles, const VectorTile *tile, gdouble step, gfloat width, gfloat height);
+static void show_vector_tile(Application *app, LoadJob *job);
+static void vector_tile_free(VectorTile *tile);
+
+/* comparing pairs */
+static void show_compare_stats(Application *app, LoadJob *job);
+static void start_compare(Application *app);
+static void on_compare_progress(guint id, Application *app);
+static gboolean show_compare_progress(Application *app);
+static void jump_to_next_difference(Application *app);
+static void compare_items(Application *app);
+static void set_compare(Application *app, gboolean compare);
+static gboolean parse_versus(int *argc, char ***argv);
+
+/* metrics */
+static void restart_metrics(Application *app);
+static void update_metrics(Application *app);
+static gboolean write_metrics(Application *app);
+static gboolean on_metrics_signal(Application *app);
+static void on_stage_paint(ClutterActor *stage, Application *app);
+static void on_stage_painted(ClutterActor *stage, Application *app);
+
+/* interaction traces */
+static void start_trace(Application *app);
+static void save_trace_state(Application *app);
+static void restore_trace_state(Application *app);
+static gboolean record_event(ClutterActor *stage, ClutterEvent *event, Application *app);
+static void record_drag(ClutterDragAction *action, ClutterActor *actor,
+        gfloat delta_x, gfloat delta_y, Application *app);
+static void record_drag_end(ClutterDragAction *action, ClutterActor *actor,
+        gfloat event_x, gfloat event_y, ClutterModifierType modifiers, Application *app);
+static void replay_event(const TraceEvent *trace_event, Application *app);
+static void on_replay_done(Application *app);
+static gboolean finish_replay(Application *app);
+
+/* slideshow */
+static void update_slideshow(Application *app);
+static void restart_slideshow(Application *app);
+static void on_slideshow_prepare(guint index, Application *app);
+static void on_slideshow_show(guint index, Application *app);
 
 /* items (un)loading */
 static void load_prev(Application *app);
 static void load_next(Application *app);
 static void reload(Application *app);
+static gboolean reload_now(Application *app);
 static void load_more(Application *app);
 static void clean_items(Application *app);
 static void update(Application *app);
-static gboolean load_image(Application *app, const char *filename, gint x, gint y);
-static gboolean load_images(Application *app);
+static void update_title(Application *app);
+static ClutterActor* new_item(Application *app, const char *filename, gboolean *ok);
+static ClutterActor* add_item_label(Application *app, ClutterActor *item, const char *filename, gboolean ok);
+static void pack_item(Application *app, ClutterActor *item, gint x, gint y);
+static LoadJob *load_image(Application *app, const char *filename, const char *compare_filename, gint x, gint y);
+static void load_images(Application *app);
+static gboolean is_software_renderer(void);
+static gsize get_texture_size(ClutterActor *view);
+static gdouble get_texture_priority(ClutterActor *view, Application *app);
+static gboolean downgrade_texture(ClutterActor *view, Application *app);
+static gboolean can_use_atlas(const Application *app);
+static ClutterActor* set_item_image(Application *app, ClutterActor *item, Image *image,
+        const CompressedImage *compressed, gboolean thumbnail, GError **error);
+static void refine_items(Application *app);
+
+/* sorting */
+static void set_sort_order(Application *app, SortOrder order, gboolean descending);
+static void sort_items(Application *app);
+static void on_sort_done(SortResult *result, Application *app);
+static gboolean show_sort_result(SortResult *result);
+
+/* filter and jump-to */
+static void set_visible(Application *app, FilterResult *visible);
+static void filter_items(Application *app, const gchar *query);
+static void jump_to(Application *app, const gchar *query);
+static void jump_to_result(Application *app, const FilterResult *result);
+static void on_search_done(FilterResult *result, Application *app);
+static gboolean show_search_result(FilterResult *result);
+static void prompt_show(Application *app, PromptMode mode, const gchar *text);
+static void prompt_hide(Application *app);
+static void prompt_update(Application *app, const gchar *status);
+static gboolean prompt_on_key_press(Application *app, ClutterEvent *event);
+
+/* decoding */
+static gboolean load_job_is_stale(const LoadJob *job);
+static LoadJob *load_job_new(Application *app, const char *filename, ClutterActor *item);
+static void load_job_free(LoadJob *job);
+static Image *load_job_decode(LoadJob *job, GError **error);
+static Image *load_job_compare(LoadJob *job, GError **error);
+static Image *load_job_render_page(LoadJob *job, GError **error);
+static Image *load_job_decode_data(LoadJob *job, const guchar *data, gsize size, gboolean partial, GError **error);
+static gboolean may_have_preview(const gchar *filename);
+static gboolean load_job_head_is_enough(LoadJob *job);
+static Image *load_job_decode_read_preview(LoadJob *job);
+static void load_jobs(Application *app, GPtrArray *jobs);
+static void prefetch_items(Application *app);
+static void on_file_read(IoRequest *read, Application *app);
+static Image *load_job_decode_preview(LoadJob *job, const guchar *data, const ExifInfo *exif);
+static void load_job_process(LoadJob *job);
+static void load_job_run(LoadJob *job, Application *app);
+static void show_loaded(Application *app, LoadJob *job);
+static gboolean dispatch_loaded(Application *app);
+static void free_documents(Application *app);
+static gboolean expand_documents(Application *app);
 
 /* Actor methods */
 static void crop_container(ClutterActor *actor, guint n);
@@ -152,9 +543,10 @@ static void set_zoom(ClutterActor *actor, gdouble zoom_level,
 static gdouble get_zoom(ClutterActor *actor);
 
 /* scrollable Actor */
-static void init_scrollable(ClutterActor *actor, guint *scroll_animation);
+static ClutterAction *init_scrollable(ClutterActor *actor, guint *scroll_animation);
 static void scrollable_set_scroll(ClutterActor *actor, gfloat x, gfloat y, guint scroll_animation);
 static void scrollable_get_scroll(ClutterActor *actor, gfloat *x, gfloat *y);
+static void scrollable_get_max(ClutterActor *actor, gfloat *max_x, gfloat *max_y);
 static ClutterActor* scrollable_get_offset_parent(ClutterActor *actor);
 static gboolean scrollable_on_scroll(ClutterActor *actor, ClutterEvent *event, guint *scroll_animation);
 static gboolean scrollable_on_key_press(ClutterActor *actor, ClutterEvent *event, guint *scroll_animation);
@@ -176,9 +568,19 @@ static void scrollable_on_drag(
 static void on_allocation_changed(ClutterActor *actor, ClutterActorBox *box, ClutterAllocationFlags flags, Application *app);
 static gboolean on_key_press(ClutterActor *stage, ClutterEvent *event, gpointer user_data);
 static void on_zoom_completed(ClutterAnimation *anim, Application *app);
+static void on_first_paint(ClutterActor *stage, Application *app);
 
 /* configuration */
 static GKeyFile *key_file_new(const gchar *filename);
+static GKeyFile *key_file_new_lazy(
+        const gchar *filename,
+        const gchar *key,
+        GMappedFile **mapped,
+        const gchar **list,
+        gsize *list_size );
+static gchar *list_get_item(const gchar *list, gsize size, guint index);
+static PathStore *list_parse(const gchar *list, gsize size);
+static void list_append_escaped(GString *list, const gchar *item);
 static void key_file_free(GKeyFile *keyfile);
 static gboolean key_file_save(GKeyFile *keyfile, const gchar *filename);
 static ClutterColor color_from_string(const gchar *color_string);
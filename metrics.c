@@ -0,0 +1,178 @@
+#include "metrics.h"
+
+typedef struct _MetricsInfo MetricsInfo;
+
+struct _MetricsInfo {
+    const gchar *name;
+    const gchar *help;
+    const gchar *type;
+    /* value is divided by scale (microseconds to seconds) */
+    gdouble scale;
+};
+
+/* upper bounds of histogram buckets (microseconds), last bucket is +Inf */
+static const gint64 metrics_bounds[] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000,
+    500000, 1000000, 2000000, 5000000
+};
+#define METRICS_BUCKETS (G_N_ELEMENTS(metrics_bounds) + 1)
+
+typedef struct _MetricsBuckets MetricsBuckets;
+
+struct _MetricsBuckets {
+    gsize counts[METRICS_BUCKETS];
+    /* microseconds */
+    gsize sum;
+};
+
+struct _Metrics {
+    gsize values[MetricsValueCount];
+    MetricsBuckets histograms[MetricsHistogramCount];
+};
+
+static const MetricsInfo metrics_values[] = {
+    {"imagepeek_items_loaded_total", "Images shown after loading.", "counter", 1},
+    {"imagepeek_load_errors_total", "Images which failed to load.", "counter", 1},
+    {"imagepeek_previews_total", "Embedded previews shown instead of images.", "counter", 1},
+    {"imagepeek_pixel_cache_hits_total", "Images mapped from decoded pixel cache.", "counter", 1},
+    {"imagepeek_pixel_cache_misses_total", "Full images decoded with pixel cache enabled.", "counter", 1},
+    {"imagepeek_read_bytes_total", "Bytes read by I/O stage.", "counter", 1},
+    {"imagepeek_frame_drops_total", "Frames painted longer than 1/60 s.", "counter", 1},
+    {"imagepeek_stalls_total", "Main loop stalls detected by watchdog.", "counter", 1},
+    {"imagepeek_stall_seconds_total", "Duration of finished main loop stalls.", "counter", 1e6},
+    {"imagepeek_items", "Items in (filtered) list.", "gauge", 1},
+    {"imagepeek_texture_bytes", "Memory of textures tracked by budget.", "gauge", 1},
+    {"imagepeek_atlas_bytes", "Memory of atlas textures.", "gauge", 1},
+};
+
+static const MetricsInfo metrics_histograms[] = {
+    {"imagepeek_decode_seconds", "Time to read and decode image in worker thread.", "histogram", 1e6},
+    {"imagepeek_upload_seconds", "Time to upload decoded image to texture.", "histogram", 1e6},
+    {"imagepeek_frame_seconds", "Duration of stage paint.", "histogram", 1e6},
+};
+
+Metrics *
+metrics_new(void)
+{
+    G_STATIC_ASSERT( G_N_ELEMENTS(metrics_values) == MetricsValueCount );
+    G_STATIC_ASSERT( G_N_ELEMENTS(metrics_histograms) == MetricsHistogramCount );
+
+    return g_new0(Metrics, 1);
+}
+
+void
+metrics_free(Metrics *metrics)
+{
+    g_free(metrics);
+}
+
+void
+metrics_add(Metrics *metrics, MetricsValue value, gsize amount)
+{
+    g_atomic_pointer_add(&metrics->values[value], amount);
+}
+
+void
+metrics_set(Metrics *metrics, MetricsValue value, gsize amount)
+{
+    g_atomic_pointer_set(&metrics->values[value], amount);
+}
+
+gsize
+metrics_get(Metrics *metrics, MetricsValue value)
+{
+    return (gsize)g_atomic_pointer_get(&metrics->values[value]);
+}
+
+void
+metrics_observe(Metrics *metrics, MetricsHistogram histogram, gint64 time)
+{
+    MetricsBuckets *buckets = &metrics->histograms[histogram];
+    guint i = 0;
+
+    time = MAX(0, time);
+    while ( i < G_N_ELEMENTS(metrics_bounds) && time > metrics_bounds[i] )
+        ++i;
+
+    g_atomic_pointer_add(&buckets->counts[i], 1);
+    g_atomic_pointer_add(&buckets->sum, time);
+}
+
+static void
+metrics_append_header(GString *text, const MetricsInfo *info)
+{
+    g_string_append_printf( text, "# HELP %s %s\n# TYPE %s %s\n",
+            info->name, info->help, info->name, info->type );
+}
+
+/* appends value in format independent of locale */
+static void
+metrics_append_number(GString *text, gdouble number)
+{
+    gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append( text, g_ascii_dtostr(buffer, sizeof(buffer), number) );
+}
+
+gchar *
+metrics_to_text(Metrics *metrics)
+{
+    const MetricsInfo *info;
+    MetricsBuckets *buckets;
+    GString *text;
+    gsize value, count;
+    guint i, j;
+
+    text = g_string_new(NULL);
+
+    for (i = 0; i < MetricsValueCount; ++i) {
+        info = &metrics_values[i];
+        value = (gsize)g_atomic_pointer_get(&metrics->values[i]);
+        metrics_append_header(text, info);
+        g_string_append_printf(text, "%s ", info->name);
+        if (info->scale == 1)
+            g_string_append_printf(text, "%" G_GSIZE_FORMAT, value);
+        else
+            metrics_append_number(text, value / info->scale);
+        g_string_append_c(text, '\n');
+    }
+
+    for (i = 0; i < MetricsHistogramCount; ++i) {
+        info = &metrics_histograms[i];
+        buckets = &metrics->histograms[i];
+        metrics_append_header(text, info);
+
+        /* buckets are cumulative */
+        count = 0;
+        for (j = 0; j < METRICS_BUCKETS; ++j) {
+            count += (gsize)g_atomic_pointer_get(&buckets->counts[j]);
+            g_string_append_printf(text, "%s_bucket{le=\"", info->name);
+            if (j < G_N_ELEMENTS(metrics_bounds))
+                metrics_append_number(text, metrics_bounds[j] / info->scale);
+            else
+                g_string_append(text, "+Inf");
+            g_string_append_printf(text, "\"} %" G_GSIZE_FORMAT "\n", count);
+        }
+
+        g_string_append_printf(text, "%s_sum ", info->name);
+        metrics_append_number( text,
+                (gsize)g_atomic_pointer_get(&buckets->sum) / info->scale );
+        g_string_append_printf(text, "\n%s_count %" G_GSIZE_FORMAT "\n", info->name, count);
+    }
+
+    return g_string_free(text, FALSE);
+}
+
+gboolean
+metrics_write(Metrics *metrics, const gchar *filename, GError **error)
+{
+    gchar *text;
+    gboolean ok;
+
+    /* written into temporary file which is renamed */
+    text = metrics_to_text(metrics);
+    ok = g_file_set_contents(filename, text, -1, error);
+    g_free(text);
+
+    return ok;
+}
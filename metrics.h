@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+typedef struct _Metrics Metrics;
+
+typedef enum {
+    /* counters */
+    MetricsItemsLoaded,
+    MetricsLoadErrors,
+    MetricsPreviews,
+    MetricsPixelCacheHits,
+    MetricsPixelCacheMisses,
+    MetricsBytesRead,
+    MetricsFrameDrops,
+    MetricsStalls,
+    /* microseconds */
+    MetricsStallTime,
+    /* gauges */
+    MetricsItems,
+    MetricsTextureMemory,
+    MetricsAtlasMemory,
+    MetricsValueCount
+} MetricsValue;
+
+/* histograms of durations in microseconds */
+typedef enum {
+    MetricsDecodeTime,
+    MetricsUploadTime,
+    MetricsFrameTime,
+    MetricsHistogramCount
+} MetricsHistogram;
+
+/*
+ * Runtime counters, gauges and latency histograms.
+ *
+ * Values are updated with atomic operations without locking, so they can
+ * be recorded from any thread. Snapshot taken while values are updated
+ * can be slightly inconsistent (e.g. histogram sum and count).
+ */
+Metrics *metrics_new(void);
+void metrics_free(Metrics *metrics);
+
+/* adds to counter */
+void metrics_add(Metrics *metrics, MetricsValue value, gsize amount);
+/* sets gauge (or counter maintained elsewhere) */
+void metrics_set(Metrics *metrics, MetricsValue value, gsize amount);
+gsize metrics_get(Metrics *metrics, MetricsValue value);
+void metrics_observe(Metrics *metrics, MetricsHistogram histogram, gint64 time);
+
+/* returns newly allocated Prometheus text exposition of all metrics */
+gchar *metrics_to_text(Metrics *metrics);
+/* replaces file atomically (as expected by textfile collectors) */
+gboolean metrics_write(Metrics *metrics, const gchar *filename, GError **error);
+
+#endif /* METRICS_H */
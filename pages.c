@@ -0,0 +1,550 @@
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "pages.h"
+
+#ifdef HAVE_LIBTIFF
+#include <tiffio.h>
+#endif
+
+#ifdef HAVE_POPPLER
+#include <poppler.h>
+#include <cairo.h>
+#endif
+
+/* suffix of page items */
+#define PAGES_SUFFIX "#page="
+/* rows of TIFF page decoded at once */
+#define PAGES_TIFF_BAND 64
+
+typedef enum {
+    PagesNone,
+    PagesTiff,
+    PagesPdf
+} PagesFormat;
+
+static PagesFormat
+pages_get_format(const gchar *path)
+{
+    const gchar *ext;
+
+    ext = strrchr(path, '.');
+    if (!ext || strchr(ext, G_DIR_SEPARATOR))
+        return PagesNone;
+
+#ifdef HAVE_LIBTIFF
+    if ( g_ascii_strcasecmp(ext, ".tif") == 0 || g_ascii_strcasecmp(ext, ".tiff") == 0 )
+        return PagesTiff;
+#endif
+#ifdef HAVE_POPPLER
+    if ( g_ascii_strcasecmp(ext, ".pdf") == 0 )
+        return PagesPdf;
+#endif
+    return PagesNone;
+}
+
+#if defined(HAVE_LIBTIFF) || defined(HAVE_POPPLER)
+/* returns size scaled down with given scale (never smaller) */
+static gint
+pages_scaled_size(gint size, gdouble scale)
+{
+    if (scale >= 1.0)
+        return size;
+    return MAX( 1, (gint)ceil(size*scale) );
+}
+#endif
+
+#ifdef HAVE_LIBTIFF
+/*
+ * TIFF -- libtiff
+ *
+ * Page is decoded in bands of rows which are averaged into image of
+ * requested size so that huge scans don't need memory for full page.
+ * Each thread keeps last opened file; directories of following pages are
+ * read from current one instead of walking all previous directories.
+ */
+typedef struct _PagesTiffCache PagesTiffCache;
+
+struct _PagesTiffCache {
+    gchar *path;
+    gint64 mtime;
+    gint64 size;
+    TIFF *tiff;
+};
+
+static void
+pages_tiff_cache_free(PagesTiffCache *cache)
+{
+    TIFFClose(cache->tiff);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+static GPrivate pages_tiff_cache = G_PRIVATE_INIT( (GDestroyNotify)pages_tiff_cache_free );
+
+/* returns file owned by calling thread (reused if file didn't change) */
+static TIFF *
+pages_tiff_open(const gchar *path)
+{
+    static gsize initialized = 0;
+    PagesTiffCache *cache;
+    struct stat st;
+    TIFF *tiff;
+
+    /* errors are reported for items, warnings about unknown tags are noise */
+    if ( g_once_init_enter(&initialized) ) {
+        TIFFSetWarningHandler(NULL);
+        TIFFSetErrorHandler(NULL);
+        g_once_init_leave(&initialized, 1);
+    }
+
+    if ( stat(path, &st) != 0 )
+        return NULL;
+
+    cache = g_private_get(&pages_tiff_cache);
+    if ( cache && strcmp(cache->path, path) == 0 &&
+         cache->mtime == st.st_mtime && cache->size == st.st_size )
+    {
+        return cache->tiff;
+    }
+
+    tiff = TIFFOpen(path, "r");
+    if (!tiff)
+        return NULL;
+
+    cache = g_new0(PagesTiffCache, 1);
+    cache->path = g_strdup(path);
+    cache->mtime = st.st_mtime;
+    cache->size = st.st_size;
+    cache->tiff = tiff;
+    g_private_replace(&pages_tiff_cache, cache);
+
+    return tiff;
+}
+
+/* closes file after failure (its state is unknown) */
+static void
+pages_tiff_close(void)
+{
+    g_private_replace(&pages_tiff_cache, NULL);
+}
+
+/* reads directory of page (from 0) stepping forward from current one if possible */
+static gboolean
+pages_tiff_set_page(TIFF *tiff, gint page)
+{
+    gint current = TIFFCurrentDirectory(tiff);
+
+    if (current > page)
+        return TIFFSetDirectory(tiff, page);
+
+    for (; current < page; ++current) {
+        if ( !TIFFReadDirectory(tiff) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint
+pages_tiff_count(const gchar *path)
+{
+    TIFF *tiff;
+
+    tiff = pages_tiff_open(path);
+    if (!tiff)
+        return 0;
+    /* directories are only walked, pages are not decoded */
+    return TIFFNumberOfDirectories(tiff);
+}
+
+/* writes averaged row of output image and clears sums */
+static void
+pages_tiff_flush_row(Image *image, gint y, guint32 *sums)
+{
+    guchar *row = image->pixels + (gsize)y * image->rowstride;
+    guint32 *sum;
+    gint x, n;
+
+    for (x = 0; x < image->width; ++x) {
+        sum = sums + 5*x;
+        n = MAX(1, sum[4]);
+        *row++ = sum[0] / n;
+        *row++ = sum[1] / n;
+        *row++ = sum[2] / n;
+        if (image->has_alpha)
+            *row++ = sum[3] / n;
+    }
+
+    memset( sums, 0, sizeof(guint32) * 5 * image->width );
+}
+
+static Image *
+pages_tiff_render(const gchar *path, gint page, const DecoderRequest *request, GError **error)
+{
+    TIFF *tiff;
+    TIFFRGBAImage rgba;
+    char message[1024];
+    Image *image = NULL;
+    guint32 *band = NULL, *sums = NULL, *sum, pixel;
+    gint *columns = NULL;
+    gint width, height, out_width, out_height, rows, x, y, out_y, current = 0;
+    gdouble scale;
+    gboolean ok = FALSE;
+
+    tiff = pages_tiff_open(path);
+    if (!tiff) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Failed to open TIFF '%s'", path);
+        return NULL;
+    }
+    if ( !pages_tiff_set_page(tiff, page - 1) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Page %d not found in '%s'", page, path);
+        pages_tiff_close();
+        return NULL;
+    }
+    if ( !TIFFRGBAImageOK(tiff, message) || !TIFFRGBAImageBegin(&rgba, tiff, 0, message) ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Unsupported TIFF page %d in '%s' (%s)", page, path, message);
+        return NULL;
+    }
+    rgba.req_orientation = ORIENTATION_TOPLEFT;
+    width = MIN(rgba.width, G_MAXINT);
+    height = MIN(rgba.height, G_MAXINT);
+
+    scale = decoder_fit_scale(request, width, height);
+    out_width = pages_scaled_size(width, scale);
+    out_height = pages_scaled_size(height, scale);
+    if ( (gint64)out_width*out_height > DECODER_MAX_PIXELS ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "TIFF page %d in '%s' is too big (%dx%d)", page, path,
+                out_width, out_height);
+        TIFFRGBAImageEnd(&rgba);
+        return NULL;
+    }
+
+    image = image_new(out_width, out_height, rgba.alpha != 0);
+    band = g_try_new(guint32, (gsize)width * PAGES_TIFF_BAND);
+    sums = g_try_new0(guint32, (gsize)5 * (image ? image->width : 1));
+    columns = g_try_new(gint, width);
+    if (!image || !band || !sums || !columns) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory for TIFF page %d in '%s'", page, path);
+        goto done;
+    }
+    image->original_width = width;
+    image->original_height = height;
+
+    for (x = 0; x < width; ++x)
+        columns[x] = (gint64)x * image->width / width;
+
+    for (y = 0; y < height; y += PAGES_TIFF_BAND) {
+        if ( decoder_is_cancelled(request, error) )
+            goto done;
+
+        rows = MIN(PAGES_TIFF_BAND, height - y);
+        rgba.row_offset = y;
+        rgba.col_offset = 0;
+        if ( !TIFFRGBAImageGet(&rgba, band, width, rows) ) {
+            g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                    "Failed to decode TIFF page %d in '%s'", page, path);
+            goto done;
+        }
+
+        for (out_y = 0; out_y < rows; ++out_y) {
+            if ( (gint64)(y + out_y) * image->height / height != current ) {
+                pages_tiff_flush_row(image, current, sums);
+                ++current;
+            }
+            for (x = 0; x < width; ++x) {
+                pixel = band[(gsize)out_y * width + x];
+                sum = sums + 5*columns[x];
+                sum[0] += TIFFGetR(pixel);
+                sum[1] += TIFFGetG(pixel);
+                sum[2] += TIFFGetB(pixel);
+                sum[3] += TIFFGetA(pixel);
+                ++sum[4];
+            }
+        }
+    }
+    pages_tiff_flush_row(image, current, sums);
+    ok = TRUE;
+
+done:
+    TIFFRGBAImageEnd(&rgba);
+    if (!ok)
+        pages_tiff_close();
+    g_free(band);
+    g_free(sums);
+    g_free(columns);
+    if (!ok && image) {
+        image_free(image);
+        image = NULL;
+    }
+
+    return image;
+}
+#endif /* HAVE_LIBTIFF */
+
+#ifdef HAVE_POPPLER
+/*
+ * PDF -- poppler-glib
+ *
+ * Pages are rendered with cairo at PAGES_PDF_DPI times scale. Each thread
+ * keeps last opened document so that consecutive pages are rendered
+ * without parsing the document again (documents are not shared between
+ * threads).
+ */
+typedef struct _PagesPdfCache PagesPdfCache;
+
+struct _PagesPdfCache {
+    gchar *path;
+    gint64 mtime;
+    gint64 size;
+    PopplerDocument *document;
+};
+
+static void
+pages_pdf_cache_free(PagesPdfCache *cache)
+{
+    g_object_unref(cache->document);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+static GPrivate pages_pdf_cache = G_PRIVATE_INIT( (GDestroyNotify)pages_pdf_cache_free );
+
+/* returns new reference to document (reused if file didn't change) */
+static PopplerDocument *
+pages_pdf_open(const gchar *path, GError **error)
+{
+    PagesPdfCache *cache;
+    PopplerDocument *document;
+    struct stat st;
+    gchar *uri;
+
+    if ( stat(path, &st) != 0 ) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Failed to open '%s' (%s)", path, g_strerror(errno));
+        return NULL;
+    }
+
+    cache = g_private_get(&pages_pdf_cache);
+    if ( cache && strcmp(cache->path, path) == 0 &&
+         cache->mtime == st.st_mtime && cache->size == st.st_size )
+    {
+        return g_object_ref(cache->document);
+    }
+
+    uri = g_filename_to_uri(path, NULL, error);
+    if (!uri)
+        return NULL;
+    document = poppler_document_new_from_file(uri, NULL, error);
+    g_free(uri);
+    if (!document)
+        return NULL;
+
+    cache = g_new0(PagesPdfCache, 1);
+    cache->path = g_strdup(path);
+    cache->mtime = st.st_mtime;
+    cache->size = st.st_size;
+    cache->document = g_object_ref(document);
+    g_private_replace(&pages_pdf_cache, cache);
+
+    return document;
+}
+
+static gint
+pages_pdf_count(const gchar *path)
+{
+    PopplerDocument *document;
+    gint count;
+
+    document = pages_pdf_open(path, NULL);
+    if (!document)
+        return 0;
+    count = poppler_document_get_n_pages(document);
+    g_object_unref(document);
+
+    return count;
+}
+
+static Image *
+pages_pdf_render(const gchar *path, gint page, const DecoderRequest *request, GError **error)
+{
+    PopplerDocument *document;
+    PopplerPage *pdf_page;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    const guchar *data;
+    guchar *row;
+    guint32 pixel;
+    gdouble width, height, zoom, scale;
+    gint out_width, out_height, stride, x, y;
+    Image *image;
+
+    if ( decoder_is_cancelled(request, error) )
+        return NULL;
+
+    document = pages_pdf_open(path, error);
+    if (!document)
+        return NULL;
+    pdf_page = poppler_document_get_page(document, page - 1);
+    if (!pdf_page) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_FAILED,
+                "Page %d not found in '%s'", page, path);
+        g_object_unref(document);
+        return NULL;
+    }
+
+    poppler_page_get_size(pdf_page, &width, &height);
+    width = CLAMP(ceil(width * PAGES_PDF_DPI / 72.0), 1, G_MAXINT);
+    height = CLAMP(ceil(height * PAGES_PDF_DPI / 72.0), 1, G_MAXINT);
+    scale = decoder_fit_scale(request, width, height);
+    out_width = pages_scaled_size(width, scale);
+    out_height = pages_scaled_size(height, scale);
+    if ( (gint64)out_width*out_height > DECODER_MAX_PIXELS ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Page %d in '%s' is too big (%dx%d)", page, path,
+                out_width, out_height);
+        g_object_unref(pdf_page);
+        g_object_unref(document);
+        return NULL;
+    }
+    /* opening document can take long */
+    if ( decoder_is_cancelled(request, error) ) {
+        g_object_unref(pdf_page);
+        g_object_unref(document);
+        return NULL;
+    }
+
+    image = image_new(out_width, out_height, FALSE);
+    if (!image) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory for page %d in '%s'", page, path);
+        g_object_unref(pdf_page);
+        g_object_unref(document);
+        return NULL;
+    }
+    image->original_width = width;
+    image->original_height = height;
+    zoom = image->width / width * PAGES_PDF_DPI / 72.0;
+
+    /* pages are transparent, paper is white */
+    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, image->width, image->height);
+    if ( cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ) {
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_NO_MEMORY,
+                "Not enough memory for page %d in '%s'", page, path);
+        cairo_surface_destroy(surface);
+        image_free(image);
+        g_object_unref(pdf_page);
+        g_object_unref(document);
+        return NULL;
+    }
+    cr = cairo_create(surface);
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_paint(cr);
+    cairo_scale(cr, zoom, zoom);
+    poppler_page_render(pdf_page, cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(surface);
+
+    /* pixels are native endian 0xXXRRGGBB */
+    data = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+    for (y = 0; y < image->height; ++y) {
+        row = image->pixels + (gsize)y * image->rowstride;
+        for (x = 0; x < image->width; ++x) {
+            pixel = ((const guint32 *)(data + (gsize)y * stride))[x];
+            *row++ = pixel >> 16;
+            *row++ = pixel >> 8;
+            *row++ = pixel;
+        }
+    }
+
+    cairo_surface_destroy(surface);
+    g_object_unref(pdf_page);
+    g_object_unref(document);
+
+    return image;
+}
+#endif /* HAVE_POPPLER */
+
+gint
+pages_count(const gchar *path)
+{
+    switch ( pages_get_format(path) ) {
+#ifdef HAVE_LIBTIFF
+    case PagesTiff:
+        return pages_tiff_count(path);
+#endif
+#ifdef HAVE_POPPLER
+    case PagesPdf:
+        return pages_pdf_count(path);
+#endif
+    default:
+        return 0;
+    }
+}
+
+gchar *
+pages_get_item(const gchar *path, gint page)
+{
+    return g_strdup_printf("%s" PAGES_SUFFIX "%d", path, page);
+}
+
+gchar *
+pages_parse(const gchar *item, gint *page)
+{
+    const gchar *suffix, *number;
+    gchar *end, *path;
+    glong value;
+
+    suffix = g_strrstr(item, PAGES_SUFFIX);
+    if (!suffix) {
+        /* document which is not expanded yet stands for its first page */
+        if (pages_get_format(item) == PagesNone)
+            return NULL;
+        if (page)
+            *page = 1;
+        return g_strdup(item);
+    }
+    number = suffix + strlen(PAGES_SUFFIX);
+    if ( !g_ascii_isdigit(number[0]) )
+        return NULL;
+    value = strtol(number, &end, 10);
+    if (*end != '\0' || value < 1 || value > G_MAXINT)
+        return NULL;
+
+    path = g_strndup(item, suffix - item);
+    if (pages_get_format(path) == PagesNone) {
+        g_free(path);
+        return NULL;
+    }
+
+    if (page)
+        *page = value;
+    return path;
+}
+
+Image *
+pages_render(const gchar *path, gint page, const DecoderRequest *request, GError **error)
+{
+    switch ( pages_get_format(path) ) {
+#ifdef HAVE_LIBTIFF
+    case PagesTiff:
+        return pages_tiff_render(path, page, request, error);
+#endif
+#ifdef HAVE_POPPLER
+    case PagesPdf:
+        return pages_pdf_render(path, page, request, error);
+#endif
+    default:
+        g_set_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED,
+                "Pages of '%s' are not supported", path);
+        return NULL;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include <glib.h>
+#include "decoder.h"
+
+/* resolution of rendered PDF pages at zoom 1 */
+#define PAGES_PDF_DPI 150
+
+/*
+ * Multi-page documents (TIFF with libtiff, PDF with poppler-glib).
+ *
+ * Document is added to item list as single item showing its first page;
+ * documents are opened only in worker threads and item of multi-page
+ * document is replaced with an item for each page (path of document and
+ * page number, e.g. "scan.pdf#page=12") after its pages are counted.
+ * Pages are decoded or rendered only when shown and only in requested
+ * resolution.
+ */
+
+/*
+ * Returns number of pages of document (0 if path is not supported document
+ * or cannot be opened). Only page index of document is read.
+ */
+gint pages_count(const gchar *path);
+
+/* returns item for page (from 1) of document (newly allocated) */
+gchar *pages_get_item(const gchar *path, gint page);
+
+/*
+ * Returns document path (newly allocated) and page number (from 1) of page
+ * item (document itself is its first page) or NULL if item is not page.
+ */
+gchar *pages_parse(const gchar *item, gint *page);
+
+/*
+ * Decodes or renders page of document in at least requested scale (lowered
+ * to fit requested size); decoding is stopped if request is cancelled.
+ */
+Image *pages_render(const gchar *path, gint page, const DecoderRequest *request, GError **error);
+
+#endif /* PAGES_H */
@@ -0,0 +1,207 @@
+#include <string.h>
+#include "pathstore.h"
+
+typedef struct _PathStoreItem PathStoreItem;
+
+/* directory index and offset of base name */
+struct _PathStoreItem {
+    guint32 dir;
+    guint32 name;
+};
+
+struct _PathStore {
+    /* PathStoreItem for each path */
+    GArray *items;
+    /* packed NUL-terminated base names */
+    GByteArray *names;
+
+    /* interned directories (including trailing slash, first is empty) */
+    GStringChunk *dir_chunk;
+    GPtrArray *dirs;
+    /* directory -> index + 1 */
+    GHashTable *dir_index;
+    gsize dirs_size;
+
+    /* consecutive paths are usually in same directory */
+    guint32 last_dir;
+};
+
+static guint32
+path_store_intern_dir(PathStore *store, const gchar *dir, gsize length)
+{
+    const gchar *last;
+    gchar *key;
+    guint32 index;
+
+    last = g_ptr_array_index(store->dirs, store->last_dir);
+    if ( strncmp(last, dir, length) == 0 && last[length] == '\0' )
+        return store->last_dir;
+
+    key = g_strndup(dir, length);
+    index = GPOINTER_TO_UINT( g_hash_table_lookup(store->dir_index, key) );
+    if (index == 0) {
+        g_free(key);
+        key = g_string_chunk_insert_len(store->dir_chunk, dir, length);
+        g_ptr_array_add(store->dirs, key);
+        index = store->dirs->len;
+        g_hash_table_insert( store->dir_index, key, GUINT_TO_POINTER(index) );
+        store->dirs_size += length + 1;
+    } else {
+        g_free(key);
+    }
+
+    store->last_dir = index - 1;
+    return store->last_dir;
+}
+
+PathStore *
+path_store_new(void)
+{
+    PathStore *store;
+
+    store = g_new0(PathStore, 1);
+    store->items = g_array_new( FALSE, FALSE, sizeof(PathStoreItem) );
+    store->names = g_byte_array_new();
+    store->dir_chunk = g_string_chunk_new(4096);
+    store->dirs = g_ptr_array_new();
+    store->dir_index = g_hash_table_new(g_str_hash, g_str_equal);
+
+    /* paths without directory */
+    g_ptr_array_add( store->dirs, g_string_chunk_insert(store->dir_chunk, "") );
+    g_hash_table_insert( store->dir_index, g_ptr_array_index(store->dirs, 0),
+            GUINT_TO_POINTER(1) );
+
+    return store;
+}
+
+void
+path_store_free(PathStore *store)
+{
+    g_array_free(store->items, TRUE);
+    g_byte_array_free(store->names, TRUE);
+    g_hash_table_destroy(store->dir_index);
+    g_ptr_array_free(store->dirs, TRUE);
+    g_string_chunk_free(store->dir_chunk);
+    g_free(store);
+}
+
+void
+path_store_add_len(PathStore *store, const gchar *path, gsize length)
+{
+    PathStoreItem item;
+    const gchar *name;
+    gsize dir_length;
+
+    /* base name starts after last slash */
+    name = path + length;
+    while (name != path && name[-1] != '/')
+        --name;
+    dir_length = name - path;
+
+    item.dir = path_store_intern_dir(store, path, dir_length);
+    item.name = store->names->len;
+    g_byte_array_append( store->names, (const guint8 *)name, length - dir_length );
+    g_byte_array_append( store->names, (const guint8 *)"", 1 );
+    g_array_append_val(store->items, item);
+}
+
+void
+path_store_add(PathStore *store, const gchar *path)
+{
+    path_store_add_len( store, path, strlen(path) );
+}
+
+guint
+path_store_get_count(const PathStore *store)
+{
+    return store->items->len;
+}
+
+void
+path_store_append(const PathStore *store, guint index, GString *path)
+{
+    const PathStoreItem *item;
+
+    g_return_if_fail(index < store->items->len);
+
+    item = &g_array_index(store->items, PathStoreItem, index);
+    g_string_append(path, g_ptr_array_index(store->dirs, item->dir));
+    g_string_append(path, (const gchar *)store->names->data + item->name);
+}
+
+gchar *
+path_store_get(const PathStore *store, guint index)
+{
+    const PathStoreItem *item;
+
+    g_return_val_if_fail(index < store->items->len, NULL);
+
+    item = &g_array_index(store->items, PathStoreItem, index);
+    return g_strconcat( g_ptr_array_index(store->dirs, item->dir),
+            (const gchar *)store->names->data + item->name, NULL );
+}
+
+void
+path_store_replace(PathStore *store, guint index, const gchar * const *paths, guint count)
+{
+    path_store_replace_many(store, &index, &count, 1, paths);
+}
+
+void
+path_store_replace_many(PathStore *store, const guint *indices, const guint *counts,
+        guint n, const gchar * const *paths)
+{
+    GArray *items;
+    guint len, added, total = 0, i, j;
+
+    for (i = 0; i < n; ++i) {
+        g_return_if_fail(indices[i] < store->items->len);
+        g_return_if_fail(i == 0 || indices[i - 1] < indices[i]);
+        total += counts[i];
+    }
+
+    /* new paths are added at end and moved in place of replaced ones */
+    len = store->items->len;
+    for (i = 0; i < total; ++i)
+        path_store_add(store, paths[i]);
+
+    items = g_array_sized_new( FALSE, FALSE, sizeof(PathStoreItem), len - n + total );
+    added = len;
+    for (i = 0, j = 0; i < len; ++i) {
+        if (j < n && indices[j] == i) {
+            g_array_append_vals( items, &g_array_index(store->items, PathStoreItem, added),
+                    counts[j] );
+            added += counts[j];
+            ++j;
+        } else {
+            g_array_append_val( items, g_array_index(store->items, PathStoreItem, i) );
+        }
+    }
+
+    g_array_free(store->items, TRUE);
+    store->items = items;
+}
+
+void
+path_store_reorder(PathStore *store, const guint32 *order)
+{
+    GArray *items;
+    guint i;
+
+    items = g_array_sized_new( FALSE, FALSE, sizeof(PathStoreItem), store->items->len );
+    for (i = 0; i < store->items->len; ++i)
+        g_array_append_val( items, g_array_index(store->items, PathStoreItem, order[i]) );
+
+    g_array_free(store->items, TRUE);
+    store->items = items;
+}
+
+gsize
+path_store_get_memory(const PathStore *store)
+{
+    return sizeof(PathStore)
+        + store->items->len * sizeof(PathStoreItem)
+        + store->names->len
+        + store->dirs_size
+        + store->dirs->len * 3 * sizeof(gpointer);
+}
@@ -0,0 +1,45 @@
+#ifndef PATHSTORE_H
+#define PATHSTORE_H
+
+#include <glib.h>
+
+typedef struct _PathStore PathStore;
+
+/*
+ * Compact list of paths.
+ *
+ * Directories are interned (each stored only once) and base names are
+ * packed in a single buffer, so a path costs its base name and 8 bytes
+ * instead of a separately allocated string. Paths are accessed by index in
+ * constant time.
+ */
+PathStore *path_store_new(void);
+void path_store_free(PathStore *store);
+
+void path_store_add(PathStore *store, const gchar *path);
+/* adds path which need not be NUL terminated */
+void path_store_add_len(PathStore *store, const gchar *path, gsize length);
+
+guint path_store_get_count(const PathStore *store);
+
+/* returns new string with path at index */
+gchar *path_store_get(const PathStore *store, guint index);
+/* appends path at index to string */
+void path_store_append(const PathStore *store, guint index, GString *path);
+
+/* replaces path at index with count paths */
+void path_store_replace(PathStore *store, guint index, const gchar * const *paths, guint count);
+/*
+ * Replaces paths at n increasing indices at once, path at indices[i] with
+ * next counts[i] paths (in linear time).
+ */
+void path_store_replace_many(PathStore *store, const guint *indices, const guint *counts,
+        guint n, const gchar * const *paths);
+
+/* reorders paths so that path at index i is the one previously at order[i] */
+void path_store_reorder(PathStore *store, const guint32 *order);
+
+/* returns approximate number of bytes used by store */
+gsize path_store_get_memory(const PathStore *store);
+
+#endif /* PATHSTORE_H */
@@ -0,0 +1,445 @@
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "phash.h"
+#include "exif.h"
+#include "keycache.h"
+#include "pages.h"
+
+/* paths processed by one task */
+#define PHASH_CHUNK 256
+/* hash grid (one more column for horizontal differences) */
+#define PHASH_COLUMNS 9
+#define PHASH_ROWS 8
+/* images are decoded with shorter side at least this size */
+#define PHASH_DECODE_SIZE 32
+/* first line of cache file */
+#define PHASH_CACHE_HEADER "imagepeek hashes 2\n"
+/* niceness of hashing threads (decoding of shown items goes first) */
+#define PHASH_NICE 10
+
+typedef struct _HashJob HashJob;
+typedef struct _HashChunk HashChunk;
+
+/* values of cached keys */
+enum {
+    /* 0 if image cannot be decoded */
+    HashKeyKnown,
+    HashKeyHash
+};
+
+struct _HashChunk {
+    HashJob *job;
+    guint start, end;
+};
+
+struct _HashJob {
+    Hasher *hasher;
+    guint id;
+    const PathStore *store;
+
+    guint64 *hashes;
+    guint8 *known;
+    guint count;
+    /* number of decoded images (atomic) */
+    gint computed;
+
+    HashChunk *chunks;
+    guint chunk_count;
+    /* unfinished chunks (atomic) */
+    gint remaining;
+};
+
+struct _Hasher {
+    HashCallback *callback;
+    gpointer user_data;
+    GThreadPool *pool;
+
+    /* id of current hashing, others are cancelled (atomic) */
+    gint current;
+    guint last_id;
+
+    /* number of unfinished jobs */
+    GMutex lock;
+    GCond idle;
+    guint running;
+
+    KeyCache *cache;
+};
+
+/*
+ * Computes luma of pixels in row. Loops have constant pixel size so that
+ * compiler vectorizes them.
+ */
+static void
+phash_luma_row(const guchar *src, gint width, gboolean has_alpha, guint16 *luma)
+{
+    gint x;
+
+    if (has_alpha) {
+        for (x = 0; x < width; ++x)
+            luma[x] = (77 * src[4*x] + 150 * src[4*x + 1] + 29 * src[4*x + 2]) >> 8;
+    } else {
+        for (x = 0; x < width; ++x)
+            luma[x] = (77 * src[3*x] + 150 * src[3*x + 1] + 29 * src[3*x + 2]) >> 8;
+    }
+}
+
+/* sums values in range (vectorized reduction) */
+static guint32
+phash_sum(const guint16 *luma, gint start, gint end)
+{
+    guint32 sum = 0;
+    gint x;
+
+    for (x = start; x < end; ++x)
+        sum += luma[x];
+
+    return sum;
+}
+
+guint64
+phash_image(const Image *image)
+{
+    guint64 sums[PHASH_ROWS][PHASH_COLUMNS], counts[PHASH_ROWS][PHASH_COLUMNS];
+    gint x_bounds[PHASH_COLUMNS + 1];
+    guint16 *luma;
+    guint64 hash = 0;
+    gint row, column, y, y0, y1, x0, x1;
+
+    luma = g_new(guint16, image->width);
+    for (column = 0; column <= PHASH_COLUMNS; ++column)
+        x_bounds[column] = column * image->width / PHASH_COLUMNS;
+
+    /* cells cover at least one pixel of small images */
+    for (row = 0; row < PHASH_ROWS; ++row) {
+        y0 = row * image->height / PHASH_ROWS;
+        y1 = MAX( (row + 1) * image->height / PHASH_ROWS, y0 + 1 );
+        memset( sums[row], 0, sizeof(sums[row]) );
+        for (y = y0; y < y1; ++y) {
+            phash_luma_row( image->pixels + (gsize)y * image->rowstride,
+                    image->width, image->has_alpha, luma );
+            for (column = 0; column < PHASH_COLUMNS; ++column) {
+                x0 = x_bounds[column];
+                x1 = MAX(x_bounds[column + 1], x0 + 1);
+                sums[row][column] += phash_sum(luma, x0, x1);
+                counts[row][column] = (guint64)(x1 - x0) * (y1 - y0);
+            }
+        }
+    }
+    g_free(luma);
+
+    /* compares cell means without division */
+    for (row = 0; row < PHASH_ROWS; ++row) {
+        for (column = 0; column + 1 < PHASH_COLUMNS; ++column) {
+            if ( sums[row][column] * counts[row][column + 1] <
+                 sums[row][column + 1] * counts[row][column] )
+            {
+                hash |= (guint64)1 << (row * (PHASH_COLUMNS - 1) + column);
+            }
+        }
+    }
+
+    return hash;
+}
+
+guint
+phash_distance(guint64 a, guint64 b)
+{
+    return __builtin_popcountll(a ^ b);
+}
+
+static gdouble
+phash_scale(gint width, gint height)
+{
+    if (width <= 0 || height <= 0)
+        return 1.0;
+    return MIN( 1.0, (gdouble)PHASH_DECODE_SIZE / MIN(width, height) );
+}
+
+static gboolean
+hash_job_is_cancelled(const HashJob *job)
+{
+    return (guint)g_atomic_int_get(&job->hasher->current) != job->id;
+}
+
+/* decodes image in smallest resolution available (stopped if job is cancelled) */
+static Image *
+phash_decode(const gchar *path, HashJob *job)
+{
+    DecoderRequest request = {1.0, (DecoderCancelled*)hash_job_is_cancelled, job};
+    const Decoder *decoder;
+    DecoderInfo info;
+    GMappedFile *file;
+    const guchar *data;
+    gsize size;
+    ExifInfo exif;
+    Image *image = NULL;
+    gchar *document;
+    gint page;
+
+    /* size of page is not known before it's opened, page fits decoded size */
+    document = pages_parse(path, &page);
+    if (document) {
+        request.fit_width = request.fit_height = PHASH_DECODE_SIZE;
+        image = pages_render(document, page, &request, NULL);
+        g_free(document);
+        return image;
+    }
+
+    /* only pages of preview or scaled data are read from disk */
+    file = g_mapped_file_new(path, FALSE, NULL);
+    if (!file)
+        return NULL;
+    data = (const guchar*)g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+
+    exif_read(data, size, &exif);
+    if (exif.preview_size > 0) {
+        request.scale = phash_scale(exif.preview_width, exif.preview_height);
+        image = decoder_decode( data + exif.preview_offset, exif.preview_size,
+                &request, NULL );
+    }
+
+    if ( !image && size > 0 && !hash_job_is_cancelled(job) ) {
+        request.scale = 1.0;
+        decoder = decoder_find(data, size);
+        if ( decoder->get_info && decoder->get_info(data, size, &request, &info, NULL) )
+            request.scale = phash_scale(info.width, info.height);
+        image = decoder_decode(data, size, &request, NULL);
+    }
+
+    g_mapped_file_unref(file);
+
+    return image;
+}
+
+/* lowers priority of calling worker thread once */
+static void
+phash_lower_priority(void)
+{
+#ifdef __linux__
+    static GPrivate lowered = G_PRIVATE_INIT(NULL);
+
+    /* on Linux niceness is per thread */
+    if ( !g_private_get(&lowered) ) {
+        setpriority( PRIO_PROCESS, syscall(SYS_gettid), PHASH_NICE );
+        g_private_set( &lowered, GINT_TO_POINTER(TRUE) );
+    }
+#endif
+}
+
+static void
+hash_gather(HashChunk *chunk, guint32 index, GString *path)
+{
+    HashJob *job = chunk->job;
+    CachedKey key;
+    Image *image;
+    struct stat st;
+    gchar *document;
+    gboolean ok;
+
+    g_string_truncate(path, 0);
+    path_store_append(job->store, index, path);
+
+    /* pages are hashed again when their document changes */
+    document = pages_parse(path->str, NULL);
+    ok = stat(document ? document : path->str, &st) == 0;
+    g_free(document);
+    if (!ok)
+        return;
+
+    if ( !key_cache_lookup(job->hasher->cache, path->str, &st, &key) ) {
+        image = phash_decode(path->str, job);
+        /* image of cancelled job is unknown, not undecodable */
+        if ( !image && hash_job_is_cancelled(job) )
+            return;
+        key.mtime = st.st_mtime;
+        key.size = st.st_size;
+        key.values[HashKeyKnown] = image != NULL;
+        key.values[HashKeyHash] = image ? (gint64)phash_image(image) : 0;
+        if (image)
+            image_free(image);
+        key_cache_add(job->hasher->cache, path->str, &key);
+        g_atomic_int_inc(&job->computed);
+    }
+
+    job->hashes[index] = (guint64)key.values[HashKeyHash];
+    job->known[index] = key.values[HashKeyKnown] != 0;
+}
+
+static void
+hash_job_free(HashJob *job)
+{
+    g_free(job->hashes);
+    g_free(job->known);
+    g_free(job->chunks);
+    g_free(job);
+}
+
+static void
+hash_job_finish(HashJob *job)
+{
+    Hasher *hasher = job->hasher;
+    HashResult *result;
+
+    if ( !hash_job_is_cancelled(job) ) {
+        /* arrays are moved to result */
+        result = g_new(HashResult, 1);
+        result->id = job->id;
+        result->count = job->count;
+        result->hashes = job->hashes;
+        result->known = job->known;
+        result->computed = g_atomic_int_get(&job->computed);
+        result->user_data = hasher->user_data;
+        job->hashes = NULL;
+        job->known = NULL;
+        hasher->callback(result, hasher->user_data);
+    }
+
+    /* hashes computed before cancellation are valid (saved in background) */
+    key_cache_flush(hasher->cache);
+    hash_job_free(job);
+
+    g_mutex_lock(&hasher->lock);
+    if (--hasher->running == 0)
+        g_cond_broadcast(&hasher->idle);
+    g_mutex_unlock(&hasher->lock);
+}
+
+static void
+hash_run_chunk(HashChunk *chunk, Hasher *hasher)
+{
+    HashJob *job = chunk->job;
+    GString *path;
+    guint32 i;
+
+    if ( !hash_job_is_cancelled(job) ) {
+        phash_lower_priority();
+        path = g_string_sized_new(256);
+        for (i = chunk->start; i < chunk->end && !hash_job_is_cancelled(job); ++i)
+            hash_gather(chunk, i, path);
+        g_string_free(path, TRUE);
+    }
+
+    if ( g_atomic_int_dec_and_test(&job->remaining) )
+        hash_job_finish(job);
+}
+
+Hasher *
+hasher_new(HashCallback *callback, gpointer user_data)
+{
+    Hasher *hasher;
+
+    hasher = g_new0(Hasher, 1);
+    hasher->callback = callback;
+    hasher->user_data = user_data;
+    /* half of processors are left for decoding of shown items */
+    hasher->pool = g_thread_pool_new( (GFunc)hash_run_chunk, hasher,
+            MAX(1, g_get_num_processors() / 2), FALSE, NULL );
+    g_mutex_init(&hasher->lock);
+    g_cond_init(&hasher->idle);
+    hasher->cache = key_cache_new("hashes", PHASH_CACHE_HEADER);
+
+    return hasher;
+}
+
+void
+hasher_free(Hasher *hasher)
+{
+    hasher_cancel(hasher);
+    g_thread_pool_free(hasher->pool, TRUE, TRUE);
+    g_mutex_clear(&hasher->lock);
+    g_cond_clear(&hasher->idle);
+    key_cache_free(hasher->cache);
+    g_free(hasher);
+}
+
+guint
+hasher_start(Hasher *hasher, const PathStore *store)
+{
+    HashJob *job;
+    HashChunk *chunks, *chunk;
+    guint id, i, chunk_count;
+
+    job = g_new0(HashJob, 1);
+
+    /* id 0 is reserved for cancelled state */
+    if (++hasher->last_id == 0)
+        ++hasher->last_id;
+    job->id = hasher->last_id;
+    job->hasher = hasher;
+    job->store = store;
+
+    job->count = path_store_get_count(store);
+    job->hashes = g_new0(guint64, MAX(job->count, 1));
+    job->known = g_new0(guint8, MAX(job->count, 1));
+
+    job->chunk_count = MAX( 1, (job->count + PHASH_CHUNK - 1) / PHASH_CHUNK );
+    job->chunks = g_new0(HashChunk, job->chunk_count);
+    job->remaining = job->chunk_count;
+
+    g_atomic_int_set(&hasher->current, job->id);
+
+    g_mutex_lock(&hasher->lock);
+    ++hasher->running;
+    g_mutex_unlock(&hasher->lock);
+
+    for (i = 0; i < job->chunk_count; ++i) {
+        chunk = &job->chunks[i];
+        chunk->job = job;
+        chunk->start = i * PHASH_CHUNK;
+        chunk->end = MIN(job->count, chunk->start + PHASH_CHUNK);
+    }
+    /* job is freed when its last chunk is finished */
+    id = job->id;
+    chunks = job->chunks;
+    chunk_count = job->chunk_count;
+    for (i = 0; i < chunk_count; ++i)
+        g_thread_pool_push(hasher->pool, &chunks[i], NULL);
+
+    return id;
+}
+
+void
+hasher_cancel(Hasher *hasher)
+{
+    g_atomic_int_set(&hasher->current, 0);
+
+    g_mutex_lock(&hasher->lock);
+    while (hasher->running > 0)
+        g_cond_wait(&hasher->idle, &hasher->lock);
+    g_mutex_unlock(&hasher->lock);
+}
+
+void
+hash_result_reorder(HashResult *result, const guint32 *order)
+{
+    guint64 *hashes;
+    guint8 *known;
+    guint i;
+
+    hashes = g_new(guint64, MAX(result->count, 1));
+    known = g_new(guint8, MAX(result->count, 1));
+    for (i = 0; i < result->count; ++i) {
+        hashes[i] = result->hashes[order[i]];
+        known[i] = result->known[order[i]];
+    }
+
+    g_free(result->hashes);
+    g_free(result->known);
+    result->hashes = hashes;
+    result->known = known;
+}
+
+void
+hash_result_free(HashResult *result)
+{
+    g_free(result->hashes);
+    g_free(result->known);
+    g_free(result);
+}
@@ -0,0 +1,62 @@
+#ifndef PHASH_H
+#define PHASH_H
+
+#include <glib.h>
+#include "decoder.h"
+#include "pathstore.h"
+
+typedef struct _Hasher Hasher;
+typedef struct _HashResult HashResult;
+
+struct _HashResult {
+    /* id returned by hasher_start() */
+    guint id;
+    /* hash of path at each index (valid if known[index] is TRUE) */
+    guint64 *hashes;
+    guint8 *known;
+    guint count;
+    /* number of hashes computed (others were cached) */
+    guint computed;
+    gpointer user_data;
+};
+
+typedef void HashCallback(HashResult *result, gpointer user_data);
+
+/*
+ * Returns difference hash (dHash) of image: image is reduced to 9x8 luma
+ * cells and each bit tells whether cell is darker than its right
+ * neighbour. Similar images have hashes with small Hamming distance.
+ */
+guint64 phash_image(const Image *image);
+/* returns number of different bits */
+guint phash_distance(guint64 a, guint64 b);
+
+/*
+ * Computes perceptual hashes of paths in PathStore in background.
+ *
+ * Images are decoded in smallest resolution available (embedded preview
+ * or scaled JPEG decoding) in threads with lower priority on half of
+ * processors; cancelling stops decoding. Hashes are cached persistently
+ * with file modification time and size in user cache directory.
+ *
+ * Callback is called from worker thread with result owned by caller
+ * (unless hashing is cancelled).
+ */
+Hasher *hasher_new(HashCallback *callback, gpointer user_data);
+/* cancels hashing */
+void hasher_free(Hasher *hasher);
+
+/*
+ * Starts hashing and cancels previous one. Store must not change until
+ * callback is called or hasher_cancel() returns.
+ * Returns hashing id.
+ */
+guint hasher_start(Hasher *hasher, const PathStore *store);
+/* cancels hashing and waits for worker threads */
+void hasher_cancel(Hasher *hasher);
+
+/* reorders hashes like path_store_reorder() */
+void hash_result_reorder(HashResult *result, const guint32 *order);
+void hash_result_free(HashResult *result);
+
+#endif /* PHASH_H */
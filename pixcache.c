@@ -0,0 +1,522 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#include "pixcache.h"
+
+#define PIXEL_CACHE_MAGIC "IMGPEEK1"
+/* images waiting to be saved at most (others are dropped) */
+#define PIXEL_CACHE_MAX_PENDING 2
+
+typedef struct _PixelCacheHeader PixelCacheHeader;
+typedef struct _PixelCacheFile PixelCacheFile;
+typedef struct _PixelCacheSave PixelCacheSave;
+
+/* header of cache file followed by pixel data (64 bytes so rows are aligned) */
+struct _PixelCacheHeader {
+    gchar magic[8];
+    /* source file */
+    gint64 mtime;
+    guint64 file_size;
+    /* size of data after header */
+    guint64 data_size;
+    guint32 width, height;
+    guint32 rowstride;
+    guint32 has_alpha;
+    guint32 original_width, original_height;
+    /* data are LZ4 compressed rows without padding */
+    guint32 compressed;
+    guint32 reserved;
+};
+
+G_STATIC_ASSERT(sizeof(PixelCacheHeader) == 64);
+
+struct _PixelCacheFile {
+    gchar *path;
+    gsize size;
+    time_t mtime;
+};
+
+struct _PixelCacheSave {
+    gchar *filename;
+    Image *image;
+};
+
+struct _PixelCache {
+    gchar *dir;
+    /* in MiB (atomic) */
+    gint limit;
+    gint compress;
+
+    /* single thread saving images after they are shown */
+    GThreadPool *writer;
+    /* queued images are dropped (atomic) */
+    gint stopping;
+
+    /* size of files in cache (-1 until directory is scanned) */
+    GMutex lock;
+    gint64 total;
+};
+
+static void pixel_cache_save_run(PixelCacheSave *save, PixelCache *cache);
+
+static gchar *
+pixel_cache_path(const PixelCache *cache, const gchar *filename, const struct stat *st)
+{
+    gchar *key, *checksum, *path;
+
+    key = g_strdup_printf( "%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT,
+            filename, (gint64)st->st_mtime, (gint64)st->st_size );
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    path = g_build_filename(cache->dir, checksum, NULL);
+
+    g_free(checksum);
+    g_free(key);
+    return path;
+}
+
+static gboolean
+pixel_cache_header_is_valid(const PixelCacheHeader *header, const struct stat *st, gsize length)
+{
+    gsize bpp = header->has_alpha ? 4 : 3;
+
+    if ( memcmp(header->magic, PIXEL_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+         header->mtime != (gint64)st->st_mtime ||
+         header->file_size != (guint64)st->st_size ||
+         header->data_size > length - sizeof(PixelCacheHeader) ||
+         header->width == 0 || header->height == 0 ||
+         header->width > G_MAXINT / bpp || header->height > G_MAXINT ||
+         header->rowstride < header->width * bpp )
+    {
+        return FALSE;
+    }
+
+    return header->compressed ||
+        header->data_size == (guint64)header->rowstride * header->height;
+}
+
+static void
+pixel_cache_unmap(guchar *pixels, GMappedFile *mapped)
+{
+    g_mapped_file_unref(mapped);
+}
+
+#ifdef HAVE_LZ4
+static Image *
+pixel_cache_decompress(const PixelCacheHeader *header, const gchar *data)
+{
+    Image *image;
+    guchar *packed;
+    gsize row_size = (gsize)header->width * (header->has_alpha ? 4 : 3);
+    gsize size = row_size * header->height;
+    guint y;
+
+    if (size > LZ4_MAX_INPUT_SIZE || header->data_size > LZ4_MAX_INPUT_SIZE)
+        return NULL;
+
+    image = image_new(header->width, header->height, header->has_alpha);
+    if (!image)
+        return NULL;
+
+    /* rows are decompressed in place if they are not padded */
+    packed = image->rowstride == (gint)row_size ? image->pixels : g_try_malloc(size);
+    if ( !packed ||
+         LZ4_decompress_safe(data, (gchar*)packed, header->data_size, size) != (gint)size )
+    {
+        if (packed != image->pixels)
+            g_free(packed);
+        image_free(image);
+        return NULL;
+    }
+
+    if (packed != image->pixels) {
+        for (y = 0; y < header->height; ++y)
+            memcpy( image->pixels + y*image->rowstride, packed + y*row_size, row_size );
+        g_free(packed);
+    }
+
+    return image;
+}
+
+/* returns compressed rows of image (newly allocated) */
+static gchar *
+pixel_cache_compress(const Image *image, gsize *compressed_size)
+{
+    gchar *packed, *compressed;
+    gsize row_size = (gsize)image->width * (image->has_alpha ? 4 : 3);
+    gsize size = row_size * image->height;
+    gint bound, n;
+    gint y;
+
+    if (size > LZ4_MAX_INPUT_SIZE)
+        return NULL;
+
+    packed = g_try_malloc(size);
+    bound = LZ4_compressBound(size);
+    compressed = g_try_malloc(bound);
+    if (!packed || !compressed) {
+        g_free(packed);
+        g_free(compressed);
+        return NULL;
+    }
+
+    for (y = 0; y < image->height; ++y)
+        memcpy( packed + y*row_size, image->pixels + y*image->rowstride, row_size );
+
+    n = LZ4_compress_default(packed, compressed, size, bound);
+    g_free(packed);
+    if (n <= 0) {
+        g_free(compressed);
+        return NULL;
+    }
+
+    *compressed_size = n;
+    return compressed;
+}
+#endif
+
+static gboolean
+pixel_cache_write(gint fd, const void *data, gsize size)
+{
+    const gchar *p = data;
+    gssize n;
+
+    while (size > 0) {
+        n = write(fd, p, size);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        size -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+pixel_cache_write_pixels(gint fd, const Image *image)
+{
+    static const gchar padding[16] = {0};
+    gsize row_size = (gsize)image->width * (image->has_alpha ? 4 : 3);
+    gsize skip = image->rowstride - row_size;
+    gsize n;
+
+    /* last row of pixbuf can be shorter than rowstride */
+    if ( !pixel_cache_write(fd, image->pixels, (gsize)image->rowstride * (image->height - 1)) ||
+         !pixel_cache_write(fd, image->pixels + (gsize)image->rowstride * (image->height - 1), row_size) )
+    {
+        return FALSE;
+    }
+
+    for (; skip > 0; skip -= n) {
+        n = MIN( skip, sizeof(padding) );
+        if ( !pixel_cache_write(fd, padding, n) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint
+pixel_cache_compare_files(const void *a, const void *b)
+{
+    time_t x = ((const PixelCacheFile *)a)->mtime;
+    time_t y = ((const PixelCacheFile *)b)->mtime;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Removes least recently used files until cache fits into limit and
+ * returns size of remaining files.
+ */
+static gint64
+pixel_cache_evict(PixelCache *cache, gsize limit)
+{
+    GDir *dir;
+    GArray *files;
+    PixelCacheFile file, *f;
+    struct stat st;
+    const gchar *name;
+    gint64 total = 0;
+    guint i;
+
+    dir = g_dir_open(cache->dir, 0, NULL);
+    if (!dir)
+        return 0;
+
+    files = g_array_new( FALSE, FALSE, sizeof(PixelCacheFile) );
+    while ( (name = g_dir_read_name(dir)) ) {
+        /* skip files which are being written */
+        if ( strchr(name, '.') )
+            continue;
+        file.path = g_build_filename(cache->dir, name, NULL);
+        if ( stat(file.path, &st) != 0 || !S_ISREG(st.st_mode) ) {
+            g_free(file.path);
+            continue;
+        }
+        file.size = st.st_size;
+        file.mtime = st.st_mtime;
+        total += file.size;
+        g_array_append_val(files, file);
+    }
+    g_dir_close(dir);
+
+    g_array_sort(files, pixel_cache_compare_files);
+    for (i = 0; i < files->len; ++i) {
+        f = &g_array_index(files, PixelCacheFile, i);
+        if (total > (gint64)limit && g_unlink(f->path) == 0)
+            total -= f->size;
+        g_free(f->path);
+    }
+    g_array_free(files, TRUE);
+
+    return total;
+}
+
+PixelCache *
+pixel_cache_new(void)
+{
+    PixelCache *cache;
+
+    cache = g_new(PixelCache, 1);
+    cache->dir = g_build_filename( g_get_user_cache_dir(), "imagepeek", "pixels", NULL );
+    cache->limit = 0;
+    cache->compress = FALSE;
+    cache->stopping = FALSE;
+    cache->total = -1;
+    g_mutex_init(&cache->lock);
+    cache->writer = g_thread_pool_new( (GFunc)pixel_cache_save_run, cache,
+            1, FALSE, NULL );
+
+    return cache;
+}
+
+void
+pixel_cache_free(PixelCache *cache)
+{
+    /* image being written is finished, others are dropped */
+    g_atomic_int_set(&cache->stopping, TRUE);
+    g_thread_pool_free(cache->writer, FALSE, TRUE);
+    g_mutex_clear(&cache->lock);
+    g_free(cache->dir);
+    g_free(cache);
+}
+
+void
+pixel_cache_set_limit(PixelCache *cache, guint limit)
+{
+    g_atomic_int_set( &cache->limit, MIN(limit, G_MAXINT) );
+}
+
+guint
+pixel_cache_get_limit(const PixelCache *cache)
+{
+    return g_atomic_int_get(&cache->limit);
+}
+
+void
+pixel_cache_set_compress(PixelCache *cache, gboolean compress)
+{
+    g_atomic_int_set(&cache->compress, compress);
+}
+
+gboolean
+pixel_cache_get_compress(const PixelCache *cache)
+{
+    return g_atomic_int_get(&cache->compress);
+}
+
+gboolean
+pixel_cache_contains(PixelCache *cache, const gchar *filename)
+{
+    struct stat st;
+    gchar *path;
+    gboolean found;
+
+    if ( pixel_cache_get_limit(cache) == 0 || stat(filename, &st) != 0 )
+        return FALSE;
+
+    path = pixel_cache_path(cache, filename, &st);
+    found = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+    g_free(path);
+
+    return found;
+}
+
+Image *
+pixel_cache_load(PixelCache *cache, const gchar *filename)
+{
+    GMappedFile *mapped;
+    GdkPixbuf *pixbuf;
+    PixelCacheHeader header;
+    Image *image = NULL;
+    struct stat st;
+    const gchar *contents;
+    gsize length;
+    gchar *path;
+
+    if ( pixel_cache_get_limit(cache) == 0 || stat(filename, &st) != 0 )
+        return NULL;
+
+    path = pixel_cache_path(cache, filename, &st);
+    mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (!mapped) {
+        g_free(path);
+        return NULL;
+    }
+
+    contents = g_mapped_file_get_contents(mapped);
+    length = g_mapped_file_get_length(mapped);
+    if (length >= sizeof(header))
+        memcpy( &header, contents, sizeof(header) );
+
+    if ( length < sizeof(header) || !pixel_cache_header_is_valid(&header, &st, length) ) {
+        g_mapped_file_unref(mapped);
+        if ( g_unlink(path) == 0 ) {
+            g_mutex_lock(&cache->lock);
+            if (cache->total >= 0)
+                cache->total = MAX(0, cache->total - (gint64)length);
+            g_mutex_unlock(&cache->lock);
+        }
+        g_free(path);
+        return NULL;
+    }
+
+    /* mark as recently used */
+    g_utime(path, NULL);
+    g_free(path);
+
+    if (header.compressed) {
+#ifdef HAVE_LZ4
+        image = pixel_cache_decompress(&header, contents + sizeof(header));
+#endif
+        g_mapped_file_unref(mapped);
+    } else {
+        /* pixels are read from disk as they are used */
+        pixbuf = gdk_pixbuf_new_from_data( (const guchar*)contents + sizeof(header),
+                GDK_COLORSPACE_RGB, header.has_alpha, 8,
+                header.width, header.height, header.rowstride,
+                (GdkPixbufDestroyNotify)pixel_cache_unmap, mapped );
+        image = image_new_from_pixbuf(pixbuf);
+        g_object_unref(pixbuf);
+    }
+
+    if (image) {
+        image->original_width = header.original_width;
+        image->original_height = header.original_height;
+    }
+
+    return image;
+}
+
+static void
+pixel_cache_store(PixelCache *cache, const gchar *filename, const Image *image)
+{
+    PixelCacheHeader header;
+    struct stat st, old_st;
+    gchar *path, *tmp_path, *compressed = NULL;
+    gsize limit, size;
+    gint64 replaced = 0;
+    gboolean ok;
+    gint fd;
+
+    limit = (gsize)pixel_cache_get_limit(cache) * 1024 * 1024;
+    size = (gsize)image->rowstride * image->height;
+    if ( limit == 0 || size > limit || stat(filename, &st) != 0 )
+        return;
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, PIXEL_CACHE_MAGIC, sizeof(header.magic) );
+    header.mtime = st.st_mtime;
+    header.file_size = st.st_size;
+    header.width = image->width;
+    header.height = image->height;
+    header.rowstride = image->rowstride;
+    header.has_alpha = image->has_alpha;
+    header.original_width = image->original_width;
+    header.original_height = image->original_height;
+
+#ifdef HAVE_LZ4
+    if ( pixel_cache_get_compress(cache) ) {
+        compressed = pixel_cache_compress(image, &size);
+        if (compressed) {
+            header.compressed = TRUE;
+        } else {
+            size = (gsize)image->rowstride * image->height;
+        }
+    }
+#endif
+    header.data_size = size;
+
+    /* file is complete when it appears in cache */
+    g_mkdir_with_parents(cache->dir, 0700);
+    path = pixel_cache_path(cache, filename, &st);
+    tmp_path = g_strconcat(path, ".XXXXXX", NULL);
+    fd = g_mkstemp(tmp_path);
+    if (fd == -1) {
+        g_printerr( "imagepeek: Cannot save decoded image! (%s)\n", g_strerror(errno) );
+        g_free(compressed);
+        g_free(tmp_path);
+        g_free(path);
+        return;
+    }
+
+    ok = pixel_cache_write( fd, &header, sizeof(header) ) &&
+         (compressed ? pixel_cache_write(fd, compressed, size) : pixel_cache_write_pixels(fd, image));
+    ok = close(fd) == 0 && ok;
+    if ( ok && stat(path, &old_st) == 0 )
+        replaced = old_st.st_size;
+    if ( !ok || g_rename(tmp_path, path) != 0 ) {
+        g_printerr( "imagepeek: Cannot save decoded image! (%s)\n", g_strerror(errno) );
+        g_unlink(tmp_path);
+        ok = FALSE;
+    }
+
+    g_free(compressed);
+    g_free(tmp_path);
+    g_free(path);
+
+    g_mutex_lock(&cache->lock);
+    if (ok && cache->total >= 0)
+        cache->total += sizeof(header) + size - replaced;
+    if (cache->total < 0 || cache->total > (gint64)limit)
+        cache->total = pixel_cache_evict(cache, limit);
+    g_mutex_unlock(&cache->lock);
+}
+
+static void
+pixel_cache_save_run(PixelCacheSave *save, PixelCache *cache)
+{
+    if ( !g_atomic_int_get(&cache->stopping) )
+        pixel_cache_store(cache, save->filename, save->image);
+
+    image_free(save->image);
+    g_free(save->filename);
+    g_slice_free(PixelCacheSave, save);
+}
+
+void
+pixel_cache_save(PixelCache *cache, const gchar *filename, Image *image)
+{
+    PixelCacheSave *save;
+
+    /* saving is skipped rather than keeping many huge images in memory */
+    if ( pixel_cache_get_limit(cache) == 0 ||
+         g_thread_pool_unprocessed(cache->writer) >= PIXEL_CACHE_MAX_PENDING )
+    {
+        image_free(image);
+        return;
+    }
+
+    save = g_slice_new(PixelCacheSave);
+    save->filename = g_strdup(filename);
+    save->image = image;
+    g_thread_pool_push(cache->writer, save, NULL);
+}
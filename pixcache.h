@@ -0,0 +1,44 @@
+#ifndef PIXCACHE_H
+#define PIXCACHE_H
+
+#include <glib.h>
+#include "decoder.h"
+
+/* only images which took longer to decode are stored (microseconds) */
+#define PIXEL_CACHE_MIN_DECODE_TIME 250000
+
+typedef struct _PixelCache PixelCache;
+
+/*
+ * Cache of decoded pixels on disk (~/.cache/imagepeek/pixels).
+ *
+ * Images are keyed by path, modification time and size of the file.
+ * Uncompressed pixels are mapped into memory instead of being read,
+ * LZ4 compressed pixels (if built with liblz4) take less space but have
+ * to be decompressed. Least recently used images are removed if cache
+ * exceeds its size limit (cache directory is scanned only then, size of
+ * saved images is tracked).
+ *
+ * Functions can be called from any thread.
+ */
+PixelCache *pixel_cache_new(void);
+void pixel_cache_free(PixelCache *cache);
+
+/* size limit in MiB (0 disables cache) */
+void pixel_cache_set_limit(PixelCache *cache, guint limit);
+guint pixel_cache_get_limit(const PixelCache *cache);
+/* compress newly stored images (ignored without liblz4) */
+void pixel_cache_set_compress(PixelCache *cache, gboolean compress);
+gboolean pixel_cache_get_compress(const PixelCache *cache);
+
+/* returns TRUE if cache contains image of file (without checking contents) */
+gboolean pixel_cache_contains(PixelCache *cache, const gchar *filename);
+/* returns cached image of file or NULL */
+Image *pixel_cache_load(PixelCache *cache, const gchar *filename);
+/*
+ * Stores decoded image of file in background thread and frees it. Image
+ * is dropped if previous images are still being saved.
+ */
+void pixel_cache_save(PixelCache *cache, const gchar *filename, Image *image);
+
+#endif /* PIXCACHE_H */
@@ -0,0 +1,323 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "residency.h"
+
+typedef struct _ResidencyEntry ResidencyEntry;
+typedef struct _ResidencyCandidate ResidencyCandidate;
+
+struct _ResidencyEntry {
+    Residency *residency;
+    ClutterActor *texture;
+    gsize size;
+    /* lower resolution texture was requested */
+    gboolean downgrading;
+};
+
+struct _ResidencyCandidate {
+    ResidencyEntry *entry;
+    gdouble priority;
+};
+
+struct _Residency {
+    ResidencyPriority *priority;
+    ResidencyDowngrade *downgrade;
+    gpointer user_data;
+
+    /* texture -> ResidencyEntry */
+    GHashTable *entries;
+    gsize budget;
+    gsize used;
+    guint enforce_id;
+
+    /* memory pressure */
+    gint pressure_fd;
+    guint pressure_watch;
+    guint pressure_timeout_id;
+    /* lowered budget (0 if there is no pressure) */
+    gsize pressure_limit;
+};
+
+static const gchar *residency_key = "residency";
+
+static gboolean residency_enforce(Residency *residency);
+
+/* memory which will be used after requested downgrades */
+static gsize
+residency_get_expected(const Residency *residency)
+{
+    GHashTableIter it;
+    ResidencyEntry *entry;
+    gsize used = residency->used;
+
+    g_hash_table_iter_init(&it, residency->entries);
+    while ( g_hash_table_iter_next(&it, NULL, (gpointer*)&entry) ) {
+        /* half resolution takes quarter of memory */
+        if (entry->downgrading)
+            used -= entry->size * 3 / 4;
+    }
+
+    return used;
+}
+
+static gsize
+residency_get_limit(const Residency *residency)
+{
+    if (residency->pressure_limit == 0)
+        return residency->budget;
+    if (residency->budget == 0)
+        return residency->pressure_limit;
+    return MIN(residency->budget, residency->pressure_limit);
+}
+
+static void
+residency_check(Residency *residency)
+{
+    gsize limit = residency_get_limit(residency);
+
+    if ( limit > 0 && residency->used > limit && residency->enforce_id == 0 ) {
+        residency->enforce_id = clutter_threads_add_idle(
+                (GSourceFunc)residency_enforce, residency );
+    }
+}
+
+static gint
+residency_compare_candidates(const void *a, const void *b)
+{
+    gdouble x = ((const ResidencyCandidate *)a)->priority;
+    gdouble y = ((const ResidencyCandidate *)b)->priority;
+    return (x > y) - (x < y);
+}
+
+static gboolean
+residency_enforce(Residency *residency)
+{
+    GHashTableIter it;
+    ResidencyEntry *entry;
+    ResidencyCandidate *candidates;
+    gsize limit, used;
+    guint i, count = 0;
+
+    residency->enforce_id = 0;
+
+    limit = residency_get_limit(residency);
+    used = residency_get_expected(residency);
+    if (limit == 0 || used <= limit)
+        return FALSE;
+
+    candidates = g_new( ResidencyCandidate, g_hash_table_size(residency->entries) );
+    g_hash_table_iter_init(&it, residency->entries);
+    while ( g_hash_table_iter_next(&it, NULL, (gpointer*)&entry) ) {
+        if (entry->downgrading)
+            continue;
+        candidates[count].entry = entry;
+        candidates[count].priority =
+            residency->priority(entry->texture, residency->user_data);
+        ++count;
+    }
+    qsort( candidates, count, sizeof(ResidencyCandidate), residency_compare_candidates );
+
+    /* downgrade textures with lowest priority first */
+    for (i = 0; i < count && used > limit; ++i) {
+        entry = candidates[i].entry;
+        if ( residency->downgrade(entry->texture, residency->user_data) ) {
+            entry->downgrading = TRUE;
+            used -= entry->size * 3 / 4;
+        }
+    }
+
+    g_free(candidates);
+    return FALSE;
+}
+
+/* called when texture is finalized */
+static void
+residency_entry_free(ResidencyEntry *entry)
+{
+    Residency *residency = entry->residency;
+
+    residency->used -= entry->size;
+    g_hash_table_remove(residency->entries, entry->texture);
+    g_slice_free(ResidencyEntry, entry);
+}
+
+static gboolean
+residency_on_pressure_timeout(Residency *residency)
+{
+    residency->pressure_timeout_id = 0;
+    residency->pressure_limit = 0;
+    return FALSE;
+}
+
+static gboolean
+residency_on_pressure(GIOChannel *channel, GIOCondition condition, Residency *residency)
+{
+    /* monitored cgroup was removed */
+    if (condition & G_IO_ERR) {
+        close(residency->pressure_fd);
+        residency->pressure_fd = -1;
+        residency->pressure_watch = 0;
+        return FALSE;
+    }
+
+    /* halve texture memory on each event until pressure stops */
+    residency->pressure_limit = MAX( 1, residency_get_expected(residency) / 2 );
+    if (residency->pressure_timeout_id != 0)
+        g_source_remove(residency->pressure_timeout_id);
+    residency->pressure_timeout_id = clutter_threads_add_timeout(
+            RESIDENCY_PRESSURE_TIMEOUT, (GSourceFunc)residency_on_pressure_timeout,
+            residency );
+
+    residency_check(residency);
+
+    return TRUE;
+}
+
+static gint
+residency_open_trigger(const gchar *path)
+{
+    const gchar *trigger = RESIDENCY_PRESSURE_TRIGGER;
+    gint fd;
+
+    fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    /* trigger is written with terminating null character */
+    if ( write(fd, trigger, strlen(trigger) + 1) < 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* opens memory pressure trigger of own cgroup (v2) or of whole system */
+static gint
+residency_open_pressure(void)
+{
+    gchar *contents, *line, *end, *path;
+    gint fd = -1;
+
+    if ( g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL) ) {
+        line = strstr(contents, "0::");
+        if ( line && (line == contents || line[-1] == '\n') ) {
+            line += 3;
+            end = strchr(line, '\n');
+            if (end)
+                *end = '\0';
+            path = g_strconcat("/sys/fs/cgroup", line, "/memory.pressure", NULL);
+            fd = residency_open_trigger(path);
+            g_free(path);
+        }
+        g_free(contents);
+    }
+
+    if (fd == -1)
+        fd = residency_open_trigger("/proc/pressure/memory");
+
+    return fd;
+}
+
+Residency *
+residency_new(ResidencyPriority *priority, ResidencyDowngrade *downgrade, gpointer user_data)
+{
+    Residency *residency;
+    GIOChannel *channel;
+
+    residency = g_new0(Residency, 1);
+    residency->priority = priority;
+    residency->downgrade = downgrade;
+    residency->user_data = user_data;
+    residency->entries = g_hash_table_new(NULL, NULL);
+
+    /* memory pressure is not available on older kernels */
+    residency->pressure_fd = residency_open_pressure();
+    if (residency->pressure_fd != -1) {
+        channel = g_io_channel_unix_new(residency->pressure_fd);
+        residency->pressure_watch = g_io_add_watch( channel, G_IO_PRI | G_IO_ERR,
+                (GIOFunc)residency_on_pressure, residency );
+        g_io_channel_unref(channel);
+    }
+
+    return residency;
+}
+
+void
+residency_free(Residency *residency)
+{
+    GHashTableIter it;
+    ResidencyEntry *entry;
+
+    /* textures can outlive residency */
+    g_hash_table_iter_init(&it, residency->entries);
+    while ( g_hash_table_iter_next(&it, NULL, (gpointer*)&entry) ) {
+        g_object_steal_data( G_OBJECT(entry->texture), residency_key );
+        g_slice_free(ResidencyEntry, entry);
+    }
+    g_hash_table_destroy(residency->entries);
+
+    if (residency->enforce_id != 0)
+        g_source_remove(residency->enforce_id);
+    if (residency->pressure_timeout_id != 0)
+        g_source_remove(residency->pressure_timeout_id);
+    if (residency->pressure_watch != 0)
+        g_source_remove(residency->pressure_watch);
+    if (residency->pressure_fd != -1)
+        close(residency->pressure_fd);
+
+    g_free(residency);
+}
+
+void
+residency_set_budget(Residency *residency, gsize budget)
+{
+    residency->budget = budget;
+    residency_check(residency);
+}
+
+gsize
+residency_get_budget(const Residency *residency)
+{
+    return residency->budget;
+}
+
+void
+residency_add(Residency *residency, ClutterActor *texture, gsize size)
+{
+    ResidencyEntry *entry;
+
+    entry = g_slice_new(ResidencyEntry);
+    entry->residency = residency;
+    entry->texture = texture;
+    entry->size = size;
+    entry->downgrading = FALSE;
+
+    /* replaces (and frees) previous entry of texture */
+    g_object_set_data_full( G_OBJECT(texture), residency_key, entry,
+            (GDestroyNotify)residency_entry_free );
+    g_hash_table_insert(residency->entries, texture, entry);
+    residency->used += size;
+
+    residency_check(residency);
+}
+
+gboolean
+residency_fits(const Residency *residency, gsize size)
+{
+    gsize limit = residency_get_limit(residency);
+    return limit == 0 || residency->used + size <= limit;
+}
+
+gsize
+residency_get_used(const Residency *residency)
+{
+    return residency->used;
+}
+
+gboolean
+residency_get_pressure(const Residency *residency)
+{
+    return residency->pressure_limit != 0;
+}
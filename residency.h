@@ -0,0 +1,45 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <clutter/clutter.h>
+
+/* memory pressure trigger: stall of 200 ms in 2 s window (PSI) */
+#define RESIDENCY_PRESSURE_TRIGGER "some 200000 2000000"
+/* budget is restored if there is no memory pressure for this time (ms) */
+#define RESIDENCY_PRESSURE_TIMEOUT 10000
+
+typedef struct _Residency Residency;
+
+/* returns priority of texture (textures with lowest priority are downgraded first) */
+typedef gdouble ResidencyPriority(ClutterActor *texture, gpointer user_data);
+/*
+ * Replaces texture with lower resolution one (asynchronously).
+ * Returns FALSE if texture cannot be downgraded.
+ */
+typedef gboolean ResidencyDowngrade(ClutterActor *texture, gpointer user_data);
+
+/*
+ * Tracks memory of textures against budget.
+ *
+ * If textures exceed the budget, textures with lowest priority are
+ * downgraded until the budget is met. Memory pressure of cgroup (or
+ * system) temporarily lowers the budget.
+ *
+ * Residency is used only from main thread.
+ */
+Residency *residency_new(ResidencyPriority *priority, ResidencyDowngrade *downgrade, gpointer user_data);
+void residency_free(Residency *residency);
+
+/* budget in bytes (0 for unlimited) */
+void residency_set_budget(Residency *residency, gsize budget);
+gsize residency_get_budget(const Residency *residency);
+
+/* tracks texture until it's finalized */
+void residency_add(Residency *residency, ClutterActor *texture, gsize size);
+/* returns TRUE if textures of given size can be added without exceeding budget */
+gboolean residency_fits(const Residency *residency, gsize size);
+gsize residency_get_used(const Residency *residency);
+/* TRUE while budget is lowered because of memory pressure */
+gboolean residency_get_pressure(const Residency *residency);
+
+#endif /* RESIDENCY_H */
@@ -0,0 +1,208 @@
+/* accept4() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+
+/* bigger messages are dropped */
+#define SERVER_MAX_MESSAGE (256*1024*1024)
+
+typedef struct _ServerClient ServerClient;
+
+struct _Server {
+    gchar *path;
+    gint fd;
+    guint watch;
+    ServerCallback *callback;
+    gpointer user_data;
+};
+
+struct _ServerClient {
+    Server *server;
+    GString *message;
+};
+
+static gboolean
+server_address(const gchar *path, struct sockaddr_un *address)
+{
+    if ( strlen(path) >= sizeof(address->sun_path) )
+        return FALSE;
+
+    memset( address, 0, sizeof(*address) );
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return TRUE;
+}
+
+static gint
+server_connect(const gchar *path)
+{
+    struct sockaddr_un address;
+    gint fd;
+
+    if ( !server_address(path, &address) )
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    if ( connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static gboolean
+server_on_client_data(GIOChannel *channel, GIOCondition condition, ServerClient *client)
+{
+    gchar buffer[64*1024];
+    gssize n;
+    gint fd = g_io_channel_unix_get_fd(channel);
+
+    n = read( fd, buffer, sizeof(buffer) );
+    if (n == -1 && (errno == EINTR || errno == EAGAIN))
+        return TRUE;
+
+    if (n > 0 && client->message->len + n <= SERVER_MAX_MESSAGE) {
+        g_string_append_len(client->message, buffer, n);
+        return TRUE;
+    }
+
+    /* whole message received (client closed its side) */
+    if (n == 0) {
+        client->server->callback( client->message->str, client->message->len,
+                client->server->user_data );
+    } else {
+        g_printerr("imagepeek: Failed to receive message from other instance!\n");
+    }
+
+    /* closing connection tells client that message was handled */
+    close(fd);
+    g_string_free(client->message, TRUE);
+    g_slice_free(ServerClient, client);
+
+    return FALSE;
+}
+
+static gboolean
+server_on_connect(GIOChannel *channel, GIOCondition condition, Server *server)
+{
+    ServerClient *client;
+    GIOChannel *client_channel;
+    gint fd;
+
+    fd = accept4(server->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1)
+        return TRUE;
+
+    client = g_slice_new(ServerClient);
+    client->server = server;
+    client->message = g_string_new("");
+
+    client_channel = g_io_channel_unix_new(fd);
+    g_io_add_watch( client_channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+            (GIOFunc)server_on_client_data, client );
+    g_io_channel_unref(client_channel);
+
+    return TRUE;
+}
+
+Server *
+server_new(const gchar *path, ServerCallback *callback, gpointer user_data, GError **error)
+{
+    Server *server;
+    GIOChannel *channel;
+    struct sockaddr_un address;
+    gint fd;
+
+    if ( !server_address(path, &address) ) {
+        g_set_error( error, G_FILE_ERROR, G_FILE_ERROR_NAMETOOLONG,
+                "Socket path '%s' is too long", path );
+        return NULL;
+    }
+
+    /* remove socket of instance which didn't exit cleanly */
+    fd = server_connect(path);
+    if (fd != -1) {
+        close(fd);
+        g_set_error( error, G_FILE_ERROR, G_FILE_ERROR_EXIST,
+                "Other instance listens on socket '%s'", path );
+        return NULL;
+    }
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if ( fd == -1 ||
+         bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+         listen(fd, 8) != 0 )
+    {
+        g_set_error( error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Failed to listen on socket '%s': %s", path, g_strerror(errno) );
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    server = g_new(Server, 1);
+    server->path = g_strdup(path);
+    server->fd = fd;
+    server->callback = callback;
+    server->user_data = user_data;
+
+    channel = g_io_channel_unix_new(fd);
+    server->watch = g_io_add_watch( channel, G_IO_IN,
+            (GIOFunc)server_on_connect, server );
+    g_io_channel_unref(channel);
+
+    return server;
+}
+
+void
+server_free(Server *server)
+{
+    g_source_remove(server->watch);
+    close(server->fd);
+    unlink(server->path);
+    g_free(server->path);
+    g_free(server);
+}
+
+gboolean
+server_send(const gchar *path, const gchar *message, gsize size)
+{
+    gchar buffer[64];
+    gssize n;
+    gsize offset = 0;
+    gint fd;
+
+    fd = server_connect(path);
+    if (fd == -1)
+        return FALSE;
+
+    while (offset < size) {
+        n = send(fd, message + offset, size - offset, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            close(fd);
+            return FALSE;
+        }
+        offset += n;
+    }
+    shutdown(fd, SHUT_WR);
+
+    /* wait until server closes connection */
+    do {
+        n = read( fd, buffer, sizeof(buffer) );
+    } while ( n > 0 || (n == -1 && errno == EINTR) );
+
+    close(fd);
+    return TRUE;
+}
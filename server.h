@@ -0,0 +1,27 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <glib.h>
+
+typedef struct _Server Server;
+
+/* called in main loop for each received message */
+typedef void ServerCallback(const gchar *message, gsize size, gpointer user_data);
+
+/*
+ * Control socket of single running instance.
+ *
+ * Other instances send a message (whole content of a connection) and
+ * wait until it's handled (server closes the connection).
+ */
+Server *server_new(const gchar *path, ServerCallback *callback, gpointer user_data, GError **error);
+/* closes and removes socket */
+void server_free(Server *server);
+
+/*
+ * Sends message to running instance and waits until it's handled.
+ * Returns FALSE if no instance listens on path.
+ */
+gboolean server_send(const gchar *path, const gchar *message, gsize size);
+
+#endif /* SERVER_H */
@@ -0,0 +1,337 @@
+#include "slideshow.h"
+
+/* Feistel rounds of shuffle permutation */
+#define SLIDESHOW_ROUNDS 4
+
+typedef struct _SlideshowSlot SlideshowSlot;
+
+struct _SlideshowSlot {
+    guint index;
+    gboolean ready;
+};
+
+struct _Slideshow {
+    SlideshowPrepare *prepare;
+    SlideshowShow *show;
+    gpointer user_data;
+
+    guint interval;
+    gboolean shuffle;
+    guint ready_count;
+
+    gboolean running;
+    guint count;
+    /* item shown at start (ordered slideshow continues from it) */
+    guint first;
+    /* item shown currently */
+    guint current;
+    /* next position in order of items */
+    guint64 position;
+    /* prepared items (SlideshowSlot) in order of slots */
+    GArray *slots;
+    guint timeout_id;
+    /* first slot is shown as soon as it's ready */
+    gboolean waiting;
+    gint64 deadline;
+
+    /* permutation */
+    guint32 seed;
+    guint half_bits;
+
+    guint shown;
+    guint missed;
+    gint64 late_time;
+};
+
+/* integer hash with good avalanche (lowbias32) */
+static guint32
+slideshow_hash(guint32 value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352d;
+    value ^= value >> 15;
+    value *= 0x846ca68b;
+    value ^= value >> 16;
+    return value;
+}
+
+/*
+ * Permutes index with balanced Feistel network on smallest even number of
+ * bits covering count. Results outside of range are permuted again (cycle
+ * walking), the domain is less than four times count so this ends quickly.
+ */
+static guint
+slideshow_permute(const Slideshow *slideshow, guint index, guint32 key)
+{
+    guint half = slideshow->half_bits;
+    guint32 mask = ((guint32)1 << half) - 1;
+    guint32 left, right, tmp;
+    guint i;
+
+    do {
+        left = index >> half;
+        right = index & mask;
+        for (i = 0; i < SLIDESHOW_ROUNDS; ++i) {
+            tmp = right;
+            right = left ^ ( slideshow_hash(right ^ slideshow_hash(key + i)) & mask );
+            left = tmp;
+        }
+        index = (left << half) | right;
+    } while (index >= slideshow->count);
+
+    return index;
+}
+
+static guint
+slideshow_get_index(const Slideshow *slideshow, guint64 position)
+{
+    guint64 pass = position / slideshow->count;
+    guint index = position % slideshow->count;
+
+    if (!slideshow->shuffle)
+        return (slideshow->first + index) % slideshow->count;
+
+    /* new permutation for each pass */
+    return slideshow_permute( slideshow, index,
+            slideshow_hash( slideshow->seed ^ (guint32)(pass * 0x9e3779b9) ) );
+}
+
+/*
+ * Returns index of next item which is neither shown nor prepared (order
+ * of next pass can start with items from end of previous pass).
+ */
+static guint
+slideshow_next_index(Slideshow *slideshow)
+{
+    SlideshowSlot *slot;
+    gboolean used;
+    guint index, i;
+
+    for (;;) {
+        index = slideshow_get_index(slideshow, slideshow->position++);
+        used = index == slideshow->current;
+        for (i = 0; i < slideshow->slots->len && !used; ++i) {
+            slot = &g_array_index(slideshow->slots, SlideshowSlot, i);
+            used = slot->index == index;
+        }
+        if (!used)
+            return index;
+    }
+}
+
+/* prepares items for next slots */
+static void
+slideshow_fill(Slideshow *slideshow)
+{
+    SlideshowSlot slot;
+    guint n;
+
+    n = MIN(slideshow->ready_count, slideshow->count - 1);
+    while (slideshow->running && slideshow->slots->len < n) {
+        slot.index = slideshow_next_index(slideshow);
+        slot.ready = FALSE;
+        g_array_append_val(slideshow->slots, slot);
+        slideshow->prepare(slot.index, slideshow->user_data);
+    }
+}
+
+static gboolean slideshow_on_timeout(Slideshow *slideshow);
+
+static void
+slideshow_schedule(Slideshow *slideshow)
+{
+    if (slideshow->timeout_id != 0)
+        g_source_remove(slideshow->timeout_id);
+    slideshow->timeout_id = clutter_threads_add_timeout( slideshow->interval,
+            (GSourceFunc)slideshow_on_timeout, slideshow );
+}
+
+/* shows item of first slot */
+static void
+slideshow_advance(Slideshow *slideshow)
+{
+    SlideshowSlot *slot;
+
+    slot = &g_array_index(slideshow->slots, SlideshowSlot, 0);
+    slideshow->current = slot->index;
+    g_array_remove_index(slideshow->slots, 0);
+    slideshow->waiting = FALSE;
+    ++slideshow->shown;
+
+    slideshow->show(slideshow->current, slideshow->user_data);
+    slideshow_schedule(slideshow);
+    slideshow_fill(slideshow);
+}
+
+static gboolean
+slideshow_on_timeout(Slideshow *slideshow)
+{
+    SlideshowSlot *slot;
+
+    slideshow->timeout_id = 0;
+    if (slideshow->slots->len == 0)
+        return FALSE;
+
+    slot = &g_array_index(slideshow->slots, SlideshowSlot, 0);
+    if (slot->ready) {
+        slideshow_advance(slideshow);
+    } else {
+        ++slideshow->missed;
+        slideshow->waiting = TRUE;
+        slideshow->deadline = g_get_monotonic_time();
+        g_printerr("imagepeek: Slideshow item %u is not ready in time (%u missed).\n",
+                slot->index + 1, slideshow->missed);
+    }
+
+    return FALSE;
+}
+
+Slideshow *
+slideshow_new(SlideshowPrepare *prepare, SlideshowShow *show, gpointer user_data)
+{
+    Slideshow *slideshow;
+
+    slideshow = g_new0(Slideshow, 1);
+    slideshow->prepare = prepare;
+    slideshow->show = show;
+    slideshow->user_data = user_data;
+    slideshow->interval = 5000;
+    slideshow->ready_count = 2;
+    slideshow->slots = g_array_new( FALSE, FALSE, sizeof(SlideshowSlot) );
+
+    return slideshow;
+}
+
+void
+slideshow_free(Slideshow *slideshow)
+{
+    slideshow_stop(slideshow);
+    g_array_free(slideshow->slots, TRUE);
+    g_free(slideshow);
+}
+
+void
+slideshow_set_interval(Slideshow *slideshow, guint interval)
+{
+    slideshow->interval = MAX(1, interval);
+}
+
+guint
+slideshow_get_interval(const Slideshow *slideshow)
+{
+    return slideshow->interval;
+}
+
+void
+slideshow_set_shuffle(Slideshow *slideshow, gboolean shuffle)
+{
+    slideshow->shuffle = shuffle;
+}
+
+gboolean
+slideshow_get_shuffle(const Slideshow *slideshow)
+{
+    return slideshow->shuffle;
+}
+
+void
+slideshow_set_ready_count(Slideshow *slideshow, guint count)
+{
+    slideshow->ready_count = CLAMP(count, 1, SLIDESHOW_MAX_READY);
+    slideshow_fill(slideshow);
+}
+
+guint
+slideshow_get_ready_count(const Slideshow *slideshow)
+{
+    return slideshow->ready_count;
+}
+
+gboolean
+slideshow_start(Slideshow *slideshow, guint count, guint current)
+{
+    guint bits = 0;
+
+    slideshow_stop(slideshow);
+    if (count < 2)
+        return FALSE;
+
+    slideshow->running = TRUE;
+    slideshow->count = count;
+    slideshow->current = MIN(current, count - 1);
+    slideshow->first = slideshow->current;
+    slideshow->position = 0;
+    slideshow->seed = g_random_int();
+    while ( bits < 32 && ((guint64)1 << bits) < count )
+        ++bits;
+    slideshow->half_bits = MAX(1, (bits + 1) / 2);
+    slideshow->shown = 0;
+    slideshow->missed = 0;
+    slideshow->late_time = 0;
+
+    slideshow_fill(slideshow);
+    slideshow_schedule(slideshow);
+
+    return TRUE;
+}
+
+void
+slideshow_stop(Slideshow *slideshow)
+{
+    if (slideshow->timeout_id != 0) {
+        g_source_remove(slideshow->timeout_id);
+        slideshow->timeout_id = 0;
+    }
+    g_array_set_size(slideshow->slots, 0);
+    slideshow->waiting = FALSE;
+    slideshow->running = FALSE;
+}
+
+gboolean
+slideshow_is_running(const Slideshow *slideshow)
+{
+    return slideshow->running;
+}
+
+void
+slideshow_set_ready(Slideshow *slideshow, guint index)
+{
+    SlideshowSlot *slot;
+    gint64 late;
+    guint i;
+
+    for (i = 0; i < slideshow->slots->len; ++i) {
+        slot = &g_array_index(slideshow->slots, SlideshowSlot, i);
+        if (slot->index == index)
+            break;
+    }
+    if (i == slideshow->slots->len)
+        return;
+
+    slot->ready = TRUE;
+    if (i == 0 && slideshow->waiting) {
+        late = g_get_monotonic_time() - slideshow->deadline;
+        slideshow->late_time += late;
+        g_printerr("imagepeek: Slideshow item %u shown %.0f ms late.\n",
+                index + 1, late / 1000.0);
+        slideshow_advance(slideshow);
+    }
+}
+
+guint
+slideshow_get_shown(const Slideshow *slideshow)
+{
+    return slideshow->shown;
+}
+
+guint
+slideshow_get_missed(const Slideshow *slideshow)
+{
+    return slideshow->missed;
+}
+
+gint64
+slideshow_get_late_time(const Slideshow *slideshow)
+{
+    return slideshow->late_time;
+}
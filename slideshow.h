@@ -0,0 +1,59 @@
+#ifndef SLIDESHOW_H
+#define SLIDESHOW_H
+
+#include <clutter/clutter.h>
+
+/* maximum number of items prepared ahead of their slots */
+#define SLIDESHOW_MAX_READY 16
+
+typedef struct _Slideshow Slideshow;
+
+/* starts loading item for later slot (slideshow_set_ready() is called when done) */
+typedef void SlideshowPrepare(guint index, gpointer user_data);
+/* shows prepared item */
+typedef void SlideshowShow(guint index, gpointer user_data);
+
+/*
+ * Shows items one after another in fixed interval.
+ *
+ * Next items are prepared ahead so that each is ready before its slot.
+ * If an item is not ready at its deadline, the deadline is counted as
+ * missed and the item is shown as soon as it's ready.
+ *
+ * Shuffled order is a pseudorandom permutation of item indices computed
+ * for each position (no permuted list is stored); new permutation is used
+ * on each pass over the items.
+ *
+ * Slideshow is used only from main thread.
+ */
+Slideshow *slideshow_new(SlideshowPrepare *prepare, SlideshowShow *show, gpointer user_data);
+void slideshow_free(Slideshow *slideshow);
+
+/* time between items in milliseconds */
+void slideshow_set_interval(Slideshow *slideshow, guint interval);
+guint slideshow_get_interval(const Slideshow *slideshow);
+/* shuffle items (used from next start) */
+void slideshow_set_shuffle(Slideshow *slideshow, gboolean shuffle);
+gboolean slideshow_get_shuffle(const Slideshow *slideshow);
+/* number of items prepared ahead (1 to SLIDESHOW_MAX_READY) */
+void slideshow_set_ready_count(Slideshow *slideshow, guint count);
+guint slideshow_get_ready_count(const Slideshow *slideshow);
+
+/*
+ * Starts slideshow of count items; item at index current is already shown.
+ * Returns FALSE if there are less than two items.
+ */
+gboolean slideshow_start(Slideshow *slideshow, guint count, guint current);
+void slideshow_stop(Slideshow *slideshow);
+gboolean slideshow_is_running(const Slideshow *slideshow);
+
+/* item prepared for a slot was loaded */
+void slideshow_set_ready(Slideshow *slideshow, guint index);
+
+/* statistics since start */
+guint slideshow_get_shown(const Slideshow *slideshow);
+guint slideshow_get_missed(const Slideshow *slideshow);
+/* total time missed deadlines were late (microseconds) */
+gint64 slideshow_get_late_time(const Slideshow *slideshow);
+
+#endif /* SLIDESHOW_H */
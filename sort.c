@@ -0,0 +1,388 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sort.h"
+#include "decoder.h"
+#include "exif.h"
+#include "keycache.h"
+#include "pages.h"
+
+/* paths processed by one task */
+#define SORT_CHUNK 4096
+/* start of file read to get image size and EXIF */
+#define SORT_HEAD_SIZE (256*1024)
+/* first line of cache file */
+#define SORT_CACHE_HEADER "imagepeek sort keys 1\n"
+
+typedef struct _SortEntry SortEntry;
+typedef struct _SortJob SortJob;
+typedef struct _SortChunk SortChunk;
+
+/* values of cached keys read from file (0 if unknown) */
+enum {
+    SortKeyPixels,
+    SortKeyDatetime
+};
+
+struct _SortEntry {
+    /* collate key for name order */
+    gchar *name;
+    gint64 key;
+    gboolean known;
+    guint32 index;
+};
+
+struct _SortChunk {
+    SortJob *job;
+    guint start, end;
+};
+
+struct _SortJob {
+    Sorter *sorter;
+    guint id;
+    const PathStore *store;
+    SortOrder order;
+    gboolean descending;
+
+    SortEntry *entries;
+    guint count;
+
+    SortChunk *chunks;
+    guint chunk_count;
+    /* unfinished chunks (atomic) */
+    gint remaining;
+};
+
+struct _Sorter {
+    SortCallback *callback;
+    gpointer user_data;
+    GThreadPool *pool;
+
+    /* id of current sort, other sorts are cancelled (atomic) */
+    gint current;
+    guint last_id;
+
+    /* number of unfinished sorts */
+    GMutex lock;
+    GCond idle;
+    guint running;
+
+    KeyCache *cache;
+};
+
+static const gchar * const sort_order_names[SortOrderCount] = {
+    "none",
+    "name",
+    "mtime",
+    "size",
+    "dimensions",
+    "exif"
+};
+
+static gboolean
+sort_job_is_cancelled(const SortJob *job)
+{
+    return (guint)g_atomic_int_get(&job->sorter->current) != job->id;
+}
+
+static gboolean
+sort_order_needs_cache(SortOrder order)
+{
+    return order == SortDimensions || order == SortExifTime;
+}
+
+/* reads image size and EXIF time from start of file */
+static void
+sort_read_key(const gchar *path, guchar *buffer, CachedKey *key)
+{
+    const DecoderRequest request = {1.0, NULL, NULL};
+    const Decoder *decoder;
+    DecoderInfo info;
+    ExifInfo exif;
+    gssize size;
+    gint fd, width = 0, height = 0;
+
+    key->values[SortKeyPixels] = 0;
+    key->values[SortKeyDatetime] = 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    size = read(fd, buffer, SORT_HEAD_SIZE);
+    close(fd);
+    if (size <= 0)
+        return;
+
+    if ( exif_read(buffer, size, &exif) ) {
+        key->values[SortKeyDatetime] = exif.datetime;
+        width = exif.width;
+        height = exif.height;
+        /* RAW images are shown as largest preview */
+        if (width == 0) {
+            width = exif.preview_width;
+            height = exif.preview_height;
+        }
+    }
+
+    if (width == 0) {
+        decoder = decoder_find(buffer, size);
+        if ( decoder->get_info && decoder->get_info(buffer, size, &request, &info, NULL) ) {
+            width = info.width;
+            height = info.height;
+        } else if ( !gdk_pixbuf_get_file_info(path, &width, &height) ) {
+            width = height = 0;
+        }
+    }
+
+    if (width > 0 && height > 0)
+        key->values[SortKeyPixels] = (gint64)width * height;
+}
+
+static void
+sort_gather(SortChunk *chunk, guint32 index, GString *path, guchar *buffer)
+{
+    SortJob *job = chunk->job;
+    SortEntry *entry = &job->entries[index];
+    CachedKey key;
+    struct stat st;
+    gchar *document;
+
+    entry->index = index;
+    g_string_truncate(path, 0);
+    path_store_append(job->store, index, path);
+
+    if (job->order == SortName) {
+        entry->name = g_utf8_collate_key_for_filename(path->str, path->len);
+        entry->known = TRUE;
+        return;
+    }
+
+    /* pages share keys of their document (and keep order) */
+    document = pages_parse(path->str, NULL);
+    if (document) {
+        g_string_assign(path, document);
+        g_free(document);
+    }
+
+    if ( job->order == SortNone || stat(path->str, &st) != 0 )
+        return;
+
+    if (job->order == SortMtime) {
+        entry->key = st.st_mtime;
+        entry->known = TRUE;
+        return;
+    }
+    if (job->order == SortSize) {
+        entry->key = st.st_size;
+        entry->known = TRUE;
+        return;
+    }
+
+    if ( !key_cache_lookup(job->sorter->cache, path->str, &st, &key) ) {
+        key.mtime = st.st_mtime;
+        key.size = st.st_size;
+        sort_read_key(path->str, buffer, &key);
+        key_cache_add(job->sorter->cache, path->str, &key);
+    }
+
+    entry->key = key.values[ job->order == SortDimensions ? SortKeyPixels : SortKeyDatetime ];
+    entry->known = entry->key != 0;
+}
+
+static gint
+sort_entry_compare(const SortEntry *a, const SortEntry *b, const gboolean *descending)
+{
+    gint result;
+
+    /* unknown keys are last in both directions */
+    if (a->known != b->known)
+        return a->known ? -1 : 1;
+
+    if (a->known) {
+        result = a->name ? strcmp(a->name, b->name) : (a->key > b->key) - (a->key < b->key);
+        if (result != 0)
+            return *descending ? -result : result;
+    }
+
+    /* keep list order of equal items */
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+static void
+sort_job_free(SortJob *job)
+{
+    guint i;
+
+    for (i = 0; i < job->count; ++i)
+        g_free(job->entries[i].name);
+    g_free(job->entries);
+    g_free(job->chunks);
+    g_free(job);
+}
+
+static void
+sort_job_finish(SortJob *job)
+{
+    Sorter *sorter = job->sorter;
+    SortResult *result;
+    guint i;
+
+    if ( !sort_job_is_cancelled(job) ) {
+        g_qsort_with_data( job->entries, job->count, sizeof(SortEntry),
+                (GCompareDataFunc)sort_entry_compare, &job->descending );
+
+        result = g_new(SortResult, 1);
+        result->id = job->id;
+        result->count = job->count;
+        result->order = g_new(guint32, MAX(job->count, 1));
+        result->user_data = sorter->user_data;
+        for (i = 0; i < job->count; ++i)
+            result->order[i] = job->entries[i].index;
+
+        sorter->callback(result, sorter->user_data);
+    }
+
+    /* keys read before cancellation are valid */
+    key_cache_flush(sorter->cache);
+    sort_job_free(job);
+
+    g_mutex_lock(&sorter->lock);
+    if (--sorter->running == 0)
+        g_cond_broadcast(&sorter->idle);
+    g_mutex_unlock(&sorter->lock);
+}
+
+static void
+sort_run_chunk(SortChunk *chunk, Sorter *sorter)
+{
+    SortJob *job = chunk->job;
+    GString *path;
+    guchar *buffer = NULL;
+    guint32 i;
+
+    if ( sort_order_needs_cache(job->order) && !sort_job_is_cancelled(job) )
+        buffer = g_malloc(SORT_HEAD_SIZE);
+
+    path = g_string_sized_new(256);
+    for (i = chunk->start; i < chunk->end && !sort_job_is_cancelled(job); ++i)
+        sort_gather(chunk, i, path, buffer);
+    g_string_free(path, TRUE);
+    g_free(buffer);
+
+    if ( g_atomic_int_dec_and_test(&job->remaining) )
+        sort_job_finish(job);
+}
+
+Sorter *
+sorter_new(SortCallback *callback, gpointer user_data)
+{
+    Sorter *sorter;
+
+    sorter = g_new0(Sorter, 1);
+    sorter->callback = callback;
+    sorter->user_data = user_data;
+    /* threads mostly wait for stat() and reading */
+    sorter->pool = g_thread_pool_new( (GFunc)sort_run_chunk, sorter,
+            MAX(16, g_get_num_processors()), FALSE, NULL );
+    g_mutex_init(&sorter->lock);
+    g_cond_init(&sorter->idle);
+    sorter->cache = key_cache_new("sort-keys", SORT_CACHE_HEADER);
+
+    return sorter;
+}
+
+void
+sorter_free(Sorter *sorter)
+{
+    sorter_cancel(sorter);
+    g_thread_pool_free(sorter->pool, TRUE, TRUE);
+    g_mutex_clear(&sorter->lock);
+    g_cond_clear(&sorter->idle);
+    key_cache_free(sorter->cache);
+    g_free(sorter);
+}
+
+guint
+sorter_start(Sorter *sorter, const PathStore *store, SortOrder order, gboolean descending)
+{
+    SortJob *job;
+    SortChunk *chunks, *chunk;
+    guint id, i, chunk_count;
+
+    job = g_new0(SortJob, 1);
+
+    /* id 0 is reserved for cancelled state */
+    if (++sorter->last_id == 0)
+        ++sorter->last_id;
+    job->id = sorter->last_id;
+    job->sorter = sorter;
+    job->store = store;
+    job->order = order;
+    job->descending = descending;
+
+    job->count = path_store_get_count(store);
+    job->entries = g_new0(SortEntry, MAX(job->count, 1));
+
+    job->chunk_count = MAX( 1, (job->count + SORT_CHUNK - 1) / SORT_CHUNK );
+    job->chunks = g_new0(SortChunk, job->chunk_count);
+    job->remaining = job->chunk_count;
+
+    g_atomic_int_set(&sorter->current, job->id);
+
+    g_mutex_lock(&sorter->lock);
+    ++sorter->running;
+    g_mutex_unlock(&sorter->lock);
+
+    for (i = 0; i < job->chunk_count; ++i) {
+        chunk = &job->chunks[i];
+        chunk->job = job;
+        chunk->start = i * SORT_CHUNK;
+        chunk->end = MIN(job->count, chunk->start + SORT_CHUNK);
+    }
+    /* job is freed when its last chunk is finished */
+    id = job->id;
+    chunks = job->chunks;
+    chunk_count = job->chunk_count;
+    for (i = 0; i < chunk_count; ++i)
+        g_thread_pool_push(sorter->pool, &chunks[i], NULL);
+
+    return id;
+}
+
+void
+sorter_cancel(Sorter *sorter)
+{
+    g_atomic_int_set(&sorter->current, 0);
+
+    g_mutex_lock(&sorter->lock);
+    while (sorter->running > 0)
+        g_cond_wait(&sorter->idle, &sorter->lock);
+    g_mutex_unlock(&sorter->lock);
+}
+
+void
+sort_result_free(SortResult *result)
+{
+    g_free(result->order);
+    g_free(result);
+}
+
+const gchar *
+sort_order_to_string(SortOrder order)
+{
+    return order < SortOrderCount ? sort_order_names[order] : sort_order_names[SortNone];
+}
+
+SortOrder
+sort_order_from_string(const gchar *name)
+{
+    gint i;
+
+    for (i = 0; i < SortOrderCount; ++i) {
+        if ( g_strcmp0(name, sort_order_names[i]) == 0 )
+            return i;
+    }
+
+    return SortNone;
+}
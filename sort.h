@@ -0,0 +1,67 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <glib.h>
+#include "pathstore.h"
+
+typedef enum _SortOrder SortOrder;
+typedef struct _Sorter Sorter;
+typedef struct _SortResult SortResult;
+
+enum _SortOrder {
+    /* keep order of the list */
+    SortNone,
+    /* file name (numbers in names are compared by value) */
+    SortName,
+    SortMtime,
+    SortSize,
+    /* number of pixels */
+    SortDimensions,
+    /* EXIF capture time */
+    SortExifTime,
+    SortOrderCount
+};
+
+struct _SortResult {
+    /* id returned by sorter_start() */
+    guint id;
+    /* order[i] is index of path (in store) which should be at index i */
+    guint32 *order;
+    guint count;
+    gpointer user_data;
+};
+
+typedef void SortCallback(SortResult *result, gpointer user_data);
+
+/*
+ * Sorts paths in PathStore in background.
+ *
+ * Sort keys are gathered in multiple threads. Keys which require reading
+ * files (image dimensions and EXIF time) are cached persistently with file
+ * modification time and size in user cache directory.
+ *
+ * Paths with unknown key (e.g. missing file) are sorted last. Callback is
+ * called from worker thread with result owned by caller (unless sort is
+ * cancelled).
+ */
+Sorter *sorter_new(SortCallback *callback, gpointer user_data);
+/* cancels sort */
+void sorter_free(Sorter *sorter);
+
+/*
+ * Starts sorting and cancels previous sort. Store must not change until
+ * callback is called or sorter_cancel() returns.
+ * Returns sort id.
+ */
+guint sorter_start(Sorter *sorter, const PathStore *store, SortOrder order, gboolean descending);
+/* cancels sort and waits for worker threads */
+void sorter_cancel(Sorter *sorter);
+
+void sort_result_free(SortResult *result);
+
+/* name of order used in configuration ("name", "mtime", ...) */
+const gchar *sort_order_to_string(SortOrder order);
+/* returns SortNone for unknown name */
+SortOrder sort_order_from_string(const gchar *name);
+
+#endif /* SORT_H */
@@ -0,0 +1,143 @@
+#include <math.h>
+#include <string.h>
+#include "compare.h"
+
+/* image with all channels of all pixels set to value */
+static Image *
+new_image(gint width, gint height, gboolean has_alpha, guchar value)
+{
+    Image *image = image_new(width, height, has_alpha);
+
+    memset(image->pixels, value, (gsize)image->rowstride * height);
+    return image;
+}
+
+static guchar *
+pixel(Image *image, gint x, gint y)
+{
+    return image->pixels + y*image->rowstride + x*(image->has_alpha ? 4 : 3);
+}
+
+static void
+test_identical(void)
+{
+    Image *a = new_image(7, 5, FALSE, 100);
+    Image *b = new_image(7, 5, FALSE, 100);
+    Image *heatmap;
+    CompareStats stats;
+    gchar *text;
+
+    compare_images(a, b, &stats, &heatmap);
+    g_assert_false(stats.mismatch);
+    g_assert_true( isinf(stats.psnr) );
+    g_assert_cmpuint(stats.max_delta, ==, 0);
+    g_assert_cmpuint(stats.different_pixels, ==, 0);
+    g_assert_false( compare_stats_differ(&stats, 0) );
+    text = compare_stats_to_string(&stats);
+    g_assert_cmpstr(text, ==, "identical");
+    g_free(text);
+
+    /* unchanged pixels are dimmed */
+    g_assert_nonnull(heatmap);
+    g_assert_cmpint(heatmap->width, ==, 7);
+    g_assert_cmpint(heatmap->height, ==, 5);
+    g_assert_cmpuint(pixel(heatmap, 6, 4)[0], ==, (256 * 100) >> 10);
+    image_free(heatmap);
+
+    image_free(a);
+    image_free(b);
+}
+
+static void
+test_psnr(void)
+{
+    Image *a = new_image(4, 4, FALSE, 0);
+    Image *b = new_image(4, 4, FALSE, 0);
+    Image *heatmap;
+    CompareStats stats;
+    gchar *text;
+
+    /* uniform difference: MSE is 10^2 */
+    memset(b->pixels, 10, (gsize)b->rowstride * b->height);
+    compare_images(a, b, &stats, NULL);
+    g_assert_cmpfloat_with_epsilon( stats.psnr, 20.0 * log10(255.0 / 10.0), 1e-9 );
+    g_assert_cmpuint(stats.max_delta, ==, 10);
+    g_assert_cmpuint(stats.different_pixels, ==, 16);
+
+    /* one channel of one pixel: MSE is 255^2 / 48 */
+    memset(b->pixels, 0, (gsize)b->rowstride * b->height);
+    pixel(b, 2, 1)[1] = 255;
+    compare_images(a, b, &stats, &heatmap);
+    g_assert_cmpfloat_with_epsilon( stats.psnr, 10.0 * log10(48.0), 1e-9 );
+    g_assert_cmpuint(stats.max_delta, ==, 255);
+    g_assert_cmpuint(stats.different_pixels, ==, 1);
+    g_assert_true( compare_stats_differ(&stats, 254) );
+    g_assert_false( compare_stats_differ(&stats, 255) );
+    text = compare_stats_to_string(&stats);
+    g_assert_cmpstr(text, ==, "PSNR 16.8 dB, max delta 255, 1 pixels");
+    g_free(text);
+
+    /* differing pixel is yellow */
+    g_assert_cmpuint(pixel(heatmap, 2, 1)[0], ==, 255);
+    g_assert_cmpuint(pixel(heatmap, 2, 1)[1], ==, 255);
+    g_assert_cmpuint(pixel(heatmap, 2, 1)[2], ==, 0);
+    g_assert_cmpuint(pixel(heatmap, 1, 2)[0], ==, 0);
+    image_free(heatmap);
+
+    image_free(a);
+    image_free(b);
+}
+
+/* alpha channel is compared too and row padding is ignored */
+static void
+test_alpha(void)
+{
+    Image *a = new_image(3, 2, TRUE, 50);
+    Image *b = new_image(3, 2, TRUE, 50);
+    CompareStats stats;
+
+    g_assert_cmpint(a->rowstride, ==, 12);
+    pixel(b, 1, 1)[3] = 52;
+    compare_images(a, b, &stats, NULL);
+    g_assert_cmpfloat_with_epsilon( stats.psnr, 10.0 * log10(255.0 * 255.0 * 24 / 4), 1e-9 );
+    g_assert_cmpuint(stats.max_delta, ==, 2);
+    g_assert_cmpuint(stats.different_pixels, ==, 1);
+
+    image_free(a);
+    image_free(b);
+}
+
+static void
+test_mismatch(void)
+{
+    Image *a = new_image(4, 4, FALSE, 0);
+    Image *b = new_image(4, 3, FALSE, 0);
+    Image *c = new_image(4, 4, TRUE, 0);
+    Image *heatmap;
+    CompareStats stats;
+
+    compare_images(a, b, &stats, &heatmap);
+    g_assert_true(stats.mismatch);
+    g_assert_null(heatmap);
+    g_assert_true( compare_stats_differ(&stats, 255) );
+
+    compare_images(a, c, &stats, NULL);
+    g_assert_true(stats.mismatch);
+
+    image_free(a);
+    image_free(b);
+    image_free(c);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/compare/identical", test_identical);
+    g_test_add_func("/compare/psnr", test_psnr);
+    g_test_add_func("/compare/alpha", test_alpha);
+    g_test_add_func("/compare/mismatch", test_mismatch);
+
+    return g_test_run();
+}
@@ -0,0 +1,176 @@
+#include <string.h>
+#include "filter.h"
+
+static const gchar *paths[] = {
+    "/photos/2023/IMG_0001.JPG",
+    "/photos/2023/img_0002.jpg",
+    "/photos/2024/scan.pdf#page=12",
+    "/photos/2024/anim.gif",
+    "/other/b/c.png",
+    "relative/D.PNG",
+    NULL
+};
+
+static void
+on_result(FilterResult *result, GAsyncQueue *results)
+{
+    g_async_queue_push(results, result);
+}
+
+/* returns indices matching query joined with commas */
+static gchar *
+run_query(const PathStore *store, const gchar *query)
+{
+    GAsyncQueue *results = g_async_queue_new();
+    Filter *filter = filter_new( (FilterCallback*)on_result, results );
+    FilterResult *result;
+    GError *error = NULL;
+    GString *indices;
+    guint id, i;
+
+    id = filter_start(filter, store, query, &error);
+    g_assert_no_error(error);
+    g_assert_cmpuint(id, !=, 0);
+
+    result = g_async_queue_pop(results);
+    g_assert_cmpuint(result->id, ==, id);
+    g_assert_true(result->user_data == results);
+
+    indices = g_string_new(NULL);
+    for (i = 0; i < result->count; ++i)
+        g_string_append_printf(indices, i ? ",%u" : "%u", result->indices[i]);
+
+    filter_result_free(result);
+    filter_free(filter);
+    g_async_queue_unref(results);
+
+    return g_string_free(indices, FALSE);
+}
+
+static PathStore *
+new_store(void)
+{
+    PathStore *store = path_store_new();
+    guint i;
+
+    for (i = 0; paths[i]; ++i)
+        path_store_add(store, paths[i]);
+
+    return store;
+}
+
+static void
+assert_query(const gchar *query, const gchar *expected)
+{
+    PathStore *store = new_store();
+    gchar *indices;
+
+    indices = run_query(store, query);
+    g_assert_cmpstr(indices, ==, expected);
+
+    g_free(indices);
+    path_store_free(store);
+}
+
+static void
+test_substring(void)
+{
+    /* lower case query ignores case */
+    assert_query("jpg", "0,1");
+    assert_query(".png", "4,5");
+    /* upper case letter makes query case sensitive */
+    assert_query("JPG", "0");
+    assert_query("IMG_", "0");
+    assert_query("missing", "");
+}
+
+static void
+test_glob(void)
+{
+    /* pattern matches whole path */
+    assert_query("*.jpg", "1");
+    assert_query("/photos/2024/*", "2,3");
+    assert_query("*/b/?.png", "4");
+    assert_query("anim.gif", "3");
+}
+
+static void
+test_regex(void)
+{
+    PathStore *store = new_store();
+    Filter *filter;
+    GError *error = NULL;
+
+    assert_query("re:_000[12]\\.", "0,1");
+    assert_query("re:#page=\\d+$", "2");
+    assert_query("re:^relative/", "5");
+
+    /* invalid expression is reported */
+    filter = filter_new(NULL, NULL);
+    g_assert_cmpuint(filter_start(filter, store, "re:(", &error), ==, 0);
+    g_assert_nonnull(error);
+    g_error_free(error);
+    filter_free(filter);
+    path_store_free(store);
+}
+
+/* results of chunks matched in parallel are joined in order */
+static void
+test_many(void)
+{
+    GAsyncQueue *results = g_async_queue_new();
+    Filter *filter = filter_new( (FilterCallback*)on_result, results );
+    PathStore *store = path_store_new();
+    FilterResult *result;
+    gchar *path;
+    guint i, count = 200000;
+
+    for (i = 0; i < count; ++i) {
+        path = g_strdup_printf("/dir%u/%u.%s", i % 7, i, i % 3 ? "jpg" : "png");
+        path_store_add(store, path);
+        g_free(path);
+    }
+
+    filter_start(filter, store, "png", NULL);
+    result = g_async_queue_pop(results);
+    g_assert_cmpuint(result->count, ==, (count + 2) / 3);
+    for (i = 0; i < result->count; ++i)
+        g_assert_cmpuint(result->indices[i], ==, 3*i);
+
+    g_assert_cmpuint(filter_result_find(result, 0), ==, 0);
+    g_assert_cmpuint(filter_result_find(result, 3), ==, 1);
+    g_assert_cmpuint(filter_result_find(result, 4), ==, 2);
+    g_assert_cmpuint(filter_result_find(result, count), ==, result->count);
+
+    filter_result_free(result);
+    filter_free(filter);
+    path_store_free(store);
+    g_async_queue_unref(results);
+}
+
+static void
+test_empty_store(void)
+{
+    PathStore *store = path_store_new();
+    gchar *indices;
+
+    indices = run_query(store, "anything");
+    g_assert_cmpstr(indices, ==, "");
+
+    g_free(indices);
+    path_store_free(store);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/filter/substring", test_substring);
+    g_test_add_func("/filter/glob", test_glob);
+    g_test_add_func("/filter/regex", test_regex);
+    g_test_add_func("/filter/many", test_many);
+    g_test_add_func("/filter/empty-store", test_empty_store);
+
+    return g_test_run();
+}
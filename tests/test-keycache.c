@@ -0,0 +1,170 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include "keycache.h"
+
+#define HEADER "imagepeek test keys 1\n"
+
+/* creates file in temporary directory and returns its path and stat */
+static gchar *
+new_file(const gchar *dir, const gchar *name, const gchar *contents, struct stat *st)
+{
+    gchar *path = g_build_filename(dir, name, NULL);
+
+    g_assert_true( g_file_set_contents(path, contents, -1, NULL) );
+    g_assert_cmpint( g_stat(path, st), ==, 0 );
+
+    return path;
+}
+
+static CachedKey
+key_for(const struct stat *st, gint64 value)
+{
+    CachedKey key = {st->st_mtime, st->st_size, {value, -value}};
+    return key;
+}
+
+static void
+test_lookup(void)
+{
+    KeyCache *cache = key_cache_new("lookup", HEADER);
+    struct stat st, changed;
+    CachedKey key, found;
+    gchar *dir, *path;
+
+    dir = g_dir_make_tmp("keycache-XXXXXX", NULL);
+    path = new_file(dir, "a.jpg", "data", &st);
+
+    g_assert_false( key_cache_lookup(cache, path, &st, &found) );
+
+    key = key_for(&st, 42);
+    key_cache_add(cache, path, &key);
+    g_assert_true( key_cache_lookup(cache, path, &st, &found) );
+    g_assert_cmpint(found.values[0], ==, 42);
+    g_assert_cmpint(found.values[1], ==, -42);
+
+    /* key of changed file is not valid */
+    changed = st;
+    changed.st_size += 1;
+    g_assert_false( key_cache_lookup(cache, path, &changed, &found) );
+    changed = st;
+    changed.st_mtime += 1;
+    g_assert_false( key_cache_lookup(cache, path, &changed, &found) );
+
+    /* later key replaces earlier */
+    key = key_for(&st, 7);
+    key_cache_add(cache, path, &key);
+    g_assert_true( key_cache_lookup(cache, path, &st, &found) );
+    g_assert_cmpint(found.values[0], ==, 7);
+
+    /* cache file has one path per line */
+    key_cache_add(cache, "bad\npath", &key);
+    g_assert_false( key_cache_lookup(cache, "bad\npath", &st, &found) );
+
+    key_cache_free(cache);
+    g_unlink(path);
+    g_rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+static void
+test_persist(void)
+{
+    KeyCache *cache;
+    struct stat st_a, st_b, st_removed;
+    CachedKey key, found;
+    gchar *dir, *a, *b, *removed;
+
+    dir = g_dir_make_tmp("keycache-XXXXXX", NULL);
+    a = new_file(dir, "a.jpg", "a", &st_a);
+    b = new_file(dir, "b.jpg", "bb", &st_b);
+    removed = new_file(dir, "removed.jpg", "ccc", &st_removed);
+
+    cache = key_cache_new("persist", HEADER);
+    key = key_for(&st_a, 1);
+    key_cache_add(cache, a, &key);
+    key = key_for(&st_b, 2);
+    key_cache_add(cache, b, &key);
+    key_cache_flush(cache);
+    /* waits for writer */
+    key_cache_free(cache);
+
+    /* keys are appended to existing file without checking files */
+    g_unlink(removed);
+    cache = key_cache_new("persist", HEADER);
+    key = key_for(&st_removed, 3);
+    key_cache_add(cache, removed, &key);
+    key_cache_flush(cache);
+    key_cache_free(cache);
+
+    /* keys of both sessions are loaded */
+    cache = key_cache_new("persist", HEADER);
+    g_assert_true( key_cache_lookup(cache, a, &st_a, &found) );
+    g_assert_cmpint(found.values[0], ==, 1);
+    g_assert_true( key_cache_lookup(cache, b, &st_b, &found) );
+    g_assert_cmpint(found.values[0], ==, 2);
+    g_assert_true( key_cache_lookup(cache, removed, &st_removed, &found) );
+    g_assert_cmpint(found.values[0], ==, 3);
+    key_cache_free(cache);
+
+    /* file with other header is ignored */
+    cache = key_cache_new("persist", "imagepeek test keys 2\n");
+    g_assert_false( key_cache_lookup(cache, a, &st_a, &found) );
+    key_cache_free(cache);
+
+    g_unlink(a);
+    g_unlink(b);
+    g_rmdir(dir);
+    g_free(a);
+    g_free(b);
+    g_free(removed);
+    g_free(dir);
+}
+
+/* keys of removed files are dropped when cache file is rewritten */
+static void
+test_rewrite(void)
+{
+    KeyCache *cache;
+    struct stat st, st_removed;
+    CachedKey key, found;
+    gchar *dir, *path, *removed;
+
+    dir = g_dir_make_tmp("keycache-XXXXXX", NULL);
+    path = new_file(dir, "kept.jpg", "kept", &st);
+    removed = new_file(dir, "removed.jpg", "removed", &st_removed);
+    g_unlink(removed);
+
+    /* missing cache file is written from scratch */
+    cache = key_cache_new("rewrite", HEADER);
+    key = key_for(&st, 1);
+    key_cache_add(cache, path, &key);
+    key = key_for(&st_removed, 2);
+    key_cache_add(cache, removed, &key);
+    key_cache_flush(cache);
+    key_cache_free(cache);
+
+    cache = key_cache_new("rewrite", HEADER);
+    g_assert_true( key_cache_lookup(cache, path, &st, &found) );
+    g_assert_false( key_cache_lookup(cache, removed, &st_removed, &found) );
+    key_cache_free(cache);
+
+    g_unlink(path);
+    g_rmdir(dir);
+    g_free(path);
+    g_free(removed);
+    g_free(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    /* cache files are written to temporary cache directory */
+    g_test_init(&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
+
+    g_test_add_func("/keycache/lookup", test_lookup);
+    g_test_add_func("/keycache/persist", test_persist);
+    g_test_add_func("/keycache/rewrite", test_rewrite);
+
+    return g_test_run();
+}
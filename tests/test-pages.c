@@ -0,0 +1,109 @@
+#include "pages.h"
+
+/* extension of supported document format */
+#if defined(HAVE_POPPLER)
+#define DOCUMENT "/docs/scan.pdf"
+#elif defined(HAVE_LIBTIFF)
+#define DOCUMENT "/docs/scan.tif"
+#endif
+
+static void
+assert_not_page(const gchar *item)
+{
+    gint page = -1;
+
+    g_assert_null( pages_parse(item, &page) );
+    g_assert_cmpint(page, ==, -1);
+}
+
+#ifdef DOCUMENT
+static void
+assert_page(const gchar *item, const gchar *path, gint page)
+{
+    gchar *parsed;
+    gint parsed_page = 0;
+
+    parsed = pages_parse(item, &parsed_page);
+    g_assert_cmpstr(parsed, ==, path);
+    g_assert_cmpint(parsed_page, ==, page);
+    g_free(parsed);
+}
+#endif
+
+static void
+test_unsupported(void)
+{
+    GError *error = NULL;
+
+    assert_not_page("/photos/a.jpg");
+    assert_not_page("/photos/a.jpg#page=2");
+    assert_not_page("/photos.pdf/readme");
+    assert_not_page("/photos/noext");
+    assert_not_page("");
+
+    g_assert_cmpint(pages_count("/photos/a.jpg"), ==, 0);
+    g_assert_null( pages_render("/photos/a.jpg", 1, NULL, &error) );
+    g_assert_error(error, DECODER_ERROR, DECODER_ERROR_UNSUPPORTED);
+    g_error_free(error);
+}
+
+static void
+test_parse(void)
+{
+#ifdef DOCUMENT
+    gchar *item;
+
+    /* document not expanded yet is its first page */
+    assert_page(DOCUMENT, DOCUMENT, 1);
+
+    assert_page(DOCUMENT "#page=1", DOCUMENT, 1);
+    assert_page(DOCUMENT "#page=12", DOCUMENT, 12);
+    assert_page(DOCUMENT "#page=2147483647", DOCUMENT, G_MAXINT);
+    /* last suffix is page number */
+    assert_page("/docs/a#page=1" DOCUMENT "#page=3", "/docs/a#page=1" DOCUMENT, 3);
+
+    item = pages_get_item(DOCUMENT, 7);
+    g_assert_cmpstr(item, ==, DOCUMENT "#page=7");
+    assert_page(item, DOCUMENT, 7);
+    g_free(item);
+
+    /* page number is optional output */
+    item = pages_parse(DOCUMENT "#page=4", NULL);
+    g_assert_cmpstr(item, ==, DOCUMENT);
+    g_free(item);
+
+    /* missing document has no pages */
+    g_assert_cmpint(pages_count(DOCUMENT), ==, 0);
+#else
+    g_test_skip("no document format is supported");
+#endif
+}
+
+static void
+test_invalid_page(void)
+{
+#ifdef DOCUMENT
+    assert_not_page(DOCUMENT "#page=");
+    assert_not_page(DOCUMENT "#page=0");
+    assert_not_page(DOCUMENT "#page=-1");
+    assert_not_page(DOCUMENT "#page=+1");
+    assert_not_page(DOCUMENT "#page= 1");
+    assert_not_page(DOCUMENT "#page=1x");
+    assert_not_page(DOCUMENT "#page=2147483648");
+    assert_not_page(DOCUMENT "#page=99999999999999999999");
+#else
+    g_test_skip("no document format is supported");
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pages/unsupported", test_unsupported);
+    g_test_add_func("/pages/parse", test_parse);
+    g_test_add_func("/pages/invalid-page", test_invalid_page);
+
+    return g_test_run();
+}
@@ -0,0 +1,130 @@
+#include <string.h>
+#include "pathstore.h"
+
+static PathStore *
+new_store(const gchar * const *paths)
+{
+    PathStore *store = path_store_new();
+
+    for (; *paths; ++paths)
+        path_store_add(store, *paths);
+
+    return store;
+}
+
+static void
+assert_paths(const PathStore *store, const gchar * const *paths)
+{
+    gchar *path;
+    guint i;
+
+    for (i = 0; paths[i]; ++i) {
+        path = path_store_get(store, i);
+        g_assert_cmpstr(path, ==, paths[i]);
+        g_free(path);
+    }
+    g_assert_cmpuint(path_store_get_count(store), ==, i);
+}
+
+static void
+test_add(void)
+{
+    const gchar *paths[] = {
+        "/photos/a.jpg", "/photos/b.jpg", "c.png", "/photos/sub/d.gif",
+        "/photos/e.jpg", "/", "", NULL
+    };
+    PathStore *store = new_store(paths);
+    GString *path;
+
+    assert_paths(store, paths);
+
+    path = g_string_new("prefix:");
+    path_store_append(store, 3, path);
+    g_assert_cmpstr(path->str, ==, "prefix:/photos/sub/d.gif");
+    g_string_free(path, TRUE);
+
+    path_store_free(store);
+}
+
+static void
+test_add_len(void)
+{
+    PathStore *store = path_store_new();
+    gchar *path;
+
+    path_store_add_len(store, "/dir/name.jpg\n/other", 13);
+    path = path_store_get(store, 0);
+    g_assert_cmpstr(path, ==, "/dir/name.jpg");
+    g_free(path);
+
+    path_store_free(store);
+}
+
+static void
+test_replace(void)
+{
+    const gchar *paths[] = {"/a/1.pdf", "/a/2.jpg", "/b/3.pdf", NULL};
+    const gchar *pages[] = {"/a/1.pdf#page=1", "/a/1.pdf#page=2", "/a/1.pdf#page=3"};
+    const gchar *expected[] = {
+        "/a/1.pdf#page=1", "/a/1.pdf#page=2", "/a/1.pdf#page=3",
+        "/a/2.jpg", "/b/3.pdf", NULL
+    };
+    PathStore *store = new_store(paths);
+
+    path_store_replace(store, 0, pages, 3);
+    assert_paths(store, expected);
+
+    path_store_free(store);
+}
+
+static void
+test_replace_many(void)
+{
+    const gchar *paths[] = {"/a/1.pdf", "/a/2.jpg", "/b/3.pdf", "/b/4.tif", NULL};
+    const gchar *pages[] = {
+        "/a/1.pdf#page=1", "/a/1.pdf#page=2",
+        "/b/3.pdf#page=1",
+        "/b/4.tif#page=1", "/b/4.tif#page=2", "/b/4.tif#page=3"
+    };
+    const gchar *expected[] = {
+        "/a/1.pdf#page=1", "/a/1.pdf#page=2", "/a/2.jpg", "/b/3.pdf#page=1",
+        "/b/4.tif#page=1", "/b/4.tif#page=2", "/b/4.tif#page=3", NULL
+    };
+    const guint indices[] = {0, 2, 3};
+    const guint counts[] = {2, 1, 3};
+    PathStore *store = new_store(paths);
+
+    path_store_replace_many(store, indices, counts, 3, pages);
+    assert_paths(store, expected);
+
+    path_store_free(store);
+}
+
+static void
+test_reorder(void)
+{
+    const gchar *paths[] = {"/x/a", "/y/b", "c", "/x/d", NULL};
+    const gchar *expected[] = {"/x/d", "c", "/x/a", "/y/b", NULL};
+    const guint32 order[] = {3, 2, 0, 1};
+    PathStore *store = new_store(paths);
+
+    path_store_reorder(store, order);
+    assert_paths(store, expected);
+    g_assert_cmpuint(path_store_get_memory(store), >, 0);
+
+    path_store_free(store);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pathstore/add", test_add);
+    g_test_add_func("/pathstore/add-len", test_add_len);
+    g_test_add_func("/pathstore/replace", test_replace);
+    g_test_add_func("/pathstore/replace-many", test_replace_many);
+    g_test_add_func("/pathstore/reorder", test_reorder);
+
+    return g_test_run();
+}
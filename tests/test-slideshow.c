@@ -0,0 +1,117 @@
+/* includes module source to test its static permutation */
+#include "slideshow.c"
+
+static void
+on_prepare(guint index, GArray *prepared)
+{
+    g_array_append_val(prepared, index);
+}
+
+static void
+on_show(guint index, gpointer user_data)
+{
+}
+
+/* asserts that items at positions of given pass are all different */
+static void
+assert_pass_permutes(const Slideshow *slideshow, guint64 pass)
+{
+    guint count = slideshow->count;
+    gboolean *seen = g_new0(gboolean, count);
+    guint i, index;
+
+    for (i = 0; i < count; ++i) {
+        index = slideshow_get_index(slideshow, pass * count + i);
+        g_assert_cmpuint(index, <, count);
+        g_assert_false(seen[index]);
+        seen[index] = TRUE;
+    }
+
+    g_free(seen);
+}
+
+static void
+test_permutation(void)
+{
+    const guint counts[] = {2, 3, 4, 5, 7, 16, 17, 100, 255, 1000, 65537};
+    GArray *prepared = g_array_new( FALSE, FALSE, sizeof(guint) );
+    Slideshow *slideshow;
+    guint i, pass;
+
+    slideshow = slideshow_new( (SlideshowPrepare*)on_prepare, on_show, prepared );
+    slideshow_set_shuffle(slideshow, TRUE);
+    for (i = 0; i < G_N_ELEMENTS(counts); ++i) {
+        g_assert_true( slideshow_start(slideshow, counts[i], 0) );
+        for (pass = 0; pass < 3; ++pass)
+            assert_pass_permutes(slideshow, pass);
+        slideshow_stop(slideshow);
+    }
+
+    /* whole range of keys */
+    slideshow->count = 1000;
+    slideshow->half_bits = 5;
+    for (slideshow->seed = 0; slideshow->seed < 64; ++slideshow->seed)
+        assert_pass_permutes(slideshow, 0);
+
+    slideshow_free(slideshow);
+    g_array_free(prepared, TRUE);
+}
+
+/* each pass uses new order */
+static void
+test_passes_differ(void)
+{
+    Slideshow *slideshow = slideshow_new(NULL, on_show, NULL);
+    guint i, count = 1000, same = 0;
+
+    slideshow_set_shuffle(slideshow, TRUE);
+    slideshow->count = count;
+    slideshow->half_bits = 5;
+    for (i = 0; i < count; ++i)
+        same += slideshow_get_index(slideshow, i) == slideshow_get_index(slideshow, count + i);
+    g_assert_cmpuint(same, <, count / 10);
+
+    slideshow_free(slideshow);
+}
+
+static void
+test_ordered(void)
+{
+    GArray *prepared = g_array_new( FALSE, FALSE, sizeof(guint) );
+    Slideshow *slideshow;
+    guint i;
+
+    slideshow = slideshow_new( (SlideshowPrepare*)on_prepare, on_show, prepared );
+    slideshow_set_ready_count(slideshow, 3);
+    g_assert_false( slideshow_start(slideshow, 1, 0) );
+
+    /* ordered slideshow continues from current item */
+    g_assert_true( slideshow_start(slideshow, 5, 3) );
+    g_assert_cmpuint(prepared->len, ==, 3);
+    g_assert_cmpuint(g_array_index(prepared, guint, 0), ==, 4);
+    g_assert_cmpuint(g_array_index(prepared, guint, 1), ==, 0);
+    g_assert_cmpuint(g_array_index(prepared, guint, 2), ==, 1);
+    for (i = 0; i < 5; ++i)
+        g_assert_cmpuint(slideshow_get_index(slideshow, 5 + i), ==, (3 + i) % 5);
+
+    /* current item is not prepared again */
+    g_array_set_size(prepared, 0);
+    g_assert_true( slideshow_start(slideshow, 2, 1) );
+    g_assert_cmpuint(prepared->len, ==, 1);
+    g_assert_cmpuint(g_array_index(prepared, guint, 0), ==, 0);
+
+    slideshow_free(slideshow);
+    g_array_free(prepared, TRUE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/slideshow/permutation", test_permutation);
+    g_test_add_func("/slideshow/passes-differ", test_passes_differ);
+    g_test_add_func("/slideshow/ordered", test_ordered);
+
+    return g_test_run();
+}
@@ -0,0 +1,190 @@
+#include <string.h>
+#include "texcomp.h"
+
+/* image with all pixels of given color */
+static Image *
+new_image(gint width, gint height, gboolean has_alpha, const guchar color[3])
+{
+    Image *image = g_new0(Image, 1);
+    gint x, y, channels = has_alpha ? 4 : 3;
+    guchar *pixel;
+
+    image->width = width;
+    image->height = height;
+    image->has_alpha = has_alpha;
+    image->rowstride = width*channels + 5;
+    image->pixels = g_malloc0(image->rowstride * height);
+    for (y = 0; y < height; ++y) {
+        for (x = 0; x < width; ++x) {
+            pixel = image->pixels + y*image->rowstride + x*channels;
+            memcpy(pixel, color, 3);
+        }
+    }
+
+    return image;
+}
+
+static void
+free_image(Image *image)
+{
+    g_free(image->pixels);
+    g_free(image);
+}
+
+static void
+set_pixel(Image *image, gint x, gint y, const guchar color[3])
+{
+    memcpy( image->pixels + y*image->rowstride + x*(image->has_alpha ? 4 : 3), color, 3 );
+}
+
+static void
+unpack_565(guint16 value, gint color[3])
+{
+    color[0] = (value >> 11) << 3 | (value >> 13);
+    color[1] = ((value >> 5) & 0x3f) << 2 | ((value >> 9) & 0x3);
+    color[2] = (value & 0x1f) << 3 | ((value >> 2) & 0x7);
+}
+
+/* decodes pixel i of four-color BC1 block */
+static void
+decode_pixel(const guchar *block, gint i, gint color[3])
+{
+    gint c0[3], c1[3], k;
+    guint16 v0 = block[0] | block[1] << 8;
+    guint16 v1 = block[2] | block[3] << 8;
+    guint32 indices = block[4] | block[5] << 8 | block[6] << 16 | (guint32)block[7] << 24;
+    guint index = (indices >> (2*i)) & 3;
+
+    unpack_565(v0, c0);
+    unpack_565(v1, c1);
+    for (k = 0; k < 3; ++k) {
+        if (index == 0)
+            color[k] = c0[k];
+        else if (index == 1)
+            color[k] = c1[k];
+        else if (index == 2)
+            color[k] = (2*c0[k] + c1[k]) / 3;
+        else
+            color[k] = (c0[k] + 2*c1[k]) / 3;
+    }
+}
+
+static void
+assert_block_color(const guchar *block, gint i, const guchar expected[3], gint tolerance)
+{
+    gint color[3], k;
+
+    decode_pixel(block, i, color);
+    for (k = 0; k < 3; ++k)
+        g_assert_cmpint(ABS(color[k] - expected[k]), <=, tolerance);
+}
+
+static void
+test_solid(void)
+{
+    const guchar color[3] = {200, 100, 50};
+    Image *image = new_image(4, 4, FALSE, color);
+    CompressedImage *out;
+    guint16 c0, c1;
+    gint i;
+
+    out = texcomp_encode(image, 0);
+    g_assert_nonnull(out);
+    g_assert_cmpuint(out->size, ==, 8);
+
+    /* equal end points and all pixels use first color */
+    c0 = out->data[0] | out->data[1] << 8;
+    c1 = out->data[2] | out->data[3] << 8;
+    g_assert_cmpuint(c0, ==, (200 >> 3) << 11 | (100 >> 2) << 5 | 50 >> 3);
+    g_assert_cmpuint(c1, ==, c0);
+    for (i = 4; i < 8; ++i)
+        g_assert_cmpuint(out->data[i], ==, 0);
+
+    /* error of 565 quantization only */
+    for (i = 0; i < 16; ++i)
+        assert_block_color(out->data, i, color, 7);
+
+    compressed_image_free(out);
+    free_image(image);
+}
+
+static void
+test_two_colors(void)
+{
+    const guchar black[3] = {0, 0, 0};
+    const guchar white[3] = {255, 255, 255};
+    const guchar orange[3] = {255, 128, 0};
+    const guchar blue[3] = {0, 64, 255};
+    Image *image = new_image(4, 4, TRUE, black);
+    CompressedImage *out;
+    gint i;
+
+    /* checkerboard uses only end points (inset by 1/16 of range) */
+    for (i = 0; i < 16; ++i) {
+        if ((i%4 + i/4) % 2)
+            set_pixel(image, i%4, i/4, white);
+    }
+    out = texcomp_encode(image, 0);
+    g_assert_cmpuint(out->data[0] | out->data[1] << 8, >, out->data[2] | out->data[3] << 8);
+    for (i = 0; i < 16; ++i) {
+        g_assert_cmpuint( (out->data[4 + i/4] >> (2*(i%4))) & 3, ==, (i%4 + i/4) % 2 ? 0 : 1 );
+        assert_block_color(out->data, i, (i%4 + i/4) % 2 ? white : black, 16);
+    }
+    compressed_image_free(out);
+    free_image(image);
+
+    /* colors on anti-diagonal of bounding box */
+    image = new_image(4, 4, FALSE, orange);
+    for (i = 0; i < 8; ++i)
+        set_pixel(image, i%4, i/4, blue);
+    out = texcomp_encode(image, 0);
+    for (i = 0; i < 16; ++i)
+        assert_block_color(out->data, i, i < 8 ? blue : orange, 24);
+    compressed_image_free(out);
+    free_image(image);
+}
+
+/* size is padded to whole blocks and pixels outside image repeat its edges */
+static void
+test_padding(void)
+{
+    const guchar red[3] = {255, 0, 0};
+    const guchar green[3] = {0, 255, 0};
+    Image *image = new_image(5, 3, FALSE, green);
+    CompressedImage *out;
+    const guchar *last;
+    gint i;
+
+    for (i = 0; i < 3; ++i)
+        set_pixel(image, 0, i, red);
+
+    out = texcomp_encode(image, 2);
+    g_assert_cmpint(out->padding, ==, 2);
+    g_assert_cmpint(out->width, ==, 12);
+    g_assert_cmpint(out->height, ==, 8);
+    g_assert_cmpuint(out->size, ==, 3 * 2 * 8);
+
+    /* first block: two columns of padding, left column, one green column */
+    for (i = 0; i < 16; ++i)
+        assert_block_color(out->data, i, i%4 < 3 ? red : green, 16);
+
+    /* last block is right of and below image */
+    last = out->data + out->size - 8;
+    for (i = 0; i < 16; ++i)
+        assert_block_color(last, i, green, 0);
+
+    compressed_image_free(out);
+    free_image(image);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/texcomp/solid", test_solid);
+    g_test_add_func("/texcomp/two-colors", test_two_colors);
+    g_test_add_func("/texcomp/padding", test_padding);
+
+    return g_test_run();
+}
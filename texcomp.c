@@ -0,0 +1,317 @@
+#include <string.h>
+#include "texcomp.h"
+
+/* GL constants (GL headers are not needed otherwise) */
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_TEXTURE_BINDING_2D 0x8069
+#define GL_EXTENSIONS 0x1F03
+#define GL_TEXTURE_MAG_FILTER 0x2800
+#define GL_TEXTURE_MIN_FILTER 0x2801
+#define GL_TEXTURE_WRAP_S 0x2802
+#define GL_TEXTURE_WRAP_T 0x2803
+#define GL_LINEAR 0x2601
+#define GL_CLAMP_TO_EDGE 0x812F
+#define GL_RGB 0x1907
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+
+typedef void GlGenTextures(gint n, guint *textures);
+typedef void GlDeleteTextures(gint n, const guint *textures);
+typedef void GlBindTexture(guint target, guint texture);
+typedef void GlTexParameteri(guint target, guint name, gint value);
+typedef void GlTexImage2D(guint target, gint level, gint internal_format,
+        gint width, gint height, gint border, guint format, guint type, const void *data);
+typedef void GlCompressedTexImage2D(guint target, gint level, guint internal_format,
+        gint width, gint height, gint border, gint size, const void *data);
+typedef void GlCompressedTexSubImage2D(guint target, gint level, gint x, gint y,
+        gint width, gint height, guint format, gint size, const void *data);
+typedef void GlGetIntegerv(guint name, gint *value);
+typedef const guchar *GlGetString(guint name);
+
+static struct {
+    GlGenTextures *GenTextures;
+    GlDeleteTextures *DeleteTextures;
+    GlBindTexture *BindTexture;
+    GlTexParameteri *TexParameteri;
+    GlTexImage2D *TexImage2D;
+    GlCompressedTexImage2D *CompressedTexImage2D;
+    GlCompressedTexSubImage2D *CompressedTexSubImage2D;
+    GlGetIntegerv *GetIntegerv;
+    GlGetString *GetString;
+} gl;
+
+static const guchar *
+texcomp_pixel(const Image *image, gint x, gint y)
+{
+    x = CLAMP(x, 0, image->width - 1);
+    y = CLAMP(y, 0, image->height - 1);
+    return image->pixels + y*image->rowstride + x*(image->has_alpha ? 4 : 3);
+}
+
+static guint16
+texcomp_pack_565(const gint color[3])
+{
+    return ((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3);
+}
+
+static void
+texcomp_unpack_565(guint16 value, gint color[3])
+{
+    color[0] = (value >> 11) & 0x1f;
+    color[1] = (value >> 5) & 0x3f;
+    color[2] = value & 0x1f;
+    color[0] = (color[0] << 3) | (color[0] >> 2);
+    color[1] = (color[1] << 2) | (color[1] >> 4);
+    color[2] = (color[2] << 3) | (color[2] >> 2);
+}
+
+/* encodes 4x4 pixels with end points on diagonal of bounding box of colors */
+static void
+texcomp_encode_block(guchar block[16][3], guchar *out)
+{
+    gint min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+    gint palette[4][3];
+    gint i, j, k, inset, d, distance, best, axis, covariance, tmp;
+    guint16 c0, c1, swap;
+    guint32 indices = 0;
+
+    for (i = 0; i < 16; ++i) {
+        for (k = 0; k < 3; ++k) {
+            min[k] = MIN(min[k], block[i][k]);
+            max[k] = MAX(max[k], block[i][k]);
+        }
+    }
+
+    /* end points are rarely exact colors, inset box a bit */
+    for (k = 0; k < 3; ++k) {
+        inset = (max[k] - min[k]) >> 4;
+        min[k] += inset;
+        max[k] -= inset;
+    }
+
+    /* use diagonal of box along which colors change (relative to widest channel) */
+    axis = 0;
+    for (k = 1; k < 3; ++k) {
+        if (max[k] - min[k] > max[axis] - min[axis])
+            axis = k;
+    }
+    for (k = 0; k < 3; ++k) {
+        covariance = 0;
+        for (i = 0; i < 16; ++i)
+            covariance += (2*block[i][axis] - min[axis] - max[axis]) * (2*block[i][k] - min[k] - max[k]);
+        if (covariance < 0) {
+            tmp = min[k];
+            min[k] = max[k];
+            max[k] = tmp;
+        }
+    }
+
+    /* first end point is bigger in four-color mode */
+    c0 = texcomp_pack_565(max);
+    c1 = texcomp_pack_565(min);
+    if (c0 < c1) {
+        swap = c0;
+        c0 = c1;
+        c1 = swap;
+    }
+
+    /* equal end points: all pixels use first color */
+    if (c0 != c1) {
+        texcomp_unpack_565(c0, palette[0]);
+        texcomp_unpack_565(c1, palette[1]);
+        for (k = 0; k < 3; ++k) {
+            palette[2][k] = (2*palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2*palette[1][k]) / 3;
+        }
+
+        for (i = 0; i < 16; ++i) {
+            best = 0;
+            distance = G_MAXINT;
+            for (j = 0; j < 4; ++j) {
+                d = 0;
+                for (k = 0; k < 3; ++k)
+                    d += (block[i][k] - palette[j][k]) * (block[i][k] - palette[j][k]);
+                if (d < distance) {
+                    distance = d;
+                    best = j;
+                }
+            }
+            indices |= (guint32)best << (2*i);
+        }
+    }
+
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    out[4] = indices & 0xff;
+    out[5] = (indices >> 8) & 0xff;
+    out[6] = (indices >> 16) & 0xff;
+    out[7] = indices >> 24;
+}
+
+CompressedImage *
+texcomp_encode(const Image *image, gint padding)
+{
+    CompressedImage *out;
+    guchar block[16][3], *dst;
+    gint x, y, i;
+
+    out = g_slice_new(CompressedImage);
+    out->padding = padding;
+    out->width = (image->width + 2*padding + 3) & ~3;
+    out->height = (image->height + 2*padding + 3) & ~3;
+    out->size = (gsize)(out->width / 4) * (out->height / 4) * 8;
+    out->data = g_try_malloc(out->size);
+    if (!out->data) {
+        g_slice_free(CompressedImage, out);
+        return NULL;
+    }
+
+    dst = out->data;
+    for (y = 0; y < out->height; y += 4) {
+        for (x = 0; x < out->width; x += 4, dst += 8) {
+            /* pixels outside image repeat its edges */
+            for (i = 0; i < 16; ++i) {
+                memcpy( block[i],
+                        texcomp_pixel(image, x + i%4 - padding, y + i/4 - padding), 3 );
+            }
+            texcomp_encode_block(block, dst);
+        }
+    }
+
+    return out;
+}
+
+void
+compressed_image_free(CompressedImage *image)
+{
+    g_free(image->data);
+    g_slice_free(CompressedImage, image);
+}
+
+/* returns TRUE if extension is in space separated list */
+static gboolean
+texcomp_has_extension(const gchar *extensions, const gchar *name)
+{
+    const gchar *p = extensions;
+    gsize length = strlen(name);
+
+    while ( (p = strstr(p, name)) ) {
+        if ( (p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0') )
+            return TRUE;
+        p += length;
+    }
+
+    return FALSE;
+}
+
+gboolean
+texcomp_is_supported(void)
+{
+    static gint supported = -1;
+    const gchar *extensions;
+
+    if (supported != -1)
+        return supported;
+
+#define TEXCOMP_LOAD(name) \
+    ( gl.name = (Gl##name*)cogl_get_proc_address("gl" #name) ) != NULL
+
+    supported =
+        TEXCOMP_LOAD(GenTextures) &&
+        TEXCOMP_LOAD(DeleteTextures) &&
+        TEXCOMP_LOAD(BindTexture) &&
+        TEXCOMP_LOAD(TexParameteri) &&
+        TEXCOMP_LOAD(TexImage2D) &&
+        TEXCOMP_LOAD(CompressedTexImage2D) &&
+        TEXCOMP_LOAD(CompressedTexSubImage2D) &&
+        TEXCOMP_LOAD(GetIntegerv) &&
+        TEXCOMP_LOAD(GetString);
+
+#undef TEXCOMP_LOAD
+
+    if (supported) {
+        extensions = (const gchar*)gl.GetString(GL_EXTENSIONS);
+        supported = extensions &&
+            ( texcomp_has_extension(extensions, "GL_EXT_texture_compression_s3tc") ||
+              texcomp_has_extension(extensions, "GL_EXT_texture_compression_dxt1") );
+    }
+
+    return supported;
+}
+
+/*
+ * Raw GL calls are wrapped in cogl_begin_gl() and cogl_end_gl() and
+ * restore texture binding which Cogl caches.
+ */
+
+guint
+texcomp_texture_new(gint width, gint height, CoglHandle *texture)
+{
+    guint name = 0;
+    gint previous;
+    gsize size = (gsize)(width / 4) * (height / 4) * 8;
+    guchar *blocks;
+
+    if ( !texcomp_is_supported() )
+        return 0;
+
+    blocks = g_try_malloc0(size);
+    if (!blocks)
+        return 0;
+
+    /* Cogl doesn't wrap compressed textures, so texture is compressed after wrapping */
+    cogl_begin_gl();
+    gl.GetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    gl.GenTextures(1, &name);
+    gl.BindTexture(GL_TEXTURE_2D, name);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    gl.BindTexture(GL_TEXTURE_2D, previous);
+    cogl_end_gl();
+
+    *texture = cogl_texture_new_from_foreign( name, GL_TEXTURE_2D, width, height,
+            0, 0, COGL_PIXEL_FORMAT_RGB_888 );
+
+    cogl_begin_gl();
+    if (*texture != COGL_INVALID_HANDLE) {
+        gl.GetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        gl.BindTexture(GL_TEXTURE_2D, name);
+        gl.CompressedTexImage2D( GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+                width, height, 0, size, blocks );
+        gl.BindTexture(GL_TEXTURE_2D, previous);
+    } else {
+        gl.DeleteTextures(1, &name);
+        name = 0;
+    }
+    cogl_end_gl();
+
+    g_free(blocks);
+    return name;
+}
+
+void
+texcomp_texture_free(guint gl_texture)
+{
+    cogl_begin_gl();
+    gl.DeleteTextures(1, &gl_texture);
+    cogl_end_gl();
+}
+
+void
+texcomp_texture_upload(guint gl_texture, gint x, gint y, const CompressedImage *image)
+{
+    gint previous;
+
+    cogl_begin_gl();
+    gl.GetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    gl.BindTexture(GL_TEXTURE_2D, gl_texture);
+    gl.CompressedTexSubImage2D( GL_TEXTURE_2D, 0, x, y, image->width, image->height,
+            GL_COMPRESSED_RGB_S3TC_DXT1_EXT, image->size, image->data );
+    gl.BindTexture(GL_TEXTURE_2D, previous);
+    cogl_end_gl();
+}
@@ -0,0 +1,45 @@
+#ifndef TEXCOMP_H
+#define TEXCOMP_H
+
+#include <clutter/clutter.h>
+#include "decoder.h"
+
+typedef struct _CompressedImage CompressedImage;
+
+/* BC1 (DXT1) compressed opaque image */
+struct _CompressedImage {
+    /* 8 bytes for each 4x4 block of pixels, rows of blocks */
+    guchar *data;
+    gsize size;
+    /* encoded size (multiple of 4, includes padding) */
+    gint width, height;
+    /* image starts at padding offset */
+    gint padding;
+};
+
+/*
+ * Encodes image with edges repeated around it (padding pixels on each
+ * side, more on right and bottom to fill whole blocks).
+ * Can be called from any thread.
+ */
+CompressedImage *texcomp_encode(const Image *image, gint padding);
+void compressed_image_free(CompressedImage *image);
+
+/*
+ * Functions below need current GL context (main thread).
+ */
+
+/* returns TRUE if GL supports BC1 textures */
+gboolean texcomp_is_supported(void);
+
+/*
+ * Creates BC1 texture (size must be multiple of 4).
+ * Returns GL texture name (0 on failure) and Cogl texture in *texture.
+ */
+guint texcomp_texture_new(gint width, gint height, CoglHandle *texture);
+/* frees GL texture after its Cogl texture was released */
+void texcomp_texture_free(guint gl_texture);
+/* uploads image at x, y (multiples of 4) */
+void texcomp_texture_upload(guint gl_texture, gint x, gint y, const CompressedImage *image);
+
+#endif /* TEXCOMP_H */
@@ -0,0 +1,377 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+struct _TraceRecorder {
+    FILE *file;
+    gint64 start;
+};
+
+struct _TracePlayer {
+    ClutterActor *stage;
+    TracePlay *play;
+    TraceDone *done;
+    gpointer user_data;
+
+    /* key -> value */
+    GHashTable *state;
+    /* TraceEvent */
+    GArray *events;
+    guint next;
+    gboolean fast;
+    gint64 start, end;
+    guint source_id;
+
+    /* statistics (microseconds) */
+    GArray *paint_times;
+    GArray *input_latencies;
+    GArray *latencies;
+    gint64 paint_start;
+    /* time of first event which is not drawn yet (0 if none) */
+    gint64 event_time;
+    gulong paint_handler, paint_after_handler;
+};
+
+static const gchar * const trace_type_names[] = { "key", "scroll", "drag", "drag-end" };
+
+TraceRecorder *
+trace_recorder_new(const gchar *filename, GError **error)
+{
+    TraceRecorder *recorder;
+    FILE *file;
+
+    file = fopen(filename, "w");
+    if (!file) {
+        g_set_error( error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Cannot open trace '%s' (%s)", filename, g_strerror(errno) );
+        return NULL;
+    }
+
+    recorder = g_new(TraceRecorder, 1);
+    recorder->file = file;
+    recorder->start = g_get_monotonic_time();
+    fputs("# imagepeek trace\n", file);
+
+    return recorder;
+}
+
+void
+trace_recorder_free(TraceRecorder *recorder)
+{
+    fclose(recorder->file);
+    g_free(recorder);
+}
+
+void
+trace_recorder_add_state(TraceRecorder *recorder, const gchar *key, const gchar *value)
+{
+    /* values are single line */
+    fprintf( recorder->file, "state %s %s\n", key, value ? value : "" );
+}
+
+void
+trace_recorder_add(TraceRecorder *recorder, TraceEvent *event)
+{
+    gchar x[G_ASCII_DTOSTR_BUF_SIZE], y[G_ASCII_DTOSTR_BUF_SIZE];
+
+    event->time = g_get_monotonic_time() - recorder->start;
+    fprintf( recorder->file, "%s %" G_GINT64_FORMAT,
+            trace_type_names[event->type], event->time );
+
+    switch (event->type) {
+        case TraceKey:
+            fprintf( recorder->file, " %u %u %u\n",
+                    event->keyval, (guint)event->unicode, (guint)event->state );
+            break;
+        case TraceScroll:
+            fprintf( recorder->file, " %u %u\n",
+                    (guint)event->direction, (guint)event->state );
+            break;
+        case TraceDrag:
+        case TraceDragEnd:
+            /* independent of locale */
+            g_ascii_dtostr(x, sizeof(x), event->x);
+            g_ascii_dtostr(y, sizeof(y), event->y);
+            fprintf( recorder->file, " %s %s %u\n", x, y, (guint)event->state );
+            break;
+    }
+
+    /* trace is complete even if application crashes */
+    fflush(recorder->file);
+}
+
+/* parses event line (without type name), returns FALSE on error */
+static gboolean
+trace_parse_event(TraceEvent *event, gchar **fields, guint count)
+{
+    gchar *end;
+    guint i;
+
+    if (count < 2)
+        return FALSE;
+
+    event->time = g_ascii_strtoll(fields[1], &end, 10);
+    if (*end != '\0')
+        return FALSE;
+
+    switch (event->type) {
+        case TraceKey:
+            if (count != 5)
+                return FALSE;
+            event->keyval = strtoul(fields[2], NULL, 10);
+            event->unicode = strtoul(fields[3], NULL, 10);
+            event->state = strtoul(fields[4], NULL, 10);
+            break;
+        case TraceScroll:
+            if (count != 4)
+                return FALSE;
+            event->direction = strtoul(fields[2], NULL, 10);
+            event->state = strtoul(fields[3], NULL, 10);
+            break;
+        case TraceDrag:
+        case TraceDragEnd:
+            if (count != 5)
+                return FALSE;
+            event->x = g_ascii_strtod(fields[2], NULL);
+            event->y = g_ascii_strtod(fields[3], NULL);
+            event->state = strtoul(fields[4], NULL, 10);
+            break;
+    }
+
+    for (i = 2; i < count; ++i) {
+        if (fields[i][0] == '\0')
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+trace_player_load(TracePlayer *player, const gchar *filename, GError **error)
+{
+    gchar *contents, **lines, **fields, *value;
+    TraceEvent event;
+    guint i, type, count;
+    gboolean ok = TRUE;
+
+    if ( !g_file_get_contents(filename, &contents, NULL, error) )
+        return FALSE;
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    for (i = 0; lines[i] && ok; ++i) {
+        if (lines[i][0] == '\0' || lines[i][0] == '#')
+            continue;
+
+        /* state value can contain spaces */
+        if ( g_str_has_prefix(lines[i], "state ") ) {
+            value = strchr(lines[i] + 6, ' ');
+            if (value)
+                *value++ = '\0';
+            g_hash_table_insert( player->state, g_strdup(lines[i] + 6),
+                    g_strdup(value ? value : "") );
+            continue;
+        }
+
+        fields = g_strsplit(lines[i], " ", -1);
+        count = g_strv_length(fields);
+        memset( &event, 0, sizeof(event) );
+        ok = FALSE;
+        for (type = 0; type < G_N_ELEMENTS(trace_type_names); ++type) {
+            if ( strcmp(fields[0], trace_type_names[type]) == 0 ) {
+                event.type = type;
+                ok = trace_parse_event(&event, fields, count);
+                break;
+            }
+        }
+        if (ok)
+            g_array_append_val(player->events, event);
+        else
+            g_set_error( error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                    "Bad line %u in trace '%s'", i + 1, filename );
+        g_strfreev(fields);
+    }
+
+    g_strfreev(lines);
+
+    return ok;
+}
+
+static void
+trace_player_on_paint(ClutterActor *stage, TracePlayer *player)
+{
+    player->paint_start = g_get_monotonic_time();
+}
+
+static void
+trace_player_on_paint_after(ClutterActor *stage, TracePlayer *player)
+{
+    gint64 now = g_get_monotonic_time(), time;
+
+    time = now - player->paint_start;
+    g_array_append_val(player->paint_times, time);
+
+    /* time from event to end of frame which shows its result */
+    if (player->event_time != 0) {
+        time = now - player->event_time;
+        g_array_append_val(player->input_latencies, time);
+        player->event_time = 0;
+    }
+}
+
+TracePlayer *
+trace_player_new(const gchar *filename, ClutterActor *stage,
+        TracePlay *play, TraceDone *done, gpointer user_data, GError **error)
+{
+    TracePlayer *player;
+
+    player = g_new0(TracePlayer, 1);
+    player->stage = stage;
+    player->play = play;
+    player->done = done;
+    player->user_data = user_data;
+    player->state = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    player->events = g_array_new( FALSE, FALSE, sizeof(TraceEvent) );
+    player->paint_times = g_array_new( FALSE, FALSE, sizeof(gint64) );
+    player->input_latencies = g_array_new( FALSE, FALSE, sizeof(gint64) );
+    player->latencies = g_array_new( FALSE, FALSE, sizeof(gint64) );
+
+    if ( !trace_player_load(player, filename, error) ) {
+        trace_player_free(player);
+        return NULL;
+    }
+
+    return player;
+}
+
+void
+trace_player_free(TracePlayer *player)
+{
+    if (player->source_id != 0)
+        g_source_remove(player->source_id);
+    if (player->paint_handler != 0) {
+        g_signal_handler_disconnect(player->stage, player->paint_handler);
+        g_signal_handler_disconnect(player->stage, player->paint_after_handler);
+    }
+    g_hash_table_destroy(player->state);
+    g_array_free(player->events, TRUE);
+    g_array_free(player->paint_times, TRUE);
+    g_array_free(player->input_latencies, TRUE);
+    g_array_free(player->latencies, TRUE);
+    g_free(player);
+}
+
+const gchar *
+trace_player_get_state(const TracePlayer *player, const gchar *key)
+{
+    return g_hash_table_lookup(player->state, key);
+}
+
+void
+trace_player_set_fast(TracePlayer *player, gboolean fast)
+{
+    player->fast = fast;
+}
+
+static gboolean trace_player_on_next(TracePlayer *player);
+
+static void
+trace_player_schedule(TracePlayer *player)
+{
+    const TraceEvent *event;
+    gint64 delay;
+
+    if (player->next >= player->events->len) {
+        player->source_id = 0;
+        player->end = g_get_monotonic_time();
+        player->done(player->user_data);
+        return;
+    }
+
+    if (player->fast) {
+        /* after stage is redrawn */
+        player->source_id = clutter_threads_add_idle_full( CLUTTER_PRIORITY_REDRAW + 10,
+                (GSourceFunc)trace_player_on_next, player, NULL );
+    } else {
+        event = &g_array_index(player->events, TraceEvent, player->next);
+        delay = player->start + event->time - g_get_monotonic_time();
+        player->source_id = clutter_threads_add_timeout( MAX(0, delay / 1000),
+                (GSourceFunc)trace_player_on_next, player );
+    }
+}
+
+static gboolean
+trace_player_on_next(TracePlayer *player)
+{
+    const TraceEvent *event;
+
+    event = &g_array_index(player->events, TraceEvent, player->next);
+    ++player->next;
+    if (player->event_time == 0)
+        player->event_time = g_get_monotonic_time();
+    player->play(event, player->user_data);
+
+    trace_player_schedule(player);
+
+    return FALSE;
+}
+
+void
+trace_player_start(TracePlayer *player)
+{
+    player->paint_handler = g_signal_connect( player->stage, "paint",
+            G_CALLBACK(trace_player_on_paint), player );
+    player->paint_after_handler = g_signal_connect_after( player->stage, "paint",
+            G_CALLBACK(trace_player_on_paint_after), player );
+
+    player->next = 0;
+    player->start = g_get_monotonic_time();
+    trace_player_schedule(player);
+}
+
+void
+trace_player_add_latency(TracePlayer *player, gint64 latency)
+{
+    g_array_append_val(player->latencies, latency);
+}
+
+static gint
+trace_compare_times(const void *a, const void *b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+trace_print_times(const gchar *name, GArray *times)
+{
+    gint64 *t = (gint64*)times->data;
+    guint n = times->len;
+
+    if (n == 0) {
+        g_printerr("imagepeek: Replay %s: none\n", name);
+        return;
+    }
+
+    qsort( t, n, sizeof(gint64), trace_compare_times );
+    g_printerr( "imagepeek: Replay %s: %u, p50 %.1f ms, p95 %.1f ms, "
+            "p99 %.1f ms, max %.1f ms\n", name, n,
+            t[n / 2] / 1000.0, t[(n * 95) / 100] / 1000.0,
+            t[(n * 99) / 100] / 1000.0, t[n - 1] / 1000.0 );
+}
+
+void
+trace_player_print_stats(const TracePlayer *player)
+{
+    gint64 end = player->end ? player->end : g_get_monotonic_time();
+
+    g_printerr( "imagepeek: Replayed %u events in %.2f s%s.\n",
+            player->next, (end - player->start) / 1e6,
+            player->fast ? " (fast)" : "" );
+    trace_print_times("paint times", player->paint_times);
+    trace_print_times("input latencies", player->input_latencies);
+    trace_print_times("load latencies", player->latencies);
+}
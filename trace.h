@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <clutter/clutter.h>
+
+typedef enum _TraceEventType TraceEventType;
+typedef struct _TraceEvent TraceEvent;
+typedef struct _TraceRecorder TraceRecorder;
+typedef struct _TracePlayer TracePlayer;
+
+enum _TraceEventType {
+    TraceKey,
+    TraceScroll,
+    TraceDrag,
+    TraceDragEnd
+};
+
+struct _TraceEvent {
+    TraceEventType type;
+    /* time since start of recording (microseconds) */
+    gint64 time;
+    /* modifiers of key, scroll and drag end */
+    ClutterModifierType state;
+    /* key */
+    guint keyval;
+    gunichar unicode;
+    /* scroll */
+    ClutterScrollDirection direction;
+    /* drag delta or position of drag end */
+    gfloat x, y;
+};
+
+/* replays event */
+typedef void TracePlay(const TraceEvent *event, gpointer user_data);
+/* called after last event was replayed */
+typedef void TraceDone(gpointer user_data);
+
+/*
+ * Records input events with timestamps into text file.
+ *
+ * File starts with application state ("state KEY VALUE" lines) followed
+ * by one event per line.
+ */
+TraceRecorder *trace_recorder_new(const gchar *filename, GError **error);
+void trace_recorder_free(TraceRecorder *recorder);
+/* state is written before first event */
+void trace_recorder_add_state(TraceRecorder *recorder, const gchar *key, const gchar *value);
+/* event time is set by recorder */
+void trace_recorder_add(TraceRecorder *recorder, TraceEvent *event);
+
+/*
+ * Replays recorded events at recorded times or, if fast is set, one
+ * event per main loop iteration (after stage is redrawn).
+ *
+ * While replaying, frame times (stage paint duration), input latencies
+ * (from event to end of next frame) and reported load latencies are
+ * collected; trace_player_print_stats() prints their percentiles.
+ */
+TracePlayer *trace_player_new(const gchar *filename, ClutterActor *stage,
+        TracePlay *play, TraceDone *done, gpointer user_data, GError **error);
+void trace_player_free(TracePlayer *player);
+/* returns recorded state value or NULL */
+const gchar *trace_player_get_state(const TracePlayer *player, const gchar *key);
+void trace_player_set_fast(TracePlayer *player, gboolean fast);
+void trace_player_start(TracePlayer *player);
+/* time from request to showing of an image (microseconds) */
+void trace_player_add_latency(TracePlayer *player, gint64 latency);
+void trace_player_print_stats(const TracePlayer *player);
+
+#endif /* TRACE_H */
@@ -0,0 +1,312 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "watchdog.h"
+
+/* signal which makes main thread capture its stack */
+#define WATCHDOG_SIGNAL SIGUSR2
+#define WATCHDOG_MAX_FRAMES 64
+/* time to wait for stack of main thread (microseconds) */
+#define WATCHDOG_CAPTURE_TIMEOUT 100000
+
+struct _Watchdog {
+    GThread *thread;
+    pthread_t main_thread;
+    glong main_tid;
+    guint heartbeat_id;
+
+    /* following is guarded by lock */
+    GMutex lock;
+    GCond wake;
+    gboolean quit;
+    guint threshold;
+    /* last iteration of main loop (0 before main loop is started) */
+    gint64 beat;
+    WatchdogStage stage;
+    gchar *filename;
+    /* start of reported stall (0 if main loop runs) */
+    gint64 stall_start;
+
+    guint stalls[WatchdogStageCount];
+    gint64 stall_time;
+    gint64 longest_stall;
+};
+
+static const gchar * const watchdog_stage_names[] = {
+    "main loop", "decode", "upload", "layout", "session save"
+};
+
+#ifdef __GLIBC__
+/* signal handler has no user data, there is single watchdog */
+static void *watchdog_frames[WATCHDOG_MAX_FRAMES];
+static volatile gint watchdog_frame_count;
+static volatile gint watchdog_captured;
+
+static void
+watchdog_on_signal(int signum)
+{
+    watchdog_frame_count = backtrace(watchdog_frames, WATCHDOG_MAX_FRAMES);
+    g_atomic_int_set(&watchdog_captured, 1);
+}
+
+/* logs stack of main thread */
+static gboolean
+watchdog_print_stack(Watchdog *watchdog)
+{
+    gint64 deadline;
+
+    g_atomic_int_set(&watchdog_captured, 0);
+    if ( pthread_kill(watchdog->main_thread, WATCHDOG_SIGNAL) != 0 )
+        return FALSE;
+
+    deadline = g_get_monotonic_time() + WATCHDOG_CAPTURE_TIMEOUT;
+    while ( !g_atomic_int_get(&watchdog_captured) ) {
+        if (g_get_monotonic_time() > deadline)
+            return FALSE;
+        g_usleep(1000);
+    }
+
+    g_printerr("imagepeek: Stack of main thread:\n");
+    backtrace_symbols_fd(watchdog_frames, watchdog_frame_count, STDERR_FILENO);
+    return TRUE;
+}
+#else
+static gboolean
+watchdog_print_stack(Watchdog *watchdog)
+{
+    return FALSE;
+}
+#endif
+
+/* logs kernel function main thread sleeps in */
+static void
+watchdog_print_wait_channel(Watchdog *watchdog)
+{
+    gchar *path, *wchan = NULL;
+
+    if (watchdog->main_tid == 0)
+        return;
+
+    path = g_strdup_printf("/proc/self/task/%ld/wchan", watchdog->main_tid);
+    if ( g_file_get_contents(path, &wchan, NULL, NULL) && wchan[0] != '\0' )
+        g_printerr("imagepeek: Main thread waits in kernel (%s).\n", wchan);
+    g_free(wchan);
+    g_free(path);
+}
+
+static gboolean
+watchdog_on_heartbeat(Watchdog *watchdog)
+{
+    gint64 now = g_get_monotonic_time(), duration = 0;
+
+    g_mutex_lock(&watchdog->lock);
+    watchdog->beat = now;
+    if (watchdog->stall_start != 0) {
+        duration = now - watchdog->stall_start;
+        watchdog->stall_start = 0;
+        watchdog->stall_time += duration;
+        watchdog->longest_stall = MAX(watchdog->longest_stall, duration);
+    }
+    g_mutex_unlock(&watchdog->lock);
+
+    if (duration != 0)
+        g_printerr("imagepeek: Main loop recovered after %.0f ms.\n", duration / 1000.0);
+
+    return TRUE;
+}
+
+static void
+watchdog_restart_heartbeat(Watchdog *watchdog)
+{
+    if (watchdog->heartbeat_id != 0) {
+        g_source_remove(watchdog->heartbeat_id);
+        watchdog->heartbeat_id = 0;
+    }
+
+    if (watchdog->threshold > 0) {
+        watchdog->heartbeat_id = g_timeout_add_full( G_PRIORITY_HIGH,
+                MAX(1, watchdog->threshold / 4),
+                (GSourceFunc)watchdog_on_heartbeat, watchdog, NULL );
+    }
+}
+
+static gpointer
+watchdog_run(Watchdog *watchdog)
+{
+    WatchdogStage stage;
+    gchar *filename;
+    gint64 now, stalled;
+
+    g_mutex_lock(&watchdog->lock);
+    while (!watchdog->quit) {
+        now = g_get_monotonic_time();
+        stalled = watchdog->beat != 0 && watchdog->stall_start == 0
+            && watchdog->threshold > 0 ? now - watchdog->beat : 0;
+
+        if ( stalled > (gint64)watchdog->threshold * 1000 ) {
+            /* stall is reported once, it's finished by next heartbeat */
+            watchdog->stall_start = watchdog->beat;
+            stage = watchdog->stage;
+            filename = g_strdup(watchdog->filename);
+            ++watchdog->stalls[stage];
+            g_mutex_unlock(&watchdog->lock);
+
+            g_printerr( "imagepeek: Main loop stalled for %.0f ms in %s%s%s%s!\n",
+                    stalled / 1000.0, watchdog_stage_names[stage],
+                    filename ? " ('" : "", filename ? filename : "",
+                    filename ? "')" : "" );
+            if ( !watchdog_print_stack(watchdog) )
+                watchdog_print_wait_channel(watchdog);
+            g_free(filename);
+
+            g_mutex_lock(&watchdog->lock);
+        }
+
+        g_cond_wait_until( &watchdog->wake, &watchdog->lock,
+                now + (gint64)MAX(1, watchdog->threshold / 4) * 1000 );
+    }
+    g_mutex_unlock(&watchdog->lock);
+
+    return NULL;
+}
+
+Watchdog *
+watchdog_new(void)
+{
+    Watchdog *watchdog;
+#ifdef __GLIBC__
+    struct sigaction action;
+    void *frame;
+
+    /* first call of backtrace() loads libgcc, it must not happen in signal handler */
+    backtrace(&frame, 1);
+
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = watchdog_on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(WATCHDOG_SIGNAL, &action, NULL);
+#endif
+
+    watchdog = g_new0(Watchdog, 1);
+    watchdog->main_thread = pthread_self();
+#ifdef __linux__
+    watchdog->main_tid = syscall(SYS_gettid);
+#endif
+    watchdog->stage = WatchdogMainLoop;
+    g_mutex_init(&watchdog->lock);
+    g_cond_init(&watchdog->wake);
+    watchdog->thread = g_thread_new( "watchdog", (GThreadFunc)watchdog_run, watchdog );
+
+    return watchdog;
+}
+
+void
+watchdog_free(Watchdog *watchdog)
+{
+    g_mutex_lock(&watchdog->lock);
+    watchdog->quit = TRUE;
+    g_cond_signal(&watchdog->wake);
+    g_mutex_unlock(&watchdog->lock);
+    g_thread_join(watchdog->thread);
+
+    if (watchdog->heartbeat_id != 0)
+        g_source_remove(watchdog->heartbeat_id);
+    g_mutex_clear(&watchdog->lock);
+    g_cond_clear(&watchdog->wake);
+    g_free(watchdog->filename);
+    g_free(watchdog);
+}
+
+void
+watchdog_set_threshold(Watchdog *watchdog, guint threshold)
+{
+    g_mutex_lock(&watchdog->lock);
+    watchdog->threshold = threshold;
+    /* time until main loop runs again isn't counted as stall */
+    watchdog->beat = 0;
+    g_cond_signal(&watchdog->wake);
+    g_mutex_unlock(&watchdog->lock);
+
+    watchdog_restart_heartbeat(watchdog);
+}
+
+guint
+watchdog_get_threshold(const Watchdog *watchdog)
+{
+    return watchdog->threshold;
+}
+
+void
+watchdog_enter(Watchdog *watchdog, WatchdogStage stage, const gchar *filename)
+{
+    g_mutex_lock(&watchdog->lock);
+    watchdog->stage = stage;
+    g_free(watchdog->filename);
+    watchdog->filename = g_strdup(filename);
+    g_mutex_unlock(&watchdog->lock);
+}
+
+void
+watchdog_leave(Watchdog *watchdog)
+{
+    watchdog_enter(watchdog, WatchdogMainLoop, NULL);
+}
+
+const gchar *
+watchdog_stage_name(WatchdogStage stage)
+{
+    return watchdog_stage_names[stage];
+}
+
+guint
+watchdog_get_stalls(const Watchdog *watchdog, WatchdogStage stage)
+{
+    Watchdog *w = (Watchdog*)watchdog;
+    guint stalls = 0, i;
+
+    g_mutex_lock(&w->lock);
+    if (stage < WatchdogStageCount) {
+        stalls = w->stalls[stage];
+    } else {
+        for (i = 0; i < WatchdogStageCount; ++i)
+            stalls += w->stalls[i];
+    }
+    g_mutex_unlock(&w->lock);
+
+    return stalls;
+}
+
+gint64
+watchdog_get_stall_time(const Watchdog *watchdog)
+{
+    Watchdog *w = (Watchdog*)watchdog;
+    gint64 time;
+
+    g_mutex_lock(&w->lock);
+    time = w->stall_time;
+    g_mutex_unlock(&w->lock);
+
+    return time;
+}
+
+gint64
+watchdog_get_longest_stall(const Watchdog *watchdog)
+{
+    Watchdog *w = (Watchdog*)watchdog;
+    gint64 time;
+
+    g_mutex_lock(&w->lock);
+    time = w->longest_stall;
+    g_mutex_unlock(&w->lock);
+
+    return time;
+}
@@ -0,0 +1,53 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <clutter/clutter.h>
+
+typedef struct _Watchdog Watchdog;
+
+/* work done by main thread which can block it */
+typedef enum {
+    /* nothing is marked (event handlers, relayout, painting) */
+    WatchdogMainLoop,
+    /* synchronous decoding of first image */
+    WatchdogDecode,
+    /* texture upload of decoded image */
+    WatchdogUpload,
+    /* packing of item into table layout */
+    WatchdogLayout,
+    /* writing session file */
+    WatchdogSaveSession,
+    WatchdogStageCount
+} WatchdogStage;
+
+/*
+ * Detects stalls of main loop.
+ *
+ * Main loop updates heartbeat from high priority timeout. If it isn't
+ * updated within threshold, watchdog thread logs stall with current
+ * stage and file of main thread and its stack (captured by signal
+ * handler on glibc; main thread blocked in kernel, e.g. on hung NFS
+ * mount, cannot run the handler so kernel wait channel is logged
+ * instead). Stalls are counted per stage.
+ *
+ * Must be created in main thread before main loop is started.
+ */
+Watchdog *watchdog_new(void);
+void watchdog_free(Watchdog *watchdog);
+
+/* threshold in milliseconds (0 disables detection) */
+void watchdog_set_threshold(Watchdog *watchdog, guint threshold);
+guint watchdog_get_threshold(const Watchdog *watchdog);
+
+/* marks start and end of work in main thread (filename can be NULL) */
+void watchdog_enter(Watchdog *watchdog, WatchdogStage stage, const gchar *filename);
+void watchdog_leave(Watchdog *watchdog);
+
+const gchar *watchdog_stage_name(WatchdogStage stage);
+/* number of stalls (in given stage or, for WatchdogStageCount, in total) */
+guint watchdog_get_stalls(const Watchdog *watchdog, WatchdogStage stage);
+/* total and longest duration of finished stalls (microseconds) */
+gint64 watchdog_get_stall_time(const Watchdog *watchdog);
+gint64 watchdog_get_longest_stall(const Watchdog *watchdog);
+
+#endif /* WATCHDOG_H */